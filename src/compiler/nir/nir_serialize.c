@@ -28,7 +28,6 @@
 #include "nir_xfb_info.h"
 
 #define NIR_SERIALIZE_FUNC_HAS_IMPL ((void *)(intptr_t)1)
-#define MAX_OBJECT_IDS              (1 << 20)
 
 typedef struct {
    size_t blob_offset;
@@ -93,7 +92,6 @@ static void
 write_add_object(write_ctx *ctx, const void *obj)
 {
    uint32_t index = ctx->next_idx++;
-   assert(index != MAX_OBJECT_IDS);
    _mesa_hash_table_insert(ctx->remap_table, obj, (void *)(uintptr_t)index);
 }
 
@@ -119,10 +117,34 @@ read_lookup_object(read_ctx *ctx, uint32_t idx)
    return ctx->idx_table[idx];
 }
 
+static void
+write_object(write_ctx *ctx, const void *obj)
+{
+   blob_write_varint32(ctx->blob, write_lookup_object(ctx, obj));
+}
+
 static void *
 read_object(read_ctx *ctx)
 {
-   return read_lookup_object(ctx, blob_read_uint32(ctx->blob));
+   return read_lookup_object(ctx, blob_read_varint32(ctx->blob));
+}
+
+/* Instruction headers and other bitfields are written as plain 4 bytes
+ * without any alignment, because the varints between them would otherwise be
+ * followed by padding most of the time.
+ */
+static void
+write_packed_uint32(write_ctx *ctx, uint32_t value)
+{
+   blob_write_bytes(ctx->blob, &value, sizeof(value));
+}
+
+static uint32_t
+read_packed_uint32(read_ctx *ctx)
+{
+   uint32_t value = 0;
+   blob_copy_bytes(ctx->blob, &value, sizeof(value));
+   return value;
 }
 
 static uint32_t
@@ -177,7 +199,7 @@ static void
 write_constant(write_ctx *ctx, const nir_constant *c)
 {
    blob_write_bytes(ctx->blob, c->values, sizeof(c->values));
-   blob_write_uint32(ctx->blob, c->num_elements);
+   blob_write_varint32(ctx->blob, c->num_elements);
    for (unsigned i = 0; i < c->num_elements; i++)
       write_constant(ctx, c->elements[i]);
 }
@@ -190,7 +212,7 @@ read_constant(read_ctx *ctx, nir_variable *nvar)
    static const nir_const_value zero_vals[ARRAY_SIZE(c->values)] = { 0 };
    blob_copy_bytes(ctx->blob, (uint8_t *)c->values, sizeof(c->values));
    c->is_null_constant = memcmp(c->values, zero_vals, sizeof(c->values)) == 0;
-   c->num_elements = blob_read_uint32(ctx->blob);
+   c->num_elements = blob_read_varint32(ctx->blob);
    c->elements = ralloc_array(nvar, nir_constant *, c->num_elements);
    for (unsigned i = 0; i < c->num_elements; i++) {
       c->elements[i] = read_constant(ctx, nvar);
@@ -282,7 +304,7 @@ write_variable(write_ctx *ctx, const nir_variable *var)
 
    flags.u.ray_query = var->data.ray_query;
 
-   blob_write_uint32(ctx->blob, flags.u32);
+   write_packed_uint32(ctx, flags.u32);
 
    if (!flags.u.type_same_as_last) {
       encode_type_to_blob(ctx->blob, var->type);
@@ -310,7 +332,7 @@ write_variable(write_ctx *ctx, const nir_variable *var)
       diff.u.driver_location = data.driver_location -
                                ctx->last_var_data.driver_location;
 
-      blob_write_uint32(ctx->blob, diff.u32);
+      write_packed_uint32(ctx, diff.u32);
    }
 
    ctx->last_var_data = data;
@@ -322,8 +344,7 @@ write_variable(write_ctx *ctx, const nir_variable *var)
    if (var->constant_initializer)
       write_constant(ctx, var->constant_initializer);
    if (var->pointer_initializer)
-      blob_write_uint32(ctx->blob,
-                        write_lookup_object(ctx, var->pointer_initializer));
+      write_object(ctx, var->pointer_initializer);
    if (var->num_members > 0) {
       blob_write_bytes(ctx->blob, (uint8_t *)var->members,
                        var->num_members * sizeof(*var->members));
@@ -337,7 +358,7 @@ read_variable(read_ctx *ctx)
    read_add_object(ctx, var);
 
    union packed_var flags;
-   flags.u32 = blob_read_uint32(ctx->blob);
+   flags.u32 = read_packed_uint32(ctx);
 
    if (flags.u.type_same_as_last) {
       var->type = ctx->last_type;
@@ -367,7 +388,7 @@ read_variable(read_ctx *ctx)
       ctx->last_var_data = var->data;
    } else { /* var_encode_location_diff */
       union packed_var_data_diff diff;
-      diff.u32 = blob_read_uint32(ctx->blob);
+      diff.u32 = read_packed_uint32(ctx);
 
       var->data = ctx->last_var_data;
       var->data.location += diff.u.location;
@@ -412,7 +433,7 @@ read_variable(read_ctx *ctx)
 static void
 write_var_list(write_ctx *ctx, const struct exec_list *src)
 {
-   blob_write_uint32(ctx->blob, exec_list_length(src));
+   blob_write_varint32(ctx->blob, exec_list_length(src));
    foreach_list_typed(nir_variable, var, node, src) {
       write_variable(ctx, var);
    }
@@ -422,58 +443,34 @@ static void
 read_var_list(read_ctx *ctx, struct exec_list *dst)
 {
    exec_list_make_empty(dst);
-   unsigned num_vars = blob_read_uint32(ctx->blob);
+   unsigned num_vars = blob_read_varint32(ctx->blob);
    for (unsigned i = 0; i < num_vars; i++) {
       nir_variable *var = read_variable(ctx);
       exec_list_push_tail(dst, &var->node);
    }
 }
 
-union packed_src {
-   uint32_t u32;
-   struct {
-      unsigned _pad : 2; /* <-- Header */
-      unsigned object_idx : 20;
-      unsigned _footer : 10; /* <-- Footer */
-   } any;
-   struct {
-      unsigned _header : 22; /* <-- Header */
-      unsigned _pad : 2;     /* <-- Footer */
-      unsigned swizzle_x : 2;
-      unsigned swizzle_y : 2;
-      unsigned swizzle_z : 2;
-      unsigned swizzle_w : 2;
-   } alu;
-   struct {
-      unsigned _header : 22; /* <-- Header */
-      unsigned src_type : 5; /* <-- Footer */
-      unsigned _pad : 5;
-   } tex;
-};
-
-static void
-write_src_full(write_ctx *ctx, const nir_src *src, union packed_src header)
-{
-   header.any.object_idx = write_lookup_object(ctx, src->ssa);
-   blob_write_uint32(ctx->blob, header.u32);
-}
-
+/* Sources are stored as the distance from the next object ID to the one of
+ * their definition, which is small for most sources, in a varint.  Except for
+ * phi sources, which are fixed up later, definitions always precede their
+ * uses.
+ */
 static void
 write_src(write_ctx *ctx, const nir_src *src)
 {
-   union packed_src header = { 0 };
-   write_src_full(ctx, src, header);
+   uint32_t idx = write_lookup_object(ctx, src->ssa);
+
+   assert(idx < ctx->next_idx);
+   blob_write_varint32(ctx->blob, ctx->next_idx - idx);
 }
 
-static union packed_src
+static void
 read_src(read_ctx *ctx, nir_src *src)
 {
-   STATIC_ASSERT(sizeof(union packed_src) == 4);
-   union packed_src header;
-   header.u32 = blob_read_uint32(ctx->blob);
+   uint32_t distance = blob_read_varint32(ctx->blob);
 
-   src->ssa = read_lookup_object(ctx, header.any.object_idx);
-   return header;
+   assert(distance && distance <= ctx->next_idx);
+   src->ssa = read_lookup_object(ctx, ctx->next_idx - distance);
 }
 
 union packed_def {
@@ -494,9 +491,8 @@ enum intrinsic_const_indices_encoding {
     */
    const_indices_all_combined,
 
-   const_indices_8bit,  /* 8 bits per element */
-   const_indices_16bit, /* 16 bits per element */
-   const_indices_32bit, /* 32 bits per element */
+   const_indices_8bit,   /* 8 bits per element */
+   const_indices_varint, /* a varint per element */
 };
 
 enum load_const_packing {
@@ -525,10 +521,11 @@ union packed_instr {
       unsigned no_signed_wrap : 1;
       unsigned no_unsigned_wrap : 1;
       unsigned padding : 1;
-      /* Reg: writemask; SSA: swizzles for 2 srcs */
-      unsigned writemask_or_two_swizzles : 4;
+      /* With packed_swizzles: the swizzles of src0.x and src1.x */
+      unsigned two_swizzles : 4;
       unsigned op : 9;
-      unsigned packed_src_ssa_16bit : 1;
+      /* All other swizzles are the identity and aren't stored. */
+      unsigned packed_swizzles : 1;
       /* Scalarized ALUs always have the same header. */
       unsigned num_followup_alu_sharing_header : 2;
       unsigned def : 8;
@@ -538,16 +535,15 @@ union packed_instr {
       unsigned deref_type : 3;
       unsigned cast_type_same_as_last : 1;
       unsigned modes : 5; /* See (de|en)code_deref_modes() */
-      unsigned _pad : 9;
+      unsigned _pad : 10;
       unsigned in_bounds : 1;
-      unsigned packed_src_ssa_16bit : 1; /* deref_var redefines this */
       unsigned def : 8;
    } deref;
    struct {
       unsigned instr_type : 4;
       unsigned deref_type : 3;
       unsigned _pad : 1;
-      unsigned object_idx : 16; /* if 0, the object ID is a separate uint32 */
+      unsigned object_idx : 16; /* if 0, the object ID is a separate varint */
       unsigned def : 8;
    } deref_var;
    struct {
@@ -633,24 +629,24 @@ write_def(write_ctx *ctx, const nir_def *def, union packed_instr header,
          if (last_header.alu.num_followup_alu_sharing_header < 3 &&
              header.u32 == clean_header.u32) {
             last_header.alu.num_followup_alu_sharing_header++;
-            blob_overwrite_uint32(ctx->blob, ctx->last_alu_header_offset,
-                                  last_header.u32);
+            blob_overwrite_bytes(ctx->blob, ctx->last_alu_header_offset,
+                                 &last_header.u32, sizeof(last_header.u32));
             ctx->last_alu_header = last_header.u32;
             equal_header = true;
          }
       }
 
       if (!equal_header) {
-         ctx->last_alu_header_offset = blob_reserve_uint32(ctx->blob);
-         blob_overwrite_uint32(ctx->blob, ctx->last_alu_header_offset, header.u32);
+         ctx->last_alu_header_offset = ctx->blob->size;
+         write_packed_uint32(ctx, header.u32);
          ctx->last_alu_header = header.u32;
       }
    } else {
-      blob_write_uint32(ctx->blob, header.u32);
+      write_packed_uint32(ctx, header.u32);
    }
 
    if (pdef.num_components == NUM_COMPONENTS_IS_SEPARATE_7)
-      blob_write_uint32(ctx->blob, def->num_components);
+      blob_write_varint32(ctx->blob, def->num_components);
 
    write_add_object(ctx, def);
 }
@@ -665,7 +661,7 @@ read_def(read_ctx *ctx, nir_def *def, nir_instr *instr,
    unsigned bit_size = decode_bit_size_3bits(pdef.bit_size);
    unsigned num_components;
    if (pdef.num_components == NUM_COMPONENTS_IS_SEPARATE_7)
-      num_components = blob_read_uint32(ctx->blob);
+      num_components = blob_read_varint32(ctx->blob);
    else
       num_components = decode_num_components_in_3bits(pdef.num_components);
    nir_def_init(instr, def, num_components, bit_size);
@@ -674,14 +670,7 @@ read_def(read_ctx *ctx, nir_def *def, nir_instr *instr,
 }
 
 static bool
-are_object_ids_16bit(write_ctx *ctx)
-{
-   /* Check the highest object ID, because they are monotonic. */
-   return ctx->next_idx < (1 << 16);
-}
-
-static bool
-is_alu_src_ssa_16bit(write_ctx *ctx, const nir_alu_instr *alu)
+are_alu_swizzles_packed(const nir_alu_instr *alu)
 {
    unsigned num_srcs = nir_op_infos[alu->op].num_inputs;
 
@@ -690,7 +679,7 @@ is_alu_src_ssa_16bit(write_ctx *ctx, const nir_alu_instr *alu)
 
       for (unsigned chan = 0; chan < src_components; chan++) {
          /* The swizzles for src0.x and src1.x are stored
-          * in writemask_or_two_swizzles for SSA ALUs.
+          * in two_swizzles.
           */
          if (i < 2 && chan == 0 && alu->src[i].swizzle[chan] < 4)
             continue;
@@ -700,7 +689,7 @@ is_alu_src_ssa_16bit(write_ctx *ctx, const nir_alu_instr *alu)
       }
    }
 
-   return are_object_ids_16bit(ctx);
+   return true;
 }
 
 static void
@@ -718,52 +707,44 @@ write_alu(write_ctx *ctx, const nir_alu_instr *alu)
    header.alu.no_signed_wrap = alu->no_signed_wrap;
    header.alu.no_unsigned_wrap = alu->no_unsigned_wrap;
    header.alu.op = alu->op;
-   header.alu.packed_src_ssa_16bit = is_alu_src_ssa_16bit(ctx, alu);
+   header.alu.packed_swizzles = are_alu_swizzles_packed(alu);
 
-   if (header.alu.packed_src_ssa_16bit) {
-      /* For packed srcs of SSA ALUs, this field stores the swizzles. */
-      header.alu.writemask_or_two_swizzles = alu->src[0].swizzle[0];
+   if (header.alu.packed_swizzles) {
+      header.alu.two_swizzles = alu->src[0].swizzle[0];
       if (num_srcs > 1)
-         header.alu.writemask_or_two_swizzles |= alu->src[1].swizzle[0] << 2;
+         header.alu.two_swizzles |= alu->src[1].swizzle[0] << 2;
    }
 
    write_def(ctx, &alu->def, header, alu->instr.type);
-   blob_write_uint32(ctx->blob, alu->fp_fast_math);
+   blob_write_varint32(ctx->blob, alu->fp_fast_math);
 
-   if (header.alu.packed_src_ssa_16bit) {
-      for (unsigned i = 0; i < num_srcs; i++) {
-         unsigned idx = write_lookup_object(ctx, alu->src[i].src.ssa);
-         assert(idx < (1 << 16));
-         blob_write_uint16(ctx->blob, idx);
-      }
-   } else {
-      for (unsigned i = 0; i < num_srcs; i++) {
-         unsigned src_channels = nir_ssa_alu_instr_src_components(alu, i);
-         unsigned src_components = nir_src_num_components(alu->src[i].src);
-         union packed_src src;
-         bool packed = src_components <= 4 && src_channels <= 4;
-         src.u32 = 0;
-
-         if (packed) {
-            src.alu.swizzle_x = alu->src[i].swizzle[0];
-            src.alu.swizzle_y = alu->src[i].swizzle[1];
-            src.alu.swizzle_z = alu->src[i].swizzle[2];
-            src.alu.swizzle_w = alu->src[i].swizzle[3];
-         }
+   for (unsigned i = 0; i < num_srcs; i++) {
+      write_src(ctx, &alu->src[i].src);
 
-         write_src_full(ctx, &alu->src[i].src, src);
+      if (header.alu.packed_swizzles)
+         continue;
 
-         /* Store swizzles for vec8 and vec16. */
-         if (!packed) {
-            for (unsigned o = 0; o < src_channels; o += 8) {
-               unsigned value = 0;
+      unsigned src_channels = nir_ssa_alu_instr_src_components(alu, i);
+      unsigned src_components = nir_src_num_components(alu->src[i].src);
+
+      if (src_components <= 4 && src_channels <= 4) {
+         /* 2 bits per swizzle */
+         uint8_t value = 0;
 
-               for (unsigned j = 0; j < 8 && o + j < src_channels; j++) {
-                  value |= (uint32_t)alu->src[i].swizzle[o + j] << (4 * j); /* 4 bits per swizzle */
-               }
+         for (unsigned j = 0; j < 4; j++)
+            value |= alu->src[i].swizzle[j] << (2 * j);
 
-               blob_write_uint32(ctx->blob, value);
+         blob_write_uint8(ctx->blob, value);
+      } else {
+         /* Store swizzles for vec8 and vec16. */
+         for (unsigned o = 0; o < src_channels; o += 8) {
+            unsigned value = 0;
+
+            for (unsigned j = 0; j < 8 && o + j < src_channels; j++) {
+               value |= (uint32_t)alu->src[i].swizzle[o + j] << (4 * j); /* 4 bits per swizzle */
             }
+
+            blob_write_varint32(ctx->blob, value);
          }
       }
    }
@@ -780,52 +761,43 @@ read_alu(read_ctx *ctx, union packed_instr header)
    alu->no_unsigned_wrap = header.alu.no_unsigned_wrap;
 
    read_def(ctx, &alu->def, &alu->instr, header);
-   alu->fp_fast_math = blob_read_uint32(ctx->blob);
+   alu->fp_fast_math = blob_read_varint32(ctx->blob);
 
-   if (header.alu.packed_src_ssa_16bit) {
-      for (unsigned i = 0; i < num_srcs; i++) {
-         nir_alu_src *src = &alu->src[i];
-         src->src.ssa = read_lookup_object(ctx, blob_read_uint16(ctx->blob));
+   for (unsigned i = 0; i < num_srcs; i++) {
+      nir_alu_src *src = &alu->src[i];
 
-         memset(&src->swizzle, 0, sizeof(src->swizzle));
+      read_src(ctx, &src->src);
 
-         unsigned src_components = nir_ssa_alu_instr_src_components(alu, i);
+      unsigned src_channels = nir_ssa_alu_instr_src_components(alu, i);
+      unsigned src_components = nir_src_num_components(src->src);
 
-         for (unsigned chan = 0; chan < src_components; chan++)
+      memset(&src->swizzle, 0, sizeof(src->swizzle));
+
+      if (header.alu.packed_swizzles) {
+         for (unsigned chan = 0; chan < src_channels; chan++)
             src->swizzle[chan] = chan;
-      }
-   } else {
-      for (unsigned i = 0; i < num_srcs; i++) {
-         union packed_src src = read_src(ctx, &alu->src[i].src);
-         unsigned src_channels = nir_ssa_alu_instr_src_components(alu, i);
-         unsigned src_components = nir_src_num_components(alu->src[i].src);
-         bool packed = src_components <= 4 && src_channels <= 4;
-
-         memset(&alu->src[i].swizzle, 0, sizeof(alu->src[i].swizzle));
-
-         if (packed) {
-            alu->src[i].swizzle[0] = src.alu.swizzle_x;
-            alu->src[i].swizzle[1] = src.alu.swizzle_y;
-            alu->src[i].swizzle[2] = src.alu.swizzle_z;
-            alu->src[i].swizzle[3] = src.alu.swizzle_w;
-         } else {
-            /* Load swizzles for vec8 and vec16. */
-            for (unsigned o = 0; o < src_channels; o += 8) {
-               unsigned value = blob_read_uint32(ctx->blob);
-
-               for (unsigned j = 0; j < 8 && o + j < src_channels; j++) {
-                  alu->src[i].swizzle[o + j] =
-                     (value >> (4 * j)) & 0xf; /* 4 bits per swizzle */
-               }
+      } else if (src_components <= 4 && src_channels <= 4) {
+         uint8_t value = blob_read_uint8(ctx->blob);
+
+         for (unsigned j = 0; j < 4; j++)
+            src->swizzle[j] = (value >> (2 * j)) & 0x3;
+      } else {
+         /* Load swizzles for vec8 and vec16. */
+         for (unsigned o = 0; o < src_channels; o += 8) {
+            unsigned value = blob_read_varint32(ctx->blob);
+
+            for (unsigned j = 0; j < 8 && o + j < src_channels; j++) {
+               src->swizzle[o + j] =
+                  (value >> (4 * j)) & 0xf; /* 4 bits per swizzle */
             }
          }
       }
    }
 
-   if (header.alu.packed_src_ssa_16bit) {
-      alu->src[0].swizzle[0] = header.alu.writemask_or_two_swizzles & 0x3;
+   if (header.alu.packed_swizzles) {
+      alu->src[0].swizzle[0] = header.alu.two_swizzles & 0x3;
       if (num_srcs > 1)
-         alu->src[1].swizzle[0] = header.alu.writemask_or_two_swizzles >> 2;
+         alu->src[1].swizzle[0] = header.alu.two_swizzles >> 2;
    }
 
    return alu;
@@ -905,43 +877,33 @@ write_deref(write_ctx *ctx, const nir_deref_instr *deref)
    }
 
    if (deref->deref_type == nir_deref_type_array ||
-       deref->deref_type == nir_deref_type_ptr_as_array) {
-      header.deref.packed_src_ssa_16bit = are_object_ids_16bit(ctx);
-
+       deref->deref_type == nir_deref_type_ptr_as_array)
       header.deref.in_bounds = deref->arr.in_bounds;
-   }
 
    write_def(ctx, &deref->def, header, deref->instr.type);
 
    switch (deref->deref_type) {
    case nir_deref_type_var:
       if (!header.deref_var.object_idx)
-         blob_write_uint32(ctx->blob, var_idx);
+         blob_write_varint32(ctx->blob, var_idx);
       break;
 
    case nir_deref_type_struct:
       write_src(ctx, &deref->parent);
-      blob_write_uint32(ctx->blob, deref->strct.index);
+      blob_write_varint32(ctx->blob, deref->strct.index);
       break;
 
    case nir_deref_type_array:
    case nir_deref_type_ptr_as_array:
-      if (header.deref.packed_src_ssa_16bit) {
-         blob_write_uint16(ctx->blob,
-                           write_lookup_object(ctx, deref->parent.ssa));
-         blob_write_uint16(ctx->blob,
-                           write_lookup_object(ctx, deref->arr.index.ssa));
-      } else {
-         write_src(ctx, &deref->parent);
-         write_src(ctx, &deref->arr.index);
-      }
+      write_src(ctx, &deref->parent);
+      write_src(ctx, &deref->arr.index);
       break;
 
    case nir_deref_type_cast:
       write_src(ctx, &deref->parent);
-      blob_write_uint32(ctx->blob, deref->cast.ptr_stride);
-      blob_write_uint32(ctx->blob, deref->cast.align_mul);
-      blob_write_uint32(ctx->blob, deref->cast.align_offset);
+      blob_write_varint32(ctx->blob, deref->cast.ptr_stride);
+      blob_write_varint32(ctx->blob, deref->cast.align_mul);
+      blob_write_varint32(ctx->blob, deref->cast.align_offset);
       if (!header.deref.cast_type_same_as_last) {
          encode_type_to_blob(ctx->blob, deref->type);
          ctx->last_type = deref->type;
@@ -980,19 +942,14 @@ read_deref(read_ctx *ctx, union packed_instr header)
    case nir_deref_type_struct:
       read_src(ctx, &deref->parent);
       parent = nir_src_as_deref(deref->parent);
-      deref->strct.index = blob_read_uint32(ctx->blob);
+      deref->strct.index = blob_read_varint32(ctx->blob);
       deref->type = glsl_get_struct_field(parent->type, deref->strct.index);
       break;
 
    case nir_deref_type_array:
    case nir_deref_type_ptr_as_array:
-      if (header.deref.packed_src_ssa_16bit) {
-         deref->parent.ssa = read_lookup_object(ctx, blob_read_uint16(ctx->blob));
-         deref->arr.index.ssa = read_lookup_object(ctx, blob_read_uint16(ctx->blob));
-      } else {
-         read_src(ctx, &deref->parent);
-         read_src(ctx, &deref->arr.index);
-      }
+      read_src(ctx, &deref->parent);
+      read_src(ctx, &deref->arr.index);
 
       deref->arr.in_bounds = header.deref.in_bounds;
 
@@ -1005,9 +962,9 @@ read_deref(read_ctx *ctx, union packed_instr header)
 
    case nir_deref_type_cast:
       read_src(ctx, &deref->parent);
-      deref->cast.ptr_stride = blob_read_uint32(ctx->blob);
-      deref->cast.align_mul = blob_read_uint32(ctx->blob);
-      deref->cast.align_offset = blob_read_uint32(ctx->blob);
+      deref->cast.ptr_stride = blob_read_varint32(ctx->blob);
+      deref->cast.align_mul = blob_read_varint32(ctx->blob);
+      deref->cast.align_offset = blob_read_varint32(ctx->blob);
       if (header.deref.cast_type_same_as_last) {
          deref->type = ctx->last_type;
       } else {
@@ -1071,16 +1028,14 @@ write_intrinsic(write_ctx *ctx, const nir_intrinsic_instr *intrin)
          }
       } else if (max_bits <= 8)
          header.intrinsic.const_indices_encoding = const_indices_8bit;
-      else if (max_bits <= 16)
-         header.intrinsic.const_indices_encoding = const_indices_16bit;
       else
-         header.intrinsic.const_indices_encoding = const_indices_32bit;
+         header.intrinsic.const_indices_encoding = const_indices_varint;
    }
 
    if (nir_intrinsic_infos[intrin->intrinsic].has_dest)
       write_def(ctx, &intrin->def, header, intrin->instr.type);
    else
-      blob_write_uint32(ctx->blob, header.u32);
+      write_packed_uint32(ctx, header.u32);
 
    for (unsigned i = 0; i < num_srcs; i++)
       write_src(ctx, &intrin->src[i]);
@@ -1091,13 +1046,9 @@ write_intrinsic(write_ctx *ctx, const nir_intrinsic_instr *intrin)
          for (unsigned i = 0; i < num_indices; i++)
             blob_write_uint8(ctx->blob, intrin->const_index[i]);
          break;
-      case const_indices_16bit:
-         for (unsigned i = 0; i < num_indices; i++)
-            blob_write_uint16(ctx->blob, intrin->const_index[i]);
-         break;
-      case const_indices_32bit:
+      case const_indices_varint:
          for (unsigned i = 0; i < num_indices; i++)
-            blob_write_uint32(ctx->blob, intrin->const_index[i]);
+            blob_write_varint32(ctx->blob, intrin->const_index[i]);
          break;
       }
    }
@@ -1149,13 +1100,9 @@ read_intrinsic(read_ctx *ctx, union packed_instr header)
          for (unsigned i = 0; i < num_indices; i++)
             intrin->const_index[i] = blob_read_uint8(ctx->blob);
          break;
-      case const_indices_16bit:
-         for (unsigned i = 0; i < num_indices; i++)
-            intrin->const_index[i] = blob_read_uint16(ctx->blob);
-         break;
-      case const_indices_32bit:
+      case const_indices_varint:
          for (unsigned i = 0; i < num_indices; i++)
-            intrin->const_index[i] = blob_read_uint32(ctx->blob);
+            intrin->const_index[i] = blob_read_varint32(ctx->blob);
          break;
       }
    }
@@ -1217,7 +1164,7 @@ write_load_const(write_ctx *ctx, const nir_load_const_instr *lc)
       }
    }
 
-   blob_write_uint32(ctx->blob, header.u32);
+   write_packed_uint32(ctx, header.u32);
 
    if (header.load_const.packing == load_const_full) {
       switch (lc->def.bit_size) {
@@ -1228,12 +1175,12 @@ write_load_const(write_ctx *ctx, const nir_load_const_instr *lc)
 
       case 32:
          for (unsigned i = 0; i < lc->def.num_components; i++)
-            blob_write_uint32(ctx->blob, lc->value[i].u32);
+            write_packed_uint32(ctx, lc->value[i].u32);
          break;
 
       case 16:
          for (unsigned i = 0; i < lc->def.num_components; i++)
-            blob_write_uint16(ctx->blob, lc->value[i].u16);
+            blob_write_bytes(ctx->blob, &lc->value[i].u16, sizeof(uint16_t));
          break;
 
       default:
@@ -1303,12 +1250,12 @@ read_load_const(read_ctx *ctx, union packed_instr header)
 
       case 32:
          for (unsigned i = 0; i < lc->def.num_components; i++)
-            lc->value[i].u32 = blob_read_uint32(ctx->blob);
+            lc->value[i].u32 = read_packed_uint32(ctx);
          break;
 
       case 16:
          for (unsigned i = 0; i < lc->def.num_components; i++)
-            lc->value[i].u16 = blob_read_uint16(ctx->blob);
+            blob_copy_bytes(ctx->blob, &lc->value[i].u16, sizeof(uint16_t));
          break;
 
       default:
@@ -1336,7 +1283,7 @@ write_ssa_undef(write_ctx *ctx, const nir_undef_instr *undef)
    header.undef.last_component = undef->def.num_components - 1;
    header.undef.bit_size = encode_bit_size_3bits(undef->def.bit_size);
 
-   blob_write_uint32(ctx->blob, header.u32);
+   write_packed_uint32(ctx, header.u32);
    write_add_object(ctx, &undef->def);
 }
 
@@ -1377,6 +1324,7 @@ write_tex(write_ctx *ctx, const nir_tex_instr *tex)
 {
    assert(tex->num_srcs < 16);
    assert(tex->op < 32);
+   STATIC_ASSERT(nir_num_tex_src_types <= 256);
 
    union packed_instr header;
    header.u32 = 0;
@@ -1387,9 +1335,9 @@ write_tex(write_ctx *ctx, const nir_tex_instr *tex)
 
    write_def(ctx, &tex->def, header, tex->instr.type);
 
-   blob_write_uint32(ctx->blob, tex->texture_index);
-   blob_write_uint32(ctx->blob, tex->sampler_index);
-   blob_write_uint32(ctx->blob, tex->backend_flags);
+   blob_write_varint32(ctx->blob, tex->texture_index);
+   blob_write_varint32(ctx->blob, tex->sampler_index);
+   blob_write_varint32(ctx->blob, tex->backend_flags);
    if (tex->op == nir_texop_tg4)
       blob_write_bytes(ctx->blob, tex->tg4_offsets, sizeof(tex->tg4_offsets));
 
@@ -1408,13 +1356,11 @@ write_tex(write_ctx *ctx, const nir_tex_instr *tex)
       .u.array_is_lowered_cube = tex->array_is_lowered_cube,
       .u.is_gather_implicit_lod = tex->is_gather_implicit_lod,
    };
-   blob_write_uint32(ctx->blob, packed.u32);
+   write_packed_uint32(ctx, packed.u32);
 
    for (unsigned i = 0; i < tex->num_srcs; i++) {
-      union packed_src src;
-      src.u32 = 0;
-      src.tex.src_type = tex->src[i].src_type;
-      write_src_full(ctx, &tex->src[i].src, src);
+      blob_write_uint8(ctx->blob, tex->src[i].src_type);
+      write_src(ctx, &tex->src[i].src);
    }
 }
 
@@ -1426,14 +1372,14 @@ read_tex(read_ctx *ctx, union packed_instr header)
    read_def(ctx, &tex->def, &tex->instr, header);
 
    tex->op = header.tex.op;
-   tex->texture_index = blob_read_uint32(ctx->blob);
-   tex->sampler_index = blob_read_uint32(ctx->blob);
-   tex->backend_flags = blob_read_uint32(ctx->blob);
+   tex->texture_index = blob_read_varint32(ctx->blob);
+   tex->sampler_index = blob_read_varint32(ctx->blob);
+   tex->backend_flags = blob_read_varint32(ctx->blob);
    if (tex->op == nir_texop_tg4)
       blob_copy_bytes(ctx->blob, tex->tg4_offsets, sizeof(tex->tg4_offsets));
 
    union packed_tex_data packed;
-   packed.u32 = blob_read_uint32(ctx->blob);
+   packed.u32 = read_packed_uint32(ctx);
    tex->sampler_dim = packed.u.sampler_dim;
    tex->dest_type = packed.u.dest_type;
    tex->coord_components = packed.u.coord_components;
@@ -1448,8 +1394,8 @@ read_tex(read_ctx *ctx, union packed_instr header)
    tex->is_gather_implicit_lod = packed.u.is_gather_implicit_lod;
 
    for (unsigned i = 0; i < tex->num_srcs; i++) {
-      union packed_src src = read_src(ctx, &tex->src[i].src);
-      tex->src[i].src_type = src.tex.src_type;
+      tex->src[i].src_type = blob_read_uint8(ctx->blob);
+      read_src(ctx, &tex->src[i].src);
    }
 
    return tex;
@@ -1472,9 +1418,7 @@ write_phi(write_ctx *ctx, const nir_phi_instr *phi)
    write_def(ctx, &phi->def, header, phi->instr.type);
 
    nir_foreach_phi_src(src, phi) {
-      size_t blob_offset = blob_reserve_uint32(ctx->blob);
-      ASSERTED size_t blob_offset2 = blob_reserve_uint32(ctx->blob);
-      assert(blob_offset + sizeof(uint32_t) == blob_offset2);
+      size_t blob_offset = blob_reserve_bytes(ctx->blob, 2 * sizeof(uint32_t));
       write_phi_fixup fixup = {
          .blob_offset = blob_offset,
          .src = src->src.ssa,
@@ -1488,10 +1432,12 @@ static void
 write_fixup_phis(write_ctx *ctx)
 {
    util_dynarray_foreach(&ctx->phi_fixups, write_phi_fixup, fixup) {
-      blob_overwrite_uint32(ctx->blob, fixup->blob_offset,
-                            write_lookup_object(ctx, fixup->src));
-      blob_overwrite_uint32(ctx->blob, fixup->blob_offset + sizeof(uint32_t),
-                            write_lookup_object(ctx, fixup->block));
+      uint32_t values[2] = {
+         write_lookup_object(ctx, fixup->src),
+         write_lookup_object(ctx, fixup->block),
+      };
+      blob_overwrite_bytes(ctx->blob, fixup->blob_offset, values,
+                           sizeof(values));
    }
 
    util_dynarray_clear(&ctx->phi_fixups);
@@ -1515,8 +1461,8 @@ read_phi(read_ctx *ctx, nir_block *blk, union packed_instr header)
    nir_instr_insert_after_block(blk, &phi->instr);
 
    for (unsigned i = 0; i < header.phi.num_srcs; i++) {
-      nir_def *def = (nir_def *)(uintptr_t)blob_read_uint32(ctx->blob);
-      nir_block *pred = (nir_block *)(uintptr_t)blob_read_uint32(ctx->blob);
+      nir_def *def = (nir_def *)(uintptr_t)read_packed_uint32(ctx);
+      nir_block *pred = (nir_block *)(uintptr_t)read_packed_uint32(ctx);
       nir_phi_src *src = nir_phi_instr_add_src(phi, pred, def);
 
       /* Since we're not letting nir_insert_instr handle use/def stuff for us,
@@ -1563,7 +1509,7 @@ write_jump(write_ctx *ctx, const nir_jump_instr *jmp)
    header.jump.instr_type = jmp->instr.type;
    header.jump.type = jmp->type;
 
-   blob_write_uint32(ctx->blob, header.u32);
+   write_packed_uint32(ctx, header.u32);
 }
 
 static nir_jump_instr *
@@ -1580,7 +1526,7 @@ read_jump(read_ctx *ctx, union packed_instr header)
 static void
 write_call(write_ctx *ctx, const nir_call_instr *call)
 {
-   blob_write_uint32(ctx->blob, write_lookup_object(ctx, call->callee));
+   write_object(ctx, call->callee);
 
    for (unsigned i = 0; i < call->num_params; i++)
       write_src(ctx, &call->params[i]);
@@ -1610,10 +1556,10 @@ write_debug_info(write_ctx *ctx, const nir_debug_info_instr *di)
 
    switch (di->type) {
    case nir_debug_info_src_loc:
-      blob_write_uint32(ctx->blob, header.u32);
-      blob_write_uint32(ctx->blob, di->src_loc.line);
-      blob_write_uint32(ctx->blob, di->src_loc.column);
-      blob_write_uint32(ctx->blob, di->src_loc.spirv_offset);
+      write_packed_uint32(ctx, header.u32);
+      blob_write_varint32(ctx->blob, di->src_loc.line);
+      blob_write_varint32(ctx->blob, di->src_loc.column);
+      blob_write_varint32(ctx->blob, di->src_loc.spirv_offset);
       blob_write_uint8(ctx->blob, di->src_loc.source);
       if (di->src_loc.line)
          write_src(ctx, &di->src_loc.filename);
@@ -1635,9 +1581,9 @@ read_debug_info(read_ctx *ctx, union packed_instr header)
    switch (type) {
    case nir_debug_info_src_loc: {
       nir_debug_info_instr *di = nir_debug_info_instr_create(ctx->nir, type, 0);
-      di->src_loc.line = blob_read_uint32(ctx->blob);
-      di->src_loc.column = blob_read_uint32(ctx->blob);
-      di->src_loc.spirv_offset = blob_read_uint32(ctx->blob);
+      di->src_loc.line = blob_read_varint32(ctx->blob);
+      di->src_loc.column = blob_read_varint32(ctx->blob);
+      di->src_loc.spirv_offset = blob_read_varint32(ctx->blob);
       di->src_loc.source = blob_read_uint8(ctx->blob);
       if (di->src_loc.line)
          read_src(ctx, &di->src_loc.filename);
@@ -1687,7 +1633,7 @@ write_instr(write_ctx *ctx, const nir_instr *instr)
       write_jump(ctx, nir_instr_as_jump(instr));
       break;
    case nir_instr_type_call:
-      blob_write_uint32(ctx->blob, instr->type);
+      write_packed_uint32(ctx, instr->type);
       write_call(ctx, nir_instr_as_call(instr));
       break;
    case nir_instr_type_debug_info:
@@ -1706,7 +1652,7 @@ read_instr(read_ctx *ctx, nir_block *block)
 {
    STATIC_ASSERT(sizeof(union packed_instr) == 4);
    union packed_instr header;
-   header.u32 = blob_read_uint32(ctx->blob);
+   header.u32 = read_packed_uint32(ctx);
    nir_instr *instr;
 
    switch (header.any.instr_type) {
@@ -1761,7 +1707,7 @@ write_block(write_ctx *ctx, const nir_block *block)
 {
    write_add_object(ctx, block);
    blob_write_uint8(ctx->blob, block->divergent);
-   blob_write_uint32(ctx->blob, exec_list_length(&block->instr_list));
+   blob_write_varint32(ctx->blob, exec_list_length(&block->instr_list));
 
    ctx->last_instr_type = ~0;
    ctx->last_alu_header_offset = 0;
@@ -1784,7 +1730,7 @@ read_block(read_ctx *ctx, struct exec_list *cf_list)
 
    read_add_object(ctx, block);
    block->divergent = blob_read_uint8(ctx->blob);
-   unsigned num_instrs = blob_read_uint32(ctx->blob);
+   unsigned num_instrs = blob_read_varint32(ctx->blob);
    for (unsigned i = 0; i < num_instrs;) {
       i += read_instr(ctx, block);
    }
@@ -1855,7 +1801,7 @@ read_loop(read_ctx *ctx, struct exec_list *cf_list)
 static void
 write_cf_node(write_ctx *ctx, nir_cf_node *cf)
 {
-   blob_write_uint32(ctx->blob, cf->type);
+   blob_write_uint8(ctx->blob, cf->type);
 
    switch (cf->type) {
    case nir_cf_node_block:
@@ -1875,7 +1821,7 @@ write_cf_node(write_ctx *ctx, nir_cf_node *cf)
 static void
 read_cf_node(read_ctx *ctx, struct exec_list *list)
 {
-   nir_cf_node_type type = blob_read_uint32(ctx->blob);
+   nir_cf_node_type type = blob_read_uint8(ctx->blob);
 
    switch (type) {
    case nir_cf_node_block:
@@ -1895,7 +1841,7 @@ read_cf_node(read_ctx *ctx, struct exec_list *list)
 static void
 write_cf_list(write_ctx *ctx, const struct exec_list *cf_list)
 {
-   blob_write_uint32(ctx->blob, exec_list_length(cf_list));
+   blob_write_varint32(ctx->blob, exec_list_length(cf_list));
    foreach_list_typed(nir_cf_node, cf, node, cf_list) {
       write_cf_node(ctx, cf);
    }
@@ -1904,7 +1850,7 @@ write_cf_list(write_ctx *ctx, const struct exec_list *cf_list)
 static void
 read_cf_list(read_ctx *ctx, struct exec_list *cf_list)
 {
-   uint32_t num_cf_nodes = blob_read_uint32(ctx->blob);
+   uint32_t num_cf_nodes = blob_read_varint32(ctx->blob);
    for (unsigned i = 0; i < num_cf_nodes; i++)
       read_cf_node(ctx, cf_list);
 }
@@ -1916,7 +1862,7 @@ write_function_impl(write_ctx *ctx, const nir_function_impl *fi)
    blob_write_uint8(ctx->blob, !!fi->preamble);
 
    if (fi->preamble)
-      blob_write_uint32(ctx->blob, write_lookup_object(ctx, fi->preamble));
+      write_object(ctx, fi->preamble);
 
    write_var_list(ctx, &fi->locals);
 
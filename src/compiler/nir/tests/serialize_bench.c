@@ -0,0 +1,330 @@
+/*
+ * Copyright 2024 Mesa contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * @file
+ * Size and speed of nir_serialize() and nir_deserialize() over a corpus of
+ * generated shaders shaped like the ones in shader-db: vertex transforms,
+ * fragment shaders sampling and lighting with control flow, and compute
+ * shaders with loops over SSBOs.  Each shader is measured both as the
+ * frontend produces it and after the scalarizing lowering most backends do
+ * before their NIR ends up in a shader cache.
+ *
+ *    nir_serialize_bench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "util/os_time.h"
+#include "nir.h"
+#include "nir_builder.h"
+#include "nir_serialize.h"
+
+static const nir_shader_compiler_options options = { 0 };
+
+static nir_variable *
+create_var(nir_shader *nir, nir_variable_mode mode, const struct glsl_type *type,
+           const char *name, int location)
+{
+   nir_variable *var = nir_variable_create(nir, mode, type, name);
+   var->data.location = location;
+   var->data.driver_location = location;
+   return var;
+}
+
+static nir_def *
+load_ubo_vec4(nir_builder *b, unsigned vec4_index)
+{
+   return nir_load_ubo(b, 4, 32, nir_imm_int(b, 0),
+                       nir_imm_int(b, vec4_index * 16),
+                       .align_mul = 16, .range = ~0);
+}
+
+static nir_def *
+mat4_mul(nir_builder *b, unsigned mat_vec4_index, nir_def *v)
+{
+   nir_def *res = nir_fmul(b, load_ubo_vec4(b, mat_vec4_index),
+                           nir_channel(b, v, 0));
+   for (unsigned i = 1; i < 4; i++) {
+      res = nir_ffma(b, load_ubo_vec4(b, mat_vec4_index + i),
+                     nir_channel(b, v, i), res);
+   }
+   return res;
+}
+
+/* Skinned vertex transform with a few varyings. */
+static nir_shader *
+build_vs(unsigned size)
+{
+   nir_builder b = nir_builder_init_simple_shader(MESA_SHADER_VERTEX, &options,
+                                                  "vs%u", size);
+   const struct glsl_type *vec4 = glsl_vec4_type();
+
+   nir_def *pos = nir_load_var(&b, create_var(b.shader, nir_var_shader_in,
+                                              vec4, "pos", VERT_ATTRIB_GENERIC0));
+   nir_def *normal = nir_load_var(&b, create_var(b.shader, nir_var_shader_in,
+                                                 vec4, "normal", VERT_ATTRIB_GENERIC1));
+   nir_def *weights = nir_load_var(&b, create_var(b.shader, nir_var_shader_in,
+                                                  vec4, "weights", VERT_ATTRIB_GENERIC2));
+
+   nir_def *skinned = nir_imm_vec4(&b, 0, 0, 0, 0);
+   for (unsigned i = 0; i < size; i++) {
+      skinned = nir_ffma(&b, mat4_mul(&b, 8 + i * 4, pos),
+                         nir_channel(&b, weights, i % 4), skinned);
+   }
+
+   nir_store_var(&b, create_var(b.shader, nir_var_shader_out, vec4,
+                                "gl_Position", VARYING_SLOT_POS),
+                 mat4_mul(&b, 0, skinned), 0xf);
+
+   nir_def *n = nir_trim_vector(&b, mat4_mul(&b, 4, normal), 3);
+   n = nir_fmul(&b, n, nir_frsq(&b, nir_fdot(&b, n, n)));
+   nir_store_var(&b, create_var(b.shader, nir_var_shader_out, glsl_vec_type(3),
+                                "normal", VARYING_SLOT_VAR0),
+                 n, 0x7);
+
+   for (unsigned i = 0; i < size; i++) {
+      nir_def *v = nir_fadd(&b, nir_fmul_imm(&b, pos, 0.5 + i),
+                            load_ubo_vec4(&b, 64 + i));
+      nir_store_var(&b, create_var(b.shader, nir_var_shader_out, vec4, "var",
+                                   VARYING_SLOT_VAR1 + i),
+                    v, 0xf);
+   }
+
+   return b.shader;
+}
+
+/* Texturing and lighting, with a light loop and branches. */
+static nir_shader *
+build_fs(unsigned size)
+{
+   nir_builder b = nir_builder_init_simple_shader(MESA_SHADER_FRAGMENT, &options,
+                                                  "fs%u", size);
+   const struct glsl_type *vec4 = glsl_vec4_type();
+   const struct glsl_type *sampler =
+      glsl_sampler_type(GLSL_SAMPLER_DIM_2D, false, false, GLSL_TYPE_FLOAT);
+
+   nir_def *uv = nir_load_var(&b, create_var(b.shader, nir_var_shader_in,
+                                             glsl_vec_type(2), "uv", VARYING_SLOT_VAR0));
+   nir_def *normal = nir_load_var(&b, create_var(b.shader, nir_var_shader_in,
+                                                 glsl_vec_type(3), "normal",
+                                                 VARYING_SLOT_VAR1));
+   nir_variable *color = nir_local_variable_create(b.impl, vec4, "color");
+   nir_variable *i_var = nir_local_variable_create(b.impl, glsl_int_type(), "i");
+
+   nir_def *albedo = nir_imm_vec4(&b, 1, 1, 1, 1);
+   for (unsigned i = 0; i < size; i++) {
+      nir_variable *tex = create_var(b.shader, nir_var_uniform, sampler, "tex", 0);
+      tex->data.binding = i;
+      nir_deref_instr *deref = nir_build_deref_var(&b, tex);
+      nir_def *coord = nir_fadd(&b, uv, nir_imm_vec2(&b, 0.125 * i, 0.25));
+      albedo = nir_fmul(&b, albedo, nir_tex_deref(&b, deref, deref, coord));
+   }
+   nir_store_var(&b, color, nir_fmul_imm(&b, albedo, 0.1), 0xf);
+   nir_store_var(&b, i_var, nir_imm_int(&b, 0), 0x1);
+
+   nir_push_loop(&b);
+   {
+      nir_def *i = nir_load_var(&b, i_var);
+      nir_break_if(&b, nir_ige_imm(&b, i, size));
+
+      nir_def *light = nir_load_ubo(&b, 4, 32, nir_imm_int(&b, 1),
+                                    nir_imul_imm(&b, i, 32),
+                                    .align_mul = 16, .range = ~0);
+      nir_def *ndotl = nir_fdot(&b, normal, nir_trim_vector(&b, light, 3));
+
+      nir_push_if(&b, nir_flt_imm(&b, ndotl, 0));
+      {
+         nir_store_var(&b, i_var, nir_iadd_imm(&b, i, 1), 0x1);
+         nir_jump(&b, nir_jump_continue);
+      }
+      nir_pop_if(&b, NULL);
+
+      nir_def *spec = nir_fpow(&b, nir_fsat(&b, ndotl),
+                               nir_channel(&b, light, 3));
+      nir_def *c = nir_ffma(&b, albedo, nir_fmul(&b, light, ndotl),
+                            nir_load_var(&b, color));
+      nir_store_var(&b, color, nir_fadd(&b, c, spec), 0xf);
+      nir_store_var(&b, i_var, nir_iadd_imm(&b, i, 1), 0x1);
+   }
+   nir_pop_loop(&b, NULL);
+
+   nir_def *out = nir_load_var(&b, color);
+   nir_push_if(&b, nir_flt_imm(&b, nir_channel(&b, out, 3), 0.5));
+   nir_discard(&b);
+   nir_pop_if(&b, NULL);
+
+   nir_store_var(&b, create_var(b.shader, nir_var_shader_out, vec4, "color",
+                                FRAG_RESULT_DATA0),
+                 out, 0xf);
+
+   return b.shader;
+}
+
+/* Reduction over an SSBO with unrolled integer math. */
+static nir_shader *
+build_cs(unsigned size)
+{
+   nir_builder b = nir_builder_init_simple_shader(MESA_SHADER_COMPUTE, &options,
+                                                  "cs%u", size);
+   b.shader->info.workgroup_size[0] = 64;
+
+   nir_variable *i_var = nir_local_variable_create(b.impl, glsl_uint_type(), "i");
+   nir_variable *acc = nir_local_variable_create(b.impl, glsl_uvec_type(4), "acc");
+
+   nir_def *id = nir_channel(&b, nir_load_global_invocation_id(&b, 32), 0);
+   nir_store_var(&b, i_var, nir_imm_int(&b, 0), 0x1);
+   nir_store_var(&b, acc, nir_imm_ivec4(&b, 0, 0, 0, 0), 0xf);
+
+   nir_push_loop(&b);
+   {
+      nir_def *i = nir_load_var(&b, i_var);
+      nir_break_if(&b, nir_uge_imm(&b, i, 256));
+
+      nir_def *a = nir_load_var(&b, acc);
+      for (unsigned j = 0; j < size; j++) {
+         nir_def *offset = nir_ishl_imm(&b, nir_iadd(&b, nir_imul_imm(&b, i, size),
+                                                     nir_iadd_imm(&b, id, j)), 4);
+         nir_def *v = nir_load_ssbo(&b, 4, 32, nir_imm_int(&b, 0), offset,
+                                    .align_mul = 16);
+         v = nir_ixor(&b, nir_ishl_imm(&b, v, j % 31), nir_ushr_imm(&b, v, 3));
+         a = nir_iadd(&b, a, nir_imul(&b, v, nir_imm_ivec4(&b, 3, 5, 7, 11)));
+      }
+      nir_store_var(&b, acc, a, 0xf);
+      nir_store_var(&b, i_var, nir_iadd_imm(&b, i, 1), 0x1);
+   }
+   nir_pop_loop(&b, NULL);
+
+   nir_store_ssbo(&b, nir_load_var(&b, acc), nir_imm_int(&b, 1),
+                  nir_ishl_imm(&b, id, 4), .align_mul = 16);
+
+   return b.shader;
+}
+
+static void
+scalarize(nir_shader *nir)
+{
+   bool progress;
+
+   nir_lower_vars_to_ssa(nir);
+   nir_lower_alu_to_scalar(nir, NULL, NULL);
+   do {
+      progress = false;
+      progress |= nir_copy_prop(nir);
+      progress |= nir_opt_cse(nir);
+      progress |= nir_opt_dce(nir);
+   } while (progress);
+}
+
+static const struct {
+   const char *name;
+   nir_shader *(*build)(unsigned size);
+   unsigned size;
+} shaders[] = {
+   { "vs small", build_vs, 1 },
+   { "vs skinned", build_vs, 4 },
+   { "fs small", build_fs, 1 },
+   { "fs large", build_fs, 8 },
+   { "cs small", build_cs, 2 },
+   { "cs large", build_cs, 16 },
+};
+
+struct result {
+   size_t size;
+   unsigned num_instrs;
+   double serialize_ns;
+   double deserialize_ns;
+};
+
+static unsigned
+count_instrs(const nir_shader *nir)
+{
+   unsigned count = 0;
+
+   nir_foreach_function_impl(impl, nir) {
+      nir_foreach_block(block, impl) {
+         nir_foreach_instr(instr, block)
+            count++;
+      }
+   }
+   return count;
+}
+
+static struct result
+run(const nir_shader *nir, unsigned iterations)
+{
+   struct result res = { .num_instrs = count_instrs(nir) };
+   struct blob blob;
+
+   blob_init(&blob);
+   nir_serialize(&blob, nir, true);
+   res.size = blob.size;
+
+   int64_t start = os_time_get_nano();
+   for (unsigned i = 0; i < iterations; i++) {
+      blob.size = 0;
+      nir_serialize(&blob, nir, true);
+   }
+   int64_t mid = os_time_get_nano();
+
+   for (unsigned i = 0; i < iterations; i++) {
+      struct blob_reader reader;
+
+      blob_reader_init(&reader, blob.data, blob.size);
+      ralloc_free(nir_deserialize(NULL, &options, &reader));
+   }
+   int64_t end = os_time_get_nano();
+
+   blob_finish(&blob);
+
+   res.serialize_ns = (double)(mid - start) / iterations;
+   res.deserialize_ns = (double)(end - mid) / iterations;
+   return res;
+}
+
+static void
+print_result(const char *name, const char *form, const struct result *res)
+{
+   printf("%-12s %-7s %7u %9zu %8.2f %12.2f %14.2f\n", name, form,
+          res->num_instrs, res->size, (double)res->size / res->num_instrs,
+          res->serialize_ns / 1000, res->deserialize_ns / 1000);
+}
+
+int
+main(int argc, char **argv)
+{
+   unsigned iterations = argc > 1 ? atoi(argv[1]) : 2000;
+   struct result total = { 0 };
+
+   glsl_type_singleton_init_or_ref();
+
+   printf("%-12s %-7s %7s %9s %8s %12s %14s\n", "shader", "form", "instrs",
+          "bytes", "B/instr", "serialize us", "deserialize us");
+
+   for (unsigned i = 0; i < ARRAY_SIZE(shaders); i++) {
+      nir_shader *nir = shaders[i].build(shaders[i].size);
+
+      for (unsigned scalar = 0; scalar < 2; scalar++) {
+         if (scalar)
+            scalarize(nir);
+
+         struct result res = run(nir, iterations);
+         print_result(shaders[i].name, scalar ? "scalar" : "vector", &res);
+
+         total.size += res.size;
+         total.num_instrs += res.num_instrs;
+         total.serialize_ns += res.serialize_ns;
+         total.deserialize_ns += res.deserialize_ns;
+      }
+
+      ralloc_free(nir);
+   }
+
+   print_result("total", "", &total);
+
+   glsl_type_singleton_decref();
+   return EXIT_SUCCESS;
+}
@@ -464,6 +464,36 @@ draw_get_ir_cache_key(struct nir_shader *nir,
 }
 
 
+/**
+ * Store a freshly compiled variant's code in the shader cache (cached is
+ * NULL if it came from there), or, if it was compiled with
+ * gallivm_compile_fast(), queue its optimization, which caches it instead.
+ */
+static void
+draw_llvm_finish_variant(struct draw_llvm *llvm,
+                         struct gallivm_state *gallivm,
+                         const char *func_name,
+                         func_pointer *jit_func,
+                         struct lp_cached_code *cached,
+                         unsigned char ir_sha1_cache_key[20])
+{
+   if (gallivm->fast) {
+      struct gallivm_tier_info tier = {
+         .num_funcs = 1,
+         .names = { func_name },
+         .slots = { jit_func },
+         .cache_insert = cached ? llvm->draw->disk_cache_insert_shader : NULL,
+         .cache_cookie = llvm->draw->disk_cache_cookie,
+      };
+      memcpy(tier.cache_key, ir_sha1_cache_key, sizeof tier.cache_key);
+      gallivm_tier_up(gallivm, &tier);
+   } else if (cached) {
+      llvm->draw->disk_cache_insert_shader(llvm->draw->disk_cache_cookie,
+                                           cached, ir_sha1_cache_key);
+   }
+}
+
+
 /**
  * Create LLVM-generated code for a vertex shader.
  */
@@ -506,6 +536,7 @@ draw_llvm_create_variant(struct draw_llvm *llvm,
          needs_caching = true;
    }
    variant->gallivm = gallivm_create(module_name, &llvm->context, &cached);
+   gallivm_compile_fast(variant->gallivm);
 
    create_vs_jit_types(variant);
 
@@ -527,10 +558,10 @@ draw_llvm_create_variant(struct draw_llvm *llvm,
    variant->jit_func = (draw_jit_vert_func)
          gallivm_jit_function(variant->gallivm, variant->function, variant->function_name);
 
-   if (needs_caching)
-      llvm->draw->disk_cache_insert_shader(llvm->draw->disk_cache_cookie,
-                                           &cached,
-                                           ir_sha1_cache_key);
+   draw_llvm_finish_variant(llvm, variant->gallivm, variant->function_name,
+                            (func_pointer *)&variant->jit_func,
+                            needs_caching ? &cached : NULL,
+                            ir_sha1_cache_key);
    gallivm_free_ir(variant->gallivm);
 
    variant->list_item_global.base = variant;
@@ -2532,6 +2563,7 @@ draw_gs_llvm_create_variant(struct draw_llvm *llvm,
          needs_caching = true;
    }
    variant->gallivm = gallivm_create(module_name, &llvm->context, &cached);
+   gallivm_compile_fast(variant->gallivm);
 
    create_gs_jit_types(variant);
 
@@ -2545,10 +2577,10 @@ draw_gs_llvm_create_variant(struct draw_llvm *llvm,
    variant->jit_func = (draw_gs_jit_func)
          gallivm_jit_function(variant->gallivm, variant->function, variant->function_name);
 
-   if (needs_caching)
-      llvm->draw->disk_cache_insert_shader(llvm->draw->disk_cache_cookie,
-                                           &cached,
-                                           ir_sha1_cache_key);
+   draw_llvm_finish_variant(llvm, variant->gallivm, variant->function_name,
+                            (func_pointer *)&variant->jit_func,
+                            needs_caching ? &cached : NULL,
+                            ir_sha1_cache_key);
    gallivm_free_ir(variant->gallivm);
 
    variant->list_item_global.base = variant;
@@ -3194,6 +3226,7 @@ draw_tcs_llvm_create_variant(struct draw_llvm *llvm,
    }
 
    variant->gallivm = gallivm_create(module_name, &llvm->context, &cached);
+   gallivm_compile_fast(variant->gallivm);
 
    create_tcs_jit_types(variant);
 
@@ -3209,10 +3242,10 @@ draw_tcs_llvm_create_variant(struct draw_llvm *llvm,
    variant->jit_func = (draw_tcs_jit_func)
       gallivm_jit_function(variant->gallivm, variant->function, variant->function_name);
 
-   if (needs_caching)
-      llvm->draw->disk_cache_insert_shader(llvm->draw->disk_cache_cookie,
-                                           &cached,
-                                           ir_sha1_cache_key);
+   draw_llvm_finish_variant(llvm, variant->gallivm, variant->function_name,
+                            (func_pointer *)&variant->jit_func,
+                            needs_caching ? &cached : NULL,
+                            ir_sha1_cache_key);
    gallivm_free_ir(variant->gallivm);
 
    variant->list_item_global.base = variant;
@@ -3720,6 +3753,7 @@ draw_tes_llvm_create_variant(struct draw_llvm *llvm,
          needs_caching = true;
    }
    variant->gallivm = gallivm_create(module_name, &llvm->context, &cached);
+   gallivm_compile_fast(variant->gallivm);
 
    create_tes_jit_types(variant);
 
@@ -3738,10 +3772,10 @@ draw_tes_llvm_create_variant(struct draw_llvm *llvm,
    variant->jit_func = (draw_tes_jit_func)
       gallivm_jit_function(variant->gallivm, variant->function, variant->function_name);
 
-   if (needs_caching)
-      llvm->draw->disk_cache_insert_shader(llvm->draw->disk_cache_cookie,
-                                           &cached,
-                                           ir_sha1_cache_key);
+   draw_llvm_finish_variant(llvm, variant->gallivm, variant->function_name,
+                            (func_pointer *)&variant->jit_func,
+                            needs_caching ? &cached : NULL,
+                            ir_sha1_cache_key);
    gallivm_free_ir(variant->gallivm);
 
    variant->list_item_global.base = variant;
@@ -124,6 +124,12 @@ struct draw_pt_middle_end {
 
    int (*get_max_vertex_count)(struct draw_pt_middle_end *);
 
+   /* Optional: hand everything run so far to the backend, for middle
+    * ends which keep segments in flight.  Called at the end of each
+    * frontend run, while the vertex buffers are still mapped.
+    */
+   void (*sync)(struct draw_pt_middle_end *);
+
    void (*finish)(struct draw_pt_middle_end *);
    void (*destroy)(struct draw_pt_middle_end *);
 };
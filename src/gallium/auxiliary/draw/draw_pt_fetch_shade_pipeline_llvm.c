@@ -25,9 +25,13 @@
  *
  **************************************************************************/
 
+#include "util/list.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_debug.h"
 #include "util/u_math.h"
 #include "util/u_memory.h"
 #include "util/u_prim.h"
+#include "util/u_queue.h"
 #include "draw/draw_context.h"
 #include "draw/draw_gs.h"
 #include "draw/draw_tess.h"
@@ -58,6 +62,42 @@ struct llvm_middle_end {
 
    struct draw_llvm *llvm;
    struct draw_llvm_variant *current_variant;
+
+   /* Threads shading the vertices of the next segments while the
+    * application thread hands the previous ones to the later stages,
+    * started on first use.
+    */
+   unsigned vs_threads;
+   struct util_queue vs_queue;
+
+   /* Segments whose vertices are being shaded, in submission order */
+   struct list_head vs_segments;
+   unsigned num_vs_segments;
+};
+
+
+#define LLVM_VS_MAX_SEGMENTS 16
+
+/**
+ * A vsplit segment in flight.  It owns copies of the fetch and draw
+ * elements, since vsplit reuses its buffers for the next segment.
+ */
+struct llvm_vs_segment {
+   struct list_head link;
+   struct llvm_middle_end *fpme;
+
+   struct draw_vertex_info vert_info;
+   struct draw_prim_info prim_info;
+   unsigned prim_length;
+
+   unsigned start;
+   unsigned vertex_id_offset;
+   const unsigned *fetch_elts;
+
+   /* Whether the segment was handed to the vertex threads yet */
+   bool queued;
+   bool clipped;
+   struct util_queue_fence fence;
 };
 
 
@@ -491,12 +531,48 @@ emit(struct pt_emit *emit,
 }
 
 
+/**
+ * Run the vertex fetch shader on count vertices, returns whether any of
+ * them need clipping.
+ */
+static bool
+llvm_vs_run(struct llvm_middle_end *fpme,
+            struct vertex_header *verts,
+            unsigned count,
+            unsigned start,
+            unsigned vertex_id_offset,
+            const unsigned *elts)
+{
+   struct draw_context *draw = fpme->draw;
+
+   return fpme->current_variant->jit_func(&fpme->llvm->vs_jit_context,
+                                          &fpme->llvm->jit_resources[PIPE_SHADER_VERTEX],
+                                          verts,
+                                          draw->pt.user.vbuffer,
+                                          count,
+                                          start,
+                                          fpme->vertex_size,
+                                          draw->pt.vertex_buffer,
+                                          draw->instance_id,
+                                          vertex_id_offset,
+                                          draw->start_instance,
+                                          elts,
+                                          draw->pt.user.drawid,
+                                          draw->pt.user.viewid);
+}
+
+
+/**
+ * Run the stages after the vertex shader on a segment: tessellation, GS or
+ * primitive assembly, stream output, clipping and the pipeline or emit.
+ * Frees the vertices.
+ */
 static void
-llvm_pipeline_generic(struct draw_pt_middle_end *middle,
-                      const struct draw_fetch_info *fetch_info,
-                      const struct draw_prim_info *in_prim_info)
+llvm_pipeline_post_vs(struct llvm_middle_end *fpme,
+                      struct draw_vertex_info *llvm_vert_info,
+                      const struct draw_prim_info *in_prim_info,
+                      bool clipped)
 {
-   struct llvm_middle_end *fpme = llvm_middle_end(middle);
    struct draw_context *draw = fpme->draw;
    struct draw_geometry_shader *gshader = draw->gs.geometry_shader;
    struct draw_tess_ctrl_shader *tcs_shader = draw->tcs.tess_ctrl_shader;
@@ -504,77 +580,16 @@ llvm_pipeline_generic(struct draw_pt_middle_end *middle,
    struct draw_prim_info tcs_prim_info;
    struct draw_prim_info tes_prim_info;
    struct draw_prim_info gs_prim_info[TGSI_MAX_VERTEX_STREAMS];
-   struct draw_vertex_info llvm_vert_info;
    struct draw_vertex_info tcs_vert_info;
    struct draw_vertex_info tes_vert_info;
-   struct draw_vertex_info *vert_info;
+   struct draw_vertex_info *vert_info = llvm_vert_info;
    struct draw_prim_info ia_prim_info;
    struct draw_vertex_info ia_vert_info;
    const struct draw_prim_info *prim_info = in_prim_info;
    bool free_prim_info = false;
    unsigned opt = fpme->opt;
-   bool clipped = 0;
    uint16_t *tes_elts_out = NULL;
 
-   assert(fetch_info->count > 0);
-
-   llvm_vert_info.count = fetch_info->count;
-   llvm_vert_info.vertex_size = fpme->vertex_size;
-   llvm_vert_info.stride = fpme->vertex_size;
-   llvm_vert_info.verts = (struct vertex_header *)
-      MALLOC(fpme->vertex_size *
-             align(fetch_info->count, lp_native_vector_width / 32) +
-             DRAW_EXTRA_VERTICES_PADDING);
-   if (!llvm_vert_info.verts) {
-      assert(0);
-      return;
-   }
-
-   if (draw->collect_statistics) {
-      draw->statistics.ia_vertices += prim_info->count;
-      if (prim_info->prim == MESA_PRIM_PATCHES)
-         draw->statistics.ia_primitives +=
-            prim_info->count / draw->pt.vertices_per_patch;
-      else
-         draw->statistics.ia_primitives +=
-            u_decomposed_prims_for_vertices(prim_info->prim, prim_info->count);
-      draw->statistics.vs_invocations += fetch_info->count;
-   }
-
-   {
-      unsigned start, vertex_id_offset;
-      const unsigned *elts;
-
-      if (fetch_info->linear) {
-         start = fetch_info->start;
-         vertex_id_offset = draw->start_index;
-         elts = NULL;
-      } else {
-         start = draw->pt.user.eltMax;
-         vertex_id_offset = draw->pt.user.eltBias;
-         elts = fetch_info->elts;
-      }
-      /* Run vertex fetch shader */
-      clipped = fpme->current_variant->jit_func(&fpme->llvm->vs_jit_context,
-                                                &fpme->llvm->jit_resources[PIPE_SHADER_VERTEX],
-                                                llvm_vert_info.verts,
-                                                draw->pt.user.vbuffer,
-                                                fetch_info->count,
-                                                start,
-                                                fpme->vertex_size,
-                                                draw->pt.vertex_buffer,
-                                                draw->instance_id,
-                                                vertex_id_offset,
-                                                draw->start_instance,
-                                                elts,
-                                                draw->pt.user.drawid,
-                                                draw->pt.user.viewid);
-
-      /* Finished with fetch and vs */
-      fetch_info = NULL;
-      vert_info = &llvm_vert_info;
-   }
-
    if (opt & PT_SHADE) {
       struct draw_vertex_shader *vshader = draw->vs.vertex_shader;
       if (tcs_shader) {
@@ -717,6 +732,213 @@ llvm_pipeline_generic(struct draw_pt_middle_end *middle,
 }
 
 
+static void
+llvm_vs_segment_execute(void *data, void *gdata, int thread_index)
+{
+   struct llvm_vs_segment *segment = data;
+
+   /* Shade with the FP state draw_vbo() sets on the application thread */
+   const unsigned fpstate = util_fpstate_get();
+   util_fpstate_set_denorms_to_zero(fpstate);
+
+   segment->clipped = llvm_vs_run(segment->fpme, segment->vert_info.verts,
+                                  segment->vert_info.count, segment->start,
+                                  segment->vertex_id_offset,
+                                  segment->fetch_elts);
+
+   util_fpstate_set(fpstate);
+}
+
+
+/**
+ * Wait for the oldest segment in flight, or shade it here if it wasn't
+ * queued, and hand it to the later stages.
+ */
+static void
+llvm_vs_retire_segment(struct llvm_middle_end *fpme)
+{
+   struct llvm_vs_segment *segment =
+      list_first_entry(&fpme->vs_segments, struct llvm_vs_segment, link);
+
+   if (segment->queued)
+      util_queue_fence_wait(&segment->fence);
+   else
+      llvm_vs_segment_execute(segment, NULL, 0);
+
+   list_del(&segment->link);
+   fpme->num_vs_segments--;
+
+   llvm_pipeline_post_vs(fpme, &segment->vert_info, &segment->prim_info,
+                         segment->clipped);
+
+   util_queue_fence_destroy(&segment->fence);
+   FREE(segment);
+}
+
+
+/**
+ * Hand all the segments in flight to the later stages, in order.
+ */
+static void
+llvm_vs_flush_segments(struct llvm_middle_end *fpme)
+{
+   if (list_is_empty(&fpme->vs_segments))
+      return;
+
+   /* The newest segment was held back, shade it while the threads finish
+    * the others.
+    */
+   struct llvm_vs_segment *last =
+      list_last_entry(&fpme->vs_segments, struct llvm_vs_segment, link);
+   if (!last->queued) {
+      llvm_vs_segment_execute(last, NULL, 0);
+      last->queued = true;
+   }
+
+   while (!list_is_empty(&fpme->vs_segments))
+      llvm_vs_retire_segment(fpme);
+}
+
+
+/**
+ * Shade the vertices of a segment on the vertex threads, while the
+ * application thread runs the later stages on the segments before it.
+ * The newest segment is only queued once another one follows, so a draw
+ * of a single segment never waits for a thread.  Returns false if the
+ * segment has to be run right away.
+ */
+static bool
+llvm_vs_queue_segment(struct llvm_middle_end *fpme,
+                      const struct draw_vertex_info *vert_info,
+                      const struct draw_prim_info *prim_info,
+                      unsigned start,
+                      unsigned vertex_id_offset,
+                      const unsigned *fetch_elts)
+{
+   if (!util_queue_is_initialized(&fpme->vs_queue) &&
+       !util_queue_init(&fpme->vs_queue, "draw_vs", LLVM_VS_MAX_SEGMENTS,
+                        fpme->vs_threads, 0, NULL)) {
+      fpme->vs_threads = 0;
+      return false;
+   }
+
+   const unsigned num_fetch_elts = fetch_elts ? vert_info->count : 0;
+   const unsigned num_draw_elts = prim_info->elts ? prim_info->count : 0;
+   struct llvm_vs_segment *segment =
+      MALLOC(sizeof(*segment) + num_fetch_elts * sizeof(unsigned) +
+             num_draw_elts * sizeof(uint16_t));
+   if (!segment)
+      return false;
+
+   assert(prim_info->primitive_count == 1);
+
+   segment->fpme = fpme;
+   segment->vert_info = *vert_info;
+   segment->prim_info = *prim_info;
+   segment->prim_length = prim_info->count;
+   segment->prim_info.primitive_lengths = &segment->prim_length;
+   segment->start = start;
+   segment->vertex_id_offset = vertex_id_offset;
+   segment->fetch_elts = NULL;
+   segment->queued = false;
+   segment->clipped = false;
+   util_queue_fence_init(&segment->fence);
+
+   unsigned *elts = (unsigned *)(segment + 1);
+   if (fetch_elts) {
+      memcpy(elts, fetch_elts, num_fetch_elts * sizeof(unsigned));
+      segment->fetch_elts = elts;
+   }
+   if (prim_info->elts) {
+      uint16_t *draw_elts = (uint16_t *)(elts + num_fetch_elts);
+      memcpy(draw_elts, prim_info->elts, num_draw_elts * sizeof(uint16_t));
+      segment->prim_info.elts = draw_elts;
+   }
+
+   if (!list_is_empty(&fpme->vs_segments)) {
+      struct llvm_vs_segment *prev =
+         list_last_entry(&fpme->vs_segments, struct llvm_vs_segment, link);
+      if (!prev->queued) {
+         prev->queued = true;
+         util_queue_add_job(&fpme->vs_queue, prev, &prev->fence,
+                            llvm_vs_segment_execute, NULL, 0);
+      }
+   }
+
+   list_addtail(&segment->link, &fpme->vs_segments);
+   fpme->num_vs_segments++;
+
+   /* Once every thread has a segment, retire the oldest one */
+   if (fpme->num_vs_segments > fpme->vs_threads + 1)
+      llvm_vs_retire_segment(fpme);
+
+   return true;
+}
+
+
+static void
+llvm_pipeline_generic(struct draw_pt_middle_end *middle,
+                      const struct draw_fetch_info *fetch_info,
+                      const struct draw_prim_info *prim_info)
+{
+   struct llvm_middle_end *fpme = llvm_middle_end(middle);
+   struct draw_context *draw = fpme->draw;
+   struct draw_vertex_info llvm_vert_info;
+   unsigned start, vertex_id_offset;
+   const unsigned *elts;
+   bool clipped;
+
+   assert(fetch_info->count > 0);
+
+   llvm_vert_info.count = fetch_info->count;
+   llvm_vert_info.vertex_size = fpme->vertex_size;
+   llvm_vert_info.stride = fpme->vertex_size;
+   llvm_vert_info.verts = (struct vertex_header *)
+      MALLOC(fpme->vertex_size *
+             align(fetch_info->count, lp_native_vector_width / 32) +
+             DRAW_EXTRA_VERTICES_PADDING);
+   if (!llvm_vert_info.verts) {
+      assert(0);
+      return;
+   }
+
+   if (draw->collect_statistics) {
+      draw->statistics.ia_vertices += prim_info->count;
+      if (prim_info->prim == MESA_PRIM_PATCHES)
+         draw->statistics.ia_primitives +=
+            prim_info->count / draw->pt.vertices_per_patch;
+      else
+         draw->statistics.ia_primitives +=
+            u_decomposed_prims_for_vertices(prim_info->prim, prim_info->count);
+      draw->statistics.vs_invocations += fetch_info->count;
+   }
+
+   if (fetch_info->linear) {
+      start = fetch_info->start;
+      vertex_id_offset = draw->start_index;
+      elts = NULL;
+   } else {
+      start = draw->pt.user.eltMax;
+      vertex_id_offset = draw->pt.user.eltBias;
+      elts = fetch_info->elts;
+   }
+
+   if (fpme->vs_threads &&
+       llvm_vs_queue_segment(fpme, &llvm_vert_info, prim_info,
+                             start, vertex_id_offset, elts))
+      return;
+
+   /* Segments still in flight go first */
+   llvm_vs_flush_segments(fpme);
+
+   /* Run vertex fetch shader */
+   clipped = llvm_vs_run(fpme, llvm_vert_info.verts, fetch_info->count,
+                         start, vertex_id_offset, elts);
+
+   llvm_pipeline_post_vs(fpme, &llvm_vert_info, prim_info, clipped);
+}
+
+
 static inline enum mesa_prim
 prim_type(enum mesa_prim prim, unsigned flags)
 {
@@ -817,10 +1039,18 @@ llvm_middle_end_linear_run_elts(struct draw_pt_middle_end *middle,
 }
 
 
+static void
+llvm_middle_end_sync(struct draw_pt_middle_end *middle)
+{
+   llvm_vs_flush_segments(llvm_middle_end(middle));
+}
+
+
 static void
 llvm_middle_end_finish(struct draw_pt_middle_end *middle)
 {
-   /* nothing to do */
+   /* Segments never outlive the frontend run that made them */
+   assert(list_is_empty(&llvm_middle_end(middle)->vs_segments));
 }
 
 
@@ -841,6 +1071,10 @@ llvm_middle_end_destroy(struct draw_pt_middle_end *middle)
    if (fpme->post_vs)
       draw_pt_post_vs_destroy(fpme->post_vs);
 
+   assert(list_is_empty(&fpme->vs_segments));
+   if (util_queue_is_initialized(&fpme->vs_queue))
+      util_queue_destroy(&fpme->vs_queue);
+
    FREE(middle);
 }
 
@@ -857,11 +1091,14 @@ draw_pt_fetch_pipeline_or_emit_llvm(struct draw_context *draw)
    if (!fpme)
       goto fail;
 
+   list_inithead(&fpme->vs_segments);
+
    fpme->base.prepare         = llvm_middle_end_prepare;
    fpme->base.bind_parameters = llvm_middle_end_bind_parameters;
    fpme->base.run             = llvm_middle_end_run;
    fpme->base.run_linear      = llvm_middle_end_linear_run;
    fpme->base.run_linear_elts = llvm_middle_end_linear_run_elts;
+   fpme->base.sync            = llvm_middle_end_sync;
    fpme->base.finish          = llvm_middle_end_finish;
    fpme->base.destroy         = llvm_middle_end_destroy;
 
@@ -889,6 +1126,12 @@ draw_pt_fetch_pipeline_or_emit_llvm(struct draw_context *draw)
 
    fpme->current_variant = NULL;
 
+   /* By default leave most of the CPUs to the driver's own threads */
+   fpme->vs_threads = debug_get_num_option("DRAW_VS_THREADS",
+                                           CLAMP(util_get_cpu_caps()->nr_cpus - 1,
+                                                 0, 3));
+   fpme->vs_threads = MIN2(fpme->vs_threads, LLVM_VS_MAX_SEGMENTS - 1);
+
    return &fpme->base;
 
  fail:
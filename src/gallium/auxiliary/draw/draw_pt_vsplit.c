@@ -44,6 +44,11 @@ struct vsplit_frontend {
 
    struct draw_pt_middle_end *middle;
 
+   /* splits a draw of the current index size into segments */
+   void (*split)(struct draw_pt_front_end *frontend,
+                 unsigned start,
+                 unsigned count);
+
    unsigned max_vertices;
    uint16_t segment_size;
 
@@ -201,6 +206,20 @@ vsplit_add_cache_uint32(struct vsplit_frontend *vsplit, const uint32_t *elts,
 #include "draw_pt_vsplit_tmp.h"
 
 
+static void
+vsplit_run(struct draw_pt_front_end *frontend,
+           unsigned start,
+           unsigned count)
+{
+   struct vsplit_frontend *vsplit = (struct vsplit_frontend *) frontend;
+
+   vsplit->split(frontend, start, count);
+
+   if (vsplit->middle->sync)
+      vsplit->middle->sync(vsplit->middle);
+}
+
+
 static void
 vsplit_prepare(struct draw_pt_front_end *frontend,
                enum mesa_prim in_prim,
@@ -211,22 +230,24 @@ vsplit_prepare(struct draw_pt_front_end *frontend,
 
    switch (vsplit->draw->pt.user.eltSize) {
    case 0:
-      vsplit->base.run = vsplit_run_linear;
+      vsplit->split = vsplit_run_linear;
       break;
    case 1:
-      vsplit->base.run = vsplit_run_uint8;
+      vsplit->split = vsplit_run_uint8;
       break;
    case 2:
-      vsplit->base.run = vsplit_run_uint16;
+      vsplit->split = vsplit_run_uint16;
       break;
    case 4:
-      vsplit->base.run = vsplit_run_uint32;
+      vsplit->split = vsplit_run_uint32;
       break;
    default:
       assert(0);
       break;
    }
 
+   vsplit->base.run = vsplit_run;
+
    /* split only */
    vsplit->prim = in_prim;
 
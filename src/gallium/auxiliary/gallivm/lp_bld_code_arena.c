@@ -0,0 +1,238 @@
+/*
+ * Copyright 2024 Mesa contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * @file
+ * Process-wide arena for JIT'ed code and data.
+ *
+ * Each chunk is sub-allocated with a util_vma_heap, whose addresses are
+ * the chunk's writable addresses.  Completely free chunks are unmapped,
+ * except for the last one of each kind.
+ */
+
+
+#include "util/detect_os.h"
+#include "util/list.h"
+#include "util/macros.h"
+#include "util/simple_mtx.h"
+#include "util/u_call_once.h"
+#include "util/u_math.h"
+#include "util/u_memory.h"
+#include "util/vma.h"
+
+#include "lp_bld_code_arena.h"
+
+#if DETECT_OS_POSIX
+#include <sys/mman.h>
+#include <unistd.h>
+#include "util/anon_file.h"
+#endif
+
+
+#define LP_CODE_CHUNK_SIZE (2 * 1024 * 1024)
+
+
+struct lp_code_chunk
+{
+   struct list_head head;
+   uint8_t *exec;
+   uint8_t *write;
+   size_t size;
+   size_t used;
+   struct util_vma_heap heap;
+};
+
+
+static struct {
+   simple_mtx_t lock;
+   /* [0] data, [1] code */
+   struct list_head chunks[2];
+   struct lp_code_arena_stats stats;
+   bool initialized;
+} arena = {
+   .lock = SIMPLE_MTX_INITIALIZER,
+};
+
+static util_once_flag arena_once = UTIL_ONCE_FLAG_INIT;
+
+
+static struct lp_code_chunk *
+create_chunk(bool code, size_t size)
+{
+#if DETECT_OS_POSIX
+   struct lp_code_chunk *chunk = CALLOC_STRUCT(lp_code_chunk);
+   if (!chunk)
+      return NULL;
+
+   if (code) {
+      int fd = os_create_anonymous_file(size, "gallivm-code");
+      if (fd < 0) {
+         FREE(chunk);
+         return NULL;
+      }
+
+      chunk->write = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                          fd, 0);
+      chunk->exec = mmap(NULL, size, PROT_READ | PROT_EXEC, MAP_SHARED,
+                         fd, 0);
+      close(fd);
+
+      if (chunk->write == MAP_FAILED || chunk->exec == MAP_FAILED) {
+         if (chunk->write != MAP_FAILED)
+            munmap(chunk->write, size);
+         if (chunk->exec != MAP_FAILED)
+            munmap(chunk->exec, size);
+         FREE(chunk);
+         return NULL;
+      }
+   } else {
+      chunk->write = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (chunk->write == MAP_FAILED) {
+         FREE(chunk);
+         return NULL;
+      }
+      chunk->exec = chunk->write;
+   }
+
+   chunk->size = size;
+   util_vma_heap_init(&chunk->heap, (uintptr_t)chunk->write, size);
+   chunk->heap.alloc_high = false;
+
+   list_addtail(&chunk->head, &arena.chunks[code]);
+   arena.stats.mapped += size;
+   return chunk;
+#else
+   return NULL;
+#endif
+}
+
+
+static void
+destroy_chunk(struct lp_code_chunk *chunk)
+{
+#if DETECT_OS_POSIX
+   list_del(&chunk->head);
+   arena.stats.mapped -= chunk->size;
+   util_vma_heap_finish(&chunk->heap);
+   if (chunk->exec != chunk->write)
+      munmap(chunk->exec, chunk->size);
+   munmap(chunk->write, chunk->size);
+   FREE(chunk);
+#endif
+}
+
+
+static void
+arena_init_once(void)
+{
+   list_inithead(&arena.chunks[0]);
+   list_inithead(&arena.chunks[1]);
+
+   /* Check up front that code can be double mapped, e.g. SELinux may
+    * forbid executable shared mappings, so that the caller can fall back
+    * to private allocations.
+    */
+   simple_mtx_lock(&arena.lock);
+   arena.initialized = create_chunk(true, LP_CODE_CHUNK_SIZE) != NULL;
+   simple_mtx_unlock(&arena.lock);
+}
+
+
+/**
+ * Return whether the arena can be used.
+ */
+bool
+lp_code_arena_init(void)
+{
+   util_call_once(&arena_once, arena_init_once);
+   return arena.initialized;
+}
+
+
+/**
+ * Allocate a block of code (or data if code is false).
+ * Code must be written at block->write, and will run at block->exec.
+ */
+bool
+lp_code_arena_alloc(bool code, size_t size, unsigned alignment,
+                    struct lp_code_block *block)
+{
+   size = MAX2(size, 1);
+   alignment = MAX2(alignment, 16);
+   assert(util_is_power_of_two_nonzero(alignment));
+
+   simple_mtx_lock(&arena.lock);
+
+   uint64_t addr = 0;
+   struct lp_code_chunk *chunk = NULL;
+   list_for_each_entry(struct lp_code_chunk, iter, &arena.chunks[code], head) {
+      addr = util_vma_heap_alloc(&iter->heap, size, alignment);
+      if (addr) {
+         chunk = iter;
+         break;
+      }
+   }
+
+   if (!chunk) {
+      size_t page_size = 4096;
+#if DETECT_OS_POSIX
+      page_size = sysconf(_SC_PAGESIZE);
+#endif
+      chunk = create_chunk(code, MAX2(LP_CODE_CHUNK_SIZE,
+                                      align_uintptr(size + alignment,
+                                                    page_size)));
+      if (chunk)
+         addr = util_vma_heap_alloc(&chunk->heap, size, alignment);
+   }
+
+   if (!addr) {
+      simple_mtx_unlock(&arena.lock);
+      return false;
+   }
+
+   chunk->used += size;
+   arena.stats.used += size;
+   simple_mtx_unlock(&arena.lock);
+
+   block->write = (void *)(uintptr_t)addr;
+   block->exec = chunk->exec + ((uint8_t *)block->write - chunk->write);
+   block->size = size;
+   block->chunk = chunk;
+   return true;
+}
+
+
+void
+lp_code_arena_free(struct lp_code_block *block)
+{
+   struct lp_code_chunk *chunk = block->chunk;
+   if (!chunk)
+      return;
+
+   simple_mtx_lock(&arena.lock);
+
+   util_vma_heap_free(&chunk->heap, (uintptr_t)block->write, block->size);
+   chunk->used -= block->size;
+   arena.stats.used -= block->size;
+
+   /* Give memory back, but don't keep mapping and unmapping one chunk */
+   const bool code = chunk->exec != chunk->write;
+   if (!chunk->used && !list_is_singular(&arena.chunks[code]))
+      destroy_chunk(chunk);
+
+   simple_mtx_unlock(&arena.lock);
+
+   block->chunk = NULL;
+}
+
+
+void
+lp_code_arena_get_stats(struct lp_code_arena_stats *stats)
+{
+   simple_mtx_lock(&arena.lock);
+   *stats = arena.stats;
+   simple_mtx_unlock(&arena.lock);
+}
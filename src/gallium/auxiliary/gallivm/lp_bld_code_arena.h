@@ -0,0 +1,67 @@
+/*
+ * Copyright 2024 Mesa contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * @file
+ * Process-wide arena for JIT'ed code and data.
+ *
+ * Sections of all modules are packed together into a few large chunks,
+ * rather than each module getting pages of its own.  Code chunks are
+ * mapped twice, writable and executable, so that code can be added to a
+ * chunk while other threads are running code from it.
+ */
+
+
+#ifndef LP_BLD_CODE_ARENA_H
+#define LP_BLD_CODE_ARENA_H
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+struct lp_code_chunk;
+
+struct lp_code_block
+{
+   void *exec;     /**< address to run the code at */
+   void *write;    /**< address to write the code at, same as exec for data */
+   size_t size;
+   struct lp_code_chunk *chunk;
+};
+
+struct lp_code_arena_stats
+{
+   uint64_t used;
+   uint64_t mapped;
+};
+
+
+bool
+lp_code_arena_init(void);
+
+bool
+lp_code_arena_alloc(bool code, size_t size, unsigned alignment,
+                    struct lp_code_block *block);
+
+void
+lp_code_arena_free(struct lp_code_block *block);
+
+void
+lp_code_arena_get_stats(struct lp_code_arena_stats *stats);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+
+#endif /* LP_BLD_CODE_ARENA_H */
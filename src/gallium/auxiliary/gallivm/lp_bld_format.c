@@ -29,22 +29,29 @@
 #include "lp_bld_format.h"
 
 LLVMTypeRef lp_build_format_cache_elem_type(struct gallivm_state *gallivm, enum cache_member member) {
-   assert(member == LP_BUILD_FORMAT_CACHE_MEMBER_DATA || member == LP_BUILD_FORMAT_CACHE_MEMBER_TAGS);
+   assert(member == LP_BUILD_FORMAT_CACHE_MEMBER_DATA ||
+          member == LP_BUILD_FORMAT_CACHE_MEMBER_TAGS ||
+          member == LP_BUILD_FORMAT_CACHE_MEMBER_VICTIM);
    switch (member) {
    case LP_BUILD_FORMAT_CACHE_MEMBER_DATA:
       return LLVMInt32TypeInContext(gallivm->context);
    case LP_BUILD_FORMAT_CACHE_MEMBER_TAGS:
       return LLVMInt64TypeInContext(gallivm->context);
+   case LP_BUILD_FORMAT_CACHE_MEMBER_VICTIM:
+      return LLVMInt8TypeInContext(gallivm->context);
    default:
       unreachable("lp_build_format_cache_elem_type unhandled member type");
    }
 }
 
 LLVMTypeRef lp_build_format_cache_member_type(struct gallivm_state *gallivm, enum cache_member member) {
-   assert(member == LP_BUILD_FORMAT_CACHE_MEMBER_DATA || member == LP_BUILD_FORMAT_CACHE_MEMBER_TAGS);
+   assert(member == LP_BUILD_FORMAT_CACHE_MEMBER_DATA ||
+          member == LP_BUILD_FORMAT_CACHE_MEMBER_TAGS ||
+          member == LP_BUILD_FORMAT_CACHE_MEMBER_VICTIM);
    unsigned elem_count =
          member == LP_BUILD_FORMAT_CACHE_MEMBER_DATA ? LP_BUILD_FORMAT_CACHE_SIZE * 16 :
-         member == LP_BUILD_FORMAT_CACHE_MEMBER_TAGS ? LP_BUILD_FORMAT_CACHE_SIZE : 0;
+         member == LP_BUILD_FORMAT_CACHE_MEMBER_TAGS ? LP_BUILD_FORMAT_CACHE_SIZE :
+         member == LP_BUILD_FORMAT_CACHE_MEMBER_VICTIM ? LP_BUILD_FORMAT_CACHE_SETS : 0;
    return LLVMArrayType(lp_build_format_cache_elem_type(gallivm, member), elem_count);
 }
 
@@ -54,7 +61,9 @@ lp_build_format_cache_type(struct gallivm_state *gallivm)
    LLVMTypeRef elem_types[LP_BUILD_FORMAT_CACHE_MEMBER_COUNT];
    LLVMTypeRef s;
 
-   int members[] = {LP_BUILD_FORMAT_CACHE_MEMBER_DATA, LP_BUILD_FORMAT_CACHE_MEMBER_TAGS};
+   int members[] = {LP_BUILD_FORMAT_CACHE_MEMBER_DATA,
+                    LP_BUILD_FORMAT_CACHE_MEMBER_TAGS,
+                    LP_BUILD_FORMAT_CACHE_MEMBER_VICTIM};
    for (int i = 0; i < ARRAY_SIZE(members); ++i) {
       int member = members[i];
       elem_types[member] = lp_build_format_cache_member_type(gallivm, member);
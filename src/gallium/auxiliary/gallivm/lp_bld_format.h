@@ -39,6 +39,8 @@
 
 #include "util/format/u_formats.h"
 
+#include <string.h>
+
 struct util_format_description;
 struct lp_type;
 struct lp_build_context;
@@ -49,18 +51,29 @@ struct lp_build_context;
  * Block cache
  *
  * Optional block cache to be used when unpacking big pixel blocks.
- * Must be a power of 2
+ *
+ * The cache is set-associative: a block address hashes to a set of
+ * LP_BUILD_FORMAT_CACHE_WAYS slots, which are replaced round-robin.
+ * The total size (in blocks, each decoded to 64 bytes) is chosen so the
+ * decoded data plus tags stay well within a typical per-core L2 (64KB of
+ * data for 1024 blocks) while leaving room for the texels themselves.
+ * Both sizes must be powers of 2.
  */
 
-#define LP_BUILD_FORMAT_CACHE_SIZE 128
+#define LP_BUILD_FORMAT_CACHE_SIZE 1024
+#define LP_BUILD_FORMAT_CACHE_WAYS 4
+#define LP_BUILD_FORMAT_CACHE_SETS \
+   (LP_BUILD_FORMAT_CACHE_SIZE / LP_BUILD_FORMAT_CACHE_WAYS)
 
 /*
  * Note: cache_data needs 16 byte alignment.
+ * Slot (set * WAYS + way) holds the block whose address is in cache_tags.
  */
 struct lp_build_format_cache
 {
    alignas(16) uint32_t cache_data[LP_BUILD_FORMAT_CACHE_SIZE][4][4];
    uint64_t cache_tags[LP_BUILD_FORMAT_CACHE_SIZE];
+   uint8_t cache_victim[LP_BUILD_FORMAT_CACHE_SETS];
 #if LP_BUILD_FORMAT_CACHE_DEBUG
    uint64_t cache_access_total;
    uint64_t cache_access_miss;
@@ -71,6 +84,7 @@ struct lp_build_format_cache
 enum cache_member {
    LP_BUILD_FORMAT_CACHE_MEMBER_DATA = 0,
    LP_BUILD_FORMAT_CACHE_MEMBER_TAGS,
+   LP_BUILD_FORMAT_CACHE_MEMBER_VICTIM,
 #if LP_BUILD_FORMAT_CACHE_DEBUG
    LP_BUILD_FORMAT_CACHE_MEMBER_ACCESS_TOTAL,
    LP_BUILD_FORMAT_CACHE_MEMBER_ACCESS_MISS,
@@ -79,6 +93,21 @@ enum cache_member {
 };
 
 
+/**
+ * Forget all cached blocks.
+ */
+static inline void
+lp_build_format_cache_invalidate(struct lp_build_format_cache *cache)
+{
+   memset(cache->cache_tags, 0, sizeof(cache->cache_tags));
+   memset(cache->cache_victim, 0, sizeof(cache->cache_victim));
+#if LP_BUILD_FORMAT_CACHE_DEBUG
+   cache->cache_access_total = 0;
+   cache->cache_access_miss = 0;
+#endif
+}
+
+
 LLVMTypeRef
 lp_build_format_cache_type(struct gallivm_state *gallivm);
 
@@ -1122,7 +1122,7 @@ static void
 s3tc_store_cached_block(struct gallivm_state *gallivm,
                         LLVMValueRef *col,
                         LLVMValueRef tag_value,
-                        LLVMValueRef hash_index,
+                        LLVMValueRef slot,
                         LLVMValueRef cache)
 {
    LLVMBuilderRef builder = gallivm->builder;
@@ -1133,19 +1133,19 @@ s3tc_store_cached_block(struct gallivm_state *gallivm,
    type_ptr4x32 = LLVMPointerType(LLVMVectorType(LLVMInt32TypeInContext(gallivm->context), 4), 0);
    indices[0] = lp_build_const_int32(gallivm, 0);
    indices[1] = lp_build_const_int32(gallivm, LP_BUILD_FORMAT_CACHE_MEMBER_TAGS);
-   indices[2] = hash_index;
+   indices[2] = slot;
    LLVMTypeRef cache_type = lp_build_format_cache_type(gallivm);
    ptr = LLVMBuildGEP2(builder, cache_type, cache, indices, ARRAY_SIZE(indices), "");
    LLVMBuildStore(builder, tag_value, ptr);
 
    indices[1] = lp_build_const_int32(gallivm, LP_BUILD_FORMAT_CACHE_MEMBER_DATA);
-   hash_index = LLVMBuildMul(builder, hash_index, lp_build_const_int32(gallivm, 16), "");
+   slot = LLVMBuildMul(builder, slot, lp_build_const_int32(gallivm, 16), "");
    for (count = 0; count < 4; count++) {
-      indices[2] = hash_index;
+      indices[2] = slot;
       ptr = LLVMBuildGEP2(builder, cache_type, cache, indices, ARRAY_SIZE(indices), "");
       ptr = LLVMBuildBitCast(builder, ptr, type_ptr4x32, "");
       LLVMBuildStore(builder, col[count], ptr);
-      hash_index = LLVMBuildAdd(builder, hash_index, lp_build_const_int32(gallivm, 4), "");
+      slot = LLVMBuildAdd(builder, slot, lp_build_const_int32(gallivm, 4), "");
    }
 }
 
@@ -1919,17 +1919,17 @@ generate_update_cache_one_block(struct gallivm_state *gallivm,
    LLVMBasicBlockRef block;
    LLVMBuilderRef old_builder;
    LLVMValueRef ptr_addr;
-   LLVMValueRef hash_index;
+   LLVMValueRef slot;
    LLVMValueRef cache;
    LLVMValueRef dxt_block, tag_value;
    LLVMValueRef col[LP_MAX_VECTOR_LENGTH];
 
    ptr_addr     = LLVMGetParam(function, 0);
-   hash_index   = LLVMGetParam(function, 1);
+   slot         = LLVMGetParam(function, 1);
    cache        = LLVMGetParam(function, 2);
 
    lp_build_name(ptr_addr,   "ptr_addr"  );
-   lp_build_name(hash_index, "hash_index");
+   lp_build_name(slot,       "slot"      );
    lp_build_name(cache,      "cache_addr");
 
    /*
@@ -1967,7 +1967,7 @@ generate_update_cache_one_block(struct gallivm_state *gallivm,
 
    tag_value = LLVMBuildPtrToInt(gallivm->builder, ptr_addr,
                                  LLVMInt64TypeInContext(gallivm->context), "");
-   s3tc_store_cached_block(gallivm, col, tag_value, hash_index, cache);
+   s3tc_store_cached_block(gallivm, col, tag_value, slot, cache);
 
    LLVMBuildRetVoid(gallivm->builder);
 
@@ -1982,7 +1982,7 @@ static void
 update_cached_block(struct gallivm_state *gallivm,
                     const struct util_format_description *format_desc,
                     LLVMValueRef ptr_addr,
-                    LLVMValueRef hash_index,
+                    LLVMValueRef slot,
                     LLVMValueRef cache)
 
 {
@@ -2019,7 +2019,7 @@ update_cached_block(struct gallivm_state *gallivm,
    }
 
    args[0] = ptr_addr;
-   args[1] = hash_index;
+   args[1] = slot;
    args[2] = cache;
  
    LLVMBuildCall2(builder, function_type, function, args, ARRAY_SIZE(args), "");
@@ -2028,6 +2028,79 @@ update_cached_block(struct gallivm_state *gallivm,
    LLVMSetInstructionCallConv(inst, LLVMFastCallConv);
 }
 
+/*
+ * Cached lookup of a single texel.
+ * Compares the block address against all ways of its set, and on a miss
+ * decodes the block into the round-robin victim slot of the set.
+ */
+static LLVMValueRef
+compressed_fetch_cached_one(struct gallivm_state *gallivm,
+                            const struct util_format_description *format_desc,
+                            LLVMValueRef addr,
+                            LLVMValueRef set_index,
+                            LLVMValueRef ij_index,
+                            LLVMValueRef cache)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMTypeRef i8t = LLVMInt8TypeInContext(gallivm->context);
+   LLVMValueRef first_slot, victim, slot, hit, block_index, indices[3];
+   LLVMValueRef victim_ptr;
+   struct lp_build_if_state if_ctx;
+   unsigned way;
+
+   first_slot = LLVMBuildMul(builder, set_index,
+                             lp_build_const_int32(gallivm, LP_BUILD_FORMAT_CACHE_WAYS), "");
+
+   indices[0] = lp_build_const_int32(gallivm, 0);
+   indices[1] = lp_build_const_int32(gallivm, LP_BUILD_FORMAT_CACHE_MEMBER_VICTIM);
+   indices[2] = set_index;
+   victim_ptr = LLVMBuildGEP2(builder, lp_build_format_cache_type(gallivm),
+                              cache, indices, ARRAY_SIZE(indices), "victim_gep");
+   victim = LLVMBuildLoad2(builder, i8t, victim_ptr, "victim");
+   victim = LLVMBuildZExt(builder, victim, LLVMInt32TypeInContext(gallivm->context), "");
+   victim = LLVMBuildAnd(builder, victim,
+                         lp_build_const_int32(gallivm, LP_BUILD_FORMAT_CACHE_WAYS - 1), "");
+
+   /* the slot to use if no way matches */
+   slot = LLVMBuildAdd(builder, first_slot, victim, "");
+   hit = LLVMConstInt(LLVMInt1TypeInContext(gallivm->context), 0, 0);
+
+   for (way = 0; way < LP_BUILD_FORMAT_CACHE_WAYS; way++) {
+      LLVMValueRef way_slot, tag, match;
+
+      way_slot = LLVMBuildAdd(builder, first_slot,
+                              lp_build_const_int32(gallivm, way), "");
+      tag = s3tc_lookup_tag_data(gallivm, cache, way_slot);
+      match = LLVMBuildICmp(builder, LLVMIntEQ, tag, addr, "");
+      slot = LLVMBuildSelect(builder, match, way_slot, slot, "");
+      hit = LLVMBuildOr(builder, hit, match, "");
+   }
+
+   lp_build_if(&if_ctx, gallivm, LLVMBuildNot(builder, hit, ""));
+   {
+      LLVMValueRef ptr_addr, next_victim;
+
+      ptr_addr = LLVMBuildIntToPtr(builder, addr, LLVMPointerType(i8t, 0), "");
+      update_cached_block(gallivm, format_desc, ptr_addr, slot, cache);
+
+      next_victim = LLVMBuildAdd(builder, victim, lp_build_const_int32(gallivm, 1), "");
+      next_victim = LLVMBuildAnd(builder, next_victim,
+                                 lp_build_const_int32(gallivm, LP_BUILD_FORMAT_CACHE_WAYS - 1), "");
+      next_victim = LLVMBuildTrunc(builder, next_victim, i8t, "");
+      LLVMBuildStore(builder, next_victim, victim_ptr);
+#if LP_BUILD_FORMAT_CACHE_DEBUG
+      s3tc_update_cache_access(gallivm, cache, 1,
+                               LP_BUILD_FORMAT_CACHE_MEMBER_ACCESS_MISS);
+#endif
+   }
+   lp_build_endif(&if_ctx);
+
+   block_index = LLVMBuildShl(builder, slot, lp_build_const_int32(gallivm, 4), "");
+   block_index = LLVMBuildAdd(builder, block_index, ij_index, "");
+
+   return s3tc_lookup_cached_pixel(gallivm, cache, block_index);
+}
+
 /*
  * cached lookup
  */
@@ -2043,9 +2116,9 @@ compressed_fetch_cached(struct gallivm_state *gallivm,
 
 {
    LLVMBuilderRef builder = gallivm->builder;
-   unsigned count, low_bit, log2size;
-   LLVMValueRef color, offset_stored, addr, ptr_addrtrunc, tmp;
-   LLVMValueRef ij_index, hash_index, hash_mask, block_index;
+   unsigned count, low_bit, log2sets;
+   LLVMValueRef color, addr, ptr_addrtrunc, tmp;
+   LLVMValueRef ij_index, set_index, set_mask;
    LLVMTypeRef i8t = LLVMInt8TypeInContext(gallivm->context);
    LLVMTypeRef i32t = LLVMInt32TypeInContext(gallivm->context);
    LLVMTypeRef i64t = LLVMInt64TypeInContext(gallivm->context);
@@ -2058,17 +2131,17 @@ compressed_fetch_cached(struct gallivm_state *gallivm,
    lp_build_context_init(&bld32, gallivm, type);
 
    /*
-    * compute hash - we use direct mapped cache, the hash function could
+    * compute hash - selects the set, the hash function could
     *                be better but it needs to be simple
     * per-element:
-    *    compare offset with offset stored at tag (hash)
-    *    if not equal extract block, store block, update tag
+    *    compare offset with offsets stored at the tags of the set
+    *    if none is equal extract block, store block in victim way, update tag
     *    extract color from cache
     *    assemble colors
     */
 
    low_bit = util_logbase2(format_desc->block.bits / 8);
-   log2size = util_logbase2(LP_BUILD_FORMAT_CACHE_SIZE);
+   log2sets = util_logbase2(LP_BUILD_FORMAT_CACHE_SETS);
    addr = LLVMBuildPtrToInt(builder, base_ptr, i64t, "");
    ptr_addrtrunc = LLVMBuildPtrToInt(builder, base_ptr, i32t, "");
    ptr_addrtrunc = lp_build_broadcast_scalar(&bld32, ptr_addrtrunc);
@@ -2077,79 +2150,42 @@ compressed_fetch_cached(struct gallivm_state *gallivm,
    ptr_addrtrunc = LLVMBuildAdd(builder, offset, ptr_addrtrunc, "");
    ptr_addrtrunc = LLVMBuildLShr(builder, ptr_addrtrunc,
                                  lp_build_const_int_vec(gallivm, type, low_bit), "");
-   /* This only really makes sense for size 64,128,256 */
-   hash_index = ptr_addrtrunc;
+   set_index = ptr_addrtrunc;
    ptr_addrtrunc = LLVMBuildLShr(builder, ptr_addrtrunc,
-                                 lp_build_const_int_vec(gallivm, type, 2*log2size), "");
-   hash_index = LLVMBuildXor(builder, ptr_addrtrunc, hash_index, "");
-   tmp = LLVMBuildLShr(builder, hash_index,
-                       lp_build_const_int_vec(gallivm, type, log2size), "");
-   hash_index = LLVMBuildXor(builder, hash_index, tmp, "");
-
-   hash_mask = lp_build_const_int_vec(gallivm, type, LP_BUILD_FORMAT_CACHE_SIZE - 1);
-   hash_index = LLVMBuildAnd(builder, hash_index, hash_mask, "");
+                                 lp_build_const_int_vec(gallivm, type, 2*log2sets), "");
+   set_index = LLVMBuildXor(builder, ptr_addrtrunc, set_index, "");
+   tmp = LLVMBuildLShr(builder, set_index,
+                       lp_build_const_int_vec(gallivm, type, log2sets), "");
+   set_index = LLVMBuildXor(builder, set_index, tmp, "");
+
+   set_mask = lp_build_const_int_vec(gallivm, type, LP_BUILD_FORMAT_CACHE_SETS - 1);
+   set_index = LLVMBuildAnd(builder, set_index, set_mask, "");
    ij_index = LLVMBuildShl(builder, i, lp_build_const_int_vec(gallivm, type, 2), "");
    ij_index = LLVMBuildAdd(builder, ij_index, j, "");
-   block_index = LLVMBuildShl(builder, hash_index,
-                              lp_build_const_int_vec(gallivm, type, 4), "");
-   block_index = LLVMBuildAdd(builder, ij_index, block_index, "");
 
    if (n > 1) {
       color = bld32.undef;
       for (count = 0; count < n; count++) {
-         LLVMValueRef index, cond, colorx;
-         LLVMValueRef block_indexx, hash_indexx, addrx, offsetx, ptr_addrx;
-         struct lp_build_if_state if_ctx;
+         LLVMValueRef index, colorx, addrx, offsetx;
 
          index = lp_build_const_int32(gallivm, count);
          offsetx = LLVMBuildExtractElement(builder, offset, index, "");
          addrx = LLVMBuildZExt(builder, offsetx, i64t, "");
          addrx = LLVMBuildAdd(builder, addrx, addr, "");
-         block_indexx = LLVMBuildExtractElement(builder, block_index, index, "");
-         hash_indexx = LLVMBuildLShr(builder, block_indexx,
-                                     lp_build_const_int32(gallivm, 4), "");
-         offset_stored = s3tc_lookup_tag_data(gallivm, cache, hash_indexx);
-         cond = LLVMBuildICmp(builder, LLVMIntNE, offset_stored, addrx, "");
-
-         lp_build_if(&if_ctx, gallivm, cond);
-         {
-            ptr_addrx = LLVMBuildIntToPtr(builder, addrx,
-                                          LLVMPointerType(i8t, 0), "");
-            update_cached_block(gallivm, format_desc, ptr_addrx, hash_indexx, cache);
-#if LP_BUILD_FORMAT_CACHE_DEBUG
-            s3tc_update_cache_access(gallivm, cache, 1,
-                                     LP_BUILD_FORMAT_CACHE_MEMBER_ACCESS_MISS);
-#endif
-         }
-         lp_build_endif(&if_ctx);
 
-         colorx = s3tc_lookup_cached_pixel(gallivm, cache, block_indexx);
+         colorx = compressed_fetch_cached_one(gallivm, format_desc, addrx,
+                     LLVMBuildExtractElement(builder, set_index, index, ""),
+                     LLVMBuildExtractElement(builder, ij_index, index, ""),
+                     cache);
 
-         color = LLVMBuildInsertElement(builder, color, colorx,
-                                        lp_build_const_int32(gallivm, count), "");
+         color = LLVMBuildInsertElement(builder, color, colorx, index, "");
       }
    }
    else {
-      LLVMValueRef cond;
-      struct lp_build_if_state if_ctx;
-
       tmp = LLVMBuildZExt(builder, offset, i64t, "");
       addr = LLVMBuildAdd(builder, tmp, addr, "");
-      offset_stored = s3tc_lookup_tag_data(gallivm, cache, hash_index);
-      cond = LLVMBuildICmp(builder, LLVMIntNE, offset_stored, addr, "");
-
-      lp_build_if(&if_ctx, gallivm, cond);
-      {
-         tmp = LLVMBuildIntToPtr(builder, addr, LLVMPointerType(i8t, 0), "");
-         update_cached_block(gallivm, format_desc, tmp, hash_index, cache);
-#if LP_BUILD_FORMAT_CACHE_DEBUG
-         s3tc_update_cache_access(gallivm, cache, 1,
-                                  LP_BUILD_FORMAT_CACHE_MEMBER_ACCESS_MISS);
-#endif
-      }
-      lp_build_endif(&if_ctx);
-
-      color = s3tc_lookup_cached_pixel(gallivm, cache, block_index);
+      color = compressed_fetch_cached_one(gallivm, format_desc, addr,
+                                          set_index, ij_index, cache);
    }
 #if LP_BUILD_FORMAT_CACHE_DEBUG
    s3tc_update_cache_access(gallivm, cache, n,
@@ -32,6 +32,10 @@
 #include "util/u_cpu_detect.h"
 #include "util/u_debug.h"
 #include "util/u_memory.h"
+#include "util/u_atomic.h"
+#include "util/u_call_once.h"
+#include "util/u_queue.h"
+#include "util/u_string.h"
 #include "util/os_time.h"
 #include "lp_bld.h"
 #include "lp_bld_debug.h"
@@ -42,6 +46,7 @@
 
 #include <llvm/Config/llvm-config.h>
 #include <llvm-c/Analysis.h>
+#include <llvm-c/BitReader.h>
 #include <llvm-c/BitWriter.h>
 
 static bool gallivm_initialized = false;
@@ -79,9 +84,14 @@ create_pass_manager(struct gallivm_state *gallivm)
       free(td_str);
    }
 
-   return lp_passmgr_create(gallivm->module, &gallivm->passmgr);
+   return lp_passmgr_create(gallivm->module, !gallivm->fast,
+                            &gallivm->passmgr);
 }
 
+static void
+gallivm_tier_job_destroy(struct gallivm_tier_job *job);
+
+
 /**
  * Free gallivm object's LLVM allocations, but not any generated code
  * nor the gallivm object itself.
@@ -104,6 +114,9 @@ gallivm_free_ir(struct gallivm_state *gallivm)
    }
    FREE(gallivm->module_name);
 
+   if (gallivm->fast_bitcode)
+      LLVMDisposeMemoryBuffer(gallivm->fast_bitcode);
+
    if (gallivm->target) {
       LLVMDisposeTargetData(gallivm->target);
    }
@@ -121,6 +134,7 @@ gallivm_free_ir(struct gallivm_state *gallivm)
    gallivm->context = NULL;
    gallivm->builder = NULL;
    gallivm->cache = NULL;
+   gallivm->fast_bitcode = NULL;
 }
 
 
@@ -147,7 +161,7 @@ init_gallivm_engine(struct gallivm_state *gallivm)
       char *error = NULL;
       int ret;
 
-      if (gallivm_perf & GALLIVM_PERF_NO_OPT) {
+      if ((gallivm_perf & GALLIVM_PERF_NO_OPT) || gallivm->fast) {
          optlevel = None;
       }
       else {
@@ -156,7 +170,8 @@ init_gallivm_engine(struct gallivm_state *gallivm)
 
       ret = lp_build_create_jit_compiler_for_module(&gallivm->engine,
                                                     &gallivm->code,
-                                                    gallivm->cache,
+                                                    /* fast code isn't cached */
+                                                    gallivm->fast ? NULL : gallivm->cache,
                                                     gallivm->module,
                                                     gallivm->memorymgr,
                                                     (unsigned) optlevel,
@@ -196,6 +211,25 @@ fail:
 }
 
 
+static LLVMTargetDataRef
+create_target_data(void)
+{
+   const unsigned pointer_size = 8 * sizeof(void *);
+   char layout[512];
+   snprintf(layout, sizeof layout, "%c-p:%u:%u:%u-i64:64:64-a0:0:%u-s0:%u:%u",
+#if UTIL_ARCH_LITTLE_ENDIAN
+                 'e', // little endian
+#else
+                 'E', // big endian
+#endif
+                 pointer_size, pointer_size, pointer_size, // pointer size, abi alignment, preferred alignment
+                 pointer_size, // aggregate preferred alignment
+                 pointer_size, pointer_size); // stack objects abi alignment, preferred alignment
+
+   return LLVMCreateTargetData(layout);
+}
+
+
 /**
  * Allocate gallivm LLVM objects.
  * \return  TRUE for success, FALSE for failure
@@ -262,23 +296,9 @@ init_gallivm_state(struct gallivm_state *gallivm, const char *name,
     * - http://llvm.org/docs/LangRef.html#datalayout
     */
 
-   {
-      const unsigned pointer_size = 8 * sizeof(void *);
-      char layout[512];
-      snprintf(layout, sizeof layout, "%c-p:%u:%u:%u-i64:64:64-a0:0:%u-s0:%u:%u",
-#if UTIL_ARCH_LITTLE_ENDIAN
-                    'e', // little endian
-#else
-                    'E', // big endian
-#endif
-                    pointer_size, pointer_size, pointer_size, // pointer size, abi alignment, preferred alignment
-                    pointer_size, // aggregate preferred alignment
-                    pointer_size, pointer_size); // stack objects abi alignment, preferred alignment
-
-      gallivm->target = LLVMCreateTargetData(layout);
-      if (!gallivm->target) {
-         return false;
-      }
+   gallivm->target = create_target_data();
+   if (!gallivm->target) {
+      return false;
    }
 
    if (!create_pass_manager(gallivm))
@@ -348,6 +368,8 @@ gallivm_create(const char *name, lp_context_ref *context,
 void
 gallivm_destroy(struct gallivm_state *gallivm)
 {
+   if (gallivm->tier)
+      gallivm_tier_job_destroy(gallivm->tier);
    gallivm_free_ir(gallivm);
    gallivm_free_code(gallivm);
    FREE(gallivm);
@@ -366,6 +388,8 @@ gallivm_add_global_mapping(struct gallivm_state *gallivm, LLVMValueRef sym, void
 void
 gallivm_compile_module(struct gallivm_state *gallivm)
 {
+   const int64_t time_begin = os_time_get();
+
    assert(!gallivm->compiled);
 
    if (gallivm->builder) {
@@ -400,6 +424,10 @@ gallivm_compile_module(struct gallivm_state *gallivm)
                    "[-mattr=<-mattr option(s)>]");
    }
 
+   /* Keep the unoptimized module for gallivm_tier_up() */
+   if (gallivm->fast)
+      gallivm->fast_bitcode = LLVMWriteBitcodeToMemoryBuffer(gallivm->module);
+
    lp_passmgr_run(gallivm->passmgr,
                   gallivm->module,
                   LLVMGetExecutionEngineTargetMachine(gallivm->engine),
@@ -464,6 +492,9 @@ gallivm_compile_module(struct gallivm_state *gallivm)
       }
    }
 #endif
+
+   if (gallivm->fast)
+      gallivm->fast_compile_time += os_time_get() - time_begin;
 }
 
 
@@ -479,18 +510,25 @@ gallivm_jit_function(struct gallivm_state *gallivm,
    assert(gallivm->compiled);
    assert(gallivm->engine);
 
-   if (gallivm_debug & GALLIVM_DEBUG_PERF)
+   if (gallivm->fast || (gallivm_debug & GALLIVM_DEBUG_PERF))
       time_begin = os_time_get();
 
    code = LLVMGetPointerToGlobal(gallivm->engine, func);
    assert(code);
    jit_func = pointer_to_func(code);
 
-   if (gallivm_debug & GALLIVM_DEBUG_PERF) {
+   if (gallivm->fast || (gallivm_debug & GALLIVM_DEBUG_PERF)) {
       int64_t time_end = os_time_get();
       int time_msec = (int)(time_end - time_begin) / 1000;
-      debug_printf("   jitting func %s took %d msec\n",
-                   LLVMGetValueName(func), time_msec);
+
+      /* MCJIT generates the code on the first lookup */
+      if (gallivm->fast)
+         gallivm->fast_compile_time += time_end - time_begin;
+
+      if (gallivm_debug & GALLIVM_DEBUG_PERF) {
+         debug_printf("   jitting func %s took %d msec\n",
+                      LLVMGetValueName(func), time_msec);
+      }
    }
 
    return jit_func;
@@ -506,3 +544,234 @@ gallivm_stub_func(struct gallivm_state *gallivm, LLVMValueRef func)
    (void) gallivm;
    (void) func;
 }
+
+
+/*
+ * Tiered compilation.
+ *
+ * gallivm_compile_fast() makes gallivm_compile_module() keep a copy of the
+ * module's bitcode, and then only run the passes the backends need and
+ * generate code with -O0.  gallivm_tier_up() compiles that copy again with
+ * all optimizations on a background thread, in a private LLVM context, and
+ * stores the optimized functions over the fast ones.  Other threads may
+ * still be running the fast code, so both are only freed with the gallivm
+ * state.
+ */
+
+struct gallivm_tier_job
+{
+   struct gallivm_tier_info info;
+   char *module_name;
+   LLVMMemoryBufferRef bitcode;
+   int64_t fast_compile_time;
+
+   /* Owns the optimized code, once compiled */
+   struct gallivm_state *optimized;
+
+   struct util_queue_fence fence;
+};
+
+static struct util_queue tier_queue;
+static util_once_flag tier_queue_once = UTIL_ONCE_FLAG_INIT;
+static struct gallivm_tier_stats tier_stats;
+
+
+static void
+tier_queue_init(void)
+{
+   /* Leave most of the CPU time to whatever is running the fast code */
+   util_queue_init(&tier_queue, "gallivm_opt", 64,
+                   CLAMP(util_get_cpu_caps()->nr_cpus / 4, 1, 2),
+                   UTIL_QUEUE_INIT_RESIZE_IF_FULL |
+                   UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY, NULL);
+}
+
+
+/**
+ * Compile the module with as few optimizations as possible, so that it
+ * is ready sooner, and optimize it later with gallivm_tier_up().
+ * Must be called before gallivm_compile_module().
+ * Return false if the module will be optimized right away instead, e.g.
+ * when its code was found in the shader cache or tiering isn't enabled
+ * with GALLIVM_PERF=tiered.
+ */
+bool
+gallivm_compile_fast(struct gallivm_state *gallivm)
+{
+   assert(!gallivm->compiled);
+
+   if (!(gallivm_perf & GALLIVM_PERF_TIERED) ||
+       (gallivm_perf & GALLIVM_PERF_NO_OPT) ||
+       (gallivm->cache && gallivm->cache->data_size))
+      return false;
+
+   util_call_once(&tier_queue_once, tier_queue_init);
+   if (!util_queue_is_initialized(&tier_queue))
+      return false;
+
+   struct lp_passmgr *passmgr;
+   if (!lp_passmgr_create(gallivm->module, false, &passmgr))
+      return false;
+
+   lp_passmgr_dispose(gallivm->passmgr);
+   gallivm->passmgr = passmgr;
+   gallivm->fast = true;
+   return true;
+}
+
+
+static void
+gallivm_tier_job_execute(void *data, void *gdata, int thread_index)
+{
+   struct gallivm_tier_job *job = data;
+   const int64_t time_begin = os_time_get();
+   struct lp_cached_code cached = { 0 };
+   lp_context_ref context;
+   LLVMModuleRef module;
+
+   lp_context_create(&context);
+   if (!context.ref)
+      return;
+
+   if (LLVMParseBitcodeInContext2(context.ref, job->bitcode, &module)) {
+      lp_context_destroy(&context);
+      return;
+   }
+
+   struct gallivm_state *gallivm = CALLOC_STRUCT(gallivm_state);
+   if (!gallivm) {
+      LLVMDisposeModule(module);
+      lp_context_destroy(&context);
+      return;
+   }
+
+   gallivm->context = context.ref;
+   gallivm->module = module;
+   gallivm->module_name = job->module_name;
+   job->module_name = NULL;
+   gallivm->cache = job->info.cache_insert ? &cached : NULL;
+   gallivm->target = create_target_data();
+   gallivm->memorymgr = lp_get_default_memory_manager();
+
+   /* Find the hooks the fast compile declared, rather than adding more */
+   gallivm->coro_malloc_hook = LLVMGetNamedFunction(module, "coro_malloc");
+   gallivm->coro_free_hook = LLVMGetNamedFunction(module, "coro_free");
+   gallivm->debug_printf_hook = LLVMGetNamedFunction(module, "debug_printf");
+   gallivm->get_time_hook = LLVMGetNamedFunction(module, "get_time_hook");
+
+   if (!gallivm->target || !gallivm->memorymgr ||
+       !create_pass_manager(gallivm)) {
+      gallivm_free_ir(gallivm);
+      gallivm_free_code(gallivm);
+      FREE(gallivm);
+      lp_context_destroy(&context);
+      return;
+   }
+
+   gallivm_compile_module(gallivm);
+
+   func_pointer code[GALLIVM_TIER_MAX_FUNCS];
+   for (unsigned i = 0; i < job->info.num_funcs; i++) {
+      LLVMValueRef func = LLVMGetNamedFunction(gallivm->module,
+                                               job->info.names[i]);
+      code[i] = func ? gallivm_jit_function(gallivm, func,
+                                            job->info.names[i]) : NULL;
+   }
+
+   /* Only switch over once all of them are ready */
+   for (unsigned i = 0; i < job->info.num_funcs; i++) {
+      if (code[i])
+         p_atomic_set(job->info.slots[i], code[i]);
+   }
+
+   if (job->info.cache_insert) {
+      job->info.cache_insert(job->info.cache_cookie, &cached,
+                             job->info.cache_key);
+   }
+
+   gallivm_free_ir(gallivm);
+   lp_context_destroy(&context);
+   job->optimized = gallivm;
+
+   const int64_t time = os_time_get() - time_begin;
+   p_atomic_inc(&tier_stats.optimized_modules);
+   p_atomic_add(&tier_stats.optimized_time, time);
+
+   if (gallivm_debug & GALLIVM_DEBUG_PERF) {
+      debug_printf("optimized tiered module in %d msec, %d msec after "
+                   "the fast compile\n", (int)(time / 1000),
+                   (int)(job->fast_compile_time / 1000));
+   }
+}
+
+
+/**
+ * Optimize a module compiled with gallivm_compile_fast() in the
+ * background.  Must be called after the fast functions were looked up;
+ * the slots in info are overwritten with the optimized functions
+ * whenever they are ready, until the gallivm state is destroyed.
+ */
+void
+gallivm_tier_up(struct gallivm_state *gallivm,
+                const struct gallivm_tier_info *info)
+{
+   assert(info->num_funcs <= GALLIVM_TIER_MAX_FUNCS);
+
+   if (!gallivm->fast || !gallivm->fast_bitcode || gallivm->tier)
+      return;
+
+   struct gallivm_tier_job *job = CALLOC_STRUCT(gallivm_tier_job);
+   if (!job)
+      return;
+
+   job->info = *info;
+   /* The module references process-local pointers */
+   if (gallivm->cache && gallivm->cache->dont_cache)
+      job->info.cache_insert = NULL;
+   for (unsigned i = 0; i < info->num_funcs; i++)
+      job->info.names[i] = strdup(info->names[i]);
+   if (gallivm->module_name) {
+      size_t size = strlen(gallivm->module_name) + 1;
+      job->module_name = MALLOC(size);
+      if (job->module_name)
+         memcpy(job->module_name, gallivm->module_name, size);
+   }
+   job->bitcode = gallivm->fast_bitcode;
+   gallivm->fast_bitcode = NULL;
+   job->fast_compile_time = gallivm->fast_compile_time;
+   util_queue_fence_init(&job->fence);
+
+   p_atomic_inc(&tier_stats.fast_modules);
+   p_atomic_add(&tier_stats.fast_time, gallivm->fast_compile_time);
+
+   gallivm->tier = job;
+   util_queue_add_job(&tier_queue, job, &job->fence,
+                      gallivm_tier_job_execute, NULL, 0);
+}
+
+
+static void
+gallivm_tier_job_destroy(struct gallivm_tier_job *job)
+{
+   /* Don't optimize what is about to be freed */
+   util_queue_drop_job(&tier_queue, &job->fence);
+   util_queue_fence_destroy(&job->fence);
+
+   if (job->optimized) {
+      gallivm_free_code(job->optimized);
+      FREE(job->optimized);
+   }
+
+   for (unsigned i = 0; i < job->info.num_funcs; i++)
+      free((char *)job->info.names[i]);
+   FREE(job->module_name);
+   LLVMDisposeMemoryBuffer(job->bitcode);
+   FREE(job);
+}
+
+
+void
+gallivm_get_tier_stats(struct gallivm_tier_stats *stats)
+{
+   *stats = tier_stats;
+}
@@ -47,6 +47,7 @@ extern "C" {
 #endif
 
 struct lp_cached_code;
+struct gallivm_tier_job;
 struct gallivm_state
 {
    char *module_name;
@@ -78,6 +79,43 @@ struct gallivm_state
 
    LLVMValueRef texture_descriptor;
    LLVMValueRef sampler_descriptor;
+
+   /* See gallivm_compile_fast() */
+   bool fast;
+   LLVMMemoryBufferRef fast_bitcode;
+   int64_t fast_compile_time;
+   struct gallivm_tier_job *tier;
+};
+
+
+#define GALLIVM_TIER_MAX_FUNCS 4
+
+/**
+ * What to do once a module compiled with gallivm_compile_fast() has been
+ * compiled again with all optimizations.
+ */
+struct gallivm_tier_info
+{
+   /* The functions to look up, and where to store their optimized code */
+   unsigned num_funcs;
+   const char *names[GALLIVM_TIER_MAX_FUNCS];
+   func_pointer *slots[GALLIVM_TIER_MAX_FUNCS];
+
+   /* Optional, gets the optimized object code for the shader cache */
+   void (*cache_insert)(void *cookie,
+                        struct lp_cached_code *cache,
+                        unsigned char ir_sha1_cache_key[20]);
+   void *cache_cookie;
+   unsigned char cache_key[20];
+};
+
+/** Totals of the modules compiled with gallivm_compile_fast() */
+struct gallivm_tier_stats
+{
+   unsigned fast_modules;      /**< modules compiled unoptimized first */
+   unsigned optimized_modules; /**< of those, recompiled optimized */
+   int64_t fast_time;          /**< usecs spent compiling them unoptimized */
+   int64_t optimized_time;     /**< usecs spent optimizing in the background */
 };
 
 unsigned
@@ -119,6 +157,16 @@ gallivm_jit_function(struct gallivm_state *gallivm,
 void
 gallivm_stub_func(struct gallivm_state *gallivm, LLVMValueRef func);
 
+bool
+gallivm_compile_fast(struct gallivm_state *gallivm);
+
+void
+gallivm_tier_up(struct gallivm_state *gallivm,
+                const struct gallivm_tier_info *info);
+
+void
+gallivm_get_tier_stats(struct gallivm_tier_stats *stats);
+
 unsigned gallivm_get_perf_flags(void);
 
 void lp_init_clock_hook(struct gallivm_state *gallivm);
@@ -43,6 +43,8 @@ static const struct debug_named_value lp_bld_perf_flags[] = {
    { "no_quad_lod", GALLIVM_PERF_NO_QUAD_LOD, "disable quad_lod optimization" },
    { "no_aos_sampling", GALLIVM_PERF_NO_AOS_SAMPLING, "disable aos sampling optimization" },
    { "nopt",   GALLIVM_PERF_NO_OPT, "disable optimization passes to speed up shader compilation" },
+   { "tiered", GALLIVM_PERF_TIERED, "compile shaders unoptimized first and optimize them in the background" },
+   { "no_code_arena", GALLIVM_PERF_NO_CODE_ARENA, "give each module's code pages of its own" },
    DEBUG_NAMED_VALUE_END
 };
 
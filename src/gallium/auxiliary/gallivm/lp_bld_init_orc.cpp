@@ -307,7 +307,7 @@ void lpjit_exit()
 LLVMErrorRef module_transform(void *Ctx, LLVMModuleRef mod) {
    struct lp_passmgr *mgr;
 
-   lp_passmgr_create(mod, &mgr);
+   lp_passmgr_create(mod, true, &mgr);
 
    lp_passmgr_run(mgr, mod,
                   LPJit::get_instance()->tm,
@@ -687,3 +687,26 @@ gallivm_stub_func(struct gallivm_state *gallivm, LLVMValueRef func)
    LLVMPositionBuilderAtEnd(builder, block);
    LLVMBuildRetVoid(builder);
 }
+
+/*
+ * Tiered compilation is not implemented for ORC, which compiles all modules
+ * into one process-wide JIT; every module is optimized right away.
+ */
+
+bool
+gallivm_compile_fast(struct gallivm_state *gallivm)
+{
+   return false;
+}
+
+void
+gallivm_tier_up(struct gallivm_state *gallivm,
+                const struct gallivm_tier_info *info)
+{
+}
+
+void
+gallivm_get_tier_stats(struct gallivm_tier_stats *stats)
+{
+   memset(stats, 0, sizeof *stats);
+}
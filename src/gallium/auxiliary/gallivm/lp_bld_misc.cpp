@@ -56,6 +56,7 @@
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/CodeGen/SelectionDAGNodes.h>
 #if LLVM_VERSION_MAJOR >= 15
+#include <llvm/Support/Memory.h>
 #include <llvm/Support/MemoryBuffer.h>
 #endif
 
@@ -87,6 +88,7 @@
 
 #include "lp_bld_misc.h"
 #include "lp_bld_debug.h"
+#include "lp_bld_code_arena.h"
 
 static void lp_run_atexit_for_destructors(void);
 
@@ -224,6 +226,72 @@ class DelegatingJITMemoryManager : public BaseMemoryManager {
       virtual bool finalizeMemory(std::string *ErrMsg = 0) {
          return mgr()->finalizeMemory(ErrMsg);
       }
+      virtual void notifyObjectLoaded(llvm::ExecutionEngine *EE,
+                                      const llvm::object::ObjectFile &Obj) {
+         mgr()->notifyObjectLoaded(EE, Obj);
+      }
+};
+
+
+/*
+ * Allocate sections from the process-wide code arena, so that the many
+ * small modules llvmpipe creates share pages instead of each one using at
+ * least a page per section kind.  Code is written and relocated through the
+ * arena's writable mapping, and remapped to the executable one before the
+ * relocations are applied.  Read-only data isn't write protected.
+ * Blocks are given back to the arena when the manager is deleted, which
+ * gallivm does once the generated code is freed.
+ */
+class ArenaMemoryManager : public BaseMemoryManager {
+
+   std::vector<struct lp_code_block> Blocks;
+   size_t NumLoaded = 0, NumFinalized = 0;
+
+   uint8_t *allocate(bool Code, uintptr_t Size, unsigned Alignment) {
+      struct lp_code_block Block;
+      if (!lp_code_arena_alloc(Code, Size, Alignment, &Block))
+         return NULL;
+      Blocks.push_back(Block);
+      return (uint8_t *)Block.write;
+   }
+
+   public:
+
+      virtual ~ArenaMemoryManager() {
+         for (auto &Block : Blocks)
+            lp_code_arena_free(&Block);
+      }
+
+      virtual uint8_t *allocateCodeSection(uintptr_t Size,
+                                           unsigned Alignment,
+                                           unsigned SectionID,
+                                           llvm::StringRef SectionName) {
+         return allocate(true, Size, Alignment);
+      }
+      virtual uint8_t *allocateDataSection(uintptr_t Size,
+                                           unsigned Alignment,
+                                           unsigned SectionID,
+                                           llvm::StringRef SectionName,
+                                           bool IsReadOnly) {
+         return allocate(false, Size, Alignment);
+      }
+      virtual void notifyObjectLoaded(llvm::ExecutionEngine *EE,
+                                      const llvm::object::ObjectFile &Obj) {
+         for (; NumLoaded < Blocks.size(); NumLoaded++) {
+            const struct lp_code_block &Block = Blocks[NumLoaded];
+            if (Block.exec != Block.write)
+               EE->mapSectionAddress(Block.write, (uintptr_t)Block.exec);
+         }
+      }
+      virtual bool finalizeMemory(std::string *ErrMsg = 0) {
+         for (; NumFinalized < Blocks.size(); NumFinalized++) {
+            const struct lp_code_block &Block = Blocks[NumFinalized];
+            if (Block.exec != Block.write)
+               llvm::sys::Memory::InvalidateInstructionCache(Block.exec,
+                                                             Block.size);
+         }
+         return false;
+      }
 };
 
 
@@ -627,7 +695,10 @@ LLVMMCJITMemoryManagerRef
 lp_get_default_memory_manager()
 {
    BaseMemoryManager *mm;
-   mm = new llvm::SectionMemoryManager();
+   if (!(gallivm_perf & GALLIVM_PERF_NO_CODE_ARENA) && lp_code_arena_init())
+      mm = new ArenaMemoryManager();
+   else
+      mm = new llvm::SectionMemoryManager();
    return reinterpret_cast<LLVMMCJITMemoryManagerRef>(mm);
 }
 
@@ -56,26 +56,27 @@
 #include <llvm-c/Transforms/Coroutines.h>
 #endif
 
-#if USE_NEW_PASS == 0
 struct lp_passmgr {
+   bool optimize;
+#if USE_NEW_PASS == 0
    LLVMPassManagerRef passmgr;
 #if HAVE_CORO == 1
    LLVMPassManagerRef cgpassmgr;
 #endif
-};
-#else
-struct lp_passmgr;
 #endif
+};
 
 bool
-lp_passmgr_create(LLVMModuleRef module, struct lp_passmgr **mgr_p)
+lp_passmgr_create(LLVMModuleRef module, bool optimize,
+                  struct lp_passmgr **mgr_p)
 {
-   struct lp_passmgr *mgr = NULL;
-#if USE_NEW_PASS == 0
-   mgr = CALLOC_STRUCT(lp_passmgr);
+   struct lp_passmgr *mgr = CALLOC_STRUCT(lp_passmgr);
    if (!mgr)
       return false;
 
+   mgr->optimize = optimize && !(gallivm_perf & GALLIVM_PERF_NO_OPT);
+
+#if USE_NEW_PASS == 0
    mgr->passmgr = LLVMCreateFunctionPassManagerForModule(module);
    if (!mgr->passmgr) {
       free(mgr);
@@ -101,7 +102,7 @@ lp_passmgr_create(LLVMModuleRef module, struct lp_passmgr **mgr_p)
    LLVMAddCoroElidePass(mgr->cgpassmgr);
 #endif
 
-   if ((gallivm_perf & GALLIVM_PERF_NO_OPT) == 0) {
+   if (mgr->optimize) {
       /*
        * TODO: Evaluate passes some more - keeping in mind
        * both quality of generated code and compile times.
@@ -170,7 +171,7 @@ lp_passmgr_run(struct lp_passmgr *mgr,
    LLVMPassBuilderOptionsRef opts = LLVMCreatePassBuilderOptions();
    LLVMRunPasses(module, passes, tm, opts);
 
-   if (!(gallivm_perf & GALLIVM_PERF_NO_OPT))
+   if (mgr->optimize)
 #if LLVM_VERSION_MAJOR >= 18
       strcpy(passes, "sroa,early-cse,simplifycfg,reassociate,mem2reg,instsimplify,instcombine<no-verify-fixpoint>");
 #else
@@ -230,6 +231,6 @@ lp_passmgr_dispose(struct lp_passmgr *mgr)
       mgr->cgpassmgr = NULL;
    }
 #endif
-   FREE(mgr);
 #endif
+   FREE(mgr);
 }
@@ -38,10 +38,11 @@ extern "C" {
 struct lp_passmgr;
 
 /*
- * mgr can be returned as NULL for modern pass mgr handling
- * so use a bool to denote success/fail.
+ * Without optimize only the passes the backends need are run, as with
+ * GALLIVM_PERF=nopt.
  */
-bool lp_passmgr_create(LLVMModuleRef module, struct lp_passmgr **mgr);
+bool lp_passmgr_create(LLVMModuleRef module, bool optimize,
+                       struct lp_passmgr **mgr);
 void lp_passmgr_run(struct lp_passmgr *mgr,
                     LLVMModuleRef module,
                     LLVMTargetMachineRef tm,
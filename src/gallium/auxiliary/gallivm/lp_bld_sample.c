@@ -108,6 +108,11 @@ lp_sampler_static_texture_state(struct lp_static_texture_state *state,
 
    state->format = view->format;
    state->res_format = texture->format;
+   if ((texture->flags & LP_RESOURCE_FLAG_DECOMPRESSED) &&
+       view->format == texture->format) {
+      state->format = PIPE_FORMAT_R8G8B8A8_UNORM;
+      state->res_format = PIPE_FORMAT_R8G8B8A8_UNORM;
+   }
    state->swizzle_r = view->swizzle_r;
    state->swizzle_g = view->swizzle_g;
    state->swizzle_b = view->swizzle_b;
@@ -132,6 +137,8 @@ lp_sampler_static_texture_state(struct lp_static_texture_state *state,
    state->tiled = !!(texture->flags & PIPE_RESOURCE_FLAG_SPARSE);
    if (state->tiled)
       state->tiled_samples = texture->nr_samples;
+   state->microtiled = !!(texture->flags & LP_RESOURCE_FLAG_MICROTILED) &&
+                       !view->is_tex2d_from_buf;
 
    /*
     * the layer / element / level parameters are all either dynamic
@@ -179,6 +186,7 @@ lp_sampler_static_texture_state_image(struct lp_static_texture_state *state,
       if (view->u.tex.is_2d_view_of_3d)
          state->target = PIPE_TEXTURE_2D;
    }
+   state->microtiled = !!(resource->flags & LP_RESOURCE_FLAG_MICROTILED);
 
    /*
     * the layer / element / level parameters are all either dynamic
@@ -2339,6 +2347,55 @@ lp_build_tiled_sample_offset(struct lp_build_context *bld,
 }
 
 
+/**
+ * Compute the offset of a texel in a microtiled image.
+ *
+ * Each image row of the texture holds four texel rows, stored as a
+ * sequence of 4x4 blocks with the texels of a block in row-major order:
+ *
+ *   offset = (y/4) * 4 * y_stride + ((x/4) * 16 + (y%4) * 4 + x%4) * bpp
+ *
+ * Only used for plain formats, so the i,j sub-block coordinates are zero.
+ */
+void
+lp_build_microtiled_sample_offset(struct lp_build_context *bld,
+                                  const struct util_format_description *format_desc,
+                                  LLVMValueRef x,
+                                  LLVMValueRef y,
+                                  LLVMValueRef z,
+                                  LLVMValueRef y_stride,
+                                  LLVMValueRef z_stride,
+                                  LLVMValueRef *out_offset,
+                                  LLVMValueRef *out_i,
+                                  LLVMValueRef *out_j)
+{
+   LLVMValueRef three = lp_build_const_int_vec(bld->gallivm, bld->type, 3);
+
+   assert(format_desc->block.width == 1 && format_desc->block.height == 1);
+   assert(y && y_stride);
+
+   LLVMValueRef texel = lp_build_shl_imm(bld, lp_build_shr_imm(bld, x, 2), 4);
+   texel = lp_build_or(bld, texel,
+                       lp_build_shl_imm(bld, lp_build_and(bld, y, three), 2));
+   texel = lp_build_or(bld, texel, lp_build_and(bld, x, three));
+
+   LLVMValueRef offset = lp_build_mul_imm(bld, texel,
+                                          format_desc->block.bits / 8);
+
+   LLVMValueRef y_offset = lp_build_mul(bld, lp_build_shr_imm(bld, y, 2),
+                                        lp_build_shl_imm(bld, y_stride, 2));
+   offset = lp_build_add(bld, offset, y_offset);
+
+   if (z && z_stride) {
+      offset = lp_build_add(bld, offset, lp_build_mul(bld, z, z_stride));
+   }
+
+   *out_offset = offset;
+   *out_i = bld->zero;
+   *out_j = bld->zero;
+}
+
+
 static LLVMValueRef
 lp_build_sample_min(struct lp_build_context *bld,
                     LLVMValueRef x,
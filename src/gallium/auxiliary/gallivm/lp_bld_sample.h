@@ -49,6 +49,19 @@ extern "C" {
 
 #define LP_MAX_TEXEL_BUFFER_ELEMENTS 134217728
 
+/**
+ * Driver private resource flag for textures whose images are stored as
+ * rows of 4x4 texel blocks instead of linear rows (see
+ * lp_build_microtiled_sample_offset).
+ */
+#define LP_RESOURCE_FLAG_MICROTILED (PIPE_RESOURCE_FLAG_DRV_PRIV << 0)
+
+/**
+ * Driver private resource flag for compressed textures which views of the
+ * texture's own format sample through an R8G8B8A8_UNORM copy.
+ */
+#define LP_RESOURCE_FLAG_DECOMPRESSED (PIPE_RESOURCE_FLAG_DRV_PRIV << 1)
+
 struct util_format_description;
 struct lp_type;
 struct lp_build_context;
@@ -204,6 +217,7 @@ struct lp_static_texture_state
    unsigned level_zero_only:1;
    unsigned tiled:1;
    unsigned tiled_samples:5;
+   unsigned microtiled:1;    /**< 4x4 texel block layout */
 };
 
 
@@ -776,6 +790,19 @@ lp_build_tiled_sample_offset(struct lp_build_context *bld,
                              LLVMValueRef *out_j);
 
 
+void
+lp_build_microtiled_sample_offset(struct lp_build_context *bld,
+                                  const struct util_format_description *format_desc,
+                                  LLVMValueRef x,
+                                  LLVMValueRef y,
+                                  LLVMValueRef z,
+                                  LLVMValueRef y_stride,
+                                  LLVMValueRef z_stride,
+                                  LLVMValueRef *out_offset,
+                                  LLVMValueRef *out_i,
+                                  LLVMValueRef *out_j);
+
+
 void
 lp_build_sample_soa_code(struct gallivm_state *gallivm,
                          const struct lp_static_texture_state *static_texture_state,
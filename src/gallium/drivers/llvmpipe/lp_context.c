@@ -61,6 +61,8 @@ llvmpipe_destroy(struct pipe_context *pipe)
    mtx_unlock(&lp_screen->ctx_mutex);
    lp_print_counters();
 
+   llvmpipe_cs_wait_jobs(llvmpipe);
+
    if (llvmpipe->csctx) {
       lp_csctx_destroy(llvmpipe->csctx);
    }
@@ -105,7 +107,7 @@ llvmpipe_destroy(struct pipe_context *pipe)
 
    lp_delete_setup_variants(llvmpipe);
 
-   llvmpipe_sampler_matrix_destroy(llvmpipe);
+   llvmpipe_sampler_matrix_remove_context(llvmpipe);
 
    lp_context_destroy(&llvmpipe->context);
 
@@ -179,16 +181,6 @@ lp_draw_disk_cache_find_shader(void *cookie,
 }
 
 
-static void
-lp_draw_disk_cache_insert_shader(void *cookie,
-                                 struct lp_cached_code *cache,
-                                 unsigned char ir_sha1_cache_key[20])
-{
-   struct llvmpipe_screen *screen = cookie;
-   lp_disk_cache_insert_shader(screen, cache, ir_sha1_cache_key);
-}
-
-
 static enum pipe_reset_status
 llvmpipe_get_device_reset_status(struct pipe_context *pipe)
 {
@@ -218,6 +210,8 @@ llvmpipe_create_context(struct pipe_screen *screen, void *priv,
 
    list_inithead(&llvmpipe->cs_variants_list.list);
 
+   list_inithead(&llvmpipe->cs_jobs);
+
    llvmpipe->pipe.screen = screen;
    llvmpipe->pipe.priv = priv;
 
@@ -251,7 +245,7 @@ llvmpipe_create_context(struct pipe_screen *screen, void *priv,
    llvmpipe_init_context_resource_funcs(&llvmpipe->pipe);
    llvmpipe_init_surface_functions(llvmpipe);
 
-   llvmpipe_init_sampler_matrix(llvmpipe);
+   llvmpipe_sampler_matrix_add_context(llvmpipe);
 
 #ifdef HAVE_LIBDRM
    llvmpipe_init_fence_funcs(&llvmpipe->pipe);
@@ -283,7 +277,7 @@ llvmpipe_create_context(struct pipe_screen *screen, void *priv,
    draw_set_disk_cache_callbacks(llvmpipe->draw,
                                  lp_screen,
                                  lp_draw_disk_cache_find_shader,
-                                 lp_draw_disk_cache_insert_shader);
+                                 lp_disk_cache_insert_shader_cb);
 
    draw_set_constant_buffer_stride(llvmpipe->draw,
                                    lp_get_constant_buffer_stride(screen));
@@ -78,8 +78,6 @@ struct llvmpipe_context {
    struct lp_compute_shader *tss;
    struct lp_compute_shader *mhs;
 
-   struct lp_sampler_matrix sampler_matrix;
-
    /** Other rendering state */
    unsigned sample_mask;
    unsigned min_samples;
@@ -115,6 +113,10 @@ struct llvmpipe_context {
 
    unsigned active_primgen_queries;
 
+   /** For LP_QUERY_DRAW_TIME, only counted while there are such queries */
+   unsigned active_driver_queries;
+   uint64_t draw_time;
+
    bool queries_disabled;
 
    uint64_t dirty; /**< Mask of LP_NEW_x flags */
@@ -159,11 +161,14 @@ struct llvmpipe_context {
    struct blitter_context *blitter;
 
    unsigned tex_timestamp;
+   unsigned cs_tex_timestamp;
 
    /** List of all fragment shader variants */
    struct lp_fs_variant_list_item fs_variants_list;
    unsigned nr_fs_variants;
    unsigned nr_fs_instrs;
+   /** a fallback is bound while the wanted variant compiles */
+   bool fs_fallback;
 
    bool permit_linear_rasterizer;
    bool single_vp;
@@ -177,6 +182,10 @@ struct llvmpipe_context {
    unsigned nr_cs_instrs;
    struct lp_cs_context *csctx;
 
+   /** Compute grids running on the screen pool, oldest first */
+   struct list_head cs_jobs;
+   unsigned num_cs_jobs;
+
    struct lp_cs_context *task_ctx;
    struct lp_cs_context *mesh_ctx;
 
@@ -24,37 +24,62 @@
  **************************************************************************/
 
 /**
- * compute shader thread pool.
+ * llvmpipe thread pool, running compute shaders and rasterizer scenes.
  * based on threadpool.c but modified heavily to be compute shader tuned.
  */
 
 #include "util/u_thread.h"
 #include "util/u_memory.h"
 #include "lp_cs_tpool.h"
+#include "lp_screen.h"
+
+
+/**
+ * Return the oldest task of the highest priority with work left.
+ * Called with the pool mutex held.  Never hand out a later task of the
+ * same priority first, see lp_cs_tpool.h.
+ */
+static struct lp_cs_tpool_task *
+lp_cs_tpool_next_task(struct lp_cs_tpool *pool)
+{
+   for (unsigned p = 0; p < LP_CS_TPOOL_NUM_PRIORITIES; p++) {
+      if (!list_is_empty(&pool->workqueue[p]))
+         return list_first_entry(&pool->workqueue[p],
+                                 struct lp_cs_tpool_task, list);
+   }
+   return NULL;
+}
+
 
 static int
 lp_cs_tpool_worker(void *data)
 {
-   struct lp_cs_tpool *pool = data;
+   struct lp_cs_tpool_worker *worker = data;
+   struct lp_cs_tpool *pool = worker->pool;
    struct lp_cs_local_mem lmem;
+   char thread_name[16];
+
+   snprintf(thread_name, sizeof thread_name, "llvmpipe-%u", worker->index);
+   u_thread_setname(thread_name);
 
    memset(&lmem, 0, sizeof(lmem));
+   lmem.thread_index = worker->index;
    mtx_lock(&pool->m);
 
    while (!pool->shutdown) {
       struct lp_cs_tpool_task *task;
       unsigned iter_per_thread;
 
-      while (list_is_empty(&pool->workqueue) && !pool->shutdown)
+      while (!(task = lp_cs_tpool_next_task(pool)) && !pool->shutdown)
          cnd_wait(&pool->new_work, &pool->m);
 
       if (pool->shutdown)
          break;
 
-      task = list_first_entry(&pool->workqueue, struct lp_cs_tpool_task,
-                              list);
-
       unsigned this_iter = task->iter_start;
+      lp_cs_tpool_task_func work = task->work;
+      void *work_data = task->data;
+      bool detached = task->detached;
 
       iter_per_thread = task->iter_per_thread;
 
@@ -70,13 +95,18 @@ lp_cs_tpool_worker(void *data)
          list_del(&task->list);
 
       mtx_unlock(&pool->m);
+      /* A detached task belongs to its owner again as soon as the last
+       * iteration returns, so don't look at it from here on.
+       */
       for (unsigned i = 0; i < iter_per_thread; i++)
-         task->work(task->data, this_iter + i, &lmem);
+         work(work_data, this_iter + i, &lmem);
 
       mtx_lock(&pool->m);
-      task->iter_finished += iter_per_thread;
-      if (task->iter_finished == task->iter_total)
-         cnd_broadcast(&task->finish);
+      if (!detached) {
+         task->iter_finished += iter_per_thread;
+         if (task->iter_finished == task->iter_total)
+            cnd_broadcast(&task->finish);
+      }
    }
    mtx_unlock(&pool->m);
    FREE(lmem.local_mem_ptr);
@@ -84,23 +114,42 @@ lp_cs_tpool_worker(void *data)
 }
 
 struct lp_cs_tpool *
-lp_cs_tpool_create(unsigned num_threads)
+lp_cs_tpool_create(unsigned num_threads, unsigned num_numa_nodes)
 {
    struct lp_cs_tpool *pool = CALLOC_STRUCT(lp_cs_tpool);
 
    if (!pool)
       return NULL;
 
+   pool->workers = CALLOC(MAX2(1, num_threads), sizeof(*pool->workers));
+   if (!pool->workers) {
+      FREE(pool);
+      return NULL;
+   }
+
    (void) mtx_init(&pool->m, mtx_plain);
    cnd_init(&pool->new_work);
 
-   list_inithead(&pool->workqueue);
-   assert (num_threads <= LP_MAX_THREADS);
+   for (unsigned p = 0; p < LP_CS_TPOOL_NUM_PRIORITIES; p++)
+      list_inithead(&pool->workqueue[p]);
+   num_numa_nodes = MIN2(num_numa_nodes, num_threads);
    for (unsigned i = 0; i < num_threads; i++) {
-      if (thrd_success != u_thread_create(pool->threads + i, lp_cs_tpool_worker, pool)) {
+      struct lp_cs_tpool_worker *worker = &pool->workers[i];
+
+      worker->pool = pool;
+      worker->index = i;
+      if (thrd_success != u_thread_create(&worker->thread,
+                                          lp_cs_tpool_worker, worker)) {
          num_threads = i;  /* previous thread is max */
          break;
       }
+
+      /* Give each node a contiguous block of threads, the rasterizer
+       * relies on this to pick its preferred scene band.
+       */
+      if (num_numa_nodes > 1)
+         lp_bind_thread_to_numa_node(worker->thread,
+                                     i * num_numa_nodes / num_threads);
    }
    pool->num_threads = num_threads;
    return pool;
@@ -118,14 +167,43 @@ lp_cs_tpool_destroy(struct lp_cs_tpool *pool)
    mtx_unlock(&pool->m);
 
    for (unsigned i = 0; i < pool->num_threads; i++) {
-      thrd_join(pool->threads[i], NULL);
+      thrd_join(pool->workers[i].thread, NULL);
    }
 
    cnd_destroy(&pool->new_work);
    mtx_destroy(&pool->m);
+   FREE(pool->workers);
    FREE(pool);
 }
 
+static void
+lp_cs_tpool_run_task(lp_cs_tpool_task_func work, void *data, int num_iters)
+{
+   struct lp_cs_local_mem lmem;
+
+   memset(&lmem, 0, sizeof(lmem));
+   for (unsigned t = 0; t < num_iters; t++) {
+      work(data, t, &lmem);
+   }
+   FREE(lmem.local_mem_ptr);
+}
+
+static void
+lp_cs_tpool_add_task(struct lp_cs_tpool *pool,
+                     struct lp_cs_tpool_task *task,
+                     enum lp_cs_tpool_priority priority)
+{
+   task->iter_per_thread = task->iter_total / pool->num_threads;
+   task->iter_remainder = task->iter_total % pool->num_threads;
+
+   mtx_lock(&pool->m);
+
+   list_addtail(&task->list, &pool->workqueue[priority]);
+
+   cnd_broadcast(&pool->new_work);
+   mtx_unlock(&pool->m);
+}
+
 struct lp_cs_tpool_task *
 lp_cs_tpool_queue_task(struct lp_cs_tpool *pool,
                        lp_cs_tpool_task_func work, void *data, int num_iters)
@@ -133,13 +211,7 @@ lp_cs_tpool_queue_task(struct lp_cs_tpool *pool,
    struct lp_cs_tpool_task *task;
 
    if (pool->num_threads == 0) {
-      struct lp_cs_local_mem lmem;
-
-      memset(&lmem, 0, sizeof(lmem));
-      for (unsigned t = 0; t < num_iters; t++) {
-         work(data, t, &lmem);
-      }
-      FREE(lmem.local_mem_ptr);
+      lp_cs_tpool_run_task(work, data, num_iters);
       return NULL;
    }
    task = CALLOC_STRUCT(lp_cs_tpool_task);
@@ -151,18 +223,70 @@ lp_cs_tpool_queue_task(struct lp_cs_tpool *pool,
    task->data = data;
    task->iter_total = num_iters;
 
-   task->iter_per_thread = num_iters / pool->num_threads;
-   task->iter_remainder = num_iters % pool->num_threads;
-
    cnd_init(&task->finish);
 
+   lp_cs_tpool_add_task(pool, task, LP_CS_TPOOL_PRIORITY_NORMAL);
+   return task;
+}
+
+/**
+ * Queue a task that nobody is going to wait for.  The storage is owned
+ * by the caller and the work function has to signal completion itself,
+ * the pool doesn't touch the task once its last iteration has returned.
+ */
+void
+lp_cs_tpool_queue_detached_task(struct lp_cs_tpool *pool,
+                                struct lp_cs_tpool_task *task,
+                                lp_cs_tpool_task_func work, void *data,
+                                int num_iters,
+                                enum lp_cs_tpool_priority priority)
+{
+   if (pool->num_threads == 0) {
+      lp_cs_tpool_run_task(work, data, num_iters);
+      return;
+   }
+
+   memset(task, 0, sizeof(*task));
+   task->work = work;
+   task->data = data;
+   task->iter_total = num_iters;
+   task->detached = true;
+
+   lp_cs_tpool_add_task(pool, task, priority);
+}
+
+bool
+lp_cs_tpool_task_is_done(struct lp_cs_tpool *pool,
+                         struct lp_cs_tpool_task *task)
+{
+   if (!pool || !task)
+      return true;
+
+   assert(!task->detached);
+
    mtx_lock(&pool->m);
+   bool done = task->iter_finished == task->iter_total;
+   mtx_unlock(&pool->m);
+   return done;
+}
 
-   list_addtail(&task->list, &pool->workqueue);
+/**
+ * Wait for a task without freeing it, several threads may wait for the
+ * same task this way.
+ */
+void
+lp_cs_tpool_wait_for_task_done(struct lp_cs_tpool *pool,
+                               struct lp_cs_tpool_task *task)
+{
+   if (!pool || !task)
+      return;
 
-   cnd_broadcast(&pool->new_work);
+   assert(!task->detached);
+
+   mtx_lock(&pool->m);
+   while (task->iter_finished < task->iter_total)
+      cnd_wait(&task->finish, &pool->m);
    mtx_unlock(&pool->m);
-   return task;
 }
 
 void
@@ -174,10 +298,7 @@ lp_cs_tpool_wait_for_task(struct lp_cs_tpool *pool,
    if (!pool || !task)
       return;
 
-   mtx_lock(&pool->m);
-   while (task->iter_finished < task->iter_total)
-      cnd_wait(&task->finish, &pool->m);
-   mtx_unlock(&pool->m);
+   lp_cs_tpool_wait_for_task_done(pool, task);
 
    cnd_destroy(&task->finish);
    FREE(task);
@@ -23,13 +23,22 @@
  *
  **************************************************************************/
 
-/* This is a compute shader specific thread pool.
+/* This is the llvmpipe thread pool, shared by compute shaders and the
+ * rasterizer so that both never run more threads than there are cores.
  * It allows the queuing of a number of tasks per work item.
  * The item is added to the work queue once, but it must execute
  * number of iterations times. This saves storing a bunch of queue
  * structs with just unique indexes in them.
  * It also supports a local memory support struct to be passed from
  * outside the thread exec function.
+ * Workers always pick the oldest item of the highest priority queue
+ * that has work, items of the same priority execute in queuing order.
+ *
+ * The rasterizer depends on that order: threads of a scene may block
+ * until the previous scene is done with a tile, which is only guaranteed
+ * to happen if every iteration of the previous scene was picked up before
+ * any iteration of the next one.  An item is only removed from its queue
+ * once its last iteration has been picked up.
  */
 #ifndef LP_CS_QUEUE
 #define LP_CS_QUEUE
@@ -41,19 +50,33 @@
 
 #include "lp_limits.h"
 
+enum lp_cs_tpool_priority {
+   LP_CS_TPOOL_PRIORITY_HIGH,   /**< rasterizer scenes */
+   LP_CS_TPOOL_PRIORITY_NORMAL, /**< compute grids */
+   LP_CS_TPOOL_NUM_PRIORITIES,
+};
+
+struct lp_cs_tpool_worker {
+   struct lp_cs_tpool *pool;
+   thrd_t thread;
+   unsigned index;
+};
+
 struct lp_cs_tpool {
    mtx_t m;
    cnd_t new_work;
 
-   thrd_t threads[LP_MAX_THREADS];
+   struct lp_cs_tpool_worker *workers;
    unsigned num_threads;
-   struct list_head workqueue;
+   struct list_head workqueue[LP_CS_TPOOL_NUM_PRIORITIES];
    bool shutdown;
 };
 
 struct lp_cs_local_mem {
    unsigned local_size;
    void *local_mem_ptr;
+   /** index of the worker running the iteration, 0 when not threaded */
+   unsigned thread_index;
 };
 
 typedef void (*lp_cs_tpool_task_func)(void *data, int iter_idx, struct lp_cs_local_mem *lmem);
@@ -68,15 +91,30 @@ struct lp_cs_tpool_task {
    unsigned iter_finished;
    unsigned iter_per_thread;
    unsigned iter_remainder;
+   /** owned by whoever queued it, nobody waits for it */
+   bool detached;
 };
 
-struct lp_cs_tpool *lp_cs_tpool_create(unsigned num_threads);
+struct lp_cs_tpool *lp_cs_tpool_create(unsigned num_threads,
+                                       unsigned num_numa_nodes);
 void lp_cs_tpool_destroy(struct lp_cs_tpool *);
 
 struct lp_cs_tpool_task *lp_cs_tpool_queue_task(struct lp_cs_tpool *,
                                                 lp_cs_tpool_task_func func,
                                                 void *data, int num_iters);
 
+void lp_cs_tpool_queue_detached_task(struct lp_cs_tpool *,
+                                     struct lp_cs_tpool_task *task,
+                                     lp_cs_tpool_task_func func,
+                                     void *data, int num_iters,
+                                     enum lp_cs_tpool_priority priority);
+
+bool lp_cs_tpool_task_is_done(struct lp_cs_tpool *pool,
+                              struct lp_cs_tpool_task *task);
+
+void lp_cs_tpool_wait_for_task_done(struct lp_cs_tpool *pool,
+                                    struct lp_cs_tpool_task *task);
+
 void lp_cs_tpool_wait_for_task(struct lp_cs_tpool *pool,
                             struct lp_cs_tpool_task **task);
 
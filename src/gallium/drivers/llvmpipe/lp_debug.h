@@ -65,6 +65,15 @@
 #define PERF_NO_ALPHATEST   0x80  	/* disable alpha testing */
 #define PERF_NO_RAST_LINEAR 0x100  	/* disable linear rast */
 #define PERF_NO_SHADE       0x200  	/* disable fragment shaders */
+#define PERF_NO_TILE_SORT   0x400  	/* rasterize bins in raster order */
+#define PERF_NO_SCENE_OVERLAP 0x800	/* rasterize scenes one after another */
+#define PERF_NO_NUMA        0x1000	/* don't place threads per NUMA node */
+#define PERF_NO_ASYNC_CS    0x2000	/* wait for each compute grid */
+#define PERF_NO_ASYNC_FS    0x4000	/* compile fragment shaders on the app thread */
+#define PERF_NO_MICROTILE   0x8000	/* store textures in linear rows */
+#define PERF_NO_TEX_CACHE   0x10000	/* decode compressed texels on every fetch */
+#define PERF_TEX_DECOMPRESS 0x20000	/* keep decompressed copies of compressed textures */
+#define PERF_NO_HIZ         0x40000	/* don't cull blocks by hierarchical depth */
 
 
 extern int LP_PERF;
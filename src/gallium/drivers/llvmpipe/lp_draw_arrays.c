@@ -35,6 +35,7 @@
 #include "pipe/p_context.h"
 #include "util/u_draw.h"
 #include "util/u_prim.h"
+#include "util/os_time.h"
 
 #include "lp_context.h"
 #include "lp_state.h"
@@ -68,6 +69,8 @@ llvmpipe_draw_vbo(struct pipe_context *pipe, const struct pipe_draw_info *info,
    if (!llvmpipe_check_render_cond(lp))
       return;
 
+   const uint64_t start = lp->active_driver_queries ? os_time_get_nano() : 0;
+
    if (indirect && indirect->buffer) {
       util_draw_indirect(pipe, info, drawid_offset, indirect);
       return;
@@ -184,6 +187,9 @@ llvmpipe_draw_vbo(struct pipe_context *pipe, const struct pipe_draw_info *info,
     * internally when this condition is seen?)
     */
    draw_flush(draw);
+
+   if (lp->active_driver_queries)
+      lp->draw_time += os_time_get_nano() - start;
 }
 
 
@@ -41,6 +41,7 @@
 #include "lp_fence.h"
 #include "lp_screen.h"
 #include "lp_rast.h"
+#include "lp_state.h"
 
 
 /**
@@ -54,6 +55,11 @@ llvmpipe_flush(struct pipe_context *pipe,
    struct llvmpipe_context *llvmpipe = llvmpipe_context(pipe);
    struct llvmpipe_screen *screen = llvmpipe_screen(pipe->screen);
 
+   /* The fence doesn't cover compute grids, they are done once this
+    * returns.
+    */
+   llvmpipe_cs_wait_jobs(llvmpipe);
+
    draw_flush(llvmpipe->draw);
 
    /* ask the setup module to flush */
@@ -145,5 +151,7 @@ llvmpipe_flush_resource(struct pipe_context *pipe,
       llvmpipe_finish(pipe, reason);
    }
 
-   return true;
+   /* Compute grids of every context, not only the ones flushed above */
+   return llvmpipe_cs_wait_for_resource(lp_screen, resource, read_only,
+                                        cpu_access && do_not_block);
 }
@@ -366,7 +366,7 @@ lp_jit_buffer_from_pipe_const(struct lp_jit_buffer *jit, const struct pipe_const
 void
 lp_jit_texture_from_pipe(struct lp_jit_texture *jit, const struct pipe_sampler_view *view)
 {
-   struct pipe_resource *res = view->texture;
+   struct pipe_resource *res = llvmpipe_sampler_view_resource(view);
    struct llvmpipe_resource *lp_tex = llvmpipe_resource(res);
 
    if (!lp_tex->dt) {
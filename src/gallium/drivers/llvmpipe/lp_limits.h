@@ -66,7 +66,10 @@
 
 #define LP_MAX_SAMPLES 4
 
-#define LP_MAX_THREADS 32
+/**
+ * Max number of NUMA nodes threads and framebuffer bands are spread over.
+ */
+#define LP_MAX_NUMA_NODES 16
 
 
 /**
@@ -91,6 +94,12 @@
  */
 #define LP_MAX_SETUP_VARIANTS 64
 
+/**
+ * Max number of compute grids a context keeps in flight before
+ * launching another one waits for the oldest.
+ */
+#define LP_MAX_CS_JOBS 64
+
 /*
  * Max point size reported. Cap vertex shader point sizes to this.
  */
@@ -26,6 +26,8 @@
  **************************************************************************/
 
 #include "util/u_debug.h"
+#include "gallivm/lp_bld_code_arena.h"
+#include "gallivm/lp_bld_init.h"
 #include "lp_debug.h"
 #include "lp_perf.h"
 
@@ -121,6 +123,26 @@ lp_print_counters(void)
       debug_printf("llvmpipe: nr_llvm_compiles:             %u\n", lp_count.nr_llvm_compiles);
       debug_printf("llvmpipe: total LLVM compile time:      %.2f sec\n", lp_count.llvm_compile_time / 1000000.0);
       debug_printf("llvmpipe: average LLVM compile time:    %.2f sec\n", lp_count.llvm_compile_time / 1000000.0 / lp_count.nr_llvm_compiles);
+      debug_printf("llvmpipe: nr_llvm_async_compiles:       %u\n", lp_count.nr_llvm_async_compiles);
+      debug_printf("llvmpipe: nr_llvm_compile_waits:        %u\n", lp_count.nr_llvm_compile_waits);
+      debug_printf("llvmpipe: nr_fs_fallbacks:              %u\n", lp_count.nr_fs_fallbacks);
+
+      struct gallivm_tier_stats tier;
+      gallivm_get_tier_stats(&tier);
+      if (tier.fast_modules) {
+         debug_printf("llvmpipe: nr_llvm_fast_compiles:        %u\n", tier.fast_modules);
+         debug_printf("llvmpipe: nr_llvm_optimized_compiles:   %u\n", tier.optimized_modules);
+         debug_printf("llvmpipe: fast LLVM compile time:       %.2f sec\n", tier.fast_time / 1000000.0);
+         debug_printf("llvmpipe: average fast time:            %.2f sec\n", tier.fast_time / 1000000.0 / tier.fast_modules);
+         debug_printf("llvmpipe: optimized LLVM compile time:  %.2f sec\n", tier.optimized_time / 1000000.0);
+         if (tier.optimized_modules)
+            debug_printf("llvmpipe: average optimized time:       %.2f sec\n", tier.optimized_time / 1000000.0 / tier.optimized_modules);
+      }
+
+      struct lp_code_arena_stats arena;
+      lp_code_arena_get_stats(&arena);
+      debug_printf("llvmpipe: JIT code arena:               %u KB used of %u KB\n",
+                   (unsigned)(arena.used / 1024), (unsigned)(arena.mapped / 1024));
 
    }
 }
@@ -34,6 +34,7 @@
 #define LP_PERF_H
 
 #include "util/compiler.h"
+#include "util/u_atomic.h"
 
 /**
  * Various counters
@@ -64,6 +65,9 @@ struct lp_counters
    unsigned nr_non_empty_4;
    unsigned nr_llvm_compiles;
    int64_t llvm_compile_time;  /**< total, in microseconds */
+   unsigned nr_llvm_async_compiles;  /**< fs variants compiled in the background */
+   unsigned nr_llvm_compile_waits;  /**< scenes which waited for such a compile */
+   unsigned nr_fs_fallbacks;  /**< draws with a more general variant meanwhile */
 
    unsigned nr_color_tile_clear;
    unsigned nr_color_tile_load;
@@ -78,10 +82,13 @@ extern struct lp_counters lp_count;
 #if MESA_DEBUG && !THREAD_SANITIZER
 #define LP_COUNT(counter) lp_count.counter++
 #define LP_COUNT_ADD(counter, incr)  lp_count.counter += (incr)
+/* For counters that the background shader compile threads update too. */
+#define LP_COUNT_ADD_ATOMIC(counter, incr) p_atomic_add(&lp_count.counter, (incr))
 #define LP_COUNT_GET(counter) (lp_count.counter)
 #else
 #define LP_COUNT(counter) do {} while (0)
 #define LP_COUNT_ADD(counter, incr) (void)(incr)
+#define LP_COUNT_ADD_ATOMIC(counter, incr) (void)(incr)
 #define LP_COUNT_GET(counter) 0
 #endif
 
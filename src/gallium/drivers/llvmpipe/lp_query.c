@@ -50,17 +50,158 @@ llvmpipe_query(struct pipe_query *p)
 }
 
 
+static const struct pipe_driver_query_info llvmpipe_driver_queries[] = {
+   { "llvmpipe-scenes", PIPE_QUERY_DRIVER_SPECIFIC + LP_QUERY_SCENES, { 0 },
+     PIPE_DRIVER_QUERY_TYPE_UINT64, PIPE_DRIVER_QUERY_RESULT_TYPE_CUMULATIVE },
+   { "llvmpipe-tiles", PIPE_QUERY_DRIVER_SPECIFIC + LP_QUERY_TILES, { 0 },
+     PIPE_DRIVER_QUERY_TYPE_UINT64, PIPE_DRIVER_QUERY_RESULT_TYPE_CUMULATIVE },
+   { "llvmpipe-bin-commands", PIPE_QUERY_DRIVER_SPECIFIC + LP_QUERY_BIN_COMMANDS, { 0 },
+     PIPE_DRIVER_QUERY_TYPE_UINT64, PIPE_DRIVER_QUERY_RESULT_TYPE_CUMULATIVE },
+   { "llvmpipe-draw-time", PIPE_QUERY_DRIVER_SPECIFIC + LP_QUERY_DRAW_TIME, { 0 },
+     PIPE_DRIVER_QUERY_TYPE_MICROSECONDS, PIPE_DRIVER_QUERY_RESULT_TYPE_CUMULATIVE },
+   { "llvmpipe-rast-busy-time", PIPE_QUERY_DRIVER_SPECIFIC + LP_QUERY_RAST_BUSY_TIME, { 0 },
+     PIPE_DRIVER_QUERY_TYPE_MICROSECONDS, PIPE_DRIVER_QUERY_RESULT_TYPE_CUMULATIVE },
+   { "llvmpipe-rast-wait-time", PIPE_QUERY_DRIVER_SPECIFIC + LP_QUERY_RAST_WAIT_TIME, { 0 },
+     PIPE_DRIVER_QUERY_TYPE_MICROSECONDS, PIPE_DRIVER_QUERY_RESULT_TYPE_CUMULATIVE },
+   { "llvmpipe-rast-utilization", PIPE_QUERY_DRIVER_SPECIFIC + LP_QUERY_RAST_UTILIZATION, { 100 },
+     PIPE_DRIVER_QUERY_TYPE_PERCENTAGE, PIPE_DRIVER_QUERY_RESULT_TYPE_AVERAGE },
+   { "llvmpipe-hiz-culled-pixels", PIPE_QUERY_DRIVER_SPECIFIC + LP_QUERY_HIZ_CULLED_PIXELS, { 0 },
+     PIPE_DRIVER_QUERY_TYPE_UINT64, PIPE_DRIVER_QUERY_RESULT_TYPE_CUMULATIVE },
+};
+
+static bool
+is_driver_query(const struct llvmpipe_query *pq)
+{
+   return pq->type >= PIPE_QUERY_DRIVER_SPECIFIC;
+}
+
+
+/**
+ * Sample the running total a driver query is computed from.
+ * The rasterizer totals are screen-wide, draw time is per context.
+ */
+static uint64_t
+driver_query_value(struct llvmpipe_context *llvmpipe,
+                   const struct llvmpipe_query *pq)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(llvmpipe->pipe.screen);
+   struct lp_rast_stats stats;
+
+   lp_rast_get_stats(screen->rast, &stats);
+
+   switch (pq->type - PIPE_QUERY_DRIVER_SPECIFIC) {
+   case LP_QUERY_SCENES:
+      return stats.scenes;
+   case LP_QUERY_TILES:
+      return stats.tiles;
+   case LP_QUERY_BIN_COMMANDS:
+      return stats.cmds;
+   case LP_QUERY_DRAW_TIME:
+      return llvmpipe->draw_time;
+   case LP_QUERY_RAST_BUSY_TIME:
+   case LP_QUERY_RAST_UTILIZATION:
+      return stats.busy_time;
+   case LP_QUERY_RAST_WAIT_TIME:
+      return stats.wait_time;
+   case LP_QUERY_HIZ_CULLED_PIXELS:
+      return stats.hiz_culled_pixels;
+   default:
+      unreachable("bad driver query");
+   }
+}
+
+
+static void
+driver_query_begin(struct llvmpipe_context *llvmpipe,
+                   struct llvmpipe_query *pq)
+{
+   lp_rast_enable_stats(llvmpipe_screen(llvmpipe->pipe.screen)->rast, true);
+   llvmpipe->active_driver_queries++;
+
+   pq->start[0] = driver_query_value(llvmpipe, pq);
+   pq->start[1] = os_time_get_nano();
+}
+
+
+static void
+driver_query_end(struct llvmpipe_context *llvmpipe,
+                 struct llvmpipe_query *pq)
+{
+   pq->end[0] = driver_query_value(llvmpipe, pq);
+   pq->end[1] = os_time_get_nano();
+
+   assert(llvmpipe->active_driver_queries);
+   llvmpipe->active_driver_queries--;
+   lp_rast_enable_stats(llvmpipe_screen(llvmpipe->pipe.screen)->rast, false);
+}
+
+
+static void
+driver_query_result(const struct llvmpipe_screen *screen,
+                    const struct llvmpipe_query *pq,
+                    union pipe_query_result *result)
+{
+   const uint64_t value = pq->end[0] - pq->start[0];
+
+   switch (pq->type - PIPE_QUERY_DRIVER_SPECIFIC) {
+   case LP_QUERY_DRAW_TIME:
+   case LP_QUERY_RAST_BUSY_TIME:
+   case LP_QUERY_RAST_WAIT_TIME:
+      result->u64 = value / 1000;
+      break;
+   case LP_QUERY_RAST_UTILIZATION: {
+      const uint64_t elapsed =
+         (pq->end[1] - pq->start[1]) * MAX2(1, screen->num_threads);
+      result->f = elapsed ? MIN2(100.0f * value / elapsed, 100.0f) : 0.0f;
+      break;
+   }
+   default:
+      result->u64 = value;
+      break;
+   }
+}
+
+
+static int
+llvmpipe_get_driver_query_info(struct pipe_screen *screen,
+                               unsigned index,
+                               struct pipe_driver_query_info *info)
+{
+   STATIC_ASSERT(ARRAY_SIZE(llvmpipe_driver_queries) == LP_NUM_DRIVER_QUERIES);
+
+   if (!info)
+      return ARRAY_SIZE(llvmpipe_driver_queries);
+
+   if (index >= ARRAY_SIZE(llvmpipe_driver_queries))
+      return 0;
+
+   *info = llvmpipe_driver_queries[index];
+   return 1;
+}
+
+
 static struct pipe_query *
 llvmpipe_create_query(struct pipe_context *pipe,
                       unsigned type,
                       unsigned index)
 {
-   assert(type < PIPE_QUERY_TYPES);
+   assert(type < PIPE_QUERY_TYPES ||
+          (type >= PIPE_QUERY_DRIVER_SPECIFIC &&
+           type < PIPE_QUERY_DRIVER_SPECIFIC + LP_NUM_DRIVER_QUERIES));
 
-   struct llvmpipe_query *pq = CALLOC_STRUCT(llvmpipe_query);
+   struct llvmpipe_screen *screen = llvmpipe_screen(pipe->screen);
+   /* One counter per rasterizer thread, and at least the two slots used
+    * by driver queries.
+    */
+   const unsigned num_counters = MAX2(2, screen->num_threads);
+   struct llvmpipe_query *pq =
+      CALLOC(1, sizeof(*pq) + 2 * num_counters * sizeof(pq->counters[0]));
    if (pq) {
       pq->type = type;
       pq->index = index;
+      pq->num_counters = num_counters;
+      pq->start = pq->counters;
+      pq->end = pq->counters + num_counters;
    }
 
    return (struct pipe_query *) pq;
@@ -118,6 +259,11 @@ llvmpipe_get_query_result(struct pipe_context *pipe,
     */
    result->u64 = 0;
 
+   if (is_driver_query(pq)) {
+      driver_query_result(screen, pq, result);
+      return true;
+   }
+
    /* Combine the per-thread results */
    switch (pq->type) {
    case PIPE_QUERY_OCCLUSION_COUNTER:
@@ -395,6 +541,11 @@ llvmpipe_begin_query(struct pipe_context *pipe, struct pipe_query *q)
    struct llvmpipe_context *llvmpipe = llvmpipe_context(pipe);
    struct llvmpipe_query *pq = llvmpipe_query(q);
 
+   if (is_driver_query(pq)) {
+      driver_query_begin(llvmpipe, pq);
+      return true;
+   }
+
    /* Check if the query is already in the scene.  If so, we need to
     * flush the scene now.  Real apps shouldn't re-use a query in a
     * frame of rendering.
@@ -403,8 +554,8 @@ llvmpipe_begin_query(struct pipe_context *pipe, struct pipe_query *q)
       llvmpipe_finish(pipe, __func__);
    }
 
-   memset(pq->start, 0, sizeof(pq->start));
-   memset(pq->end, 0, sizeof(pq->end));
+   memset(pq->start, 0, pq->num_counters * sizeof(pq->start[0]));
+   memset(pq->end, 0, pq->num_counters * sizeof(pq->end[0]));
    lp_setup_begin_query(llvmpipe->setup, pq);
 
    switch (pq->type) {
@@ -457,6 +608,16 @@ llvmpipe_end_query(struct pipe_context *pipe, struct pipe_query *q)
    struct llvmpipe_context *llvmpipe = llvmpipe_context(pipe);
    struct llvmpipe_query *pq = llvmpipe_query(q);
 
+   if (is_driver_query(pq)) {
+      driver_query_end(llvmpipe, pq);
+      return true;
+   }
+
+   /* Compute grids still running have to be accounted for */
+   if (pq->type == PIPE_QUERY_TIMESTAMP ||
+       pq->type == PIPE_QUERY_TIME_ELAPSED)
+      llvmpipe_cs_wait_jobs(llvmpipe);
+
    lp_setup_end_query(llvmpipe->setup, pq);
 
    switch (pq->type) {
@@ -585,3 +746,8 @@ llvmpipe_init_query_funcs(struct llvmpipe_context *llvmpipe)
 }
 
 
+void
+llvmpipe_init_screen_query_funcs(struct pipe_screen *screen)
+{
+   screen->get_driver_query_info = llvmpipe_get_driver_query_info;
+}
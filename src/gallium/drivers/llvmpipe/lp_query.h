@@ -41,9 +41,29 @@
 struct llvmpipe_context;
 
 
+/**
+ * Driver-specific queries, PIPE_QUERY_DRIVER_SPECIFIC + LP_QUERY_x.
+ * These sample running totals at begin and end query time, without
+ * waiting for the scenes binned in between to be rasterized.
+ */
+enum lp_driver_query {
+   LP_QUERY_SCENES,
+   LP_QUERY_TILES,
+   LP_QUERY_BIN_COMMANDS,
+   LP_QUERY_DRAW_TIME,
+   LP_QUERY_RAST_BUSY_TIME,
+   LP_QUERY_RAST_WAIT_TIME,
+   LP_QUERY_RAST_UTILIZATION,
+   LP_QUERY_HIZ_CULLED_PIXELS,
+   LP_NUM_DRIVER_QUERIES
+};
+
+
 struct llvmpipe_query {
-   uint64_t start[LP_MAX_THREADS];  /* start count value for each thread */
-   uint64_t end[LP_MAX_THREADS];    /* end count value for each thread */
+   uint64_t *start;                 /* start count value for each thread */
+   uint64_t *end;                   /* end count value for each thread */
+                                    /* driver queries: [0] value, [1] time */
+   unsigned num_counters;           /* size of start and end */
    struct lp_fence *fence;          /* fence from last scene this was binned in */
    enum pipe_query_type type;
    unsigned index;
@@ -51,11 +71,15 @@ struct llvmpipe_query {
    unsigned num_primitives_written[PIPE_MAX_VERTEX_STREAMS];
 
    struct pipe_query_data_pipeline_statistics stats;
+
+   uint64_t counters[];             /* storage of start and end */
 };
 
 
 extern void llvmpipe_init_query_funcs(struct llvmpipe_context * );
 
+extern void llvmpipe_init_screen_query_funcs(struct pipe_screen *screen);
+
 extern bool llvmpipe_check_render_cond(struct llvmpipe_context *);
 
 #endif /* LP_QUERY_H */
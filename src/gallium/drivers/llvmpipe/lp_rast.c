@@ -34,10 +34,12 @@
 #include "util/u_string.h"
 #include "util/u_thread.h"
 #include "util/u_memset.h"
+#include "util/u_atomic.h"
 #include "util/os_time.h"
+#include "util/perf/cpu_trace.h"
 
-#include "lp_scene_queue.h"
 #include "lp_context.h"
+#include "lp_cs_tpool.h"
 #include "lp_debug.h"
 #include "lp_fence.h"
 #include "lp_perf.h"
@@ -50,10 +52,6 @@
 #include "lp_screen.h"
 #include "lp_tex_sample.h"
 
-#ifdef _WIN32
-#include <windows.h>
-#endif
-
 #if MESA_DEBUG
 int jit_line = 0;
 const struct lp_rast_state *jit_state = NULL;
@@ -65,27 +63,45 @@ const float lp_sample_pos_4x[4][2] = { { 0.375, 0.125 },
                                        { 0.125, 0.625 },
                                        { 0.625, 0.875 } };
 
+/**
+ * Add to one of the thread's statistics.  Only the thread itself updates
+ * them, but lp_rast_get_stats() reads them concurrently, so the store must
+ * not tear.
+ */
+static inline void
+stats_add(uint64_t *counter, uint64_t value)
+{
+   p_atomic_set(counter, *counter + value);
+}
+
 /**
  * Begin rasterizing a scene.
- * Called once per scene by one thread.
+ * Called by every thread, only the first one to get here maps the
+ * framebuffer and sorts the bins.
  */
 static void
-lp_rast_begin(struct lp_rasterizer *rast,
+lp_rast_begin(struct lp_rasterizer_task *task,
               struct lp_scene *scene)
 {
-   rast->curr_scene = scene;
-
-   LP_DBG(DEBUG_RAST, "%s\n", __func__);
-
-   lp_scene_begin_rasterization(scene);
-   lp_scene_bin_iter_begin(scene);
-}
+   mtx_lock(&scene->mutex);
+   if (!scene->rast_begun) {
+      LP_DBG(DEBUG_RAST, "%s\n", __func__);
 
+      /* Draws may have been binned while their shaders were still being
+       * compiled, nothing can be shaded before those are done.
+       */
+      const uint64_t start = os_time_get_nano();
+      if (lp_scene_wait_frag_shaders(scene)) {
+         LP_COUNT(nr_llvm_compile_waits);
+         stats_add(&task->stats.wait_time, os_time_get_nano() - start);
+      }
 
-static void
-lp_rast_end(struct lp_rasterizer *rast)
-{
-   rast->curr_scene = NULL;
+      lp_scene_begin_rasterization(scene);
+      lp_scene_bin_iter_begin(scene, task->rast->num_numa_nodes);
+      scene->rast_begun = true;
+      stats_add(&task->stats.scenes, 1);
+   }
+   mtx_unlock(&scene->mutex);
 }
 
 
@@ -114,11 +130,15 @@ lp_rast_tile_begin(struct lp_rasterizer_task *task,
    task->thread_data.vis_counter = 0;
    task->thread_data.ps_invocations = 0;
 
+   task->hiz_valid = 0;
+
    for (unsigned i = 0; i < scene->fb.nr_cbufs; i++) {
       if (scene->fb.cbufs[i]) {
+         const unsigned block_bytes = scene->cbufs[i].format_bytes *
+                                      (scene->cbufs[i].microtiled ? 4 : 1);
          task->color_tiles[i] = scene->cbufs[i].map +
                                 scene->cbufs[i].stride * task->y +
-                                scene->cbufs[i].format_bytes * task->x;
+                                block_bytes * task->x;
       }
    }
    if (scene->fb.zsbuf) {
@@ -129,6 +149,166 @@ lp_rast_tile_begin(struct lp_rasterizer_task *task,
 }
 
 
+/**
+ * Bounds of the depth a primitive can store in the size x size area at
+ * x, y (window coords), from its depth plane.  The fragment shader may
+ * clamp depth to the viewport or [0,1], so those widen the bounds too.
+ */
+static void
+hiz_depth_bounds(const struct lp_rasterizer_task *task,
+                 const struct lp_rast_shader_inputs *inputs,
+                 unsigned x, unsigned y, unsigned size,
+                 float *zmin, float *zmax)
+{
+   float (*a0)[4] = GET_A0(inputs);
+   float (*dadx)[4] = GET_DADX(inputs);
+   float (*dady)[4] = GET_DADY(inputs);
+   const struct lp_jit_viewport *vp =
+      &task->state->jit_context.viewports[inputs->viewport_index];
+
+   /* Pixels and samples are evaluated inside their extent, so the corners
+    * of the area bound the plane.  Polygon offset is in a0's X component.
+    */
+   const float z0 = a0[0][2] + a0[0][0];
+   const float zx0 = dadx[0][2] * x, zx1 = dadx[0][2] * (x + size);
+   const float zy0 = dady[0][2] * y, zy1 = dady[0][2] * (y + size);
+
+   /* Slack for the shader evaluating the plane in a different order */
+   const float eps = (fabsf(a0[0][2]) + fabsf(a0[0][0]) +
+                      fabsf(zx1) + fabsf(zy1)) * (1.0f / (1 << 20));
+
+   *zmin = MIN3(z0 + MIN2(zx0, zx1) + MIN2(zy0, zy1) - eps,
+                MAX2(vp->min_depth, vp->max_depth), 1.0f);
+   *zmax = MAX3(z0 + MAX2(zx0, zx1) + MAX2(zy0, zy1) + eps,
+                MIN2(vp->min_depth, vp->max_depth), 0.0f);
+}
+
+
+/**
+ * Hierarchical depth test of the size x size area at x, y (window coords,
+ * within the current tile).  Returns true when the current primitive
+ * can't pass the depth test anywhere in it, so it needn't be shaded.
+ *
+ * The bounds are only ever lowered by clears and by primitives which are
+ * known to write every pixel of a 16x16 block, and dropped for the whole
+ * tile by anything that may raise the stored depth.  With LESS and LEQUAL
+ * depth tests nothing else can raise it, so what isn't tracked stays
+ * within the bounds.
+ */
+bool
+lp_rast_hiz_cull(struct lp_rasterizer_task *task,
+                 const struct lp_rast_shader_inputs *inputs,
+                 unsigned x, unsigned y, unsigned size)
+{
+   const struct lp_fragment_shader_variant *variant = task->state->variant;
+
+   if (!task->hiz_enabled)
+      return false;
+
+   if (variant->hiz_invalidate) {
+      task->hiz_valid = 0;
+      return false;
+   }
+
+   if (variant->hiz_cull == LP_HIZ_CULL_NONE || !task->hiz_valid ||
+       inputs->layer + inputs->view_index != 0)
+      return false;
+
+   const unsigned bx0 = (x - task->x) / 16;
+   const unsigned by0 = (y - task->y) / 16;
+   const unsigned bx1 = MIN2((x - task->x + size - 1) / 16, TILE_SIZE / 16 - 1);
+   const unsigned by1 = MIN2((y - task->y + size - 1) / 16, TILE_SIZE / 16 - 1);
+   float zmax_stored = 0.0f;
+
+   for (unsigned by = by0; by <= by1; by++) {
+      for (unsigned bx = bx0; bx <= bx1; bx++) {
+         const unsigned i = by * (TILE_SIZE / 16) + bx;
+         if (!(task->hiz_valid & (1u << i)))
+            return false;
+         zmax_stored = MAX2(zmax_stored, task->hiz_max[i]);
+      }
+   }
+
+   float zmin, zmax;
+   hiz_depth_bounds(task, inputs, x, y, size, &zmin, &zmax);
+
+   /* The depth buffer rounds the fragment's depth, possibly down */
+   zmin -= task->hiz_quantum;
+
+   const bool cull = variant->hiz_cull == LP_HIZ_CULL_LESS ?
+      zmin >= zmax_stored : zmin > zmax_stored;
+   if (cull)
+      stats_add(&task->stats.hiz_culled_pixels, size * size);
+
+   return cull;
+}
+
+
+/**
+ * Record that the current primitive was shaded on every pixel of the
+ * 16x16 block at x, y (window coords, block aligned within the tile).
+ */
+void
+lp_rast_hiz_update(struct lp_rasterizer_task *task,
+                   const struct lp_rast_shader_inputs *inputs,
+                   unsigned x, unsigned y)
+{
+   if (!task->hiz_enabled || !task->state->variant->hiz_update ||
+       inputs->layer + inputs->view_index != 0)
+      return;
+
+   const unsigned i = ((y - task->y) / 16) * (TILE_SIZE / 16) +
+                      (x - task->x) / 16;
+   float zmin, zmax;
+   hiz_depth_bounds(task, inputs, x, y, 16, &zmin, &zmax);
+
+   /* The depth buffer rounds the fragment's depth, possibly up */
+   zmax += task->hiz_quantum;
+
+   /* With LESS or LEQUAL the block now holds min(old, new) everywhere */
+   if (task->hiz_valid & (1u << i))
+      task->hiz_max[i] = MIN2(task->hiz_max[i], zmax);
+   else
+      task->hiz_max[i] = zmax;
+   task->hiz_valid |= 1u << i;
+}
+
+
+/**
+ * Fill a box of a microtiled color buffer.
+ * x and y are tile aligned, width and height are clipped to the framebuffer.
+ */
+static void
+fill_microtiled_box(uint8_t *map, enum pipe_format format,
+                    unsigned stride, unsigned layer_stride,
+                    unsigned x, unsigned y, unsigned layers,
+                    unsigned width, unsigned height,
+                    union util_color *uc)
+{
+   const unsigned bpp = util_format_get_blocksize(format);
+
+   assert(x % 4 == 0 && y % 4 == 0);
+
+   for (unsigned z = 0; z < layers; z++, map += layer_stride) {
+      if (((width | height) & 3) == 0) {
+         /* Whole blocks: each row of 4x4 blocks is one contiguous span. */
+         util_fill_rect(map, format, 4 * stride, 4 * x, y / 4,
+                        4 * width, height / 4, uc);
+         continue;
+      }
+
+      for (unsigned j = y; j < y + height; j++) {
+         for (unsigned i = x; i < x + width;) {
+            const unsigned n = MIN2(4 - i % 4, x + width - i);
+            util_fill_rect(map + llvmpipe_microtile_offset(i, j, stride, bpp),
+                           format, 0, 0, 0, n, 1, uc);
+            i += n;
+         }
+      }
+   }
+}
+
+
 /**
  * Clear the rasterizer's current color tile.
  * This is a bin command called during bin processing.
@@ -159,6 +339,19 @@ lp_rast_clear_color(struct lp_rasterizer_task *task,
    for (unsigned s = 0; s < scene->cbufs[cbuf].nr_samples; s++) {
       void *map = (char *) scene->cbufs[cbuf].map
          + scene->cbufs[cbuf].sample_stride * s;
+      if (scene->cbufs[cbuf].microtiled) {
+         fill_microtiled_box(map,
+                             format,
+                             scene->cbufs[cbuf].stride,
+                             scene->cbufs[cbuf].layer_stride,
+                             task->x,
+                             task->y,
+                             scene->fb_max_layer + 1,
+                             task->width,
+                             task->height,
+                             &uc);
+         continue;
+      }
       util_fill_box(map,
                     format,
                     scene->cbufs[cbuf].stride,
@@ -202,6 +395,21 @@ lp_rast_clear_zstencil(struct lp_rasterizer_task *task,
     * Clear the area of the depth/depth buffer matching this tile.
     */
 
+   if (scene->fb.zsbuf && task->hiz_enabled) {
+      const enum pipe_format format = scene->fb.zsbuf->format;
+      const uint64_t depth_mask = util_pack64_mask_z(format, ~0u);
+
+      if ((clear_mask64 & depth_mask) == depth_mask) {
+         float depth;
+         util_format_unpack_z_float(format, &depth, &clear_value64, 1);
+         for (unsigned i = 0; i < ARRAY_SIZE(task->hiz_max); i++)
+            task->hiz_max[i] = depth;
+         task->hiz_valid = BITFIELD_MASK(ARRAY_SIZE(task->hiz_max));
+      } else if (clear_mask64 & depth_mask) {
+         task->hiz_valid = 0;
+      }
+   }
+
    if (scene->fb.zsbuf) {
       for (unsigned s = 0; s < scene->zsbuf.nr_samples; s++) {
          uint8_t *dst_layer =
@@ -317,16 +525,31 @@ lp_rast_shade_tile(struct lp_rasterizer_task *task,
 
    const struct lp_fragment_shader_variant *variant = state->variant;
 
+   if (lp_rast_hiz_cull(task, inputs, tile_x, tile_y, TILE_SIZE))
+      return;
+
+   /* 16x16 blocks the primitive is hidden in */
+   unsigned hidden = 0;
+   for (unsigned y = 0; y < task->height; y += 16) {
+      for (unsigned x = 0; x < task->width; x += 16) {
+         if (lp_rast_hiz_cull(task, inputs, tile_x + x, tile_y + y, 16))
+            hidden |= 1u << ((y / 16) * (TILE_SIZE / 16) + x / 16);
+      }
+   }
+
    /* render the whole 64x64 tile in 4x4 chunks */
    for (unsigned y = 0; y < task->height; y += 4){
       for (unsigned x = 0; x < task->width; x += 4) {
+         if (hidden & (1u << ((y / 16) * (TILE_SIZE / 16) + x / 16)))
+            continue;
+
          /* color buffer */
          uint8_t *color[PIPE_MAX_COLOR_BUFS];
          unsigned stride[PIPE_MAX_COLOR_BUFS];
          unsigned sample_stride[PIPE_MAX_COLOR_BUFS];
          for (unsigned i = 0; i < scene->fb.nr_cbufs; i++){
             if (scene->fb.cbufs[i]) {
-               stride[i] = scene->cbufs[i].stride;
+               stride[i] = scene->cbufs[i].block_stride;
                sample_stride[i] = scene->cbufs[i].sample_stride;
                color[i] = lp_rast_get_color_block_pointer(task, i, tile_x + x,
                                           tile_y + y,
@@ -378,6 +601,11 @@ lp_rast_shade_tile(struct lp_rasterizer_task *task,
          END_JIT_CALL();
       }
    }
+
+   for (unsigned y = 0; y < task->height; y += 16) {
+      for (unsigned x = 0; x < task->width; x += 16)
+         lp_rast_hiz_update(task, inputs, tile_x + x, tile_y + y);
+   }
 }
 
 
@@ -434,7 +662,7 @@ lp_rast_shade_quads_mask_sample(struct lp_rasterizer_task *task,
    unsigned sample_stride[PIPE_MAX_COLOR_BUFS];
    for (unsigned i = 0; i < scene->fb.nr_cbufs; i++) {
       if (scene->fb.cbufs[i]) {
-         stride[i] = scene->cbufs[i].stride;
+         stride[i] = scene->cbufs[i].block_stride;
          sample_stride[i] = scene->cbufs[i].sample_stride;
          color[i] = lp_rast_get_color_block_pointer(task, i, x, y,
                                                     inputs->layer + inputs->view_index);
@@ -526,6 +754,12 @@ lp_rast_blit_tile_to_dest(struct lp_rasterizer_task *task,
       return;
    }
 
+   /* The copies below assume linear rows. */
+   if (lpt->microtiled) {
+      lp_rast_shade_tile_opaque(task, arg);
+      return;
+   }
+
    uint8_t *dst = llvmpipe_get_texture_image_address(lpt, face_slice, level);
    if (!dst)
       return;
@@ -980,7 +1214,7 @@ debug_rasterize_bin(struct lp_rasterizer_task *task,
 /**
  * Rasterize commands for a single bin.
  * \param x, y  position of the bin's tile in the framebuffer
- * Must be called between lp_rast_begin() and lp_rast_end().
+ * Must be called after lp_rast_begin().
  * Called per thread.
  */
 static void
@@ -1020,6 +1254,34 @@ rasterize_bin(struct lp_rasterizer_task *task,
 }
 
 
+/**
+ * Rasterize a bin and account for it in the thread's statistics.
+ * Shading time is only measured per tile: timing each command would
+ * cost about as much as a small triangle.
+ */
+static void
+rasterize_bin_timed(struct lp_rasterizer_task *task,
+                    const struct cmd_bin *bin, int x, int y)
+{
+   const uint64_t start = os_time_get_nano();
+
+   rasterize_bin(task, bin, x, y);
+
+   const uint64_t time = os_time_get_nano() - start;
+   const uint64_t us = time / 1000;
+
+   unsigned cmds = 0;
+   for (const struct cmd_block *block = bin->head; block; block = block->next)
+      cmds += block->count;
+
+   stats_add(&task->stats.cmds, cmds);
+   stats_add(&task->stats.tiles, 1);
+   stats_add(&task->stats.busy_time, time);
+   task->tile_hist[us ? MIN2(util_logbase2_64(us) + 1,
+                             LP_RAST_TILE_HIST_BUCKETS - 1) : 0]++;
+}
+
+
 /* An empty bin is one that just loads the contents of the tile and
  * stores them again unchanged.  This typically happens when bins have
  * been flushed for some reason in the middle of a frame, or when
@@ -1034,6 +1296,58 @@ is_empty_bin(const struct cmd_bin *bin)
 }
 
 
+/**
+ * Wake the threads sleeping in wait_tile_dependency(), after a tile was
+ * marked as done or a scene's fence was signalled.
+ */
+static void
+wake_tile_waiters(struct lp_rasterizer *rast)
+{
+   if (p_atomic_read(&rast->tile_waiters)) {
+      mtx_lock(&rast->tile_mutex);
+      cnd_broadcast(&rast->tile_cond);
+      mtx_unlock(&rast->tile_mutex);
+   }
+}
+
+
+/**
+ * Wait until the previous scene is done with tile (x, y).  Once the whole
+ * previous scene has finished it may be recycled by setup, so stop looking
+ * at its tiles as soon as its fence is signalled.
+ *
+ * This can't deadlock: pool workers take scene iterations in queuing
+ * order (see lp_cs_tpool.h), so every iteration of the previous scene was
+ * taken by a worker before this one, and those workers keep rasterizing
+ * its bins until none are left.
+ */
+static void
+wait_tile_dependency(struct lp_rasterizer_task *task,
+                     const struct lp_scene *scene, unsigned x, unsigned y)
+{
+   struct lp_rasterizer *rast = task->rast;
+
+   if (lp_scene_tile_is_done(scene->dep_scene, x, y) ||
+       lp_fence_signalled(scene->dep_fence))
+      return;
+
+   const uint64_t start = os_time_get_nano();
+
+   /* Announce the waiter before checking again, so that a thread marking
+    * the tile as done after the check sees it and takes the mutex.
+    */
+   p_atomic_inc(&rast->tile_waiters);
+   mtx_lock(&rast->tile_mutex);
+   while (!lp_scene_tile_is_done(scene->dep_scene, x, y) &&
+          !lp_fence_signalled(scene->dep_fence))
+      cnd_wait(&rast->tile_cond, &rast->tile_mutex);
+   mtx_unlock(&rast->tile_mutex);
+   p_atomic_dec(&rast->tile_waiters);
+
+   stats_add(&task->stats.wait_time, os_time_get_nano() - start);
+}
+
+
 /**
  * Rasterize/execute all bins within a scene.
  * Called per thread.
@@ -1044,27 +1358,58 @@ rasterize_scene(struct lp_rasterizer_task *task,
 {
    task->scene = scene;
 
-   /* Clear the cache tags. This should not always be necessary but
-    * simpler for now.
+   /* Hierarchical depth is only kept for single layer depth buffers */
+   task->hiz_enabled = false;
+   if (scene->zsbuf.map && scene->fb_max_layer == 0 &&
+       !(LP_PERF & PERF_NO_HIZ)) {
+      const struct util_format_description *desc =
+         util_format_description(scene->fb.zsbuf->format);
+      const unsigned z = desc->swizzle[0];
+
+      if (util_format_has_depth(desc) && z < 4) {
+         task->hiz_enabled = true;
+         task->hiz_quantum = desc->channel[z].type == UTIL_FORMAT_TYPE_FLOAT ?
+            0.0f : 1.0f / (float) u_uintN_max(desc->channel[z].size);
+      }
+   }
+
+   /* Decoded blocks survive from scene to scene, unless compressed texels
+    * were written since this thread last looked (see
+    * lp_rast_invalidate_texture_cache()).
     */
 #if LP_USE_TEXTURE_CACHE
-   memset(task->thread_data.cache->cache_tags, 0,
-          sizeof(task->thread_data.cache->cache_tags));
-#if LP_BUILD_FORMAT_CACHE_DEBUG
-   task->thread_data.cache->cache_access_total = 0;
-   task->thread_data.cache->cache_access_miss = 0;
-#endif
+   if (task->tex_cache_epoch != scene->tex_cache_epoch) {
+      lp_build_format_cache_invalidate(task->thread_data.cache);
+      task->tex_cache_epoch = scene->tex_cache_epoch;
+   }
 #endif
 
+   /* Wait for the previous scene when it can't be overlapped at all */
+   if (scene->dep_fence && !scene->dep_scene &&
+       !lp_fence_signalled(scene->dep_fence)) {
+      const uint64_t start = os_time_get_nano();
+      lp_fence_wait(scene->dep_fence);
+      stats_add(&task->stats.wait_time, os_time_get_nano() - start);
+   }
+
    if (!task->rast->no_rast) {
       /* loop over scene bins, rasterize each */
+      const bool timed = p_atomic_read(&task->rast->stats_users) > 0;
       struct cmd_bin *bin;
       int i, j;
 
       assert(scene);
-      while ((bin = lp_scene_bin_iter_next(scene, &i, &j))) {
-         if (!is_empty_bin(bin))
-            rasterize_bin(task, bin, i, j);
+      while ((bin = lp_scene_bin_iter_next(scene, task->numa_node, &i, &j))) {
+         if (scene->dep_scene)
+            wait_tile_dependency(task, scene, i, j);
+         if (!is_empty_bin(bin)) {
+            if (timed)
+               rasterize_bin_timed(task, bin, i, j);
+            else
+               rasterize_bin(task, bin, i, j);
+         }
+         lp_scene_tile_done(scene, i, j);
+         wake_tile_waiters(task->rast);
       }
    }
 
@@ -1084,12 +1429,71 @@ rasterize_scene(struct lp_rasterizer_task *task,
 
    if (scene->fence) {
       lp_fence_signal(scene->fence);
+      wake_tile_waiters(task->rast);
    }
 
    task->scene = NULL;
 }
 
 
+/**
+ * Decide how a newly queued scene is ordered against the previous one.
+ * Called with the screen's rast_mutex held.
+ */
+static void
+lp_rast_set_scene_dependency(struct lp_rasterizer *rast,
+                             struct lp_scene *scene)
+{
+   struct lp_fence *prev_fence = rast->last_fence;
+
+   if (!prev_fence || lp_fence_signalled(prev_fence))
+      return;
+
+   lp_fence_reference(&scene->dep_fence, prev_fence);
+
+   /* The previous scene can only be looked at if it comes from the same
+    * setup context: its fence is still pending, so setup hasn't recycled
+    * it.  Scenes from other contexts may be gone already.
+    */
+   if (rast->last_setup == scene->setup &&
+       !(LP_PERF & PERF_NO_SCENE_OVERLAP) &&
+       lp_scene_can_overlap(rast->last_scene, scene))
+      scene->dep_scene = rast->last_scene;
+}
+
+
+/**
+ * One pool thread's share of rasterizing a scene.
+ * The rasterizer task used is the one of the pool thread, as iterations
+ * of overlapping scenes may run at the same time.
+ */
+static void
+rast_scene_task(void *data, int iter_idx, struct lp_cs_local_mem *lmem)
+{
+   struct lp_scene *scene = (struct lp_scene *) data;
+   struct lp_rasterizer *rast = llvmpipe_screen(scene->pipe->screen)->rast;
+   struct lp_rasterizer_task *task = &rast->tasks[lmem->thread_index];
+
+   MESA_TRACE_FUNC();
+
+   /* Make sure that denorms are treated like zeros. This is
+    * the behavior required by D3D10. OpenGL doesn't care.
+    */
+   unsigned fpstate = util_fpstate_get();
+   util_fpstate_set_denorms_to_zero(fpstate);
+
+   LP_DBG(DEBUG_RAST, "thread %u rasterizing scene\n", task->thread_index);
+
+   /* the first thread to get to the scene maps the framebuffer surfaces */
+   lp_rast_begin(task, scene);
+
+   /* the scene may be recycled once this returns */
+   rasterize_scene(task, scene);
+
+   util_fpstate_set(fpstate);
+}
+
+
 /**
  * Called by setup module when it has something for us to render.
  */
@@ -1099,9 +1503,21 @@ lp_rast_queue_scene(struct lp_rasterizer *rast,
 {
    LP_DBG(DEBUG_SETUP, "%s\n", __func__);
 
+   if (rast->num_threads)
+      lp_rast_set_scene_dependency(rast, scene);
+
+   /* Textures whose memory is written behind our back can't use blocks
+    * decoded in earlier scenes.
+    */
+   if (scene->tex_cache_volatile)
+      lp_rast_invalidate_texture_cache(rast);
+   scene->tex_cache_epoch = p_atomic_read(&rast->tex_cache_epoch);
+
    lp_fence_reference(&rast->last_fence, scene->fence);
    if (rast->last_fence)
       rast->last_fence->issued = true;
+   rast->last_scene = scene;
+   rast->last_setup = scene->setup;
 
    if (rast->num_threads == 0) {
       /* no threading */
@@ -1112,194 +1528,167 @@ lp_rast_queue_scene(struct lp_rasterizer *rast,
        */
       util_fpstate_set_denorms_to_zero(fpstate);
 
-      lp_rast_begin(rast, scene);
+      lp_rast_begin(&rast->tasks[0], scene);
 
       rasterize_scene(&rast->tasks[0], scene);
 
-      lp_rast_end(rast);
-
       util_fpstate_set(fpstate);
-
-      rast->curr_scene = NULL;
    } else {
-      /* threaded rendering! */
-      lp_scene_enqueue(rast->full_scenes, scene);
-
-      /* signal the threads that there's work to do */
-      for (unsigned i = 0; i < rast->num_threads; i++) {
-         util_semaphore_signal(&rast->tasks[i].work_ready);
-      }
+      /* threaded rendering! every pool thread takes part in the scene
+       * once, the last one to finish signals the fence.
+       */
+      lp_cs_tpool_queue_detached_task(rast->pool, &scene->rast_task,
+                                      rast_scene_task, scene,
+                                      rast->num_threads,
+                                      LP_CS_TPOOL_PRIORITY_HIGH);
    }
 
    LP_DBG(DEBUG_SETUP, "%s done \n", __func__);
 }
 
 
+/**
+ * Drop the compressed texture blocks the rasterizer threads have decoded.
+ * Must be called after compressed texels changed and before any scene
+ * sampling them is queued.  Threads notice at their next scene.
+ */
 void
-lp_rast_finish(struct lp_rasterizer *rast)
+lp_rast_invalidate_texture_cache(struct lp_rasterizer *rast)
 {
-   if (rast->num_threads == 0) {
-      /* nothing to do */
-   } else {
-      /* wait for work to complete */
-      for (unsigned i = 0; i < rast->num_threads; i++) {
-         util_semaphore_wait(&rast->tasks[i].work_done);
-      }
-   }
+   p_atomic_inc(&rast->tex_cache_epoch);
 }
 
 
 /**
- * This is the thread's main entrypoint.
- * It's a simple loop:
- *   1. wait for work
- *   2. do work
- *   3. signal that we're done
+ * Count the statistics users, rasterizer threads only time tiles while
+ * there are any.
  */
-static int
-thread_function(void *init_data)
+void
+lp_rast_enable_stats(struct lp_rasterizer *rast, bool enable)
 {
-   struct lp_rasterizer_task *task = (struct lp_rasterizer_task *) init_data;
-   struct lp_rasterizer *rast = task->rast;
-   bool debug = false;
-   char thread_name[16];
-
-   snprintf(thread_name, sizeof thread_name, "llvmpipe-%u", task->thread_index);
-   u_thread_setname(thread_name);
-
-   /* Make sure that denorms are treated like zeros. This is
-    * the behavior required by D3D10. OpenGL doesn't care.
-    */
-   unsigned fpstate = util_fpstate_get();
-   util_fpstate_set_denorms_to_zero(fpstate);
+   if (enable)
+      p_atomic_inc(&rast->stats_users);
+   else
+      p_atomic_dec(&rast->stats_users);
+}
 
-   while (1) {
-      /* wait for work */
-      if (debug)
-         debug_printf("thread %d waiting for work\n", task->thread_index);
-      util_semaphore_wait(&task->work_ready);
-
-      if (rast->exit_flag)
-         break;
-
-      if (task->thread_index == 0) {
-         /* thread[0]:
-          *  - get next scene to rasterize
-          *  - map the framebuffer surfaces
-          */
-         lp_rast_begin(rast, lp_scene_dequeue(rast->full_scenes, true));
-      }
 
-      /* Wait for all threads to get here so that threads[1+] don't
-       * get a null rast->curr_scene pointer.
-       */
-      util_barrier_wait(&rast->barrier);
+/**
+ * Sum up the statistics of all threads while they may still be updating
+ * them.  Each counter is read atomically and only grows, but counters of
+ * a tile being rasterized may not all include it yet.
+ */
+void
+lp_rast_get_stats(struct lp_rasterizer *rast, struct lp_rast_stats *stats)
+{
+   memset(stats, 0, sizeof *stats);
 
-      /* do work */
-      if (debug)
-         debug_printf("thread %d doing work\n", task->thread_index);
+   for (unsigned i = 0; i < MAX2(1, rast->num_threads); i++) {
+      const struct lp_rast_stats *task_stats = &rast->tasks[i].stats;
+
+      stats->scenes += p_atomic_read(&task_stats->scenes);
+      stats->tiles += p_atomic_read(&task_stats->tiles);
+      stats->cmds += p_atomic_read(&task_stats->cmds);
+      stats->busy_time += p_atomic_read(&task_stats->busy_time);
+      stats->wait_time += p_atomic_read(&task_stats->wait_time);
+      stats->hiz_culled_pixels += p_atomic_read(&task_stats->hiz_culled_pixels);
+   }
+}
 
-      rasterize_scene(task, rast->curr_scene);
 
-      /* wait for all threads to finish with this scene */
-      util_barrier_wait(&rast->barrier);
+static void
+lp_rast_print_stats(struct lp_rasterizer *rast)
+{
+   uint64_t hist[LP_RAST_TILE_HIST_BUCKETS] = { 0 };
 
-      /* XXX: shouldn't be necessary:
-       */
-      if (task->thread_index == 0) {
-         lp_rast_end(rast);
-      }
+   for (unsigned i = 0; i < MAX2(1, rast->num_threads); i++) {
+      const struct lp_rasterizer_task *task = &rast->tasks[i];
 
-      /* signal done with work */
-      if (debug)
-         debug_printf("thread %d done working\n", task->thread_index);
+      debug_printf("llvmpipe: thread %2u: %8"PRIu64" tiles, busy %.3f sec, "
+                   "waiting %.3f sec, %"PRIu64" hiz culled pixels\n",
+                   i, task->stats.tiles,
+                   task->stats.busy_time / 1e9, task->stats.wait_time / 1e9,
+                   task->stats.hiz_culled_pixels);
 
-      util_semaphore_signal(&task->work_done);
+      for (unsigned b = 0; b < LP_RAST_TILE_HIST_BUCKETS; b++)
+         hist[b] += task->tile_hist[b];
    }
 
-#ifdef _WIN32
-   util_semaphore_signal(&task->exited);
-#endif
-
-   return 0;
-}
-
-
-/**
- * Initialize semaphores and spawn the threads.
- */
-static void
-create_rast_threads(struct lp_rasterizer *rast)
-{
-   /* NOTE: if num_threads is zero, we won't use any threads */
-   for (unsigned i = 0; i < rast->num_threads; i++) {
-      util_semaphore_init(&rast->tasks[i].work_ready, 0);
-      util_semaphore_init(&rast->tasks[i].work_done, 0);
-#ifdef _WIN32
-      util_semaphore_init(&rast->tasks[i].exited, 0);
-#endif
-      if (thrd_success != u_thread_create(rast->threads + i, thread_function,
-                                            (void *) &rast->tasks[i])) {
-         rast->num_threads = i; /* previous thread is max */
-         break;
+   debug_printf("llvmpipe: tile cost histogram:\n");
+   for (unsigned b = 0; b < LP_RAST_TILE_HIST_BUCKETS; b++) {
+      if (hist[b]) {
+         debug_printf("llvmpipe:   %s %6u us: %9"PRIu64"\n",
+                      b == LP_RAST_TILE_HIST_BUCKETS - 1 ? ">=" : " <",
+                      b == LP_RAST_TILE_HIST_BUCKETS - 1 ? 1u << (b - 1) : 1u << b,
+                      hist[b]);
       }
    }
 }
 
 
 /**
- * Create new lp_rasterizer.  If num_threads is zero, don't create any
- * new threads, do rendering synchronously.
- * \param num_threads  number of rasterizer threads to create
+ * Create new lp_rasterizer.  If the pool has no threads, do rendering
+ * synchronously.
+ * \param pool  the screen thread pool, scenes are rasterized by all of
+ *              its threads
+ * \param num_numa_nodes  number of NUMA nodes the pool is spread over
  */
 struct lp_rasterizer *
-lp_rast_create(unsigned num_threads)
+lp_rast_create(struct lp_cs_tpool *pool, unsigned num_numa_nodes)
 {
+   unsigned num_threads = pool->num_threads;
    struct lp_rasterizer *rast = CALLOC_STRUCT(lp_rasterizer);
    if (!rast) {
       goto no_rast;
    }
 
-   rast->full_scenes = lp_scene_queue_create();
-   if (!rast->full_scenes) {
-      goto no_full_scenes;
+   rast->tasks = CALLOC(MAX2(1, num_threads), sizeof(*rast->tasks));
+   if (!rast->tasks) {
+      goto no_tasks;
    }
 
+   rast->num_numa_nodes = CLAMP(MIN2(num_numa_nodes, num_threads),
+                                1, LP_MAX_NUMA_NODES);
+
    for (unsigned i = 0; i < MAX2(1, num_threads); i++) {
       struct lp_rasterizer_task *task = &rast->tasks[i];
       task->rast = rast;
       task->thread_index = i;
+      /* Matches the placement of the pool threads */
+      task->numa_node = num_threads ?
+         i * rast->num_numa_nodes / num_threads : 0;
       task->thread_data.cache =
          align_malloc(sizeof(struct lp_build_format_cache), 16);
       if (!task->thread_data.cache) {
          goto no_thread_data_cache;
       }
+      lp_build_format_cache_invalidate(task->thread_data.cache);
    }
 
+   rast->pool = pool;
    rast->num_threads = num_threads;
+   (void) mtx_init(&rast->tile_mutex, mtx_plain);
+   cnd_init(&rast->tile_cond);
 
    rast->no_rast = debug_get_bool_option("LP_NO_RAST", false);
 
-   create_rast_threads(rast);
-
-   /* for synchronizing rasterization threads */
-   if (rast->num_threads > 0) {
-      util_barrier_init(&rast->barrier, rast->num_threads);
-   }
+   /* Gather the tile histogram printed on destruction */
+   if (LP_DEBUG & DEBUG_COUNTERS)
+      rast->stats_users = 1;
 
    memset(lp_dummy_tile, 0, sizeof lp_dummy_tile);
 
    return rast;
 
 no_thread_data_cache:
-   for (unsigned i = 0; i < MAX2(1, rast->num_threads); i++) {
+   for (unsigned i = 0; i < MAX2(1, num_threads); i++) {
       if (rast->tasks[i].thread_data.cache) {
          align_free(rast->tasks[i].thread_data.cache);
       }
    }
 
-   lp_scene_queue_destroy(rast->full_scenes);
-no_full_scenes:
+no_tasks:
+   FREE(rast->tasks);
    FREE(rast);
 no_rast:
    return NULL;
@@ -1311,54 +1700,21 @@ no_rast:
 void
 lp_rast_destroy(struct lp_rasterizer *rast)
 {
-   /* Set exit_flag and signal each thread's work_ready semaphore.
-    * Each thread will be woken up, notice that the exit_flag is set and
-    * break out of its main loop.  The thread will then exit.
-    */
-   rast->exit_flag = true;
-   for (unsigned i = 0; i < rast->num_threads; i++) {
-      util_semaphore_signal(&rast->tasks[i].work_ready);
-   }
-
-   /* Wait for threads to terminate before cleaning up per-thread data.
-    * We don't actually call pipe_thread_wait to avoid dead lock on Windows
-    * per https://bugs.freedesktop.org/show_bug.cgi?id=76252 */
-   for (unsigned i = 0; i < rast->num_threads; i++) {
-#ifdef _WIN32
-      /* Threads might already be dead - Windows apparently terminates
-       * other threads when returning from main.
-       */
-      DWORD exit_code = STILL_ACTIVE;
-      if (GetExitCodeThread(rast->threads[i].handle, &exit_code) &&
-          exit_code == STILL_ACTIVE) {
-         util_semaphore_wait(&rast->tasks[i].exited);
-      }
-#else
-      thrd_join(rast->threads[i], NULL);
-#endif
-   }
+   if (LP_DEBUG & DEBUG_COUNTERS)
+      lp_rast_print_stats(rast);
 
-   /* Clean up per-thread data */
-   for (unsigned i = 0; i < rast->num_threads; i++) {
-      util_semaphore_destroy(&rast->tasks[i].work_ready);
-      util_semaphore_destroy(&rast->tasks[i].work_done);
-#ifdef _WIN32
-      util_semaphore_destroy(&rast->tasks[i].exited);
-#endif
-   }
+   /* All scenes have been rasterized by now, setup waits for their
+    * fences before it goes away.  The pool threads belong to the screen.
+    */
    for (unsigned i = 0; i < MAX2(1, rast->num_threads); i++) {
       align_free(rast->tasks[i].thread_data.cache);
    }
 
    lp_fence_reference(&rast->last_fence, NULL);
 
-   /* for synchronizing rasterization threads */
-   if (rast->num_threads > 0) {
-      util_barrier_destroy(&rast->barrier);
-   }
-
-   lp_scene_queue_destroy(rast->full_scenes);
-
+   cnd_destroy(&rast->tile_cond);
+   mtx_destroy(&rast->tile_mutex);
+   FREE(rast->tasks);
    FREE(rast);
 }
 
@@ -46,6 +46,7 @@
 struct lp_rasterizer;
 struct lp_scene;
 struct lp_fence;
+struct lp_cs_tpool;
 struct cmd_bin;
 
 #define FIXED_TYPE_WIDTH 64
@@ -231,7 +232,7 @@ GET_PLANES(const struct lp_rast_triangle *tri)
 
 
 struct lp_rasterizer *
-lp_rast_create(unsigned num_threads);
+lp_rast_create(struct lp_cs_tpool *pool, unsigned num_numa_nodes);
 
 void
 lp_rast_destroy(struct lp_rasterizer *);
@@ -240,8 +241,28 @@ void
 lp_rast_queue_scene(struct lp_rasterizer *rast,
                      struct lp_scene *scene);
 
+
+/**
+ * Rasterizer activity summed over all threads, see lp_rast_get_stats().
+ * Times are in nanoseconds.
+ */
+struct lp_rast_stats {
+   uint64_t scenes;     /**< scenes rasterized */
+   uint64_t tiles;      /**< non-empty bins rasterized */
+   uint64_t cmds;       /**< bin commands executed */
+   uint64_t busy_time;  /**< time spent rasterizing bins */
+   uint64_t wait_time;  /**< time blocked on earlier scenes or compiles */
+   uint64_t hiz_culled_pixels; /**< pixels skipped by hierarchical depth */
+};
+
+void
+lp_rast_invalidate_texture_cache(struct lp_rasterizer *rast);
+
+void
+lp_rast_enable_stats(struct lp_rasterizer *rast, bool enable);
+
 void
-lp_rast_finish(struct lp_rasterizer *rast);
+lp_rast_get_stats(struct lp_rasterizer *rast, struct lp_rast_stats *stats);
 
 
 union lp_rast_cmd_arg {
@@ -76,6 +76,9 @@ extern const struct lp_rasterizer_task *jit_task;
 struct lp_rasterizer;
 struct cmd_bin;
 
+/** Per-tile cost histogram buckets: [0] < 1us, [i] < 2^i us */
+#define LP_RAST_TILE_HIST_BUCKETS 16
+
 /**
  * Per-thread rasterization state
  */
@@ -97,14 +100,30 @@ struct lp_rasterizer_task
    /** "my" index */
    unsigned thread_index;
 
+   /** NUMA node this thread runs on, also its preferred scene band */
+   unsigned numa_node;
+
    /** Non-interpolated passthru state and occlude counter for visible pixels */
    struct lp_jit_thread_data thread_data;
 
-   util_semaphore work_ready;
-   util_semaphore work_done;
-#ifdef _WIN32
-   util_semaphore exited;
-#endif
+   /** lp_rasterizer::tex_cache_epoch the thread_data cache is valid for */
+   unsigned tex_cache_epoch;
+
+   /**
+    * Hierarchical depth of the current tile: an upper bound of the depth
+    * stored in each 16x16 block, for the blocks set in hiz_valid.
+    * See lp_rast_hiz_cull().
+    */
+   bool hiz_enabled;
+   float hiz_quantum;      /**< depth buffer rounding error */
+   unsigned hiz_valid;
+   float hiz_max[(TILE_SIZE / 16) * (TILE_SIZE / 16)];
+
+   /** Only written by this thread.  Tiles are only timed and counted
+    * while there are lp_rasterizer::stats_users.
+    */
+   struct lp_rast_stats stats;
+   uint64_t tile_hist[LP_RAST_TILE_HIST_BUCKETS];
 };
 
 
@@ -115,28 +134,51 @@ struct lp_rasterizer_task
  */
 struct lp_rasterizer
 {
-   bool exit_flag;
    bool no_rast;  /**< For debugging/profiling */
 
-   /** The incoming queue of scenes ready to rasterize */
-   struct lp_scene_queue *full_scenes;
+   /** The screen thread pool scenes are rasterized on */
+   struct lp_cs_tpool *pool;
 
-   /** The scene currently being rasterized by the threads */
-   struct lp_scene *curr_scene;
+   /** The most recently queued scene and the context which binned it */
+   struct lp_scene *last_scene;
+   const struct lp_setup_context *last_setup;
 
-   /** A task object for each rasterization thread */
-   struct lp_rasterizer_task tasks[LP_MAX_THREADS];
+   /** A task object for each pool thread (at least one) */
+   struct lp_rasterizer_task *tasks;
 
    unsigned num_threads;
-   thrd_t threads[LP_MAX_THREADS];
 
-   /** For synchronizing the rasterization threads */
-   util_barrier barrier;
+   /** Number of NUMA nodes the threads are spread over */
+   unsigned num_numa_nodes;
 
    struct lp_fence *last_fence;
+
+   /** Time tiles while non-zero, see lp_rast_enable_stats() */
+   int stats_users;
+
+   /** Bumped by lp_rast_invalidate_texture_cache() */
+   unsigned tex_cache_epoch;
+
+   /**
+    * Threads waiting for a tile of the previous scene sleep on tile_cond.
+    * It is only broadcast while tile_waiters is non-zero.
+    */
+   mtx_t tile_mutex;
+   cnd_t tile_cond;
+   int tile_waiters;
 };
 
 
+bool
+lp_rast_hiz_cull(struct lp_rasterizer_task *task,
+                 const struct lp_rast_shader_inputs *inputs,
+                 unsigned x, unsigned y, unsigned size);
+
+void
+lp_rast_hiz_update(struct lp_rasterizer_task *task,
+                   const struct lp_rast_shader_inputs *inputs,
+                   unsigned x, unsigned y);
+
 void
 lp_rast_shade_quads_mask_sample(struct lp_rasterizer_task *task,
                                 const struct lp_rast_shader_inputs *inputs,
@@ -174,7 +216,10 @@ lp_rast_get_color_block_pointer(struct lp_rasterizer_task *task,
    unsigned px = x % TILE_SIZE;
    unsigned py = y % TILE_SIZE;
 
-   unsigned pixel_offset = px * task->scene->cbufs[buf].format_bytes +
+   /* In a microtiled buffer the 4x4 blocks of a row are packed. */
+   unsigned block_bytes = task->scene->cbufs[buf].format_bytes *
+                          (task->scene->cbufs[buf].microtiled ? 4 : 1);
+   unsigned pixel_offset = px * block_bytes +
                            py * task->scene->cbufs[buf].stride;
    uint8_t *color = task->color_tiles[buf] + pixel_offset;
 
@@ -241,7 +286,7 @@ lp_rast_shade_quads_all(struct lp_rasterizer_task *task,
    /* color buffer */
    for (unsigned i = 0; i < scene->fb.nr_cbufs; i++) {
       if (scene->fb.cbufs[i]) {
-         stride[i] = scene->cbufs[i].stride;
+         stride[i] = scene->cbufs[i].block_stride;
          sample_stride[i] = scene->cbufs[i].sample_stride;
          color[i] = lp_rast_get_color_block_pointer(task, i, x, y,
                                                     inputs->layer + inputs->view_index);
@@ -165,6 +165,11 @@ lp_rast_rectangle(struct lp_rasterizer_task *task,
    struct u_rect box;
    intersect_rect_and_tile(task, rect, &box);
 
+   if (lp_rast_hiz_cull(task, &rect->inputs, task->x + box.x0,
+                        task->y + box.y0,
+                        MAX2(box.x1 - box.x0, box.y1 - box.y0) + 1))
+      return;
+
    /* The interior of the rectangle (if there is one) will be
     * rasterized as full 4x4 stamps.
     *
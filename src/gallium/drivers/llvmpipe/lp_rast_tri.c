@@ -297,6 +297,9 @@ lp_rast_triangle_32_3_16(struct lp_rasterizer_task *task,
    const int x = (arg.triangle.plane_mask & 0xff) + task->x;
    const int y = (arg.triangle.plane_mask >> 8) + task->y;
 
+   if (lp_rast_hiz_cull(task, &tri->inputs, x, y, 16))
+      return;
+
    struct { unsigned mask:16; unsigned i:8; unsigned j:8; } out[16];
    unsigned nr = 0;
 
@@ -409,6 +412,9 @@ lp_rast_triangle_32_3_4(struct lp_rasterizer_task *task,
    const unsigned x = (arg.triangle.plane_mask & 0xff) + task->x;
    const unsigned y = (arg.triangle.plane_mask >> 8) + task->y;
 
+   if (lp_rast_hiz_cull(task, &tri->inputs, x, y, 4))
+      return;
+
    /* p0 and p2 are aligned, p1 is not (plane size 24 bytes). */
    __m128i p0 = _mm_load_si128((__m128i *)&plane[0]); /* clo, chi, dcdx, dcdy */
    __m128i p1 = _mm_loadu_si128((__m128i *)&plane[1]);
@@ -580,6 +586,9 @@ lp_rast_triangle_32_3_16(struct lp_rasterizer_task *task,
    const int x = (arg.triangle.plane_mask & 0xff) + task->x;
    const int y = (arg.triangle.plane_mask >> 8) + task->y;
 
+   if (lp_rast_hiz_cull(task, &tri->inputs, x, y, 16))
+      return;
+
    struct { unsigned mask:16; unsigned i:8; unsigned j:8; } out[16];
    unsigned nr = 0;
 
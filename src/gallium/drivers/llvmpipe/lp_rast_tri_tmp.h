@@ -210,6 +210,9 @@ TAG(lp_rast_triangle)(struct lp_rasterizer_task *task,
       return;
    }
 
+   if (lp_rast_hiz_cull(task, &tri->inputs, x, y, TILE_SIZE))
+      return;
+
    outmask = 0;                 /* outside one or more trivial reject planes */
    partmask = 0;                /* outside one or more trivial accept planes */
 
@@ -322,6 +325,9 @@ TAG(lp_rast_triangle)(struct lp_rasterizer_task *task,
 
       partial_mask &= ~(1 << i);
 
+      if (lp_rast_hiz_cull(task, &tri->inputs, px, py, 16))
+         continue;
+
       LP_COUNT(nr_partially_covered_16);
       TAG(do_block_16)(task, tri, plane, px, py, cx);
    }
@@ -337,8 +343,12 @@ TAG(lp_rast_triangle)(struct lp_rasterizer_task *task,
 
       inmask &= ~(1 << i);
 
+      if (lp_rast_hiz_cull(task, &tri->inputs, px, py, 16))
+         continue;
+
       LP_COUNT(nr_fully_covered_16);
       block_full_16(task, tri, px, py);
+      lp_rast_hiz_update(task, &tri->inputs, px, py);
    }
 }
 
@@ -373,6 +383,9 @@ TRI_16(struct lp_rasterizer_task *task,
    x += task->x;
    y += task->y;
 
+   if (lp_rast_hiz_cull(task, &tri->inputs, x, y, 16))
+      return;
+
    for (unsigned j = 0; j < NR_PLANES; j++) {
       const int dcdx = -plane[j].dcdx * 4;
       const int dcdy = plane[j].dcdy * 4;
@@ -438,6 +451,9 @@ TRI_4(struct lp_rasterizer_task *task,
    const int x = task->x + (mask & 0xff);
    const int y = task->y + (mask >> 8);
 
+   if (lp_rast_hiz_cull(task, &tri->inputs, x, y, 4))
+      return;
+
    /* Iterate over partials:
     */
    unsigned mask = 0xffff;
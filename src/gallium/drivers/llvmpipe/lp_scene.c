@@ -30,6 +30,7 @@
 #include "util/u_memory.h"
 #include "util/reallocarray.h"
 #include "util/u_inlines.h"
+#include "util/u_atomic.h"
 #include "util/format/u_format.h"
 #include "lp_scene.h"
 #include "lp_fence.h"
@@ -103,6 +104,7 @@ lp_scene_destroy(struct lp_scene *scene)
    lp_scene_end_rasterization(scene);
    mtx_destroy(&scene->mutex);
    free(scene->tiles);
+   free(scene->bin_order);
    assert(scene->data.head == &scene->data.first);
    slab_free_st(&scene->setup->scene_slab, scene);
 }
@@ -147,6 +149,7 @@ lp_scene_bin_reset(struct lp_scene *scene, unsigned x, unsigned y)
    struct cmd_bin *bin = lp_scene_get_bin(scene, x, y);
 
    bin->last_state = NULL;
+   bin->cost = 0;
    bin->head = bin->tail;
    if (bin->tail) {
       bin->tail->next = NULL;
@@ -163,6 +166,8 @@ init_scene_texture(struct lp_scene_surface *ssurf, struct pipe_surface *psurf)
       ssurf->layer_stride = 0;
       ssurf->sample_stride = 0;
       ssurf->nr_samples = 0;
+      ssurf->block_stride = 0;
+      ssurf->microtiled = false;
       ssurf->map = NULL;
       return;
    }
@@ -180,6 +185,9 @@ init_scene_texture(struct lp_scene_surface *ssurf, struct pipe_surface *psurf)
                                          LP_TEX_USAGE_READ_WRITE);
       ssurf->format_bytes = util_format_get_blocksize(psurf->format);
       ssurf->nr_samples = util_res_sample_count(psurf->texture);
+      ssurf->microtiled = llvmpipe_resource(psurf->texture)->microtiled;
+      ssurf->block_stride = ssurf->microtiled ?
+         4 * ssurf->format_bytes : ssurf->stride;
    } else {
       struct llvmpipe_resource *lpr = llvmpipe_resource(psurf->texture);
       unsigned pixstride = util_format_get_blocksize(psurf->format);
@@ -190,6 +198,8 @@ init_scene_texture(struct lp_scene_surface *ssurf, struct pipe_surface *psurf)
       ssurf->map = lpr->data;
       ssurf->map += psurf->u.buf.first_element * pixstride;
       ssurf->format_bytes = util_format_get_blocksize(psurf->format);
+      ssurf->block_stride = ssurf->stride;
+      ssurf->microtiled = false;
    }
 }
 
@@ -316,6 +326,9 @@ lp_scene_end_rasterization(struct lp_scene *scene)
    }
 
    lp_fence_reference(&scene->fence, NULL);
+   lp_fence_reference(&scene->dep_fence, NULL);
+   scene->dep_scene = NULL;
+   scene->rast_begun = false;
 
    scene->resources = NULL;
    scene->writeable_resources = NULL;
@@ -512,6 +525,31 @@ lp_scene_add_frag_shader_reference(struct lp_scene *scene,
 }
 
 
+/**
+ * Wait for any background compiles of the fragment shader variants
+ * referenced by the scene to finish.
+ * Return TRUE if any of them had not finished yet.
+ */
+bool
+lp_scene_wait_frag_shaders(struct lp_scene *scene)
+{
+   bool waited = false;
+
+   for (struct shader_ref *ref = scene->frag_shaders; ref; ref = ref->next) {
+      for (int i = 0; i < ref->count; i++) {
+         struct util_queue_fence *ready = &ref->variant[i]->ready;
+
+         if (!util_queue_fence_is_signalled(ready)) {
+            util_queue_fence_wait(ready);
+            waited = true;
+         }
+      }
+   }
+
+   return waited;
+}
+
+
 /**
  * Does this scene have a reference to the given resource?
  * Returns bitmask of LP_REFERENCED_FOR_READ/WRITE bits.
@@ -547,60 +585,184 @@ lp_scene_is_resource_referenced(const struct lp_scene *scene,
 }
 
 
-/** advance curr_x,y to the next bin */
-static bool
-next_bin(struct lp_scene *scene)
+/* Bins are bucketed by log2 of their command count when ordering them
+ * for rasterization.
+ */
+#define LP_SCENE_COST_BUCKETS 32
+
+
+/**
+ * Order the bins of rows [first_row, last_row) into bin_order starting at
+ * position n, and return the position past the last one.
+ */
+static unsigned
+order_bins(struct lp_scene *scene, unsigned first_row, unsigned last_row,
+           unsigned n, bool keep_empty)
 {
-   scene->curr_x++;
-   if (scene->curr_x >= scene->tiles_x) {
-      scene->curr_x = 0;
-      scene->curr_y++;
+   const unsigned first = first_row * scene->tiles_x;
+   const unsigned last = last_row * scene->tiles_x;
+
+   if (LP_PERF & PERF_NO_TILE_SORT) {
+      for (unsigned i = first; i < last; i++) {
+         if (scene->tiles[i].head || keep_empty)
+            scene->bin_order[n++] = i;
+      }
+      return n;
    }
-   if (scene->curr_y >= scene->tiles_y) {
-      /* no more bins */
-      return false;
+
+   /* Counting sort, most expensive bucket first. */
+   unsigned offset[LP_SCENE_COST_BUCKETS] = {0};
+   for (unsigned i = first; i < last; i++) {
+      const struct cmd_bin *bin = &scene->tiles[i];
+      if (bin->head || keep_empty)
+         offset[util_logbase2(MAX2(bin->cost, 1))]++;
    }
-   return true;
+
+   for (int b = LP_SCENE_COST_BUCKETS - 1; b >= 0; b--) {
+      unsigned count = offset[b];
+      offset[b] = n;
+      n += count;
+   }
+
+   for (unsigned i = first; i < last; i++) {
+      const struct cmd_bin *bin = &scene->tiles[i];
+      if (bin->head || keep_empty)
+         scene->bin_order[offset[util_logbase2(MAX2(bin->cost, 1))]++] = i;
+   }
+
+   return n;
 }
 
 
+/**
+ * Prepare the list of bins to be handed out to the rasterizer threads.
+ * Empty bins are skipped, and the remaining ones are ordered so that the
+ * bins with the most commands come first: starting the expensive tiles
+ * early keeps a few heavy tiles from being left to a single thread at
+ * the end of the scene.  Within a cost bucket bins stay in raster order.
+ *
+ * The framebuffer rows are split into num_bands horizontal bands, one per
+ * NUMA node, each ordered separately.  Threads take bins from their own
+ * node's band first, so a given framebuffer row keeps being touched by
+ * the same node from one scene to the next.
+ *
+ * Called by one thread before the other threads start rasterizing.
+ */
 void
-lp_scene_bin_iter_begin(struct lp_scene *scene)
+lp_scene_bin_iter_begin(struct lp_scene *scene, unsigned num_bands)
+{
+   const unsigned num_bins = lp_scene_get_num_bins(scene);
+   unsigned n = 0;
+
+   scene->num_bands = CLAMP(num_bands, 1, LP_MAX_NUMA_NODES);
+   memset(scene->bands, 0, sizeof(scene->bands));
+   BITSET_ZERO(scene->tiles_done);
+
+   /* If bin_order couldn't be allocated, hand out every bin in raster
+    * order.
+    */
+   if (!scene->bin_order) {
+      scene->num_bands = 1;
+      scene->bands[0].end = num_bins;
+      return;
+   }
+
+   /* When ordered tile by tile after another scene, empty bins still have
+    * to be handed out so that they wait for that scene's tile before being
+    * marked as done: scenes queued later rely on it.
+    */
+   const bool keep_empty = scene->dep_scene != NULL;
+
+   for (unsigned i = 0; i < num_bins; i++) {
+      if (!scene->tiles[i].head && !keep_empty)
+         BITSET_SET(scene->tiles_done,
+                    (i / scene->tiles_x) * TILES_X + i % scene->tiles_x);
+   }
+
+   for (unsigned b = 0; b < scene->num_bands; b++) {
+      struct lp_scene_band *band = &scene->bands[b];
+      band->start = band->next = n;
+      n = order_bins(scene,
+                     b * scene->tiles_y / scene->num_bands,
+                     (b + 1) * scene->tiles_y / scene->num_bands,
+                     n, keep_empty);
+      band->end = n;
+   }
+}
+
+
+static bool
+scene_reads_framebuffer(const struct lp_scene *scene)
+{
+   for (const struct resource_ref *ref = scene->resources; ref;
+        ref = ref->next) {
+      for (int i = 0; i < ref->count; i++) {
+         for (unsigned j = 0; j < scene->fb.nr_cbufs; j++) {
+            if (scene->fb.cbufs[j] &&
+                scene->fb.cbufs[j]->texture == ref->resource[i])
+               return true;
+         }
+         if (scene->fb.zsbuf && scene->fb.zsbuf->texture == ref->resource[i])
+            return true;
+      }
+   }
+   return false;
+}
+
+
+/**
+ * Can the tiles of 'scene' be rasterized as soon as the same tiles of
+ * 'prev' are done, rather than after all of 'prev'?  This is only the
+ * case when both render to the same framebuffer and neither touches
+ * memory outside its own tiles: no shader images/buffers, no queries
+ * and no sampling from the framebuffer.
+ */
+bool
+lp_scene_can_overlap(const struct lp_scene *prev,
+                     const struct lp_scene *scene)
 {
-   scene->curr_x = scene->curr_y = -1;
+   if (!util_framebuffer_state_equal(&prev->fb, &scene->fb))
+      return false;
+
+   if (prev->had_queries || scene->had_queries)
+      return false;
+
+   if (prev->writeable_resources || scene->writeable_resources)
+      return false;
+
+   return !scene_reads_framebuffer(prev) && !scene_reads_framebuffer(scene);
 }
 
 
 /**
- * Return pointer to next bin to be rendered.
- * The lp_scene::curr_x and ::curr_y fields will be advanced.
+ * Return pointer to next bin to be rendered, and its position in *x, *y.
  * Multiple rendering threads will call this function to get a chunk
- * of work (a bin) to work on.
+ * of work (a bin) to work on.  Bins are claimed with a single atomic
+ * increment, so threads never block on each other here.  The caller's
+ * own band is drained first, then bins are taken from the other bands.
  */
 struct cmd_bin *
-lp_scene_bin_iter_next(struct lp_scene *scene , int *x, int *y)
+lp_scene_bin_iter_next(struct lp_scene *scene, unsigned band,
+                       int *x, int *y)
 {
-   struct cmd_bin *bin = NULL;
+   for (unsigned i = 0; i < scene->num_bands; i++) {
+      struct lp_scene_band *b =
+         &scene->bands[(band + i) % scene->num_bands];
 
-   mtx_lock(&scene->mutex);
+      if (p_atomic_read(&b->next) >= b->end)
+         continue;
 
-   if (scene->curr_x < 0) {
-      /* first bin */
-      scene->curr_x = 0;
-      scene->curr_y = 0;
-   } else if (!next_bin(scene)) {
-      /* no more bins left */
-      goto end;
-   }
+      unsigned pos = p_atomic_inc_return(&b->next) - 1;
+      if (pos >= b->end)
+         continue;
 
-   bin = lp_scene_get_bin(scene, scene->curr_x, scene->curr_y);
-   *x = scene->curr_x;
-   *y = scene->curr_y;
+      unsigned idx = scene->bin_order ? scene->bin_order[pos] : pos;
+      *x = idx % scene->tiles_x;
+      *y = idx / scene->tiles_x;
+      return &scene->tiles[idx];
+   }
 
-end:
-   /*printf("return bin %p at %d, %d\n", (void *) bin, *bin_x, *bin_y);*/
-   mtx_unlock(&scene->mutex);
-   return bin;
+   return NULL;
 }
 
 
@@ -625,6 +787,9 @@ lp_scene_begin_binning(struct lp_scene *scene,
          return;
       memset(scene->tiles, 0, sizeof(struct cmd_bin) * num_required_tiles);
       scene->num_alloced_tiles = num_required_tiles;
+
+      free(scene->bin_order);
+      scene->bin_order = malloc(num_required_tiles * sizeof(unsigned));
    }
 
    /*
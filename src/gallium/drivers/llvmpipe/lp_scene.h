@@ -35,11 +35,13 @@
 #ifndef LP_SCENE_H
 #define LP_SCENE_H
 
+#include "util/bitset.h"
+#include "util/u_atomic.h"
 #include "util/u_thread.h"
 #include "lp_rast.h"
 #include "lp_debug.h"
+#include "lp_cs_tpool.h"
 
-struct lp_scene_queue;
 struct lp_rast_state;
 
 /* We're limited to 2K by 2K for 32bit fixed point rasterization.
@@ -91,6 +93,16 @@ struct data_block {
 
 
 
+/**
+ * A range of lp_scene::bin_order, covering a horizontal band of the
+ * framebuffer which is preferably rasterized by one NUMA node.
+ */
+struct lp_scene_band {
+   unsigned start, end;
+   unsigned next;  /* next position to hand out */
+};
+
+
 /**
  * For each screen tile we have one of these bins.
  */
@@ -98,6 +110,7 @@ struct cmd_bin {
    const struct lp_rast_state *last_state;  /* most recent state set in bin */
    struct cmd_block *head;
    struct cmd_block *tail;
+   unsigned cost;  /* number of commands binned, used to order bins */
 };
 
 
@@ -127,6 +140,10 @@ struct lp_scene_surface {
    unsigned format_bytes;
    unsigned sample_stride;
    unsigned nr_samples;
+   /** row stride within a 4x4 block, as passed to the shaders */
+   unsigned block_stride;
+   /** stored as rows of 4x4 blocks (see llvmpipe_microtile_offset) */
+   bool microtiled;
 };
 
 
@@ -149,6 +166,11 @@ struct lp_scene {
    /* If queries were either active or there were begin/end query commands */
    bool had_queries;
 
+   /* Samples compressed textures the rasterizer can't track writes to */
+   bool tex_cache_volatile;
+   /* lp_rasterizer::tex_cache_epoch when the scene was queued */
+   unsigned tex_cache_epoch;
+
    /* Framebuffer mappings - valid only between begin_rasterization()
     * and end_rasterization().
     */
@@ -195,11 +217,39 @@ struct lp_scene {
     */
    unsigned tiles_x, tiles_y;
 
-   int curr_x, curr_y;  /**< for iterating over bins */
    mtx_t mutex;
 
    unsigned num_alloced_tiles;
    struct cmd_bin *tiles;
+
+   /**
+    * Indices of the non-empty bins, most expensive first within each
+    * band.  Built by lp_scene_bin_iter_begin() and handed out to the
+    * rasterizer threads by atomically incrementing the bands' next field.
+    * NULL if it couldn't be allocated, then all bins go in raster order.
+    */
+   unsigned *bin_order;
+   struct lp_scene_band bands[LP_MAX_NUMA_NODES];
+   unsigned num_bands;
+
+   /** Set once the first rasterizer thread has mapped the framebuffer */
+   bool rast_begun;
+
+   /**
+    * Rasterization of a scene may start while the previously queued scene
+    * is still being rasterized.  dep_fence is the fence of that scene if
+    * it had not finished when this one was queued.  If dep_scene is set,
+    * the two scenes render to the same framebuffer and only need to be
+    * ordered tile by tile, otherwise this scene waits for dep_fence.
+    */
+   struct lp_fence *dep_fence;
+   struct lp_scene *dep_scene;
+
+   /** Tiles completely rasterized, indexed by y * TILES_X + x */
+   BITSET_DECLARE(tiles_done, TILES_X * TILES_Y);
+
+   /** The scene's job in the screen thread pool, one iteration per thread */
+   struct lp_cs_tpool_task rast_task;
    struct data_block_list data;
 };
 
@@ -229,6 +279,8 @@ unsigned lp_scene_is_resource_referenced(const struct lp_scene *scene,
 bool lp_scene_add_frag_shader_reference(struct lp_scene *scene,
                                         struct lp_fragment_shader_variant *variant);
 
+bool lp_scene_wait_frag_shaders(struct lp_scene *scene);
+
 
 
 /**
@@ -342,6 +394,8 @@ lp_scene_bin_command(struct lp_scene *scene,
       tail->count++;
    }
 
+   bin->cost++;
+
    return true;
 }
 
@@ -396,11 +450,39 @@ lp_scene_get_num_bins(const struct lp_scene *scene)
 
 
 void
-lp_scene_bin_iter_begin(struct lp_scene *scene);
+lp_scene_bin_iter_begin(struct lp_scene *scene, unsigned num_bands);
+
+bool
+lp_scene_can_overlap(const struct lp_scene *prev,
+                     const struct lp_scene *scene);
 
 struct cmd_bin *
-lp_scene_bin_iter_next(struct lp_scene *scene, int *x, int *y);
+lp_scene_bin_iter_next(struct lp_scene *scene, unsigned band,
+                       int *x, int *y);
+
+
+
+static inline bool
+lp_scene_tile_is_done(const struct lp_scene *scene, unsigned x, unsigned y)
+{
+   unsigned idx = y * TILES_X + x;
+   return p_atomic_read(&scene->tiles_done[BITSET_BITWORD(idx)]) &
+          BITSET_BIT(idx);
+}
+
 
+/** Mark a tile as finished, called once the tile has been rasterized */
+static inline void
+lp_scene_tile_done(struct lp_scene *scene, unsigned x, unsigned y)
+{
+   unsigned idx = y * TILES_X + x;
+   BITSET_WORD *word = &scene->tiles_done[BITSET_BITWORD(idx)];
+   BITSET_WORD old;
+
+   do {
+      old = p_atomic_read(word);
+   } while (p_atomic_cmpxchg(word, old, old | BITSET_BIT(idx)) != old);
+}
 
 
 /* Begin/end binning of a scene
@@ -55,6 +55,7 @@
 #include "lp_rast.h"
 #include "lp_cs_tpool.h"
 #include "lp_flush.h"
+#include "lp_query.h"
 
 #include "frontend/sw_winsys.h"
 
@@ -101,6 +102,15 @@ static const struct debug_named_value lp_perf_flags[] = {
    { "no_alphatest",   PERF_NO_ALPHATEST, NULL },
    { "no_rast_linear", PERF_NO_RAST_LINEAR, NULL },
    { "no_shade",       PERF_NO_SHADE, NULL },
+   { "no_tile_sort",   PERF_NO_TILE_SORT, NULL },
+   { "no_scene_overlap", PERF_NO_SCENE_OVERLAP, NULL },
+   { "no_numa",        PERF_NO_NUMA, NULL },
+   { "no_async_cs",    PERF_NO_ASYNC_CS, NULL },
+   { "no_async_fs",    PERF_NO_ASYNC_FS, NULL },
+   { "no_microtile",   PERF_NO_MICROTILE, NULL },
+   { "no_tex_cache",   PERF_NO_TEX_CACHE, NULL },
+   { "tex_decompress", PERF_TEX_DECOMPRESS, NULL },
+   { "no_hiz",         PERF_NO_HIZ, NULL },
    DEBUG_NAMED_VALUE_END
 };
 
@@ -924,12 +934,17 @@ llvmpipe_destroy_screen(struct pipe_screen *_screen)
 {
    struct llvmpipe_screen *screen = llvmpipe_screen(_screen);
 
-   if (screen->cs_tpool)
-      lp_cs_tpool_destroy(screen->cs_tpool);
+   if (util_queue_is_initialized(&screen->fs_compile_queue))
+      util_queue_destroy(&screen->fs_compile_queue);
 
    if (screen->rast)
       lp_rast_destroy(screen->rast);
 
+   llvmpipe_sampler_matrix_destroy(screen);
+
+   if (screen->cs_tpool)
+      lp_cs_tpool_destroy(screen->cs_tpool);
+
    lp_jit_screen_cleanup(screen);
 
    disk_cache_destroy(screen->disk_shader_cache);
@@ -947,7 +962,7 @@ llvmpipe_destroy_screen(struct pipe_screen *_screen)
    mtx_destroy(&screen->mem_mutex);
 #endif
    mtx_destroy(&screen->rast_mutex);
-   mtx_destroy(&screen->cs_mutex);
+   mtx_destroy(&screen->cs_job_mutex);
    FREE(screen);
 }
 
@@ -1072,6 +1087,32 @@ lp_disk_cache_find_shader(struct llvmpipe_screen *screen,
 }
 
 
+/**
+ * Start loading the shaders of several lp_disk_cache_find_shader() calls
+ * that are about to happen, so that they are read and decompressed in
+ * parallel instead of one after the other.
+ */
+void
+lp_disk_cache_prefetch_shaders(struct llvmpipe_screen *screen,
+                               unsigned char (*ir_sha1_cache_keys)[20],
+                               unsigned count)
+{
+   if (!screen->disk_shader_cache || !count)
+      return;
+
+   cache_key *keys = malloc(count * sizeof(cache_key));
+   if (!keys)
+      return;
+
+   for (unsigned i = 0; i < count; i++)
+      disk_cache_compute_key(screen->disk_shader_cache, ir_sha1_cache_keys[i],
+                             20, keys[i]);
+
+   disk_cache_prefetch(screen->disk_shader_cache, keys, count);
+   free(keys);
+}
+
+
 void
 lp_disk_cache_insert_shader(struct llvmpipe_screen *screen,
                             struct lp_cached_code *cache,
@@ -1088,6 +1129,33 @@ lp_disk_cache_insert_shader(struct llvmpipe_screen *screen,
 }
 
 
+/**
+ * lp_disk_cache_insert_shader() for callbacks taking the screen as cookie.
+ */
+void
+lp_disk_cache_insert_shader_cb(void *cookie,
+                               struct lp_cached_code *cache,
+                               unsigned char ir_sha1_cache_key[20])
+{
+   lp_disk_cache_insert_shader(cookie, cache, ir_sha1_cache_key);
+}
+
+
+/**
+ * Restrict a worker thread to the CPUs of the given NUMA node.
+ */
+void
+lp_bind_thread_to_numa_node(thrd_t thread, unsigned node)
+{
+   const struct util_cpu_caps_t *caps = util_get_cpu_caps();
+
+   if (caps->numa_affinity_mask && node < caps->num_numa_nodes) {
+      util_set_thread_affinity(thread, caps->numa_affinity_mask[node], NULL,
+                               caps->num_cpu_mask_bits);
+   }
+}
+
+
 bool
 llvmpipe_screen_late_init(struct llvmpipe_screen *screen)
 {
@@ -1097,15 +1165,20 @@ llvmpipe_screen_late_init(struct llvmpipe_screen *screen)
    if (screen->late_init_done)
       goto out;
 
-   screen->rast = lp_rast_create(screen->num_threads);
-   if (!screen->rast) {
+   screen->cs_tpool = lp_cs_tpool_create(screen->num_threads,
+                                         screen->num_numa_nodes);
+   if (!screen->cs_tpool) {
       ret = false;
       goto out;
    }
 
-   screen->cs_tpool = lp_cs_tpool_create(screen->num_threads);
-   if (!screen->cs_tpool) {
-      lp_rast_destroy(screen->rast);
+   /* Fences and queries count on every pool thread taking part */
+   screen->num_threads = screen->cs_tpool->num_threads;
+
+   screen->rast = lp_rast_create(screen->cs_tpool, screen->num_numa_nodes);
+   if (!screen->rast) {
+      lp_cs_tpool_destroy(screen->cs_tpool);
+      screen->cs_tpool = NULL;
       ret = false;
       goto out;
    }
@@ -1118,6 +1191,20 @@ llvmpipe_screen_late_init(struct llvmpipe_screen *screen)
    lp_build_init(); /* get lp_native_vector_width initialised */
 
    lp_disk_cache_create(screen);
+
+#if !GALLIVM_USE_ORCJIT
+   /* ORCJIT compiles everything in one global JIT, so only MCJIT builds
+    * can compile variants concurrently with the application thread.
+    * Failing to create the queue just means compiling synchronously.
+    */
+   if (screen->num_threads && !(LP_PERF & PERF_NO_ASYNC_FS)) {
+      util_queue_init(&screen->fs_compile_queue, "lpfs", 64,
+                      CLAMP(screen->num_threads / 4, 1, 4),
+                      UTIL_QUEUE_INIT_RESIZE_IF_FULL |
+                      UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY, NULL);
+   }
+#endif
+
    screen->late_init_done = true;
 out:
    mtx_unlock(&screen->late_mutex);
@@ -1175,13 +1262,16 @@ llvmpipe_create_screen(struct sw_winsys *winsys)
 
    screen->base.get_disk_shader_cache = lp_get_disk_shader_cache;
    llvmpipe_init_screen_resource_funcs(&screen->base);
+   llvmpipe_init_screen_query_funcs(&screen->base);
 
    screen->allow_cl = !!getenv("LP_CL");
    screen->num_threads = util_get_cpu_caps()->nr_cpus > 1
       ? util_get_cpu_caps()->nr_cpus : 0;
    screen->num_threads = debug_get_num_option("LP_NUM_THREADS",
                                               screen->num_threads);
-   screen->num_threads = MIN2(screen->num_threads, LP_MAX_THREADS);
+
+   screen->num_numa_nodes = (LP_PERF & PERF_NO_NUMA) ? 1 :
+      MIN2(util_get_cpu_caps()->num_numa_nodes, LP_MAX_NUMA_NODES);
 
 #if defined(HAVE_LIBDRM) && defined(HAVE_LINUX_UDMABUF_H)
    screen->udmabuf_fd = open("/dev/udmabuf", O_RDWR);
@@ -1206,7 +1296,9 @@ llvmpipe_create_screen(struct sw_winsys *winsys)
 
    list_inithead(&screen->ctx_list);
    (void) mtx_init(&screen->ctx_mutex, mtx_plain);
-   (void) mtx_init(&screen->cs_mutex, mtx_plain);
+   list_inithead(&screen->cs_jobs);
+   (void) mtx_init(&screen->cs_job_mutex, mtx_plain);
+   llvmpipe_init_sampler_matrix(screen);
    (void) mtx_init(&screen->rast_mutex, mtx_plain);
 
    (void) mtx_init(&screen->late_mutex, mtx_plain);
@@ -37,10 +37,12 @@
 #include "pipe/p_screen.h"
 #include "pipe/p_defines.h"
 #include "util/u_thread.h"
+#include "util/u_queue.h"
 #include "util/list.h"
 #include "util/vma.h"
 #include "gallivm/lp_bld.h"
 #include "gallivm/lp_bld_misc.h"
+#include "lp_texture_handle.h"
 
 struct sw_winsys;
 struct lp_cs_tpool;
@@ -53,6 +55,9 @@ struct llvmpipe_screen
 
    unsigned num_threads;
 
+   /** Number of NUMA nodes the worker threads are spread over */
+   unsigned num_numa_nodes;
+
    /* Increments whenever textures are modified.  Contexts can track this.
     */
    unsigned timestamp;
@@ -60,8 +65,11 @@ struct llvmpipe_screen
    struct lp_rasterizer *rast;
    mtx_t rast_mutex;
 
+   /** Worker threads shared by the rasterizer and compute shaders */
    struct lp_cs_tpool *cs_tpool;
-   mtx_t cs_mutex;
+
+   /** Compiles fragment shader variants off the application thread */
+   struct util_queue fs_compile_queue;
 
    bool allow_cl;
 
@@ -71,6 +79,13 @@ struct llvmpipe_screen
    mtx_t ctx_mutex;
    struct list_head ctx_list;
 
+   /** Compute grids of all contexts still running, see lp_cs_job */
+   mtx_t cs_job_mutex;
+   struct list_head cs_jobs;
+
+   /** Texture functions behind the texture and image handles of all contexts */
+   struct lp_sampler_matrix sampler_matrix;
+
    char renderer_string[100];
 
    struct disk_cache *disk_shader_cache;
@@ -97,14 +112,28 @@ lp_disk_cache_find_shader(struct llvmpipe_screen *screen,
                           unsigned char ir_sha1_cache_key[20]);
 
 
+void
+lp_disk_cache_prefetch_shaders(struct llvmpipe_screen *screen,
+                               unsigned char (*ir_sha1_cache_keys)[20],
+                               unsigned count);
+
+
 void
 lp_disk_cache_insert_shader(struct llvmpipe_screen *screen,
                             struct lp_cached_code *cache,
                             unsigned char ir_sha1_cache_key[20]);
 
+void
+lp_disk_cache_insert_shader_cb(void *cookie,
+                               struct lp_cached_code *cache,
+                               unsigned char ir_sha1_cache_key[20]);
+
 bool
 llvmpipe_screen_late_init(struct llvmpipe_screen *screen);
 
+void
+lp_bind_thread_to_numa_node(thrd_t thread, unsigned node);
+
 
 static inline struct llvmpipe_screen *
 llvmpipe_screen(struct pipe_screen *pipe)
@@ -68,12 +68,23 @@ try_update_scene_state(struct lp_setup_context *setup);
 static unsigned
 lp_setup_wait_empty_scene(struct lp_setup_context *setup)
 {
-   /* just use the first scene if we run out */
-   if (setup->scenes[0]->fence) {
-      lp_fence_wait(setup->scenes[0]->fence);
-      lp_scene_end_rasterization(setup->scenes[0]);
+   /* Wait for the oldest scene if we run out, it's the one most likely
+    * to be finished already.
+    */
+   unsigned oldest = 0;
+   for (unsigned i = 1; i < setup->num_active_scenes; i++) {
+      const struct lp_fence *fence = setup->scenes[i]->fence;
+      const struct lp_fence *oldest_fence = setup->scenes[oldest]->fence;
+      if (fence && oldest_fence &&
+          (int)(fence->id - oldest_fence->id) < 0)
+         oldest = i;
+   }
+
+   if (setup->scenes[oldest]->fence) {
+      lp_fence_wait(setup->scenes[oldest]->fence);
+      lp_scene_end_rasterization(setup->scenes[oldest]);
    }
-   return 0;
+   return oldest;
 }
 
 
@@ -113,6 +124,7 @@ lp_setup_get_empty_scene(struct lp_setup_context *setup)
 
    setup->scene = setup->scenes[i];
    setup->scene->permit_linear_rasterizer = setup->permit_linear_rasterizer;
+   setup->scene->tex_cache_volatile = false;
    lp_scene_begin_binning(setup->scene, &setup->fb);
 }
 
@@ -1123,6 +1135,8 @@ try_update_scene_state(struct lp_setup_context *setup)
                   assert(!new_scene);
                   return false;
                }
+               if (llvmpipe_resource_is_volatile_compressed(setup->fs.current_tex[i]))
+                  scene->tex_cache_volatile = true;
             }
          }
 
@@ -1303,14 +1317,19 @@ lp_setup_destroy(struct lp_setup_context *setup)
       pipe_resource_reference(&setup->images[i].current.resource, NULL);
    }
 
-   /* free the scenes in the 'empty' queue */
+   /* Wait for all the scenes before freeing any: a scene still being
+    * rasterized may be looking at the tiles of the one before it.
+    */
    for (unsigned i = 0; i < setup->num_active_scenes; i++) {
       struct lp_scene *scene = setup->scenes[i];
 
       if (scene->fence)
          lp_fence_wait(scene->fence);
+   }
 
-      lp_scene_destroy(scene);
+   /* free the scenes in the 'empty' queue */
+   for (unsigned i = 0; i < setup->num_active_scenes; i++) {
+      lp_scene_destroy(setup->scenes[i]);
    }
 
    LP_DBG(DEBUG_SETUP, "number of scenes used: %d\n", setup->num_active_scenes);
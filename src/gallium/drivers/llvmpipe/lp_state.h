@@ -84,6 +84,7 @@
 struct vertex_info;
 struct pipe_context;
 struct llvmpipe_context;
+struct llvmpipe_screen;
 
 
 
@@ -161,6 +162,15 @@ llvmpipe_init_draw_funcs(struct llvmpipe_context *llvmpipe);
 void
 llvmpipe_init_compute_funcs(struct llvmpipe_context *llvmpipe);
 
+void
+llvmpipe_cs_wait_jobs(struct llvmpipe_context *llvmpipe);
+
+bool
+llvmpipe_cs_wait_for_resource(struct llvmpipe_screen *screen,
+                              const struct pipe_resource *resource,
+                              bool read_only,
+                              bool do_not_block);
+
 void
 llvmpipe_init_clip_funcs(struct llvmpipe_context *llvmpipe);
 
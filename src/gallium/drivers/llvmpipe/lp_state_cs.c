@@ -78,6 +78,31 @@ struct lp_cs_job_info {
    size_t payload_stride;
 };
 
+/**
+ * A compute grid the context doesn't wait for at launch.  It has its own
+ * copy of the bound state and holds references to the bound resources,
+ * so the context can change them while the grid runs.
+ *
+ * Grids are also on the screen's list, other contexts mapping or drawing
+ * with a resource wait for them there.
+ */
+struct lp_cs_job {
+   struct list_head list;
+   struct list_head screen_list;
+   struct lp_cs_tpool_task *task;
+   struct lp_cs_job_info info;
+   struct lp_cs_exec exec;
+
+   /** the shader reaches memory the resources below don't cover */
+   bool untracked_reads;
+   bool untracked_writes;
+
+   /** the first num_writeable resources may be written by the grid */
+   unsigned num_writeable;
+   unsigned num_resources;
+   struct pipe_resource *resources[];
+};
+
 enum {
    CS_ARG_CONTEXT,
    CS_ARG_RESOURCES,
@@ -452,7 +477,8 @@ generate_compute(struct llvmpipe_context *lp,
 
    sampler = lp_llvm_sampler_soa_create(lp_cs_variant_key_samplers(key),
                                         MAX2(key->nr_samplers,
-                                             key->nr_sampler_views));
+                                             key->nr_sampler_views),
+                                        false);
    image = lp_bld_llvm_image_soa_create(lp_cs_variant_key_images(key), key->nr_images);
 
    if (exec_list_length(&nir->functions) > 1) {
@@ -919,6 +945,71 @@ generate_compute(struct llvmpipe_context *lp,
 }
 
 
+/**
+ * Look for memory accesses which don't go through the bound buffers,
+ * images and sampler views: global addresses, bindless handles and
+ * descriptor buffers (buffer indices with more than one component).
+ * Grids of such shaders can't tell which resources they use.
+ */
+static void
+lp_cs_scan_untracked_access(struct lp_compute_shader *shader,
+                            const struct nir_shader *nir)
+{
+   nir_foreach_function_impl(impl, nir) {
+      nir_foreach_block(block, impl) {
+         nir_foreach_instr(instr, block) {
+            if (instr->type == nir_instr_type_tex) {
+               nir_tex_instr *tex = nir_instr_as_tex(instr);
+               if (nir_tex_instr_src_index(tex, nir_tex_src_texture_handle) >= 0)
+                  shader->untracked_reads = true;
+               continue;
+            }
+
+            if (instr->type != nir_instr_type_intrinsic)
+               continue;
+
+            nir_intrinsic_instr *intr = nir_instr_as_intrinsic(instr);
+            switch (intr->intrinsic) {
+            case nir_intrinsic_load_global:
+            case nir_intrinsic_load_global_constant:
+            case nir_intrinsic_bindless_image_load:
+            case nir_intrinsic_bindless_image_sparse_load:
+               shader->untracked_reads = true;
+               break;
+            case nir_intrinsic_store_global:
+            case nir_intrinsic_global_atomic:
+            case nir_intrinsic_global_atomic_swap:
+            case nir_intrinsic_bindless_image_store:
+            case nir_intrinsic_bindless_image_atomic:
+            case nir_intrinsic_bindless_image_atomic_swap:
+               shader->untracked_reads = true;
+               shader->untracked_writes = true;
+               break;
+            case nir_intrinsic_load_ubo:
+            case nir_intrinsic_load_ssbo:
+               if (nir_src_num_components(intr->src[0]) > 1)
+                  shader->untracked_reads = true;
+               break;
+            case nir_intrinsic_store_ssbo:
+               if (nir_src_num_components(intr->src[1]) > 1)
+                  shader->untracked_writes = true;
+               break;
+            case nir_intrinsic_ssbo_atomic:
+            case nir_intrinsic_ssbo_atomic_swap:
+               if (nir_src_num_components(intr->src[0]) > 1) {
+                  shader->untracked_reads = true;
+                  shader->untracked_writes = true;
+               }
+               break;
+            default:
+               break;
+            }
+         }
+      }
+   }
+}
+
+
 static void *
 llvmpipe_create_compute_state(struct pipe_context *pipe,
                               const struct pipe_compute_state *templ)
@@ -949,6 +1040,7 @@ llvmpipe_create_compute_state(struct pipe_context *pipe,
    nir = (struct nir_shader *)shader->base.ir.nir;
    shader->req_local_mem += nir->info.shared_size;
    shader->zero_initialize_shared_memory = nir->info.zero_initialize_shared_memory;
+   lp_cs_scan_untracked_access(shader, nir);
 
    llvmpipe_register_shader(pipe, &shader->base);
 
@@ -991,6 +1083,22 @@ llvmpipe_get_compute_state_info(struct pipe_context *pipe, void *cs,
 }
 
 
+/**
+ * Wait for the grids of all contexts running a variant.
+ */
+static void
+lp_cs_wait_for_variant(struct llvmpipe_screen *screen,
+                       const struct lp_compute_shader_variant *variant)
+{
+   mtx_lock(&screen->cs_job_mutex);
+   list_for_each_entry(struct lp_cs_job, job, &screen->cs_jobs, screen_list) {
+      if (job->exec.variant == variant)
+         lp_cs_tpool_wait_for_task_done(screen->cs_tpool, job->task);
+   }
+   mtx_unlock(&screen->cs_job_mutex);
+}
+
+
 /**
  * Remove shader variant from two lists: the shader's variant list
  * and the context's variant list.
@@ -999,6 +1107,9 @@ static void
 llvmpipe_remove_cs_shader_variant(struct llvmpipe_context *lp,
                                   struct lp_compute_shader_variant *variant)
 {
+   /* pending grids of any context may still be running the variant */
+   lp_cs_wait_for_variant(llvmpipe_screen(lp->pipe.screen), variant);
+
    if ((LP_DEBUG & DEBUG_CS) || (gallivm_debug & GALLIVM_DEBUG_IR)) {
       debug_printf("llvmpipe: del cs #%u var %u v created %u v cached %u "
                    "v total cached %u inst %u total inst %u\n",
@@ -1255,6 +1366,8 @@ generate_variant(struct llvmpipe_context *lp,
       return NULL;
    }
 
+   gallivm_compile_fast(variant->gallivm);
+
    variant->list_item_global.base = variant;
    variant->list_item_local.base = variant;
    variant->no = shader->variants_created++;
@@ -1291,7 +1404,17 @@ generate_variant(struct llvmpipe_context *lp,
    variant->jit_function = (lp_jit_cs_func)
       gallivm_jit_function(variant->gallivm, variant->function, variant->function_name);
 
-   if (needs_caching) {
+   if (variant->gallivm->fast) {
+      struct gallivm_tier_info tier = {
+         .num_funcs = 1,
+         .names = { variant->function_name },
+         .slots = { (func_pointer *)&variant->jit_function },
+         .cache_insert = needs_caching ? lp_disk_cache_insert_shader_cb : NULL,
+         .cache_cookie = screen,
+      };
+      memcpy(tier.cache_key, ir_sha1_cache_key, sizeof tier.cache_key);
+      gallivm_tier_up(variant->gallivm, &tier);
+   } else if (needs_caching) {
       lp_disk_cache_insert_shader(screen, &cached, ir_sha1_cache_key);
    }
    gallivm_free_ir(variant->gallivm);
@@ -1387,7 +1510,7 @@ llvmpipe_update_cs_variant(struct llvmpipe_context *lp,
       variant = generate_variant(lp, shader, sh_type, key);
       t1 = os_time_get();
       dt = t1 - t0;
-      LP_COUNT_ADD(llvm_compile_time, dt);
+      LP_COUNT_ADD_ATOMIC(llvm_compile_time, dt);
       LP_COUNT_ADD(nr_llvm_compiles, 2);  /* emit vs. omit in/out test */
 
       /* Put the new variant into the list */
@@ -1431,9 +1554,12 @@ lp_csctx_set_sampler_views(struct lp_cs_context *csctx,
 
       /* We are going to overwrite/unref the current texture further below. If
        * set, make sure to unmap its resource to avoid leaking previous
-       * mapping.  */
-      if (csctx->cs.current_tex[i])
+       * mapping.  Pending grids may still be sampling display targets.  */
+      if (csctx->cs.current_tex[i]) {
+         if (llvmpipe_resource(csctx->cs.current_tex[i])->dt)
+            llvmpipe_cs_wait_jobs(llvmpipe_context(csctx->pipe));
          llvmpipe_resource_unmap(csctx->cs.current_tex[i], 0, 0);
+      }
 
       if (view) {
          struct pipe_resource *res = view->texture;
@@ -1591,6 +1717,14 @@ update_csctx_ssbo(struct llvmpipe_context *llvmpipe,
 static void
 llvmpipe_cs_update_derived(struct llvmpipe_context *llvmpipe, const void *input)
 {
+   struct llvmpipe_screen *screen = llvmpipe_screen(llvmpipe->pipe.screen);
+
+   /* Check for textures that changed their layout. */
+   if (llvmpipe->cs_tex_timestamp != screen->timestamp) {
+      llvmpipe->cs_tex_timestamp = screen->timestamp;
+      llvmpipe->cs_dirty |= LP_CSNEW_SAMPLER_VIEW | LP_CSNEW_IMAGES;
+   }
+
    if (llvmpipe->cs_dirty & LP_CSNEW_CONSTANTS) {
       lp_csctx_set_cs_constants(llvmpipe->csctx,
                                 ARRAY_SIZE(llvmpipe->constants[PIPE_SHADER_COMPUTE]),
@@ -1724,6 +1858,189 @@ fill_grid_size(struct pipe_context *pipe,
 }
 
 
+static void
+lp_cs_job_destroy(struct llvmpipe_context *llvmpipe, struct lp_cs_job *job)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(llvmpipe->pipe.screen);
+
+   /* other contexts may wait for the task as long as the job is listed */
+   mtx_lock(&screen->cs_job_mutex);
+   list_del(&job->screen_list);
+   mtx_unlock(&screen->cs_job_mutex);
+
+   lp_cs_tpool_wait_for_task(screen->cs_tpool, &job->task);
+
+   for (unsigned i = 0; i < job->num_resources; i++)
+      pipe_resource_reference(&job->resources[i], NULL);
+
+   list_del(&job->list);
+   llvmpipe->num_cs_jobs--;
+   FREE(job);
+}
+
+
+/**
+ * Wait for all the compute grids launched by the context.
+ */
+void
+llvmpipe_cs_wait_jobs(struct llvmpipe_context *llvmpipe)
+{
+   list_for_each_entry_safe(struct lp_cs_job, job, &llvmpipe->cs_jobs, list)
+      lp_cs_job_destroy(llvmpipe, job);
+}
+
+
+/**
+ * Free the grids which are done, waiting for the oldest ones if there are
+ * too many in flight.
+ */
+static void
+lp_cs_jobs_retire(struct llvmpipe_context *llvmpipe)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(llvmpipe->pipe.screen);
+
+   list_for_each_entry_safe(struct lp_cs_job, job, &llvmpipe->cs_jobs, list) {
+      if (llvmpipe->num_cs_jobs < LP_MAX_CS_JOBS &&
+          !lp_cs_tpool_task_is_done(screen->cs_tpool, job->task))
+         break;
+      lp_cs_job_destroy(llvmpipe, job);
+   }
+}
+
+
+/**
+ * Whether a grid may write a resource, or read it when the caller wants
+ * to write it.  Grids with untracked accesses may use any resource.
+ */
+static bool
+lp_cs_job_conflicts(const struct lp_cs_job *job,
+                    const struct pipe_resource *resource,
+                    bool read_only)
+{
+   if (job->untracked_writes || (job->untracked_reads && !read_only))
+      return true;
+
+   for (unsigned i = 0; i < job->num_resources; i++) {
+      if (job->resources[i] == resource &&
+          (i < job->num_writeable || !read_only))
+         return true;
+   }
+   return false;
+}
+
+
+/**
+ * Wait for the grids of all contexts which conflict with accessing a
+ * resource, see lp_cs_job_conflicts().
+ *
+ * Returns false if it would have to wait but do_not_block was set.
+ */
+bool
+llvmpipe_cs_wait_for_resource(struct llvmpipe_screen *screen,
+                              const struct pipe_resource *resource,
+                              bool read_only,
+                              bool do_not_block)
+{
+   bool done = true;
+
+   mtx_lock(&screen->cs_job_mutex);
+   list_for_each_entry(struct lp_cs_job, job, &screen->cs_jobs, screen_list) {
+      if (!lp_cs_job_conflicts(job, resource, read_only))
+         continue;
+
+      if (do_not_block) {
+         if (!lp_cs_tpool_task_is_done(screen->cs_tpool, job->task)) {
+            done = false;
+            break;
+         }
+      } else {
+         lp_cs_tpool_wait_for_task_done(screen->cs_tpool, job->task);
+      }
+   }
+   mtx_unlock(&screen->cs_job_mutex);
+
+   return done;
+}
+
+
+static void
+lp_cs_job_add_resource(struct lp_cs_job *job, struct pipe_resource *res)
+{
+   if (res) {
+      job->resources[job->num_resources] = NULL;
+      pipe_resource_reference(&job->resources[job->num_resources++], res);
+   }
+}
+
+
+/**
+ * Snapshot the compute state bound to the context for a grid launched
+ * without waiting.  User constant buffers are copied along, the caller
+ * may change them as soon as the launch returns.
+ */
+static struct lp_cs_job *
+lp_cs_job_create(struct llvmpipe_context *llvmpipe,
+                 const struct lp_cs_job_info *info)
+{
+   struct lp_cs_context *csctx = llvmpipe->csctx;
+   struct lp_compute_shader *cs = llvmpipe->cs;
+   unsigned max_resources = ARRAY_SIZE(csctx->ssbos) +
+                            ARRAY_SIZE(csctx->images) +
+                            ARRAY_SIZE(csctx->constants) +
+                            csctx->cs.current_tex_num +
+                            cs->max_global_buffers;
+   size_t job_size = align(sizeof(struct lp_cs_job) +
+                           max_resources * sizeof(struct pipe_resource *), 16);
+   size_t user_size = 0;
+
+   for (unsigned i = 0; i < ARRAY_SIZE(csctx->constants); i++) {
+      const struct pipe_constant_buffer *cb = &csctx->constants[i].current;
+      if (!cb->buffer && cb->user_buffer)
+         user_size += align(cb->buffer_size, 16);
+   }
+
+   struct lp_cs_job *job = MALLOC(job_size + user_size);
+   if (!job)
+      return NULL;
+
+   job->task = NULL;
+   job->info = *info;
+   job->exec = csctx->cs.current;
+   job->info.current = &job->exec;
+   job->untracked_reads = cs->untracked_reads;
+   job->untracked_writes = cs->untracked_writes;
+   job->num_resources = 0;
+
+   uint8_t *user_data = (uint8_t *)job + job_size;
+   for (unsigned i = 0; i < ARRAY_SIZE(csctx->constants); i++) {
+      const struct pipe_constant_buffer *cb = &csctx->constants[i].current;
+      struct lp_jit_buffer *jit = &job->exec.jit_resources.constants[i];
+      if (cb->buffer || !cb->user_buffer)
+         continue;
+      if (jit->num_elements) {
+         memcpy(user_data, (const uint8_t *)cb->user_buffer + cb->buffer_offset,
+                cb->buffer_size);
+         jit->f = (const float *)user_data;
+      }
+      user_data += align(cb->buffer_size, 16);
+   }
+
+   for (unsigned i = 0; i < ARRAY_SIZE(csctx->ssbos); i++)
+      lp_cs_job_add_resource(job, csctx->ssbos[i].current.buffer);
+   for (unsigned i = 0; i < ARRAY_SIZE(csctx->images); i++)
+      lp_cs_job_add_resource(job, csctx->images[i].current.resource);
+   for (unsigned i = 0; i < cs->max_global_buffers; i++)
+      lp_cs_job_add_resource(job, cs->global_buffers[i]);
+   job->num_writeable = job->num_resources;
+   for (unsigned i = 0; i < ARRAY_SIZE(csctx->constants); i++)
+      lp_cs_job_add_resource(job, csctx->constants[i].current.buffer);
+   for (unsigned i = 0; i < csctx->cs.current_tex_num; i++)
+      lp_cs_job_add_resource(job, csctx->cs.current_tex[i]);
+
+   return job;
+}
+
+
 static void
 llvmpipe_launch_grid(struct pipe_context *pipe,
                      const struct pipe_grid_info *info)
@@ -1754,12 +2071,33 @@ llvmpipe_launch_grid(struct pipe_context *pipe,
 
    int num_tasks = job_info.grid_size[2] * job_info.grid_size[1] * job_info.grid_size[0];
    if (num_tasks) {
-      struct lp_cs_tpool_task *task;
-      mtx_lock(&screen->cs_mutex);
-      task = lp_cs_tpool_queue_task(screen->cs_tpool, cs_exec_fn, &job_info, num_tasks);
-      mtx_unlock(&screen->cs_mutex);
+      struct lp_cs_job *job = NULL;
 
-      lp_cs_tpool_wait_for_task(screen->cs_tpool, &task);
+      /* Grids are waited for by barriers, flushes and maps of the resources
+       * they use.  Kernel inputs live in caller memory, so launches with
+       * them still wait right away.
+       */
+      if (screen->cs_tpool->num_threads && !info->input &&
+          !(LP_PERF & PERF_NO_ASYNC_CS)) {
+         lp_cs_jobs_retire(llvmpipe);
+         job = lp_cs_job_create(llvmpipe, &job_info);
+      }
+
+      if (job) {
+         job->task = lp_cs_tpool_queue_task(screen->cs_tpool, cs_exec_fn,
+                                            &job->info, num_tasks);
+         list_addtail(&job->list, &llvmpipe->cs_jobs);
+         llvmpipe->num_cs_jobs++;
+
+         mtx_lock(&screen->cs_job_mutex);
+         list_addtail(&job->screen_list, &screen->cs_jobs);
+         mtx_unlock(&screen->cs_job_mutex);
+      } else {
+         struct lp_cs_tpool_task *task;
+         task = lp_cs_tpool_queue_task(screen->cs_tpool, cs_exec_fn, &job_info, num_tasks);
+
+         lp_cs_tpool_wait_for_task(screen->cs_tpool, &task);
+      }
    }
    if (!llvmpipe->queries_disabled)
       llvmpipe->pipeline_statistics.cs_invocations += num_tasks * info->block[0] * info->block[1] * info->block[2];
@@ -2164,9 +2502,7 @@ llvmpipe_draw_mesh_tasks(struct pipe_context *pipe,
 
          if (num_tasks) {
             struct lp_cs_tpool_task *task;
-            mtx_lock(&screen->cs_mutex);
             task = lp_cs_tpool_queue_task(screen->cs_tpool, cs_exec_fn, &job_info, num_tasks);
-            mtx_unlock(&screen->cs_mutex);
 
             lp_cs_tpool_wait_for_task(screen->cs_tpool, &task);
          }
@@ -2228,9 +2564,7 @@ llvmpipe_draw_mesh_tasks(struct pipe_context *pipe,
                   job_info.io = vbuf;
                   if (num_tasks) {
                      struct lp_cs_tpool_task *task;
-                     mtx_lock(&screen->cs_mutex);
                      task = lp_cs_tpool_queue_task(screen->cs_tpool, cs_exec_fn, &job_info, num_tasks);
-                     mtx_unlock(&screen->cs_mutex);
 
                      lp_cs_tpool_wait_for_task(screen->cs_tpool, &task);
                   }
@@ -123,6 +123,10 @@ struct lp_compute_shader {
    unsigned variants_cached;
    bool zero_initialize_shared_memory;
 
+   /** accesses through bindless handles, descriptor buffers or addresses */
+   bool untracked_reads;
+   bool untracked_writes;
+
    int max_global_buffers;
    struct pipe_resource **global_buffers;
 };
@@ -35,6 +35,7 @@
 #include "lp_screen.h"
 #include "lp_setup.h"
 #include "lp_state.h"
+#include "lp_texture.h"
 
 #include "tgsi/tgsi_from_mesa.h"
 
@@ -202,6 +203,7 @@ check_linear_rasterizer(struct llvmpipe_context *lp)
       (lp->framebuffer.nr_cbufs == 1 && lp->framebuffer.cbufs[0] &&
        util_res_sample_count(lp->framebuffer.cbufs[0]->texture) == 1 &&
        lp->framebuffer.cbufs[0]->texture->target == PIPE_TEXTURE_2D &&
+       !llvmpipe_resource(lp->framebuffer.cbufs[0]->texture)->microtiled &&
        (lp->framebuffer.cbufs[0]->format == PIPE_FORMAT_B8G8R8A8_UNORM ||
         lp->framebuffer.cbufs[0]->format == PIPE_FORMAT_B8G8R8X8_UNORM ||
         lp->framebuffer.cbufs[0]->format == PIPE_FORMAT_R8G8B8A8_UNORM ||
@@ -298,15 +300,16 @@ llvmpipe_update_derived(struct llvmpipe_context *llvmpipe)
                           LP_NEW_VS))
       compute_vertex_info(llvmpipe);
 
-   if (llvmpipe->dirty & (LP_NEW_FS |
-                          LP_NEW_FRAMEBUFFER |
-                          LP_NEW_BLEND |
-                          LP_NEW_SCISSOR |
-                          LP_NEW_DEPTH_STENCIL_ALPHA |
-                          LP_NEW_RASTERIZER |
-                          LP_NEW_SAMPLER |
-                          LP_NEW_SAMPLER_VIEW |
-                          LP_NEW_OCCLUSION_QUERY))
+   if ((llvmpipe->dirty & (LP_NEW_FS |
+                           LP_NEW_FRAMEBUFFER |
+                           LP_NEW_BLEND |
+                           LP_NEW_SCISSOR |
+                           LP_NEW_DEPTH_STENCIL_ALPHA |
+                           LP_NEW_RASTERIZER |
+                           LP_NEW_SAMPLER |
+                           LP_NEW_SAMPLER_VIEW |
+                           LP_NEW_OCCLUSION_QUERY)) ||
+       llvmpipe->fs_fallback)
       llvmpipe_update_fs(llvmpipe);
 
    if (llvmpipe->dirty & (LP_NEW_FS |
@@ -68,6 +68,7 @@
 #include "util/u_dual_blend.h"
 #include "util/u_upload_mgr.h"
 #include "util/os_time.h"
+#include "util/perf/cpu_trace.h"
 #include "pipe/p_shader_tokens.h"
 #include "draw/draw_context.h"
 #include "nir/tgsi_to_nir.h"
@@ -3281,7 +3282,8 @@ generate_fragment(struct llvmpipe_context *lp,
    struct lp_build_sampler_soa *sampler =
       lp_llvm_sampler_soa_create(lp_fs_variant_key_samplers(key),
                                  MAX2(key->nr_samplers,
-                                      key->nr_sampler_views));
+                                      key->nr_sampler_views),
+                                 true);
    struct lp_build_image_soa *image =
       lp_bld_llvm_image_soa_create(lp_fs_variant_key_images(key), key->nr_images);
 
@@ -3711,9 +3713,169 @@ lp_fs_get_ir_cache_key(struct lp_fragment_shader_variant *variant,
 }
 
 
+/**
+ * Everything needed to turn the IR of a fragment shader variant into
+ * machine code, possibly on one of the screen's compile threads.
+ */
+struct lp_fs_compile_job
+{
+   struct llvmpipe_screen *screen;
+   struct lp_fragment_shader_variant *variant;
+
+   /* Background compiles get a private LLVM context, as the context's
+    * one can't be used from two threads at once.
+    */
+   bool async;
+   lp_context_ref context;
+
+   struct lp_cached_code cached;
+   unsigned char ir_sha1_cache_key[20];
+   bool needs_caching;
+   bool linear_pipeline;
+};
+
+
+static struct lp_fs_compile_job *
+lp_fs_compile_job_create(struct llvmpipe_screen *screen)
+{
+   if (!util_queue_is_initialized(&screen->fs_compile_queue))
+      return NULL;
+
+   struct lp_fs_compile_job *job = CALLOC_STRUCT(lp_fs_compile_job);
+   if (!job)
+      return NULL;
+
+   lp_context_create(&job->context);
+   if (!job->context.ref) {
+      FREE(job);
+      return NULL;
+   }
+
+   job->async = true;
+   return job;
+}
+
+
+static void
+lp_fs_compile_job_destroy(struct lp_fs_compile_job *job)
+{
+   if (job->async) {
+      lp_context_destroy(&job->context);
+      FREE(job);
+   }
+}
+
+
+/**
+ * Compile the variant's module and look up the JIT'ed functions.
+ */
+static void
+compile_variant(struct lp_fs_compile_job *job)
+{
+   struct lp_fragment_shader_variant *variant = job->variant;
+
+#if GALLIVM_USE_ORCJIT
+/* module has been moved into ORCJIT after gallivm_compile_module */
+   variant->nr_instrs += lp_build_count_ir_module(variant->gallivm->module);
+
+   gallivm_compile_module(variant->gallivm);
+#else
+   gallivm_compile_module(variant->gallivm);
+
+   /* Background compiles were counted when queued */
+   if (!job->async)
+      variant->nr_instrs += lp_build_count_ir_module(variant->gallivm->module);
+#endif
+
+   if (variant->function[RAST_EDGE_TEST]) {
+      variant->jit_function[RAST_EDGE_TEST] = (lp_jit_frag_func)
+            gallivm_jit_function(variant->gallivm,
+                                 variant->function[RAST_EDGE_TEST],
+                                 variant->function_name[RAST_EDGE_TEST]);
+   }
+
+   if (variant->function[RAST_WHOLE]) {
+      variant->jit_function[RAST_WHOLE] = (lp_jit_frag_func)
+         gallivm_jit_function(variant->gallivm,
+                              variant->function[RAST_WHOLE],
+                              variant->function_name[RAST_WHOLE]);
+   } else if (!variant->jit_function[RAST_WHOLE]) {
+      variant->jit_function[RAST_WHOLE] = (lp_jit_frag_func)
+         variant->jit_function[RAST_EDGE_TEST];
+   }
+
+   if (job->linear_pipeline) {
+      if (variant->linear_function) {
+         variant->jit_linear_llvm = (lp_jit_linear_llvm_func)
+            gallivm_jit_function(variant->gallivm, variant->linear_function,
+                                 variant->linear_function_name);
+      }
+
+      /*
+       * This must be done after LLVM compilation, as it will call the JIT'ed
+       * code to determine active inputs.
+       */
+      lp_linear_check_variant(variant);
+   }
+
+   if (variant->gallivm->fast) {
+      struct gallivm_tier_info tier = {
+         .cache_insert = job->needs_caching ? lp_disk_cache_insert_shader_cb : NULL,
+         .cache_cookie = job->screen,
+      };
+      memcpy(tier.cache_key, job->ir_sha1_cache_key, sizeof tier.cache_key);
+
+      for (unsigned i = 0; i < ARRAY_SIZE(variant->jit_function); i++) {
+         /* RAST_WHOLE may be the edge test function */
+         const char *name = variant->function_name[i] ?
+            variant->function_name[i] : variant->function_name[RAST_EDGE_TEST];
+         if (name) {
+            tier.names[tier.num_funcs] = name;
+            tier.slots[tier.num_funcs++] = (func_pointer *)&variant->jit_function[i];
+         }
+      }
+      if (variant->jit_linear_llvm) {
+         tier.names[tier.num_funcs] = variant->linear_function_name;
+         tier.slots[tier.num_funcs++] = (func_pointer *)&variant->jit_linear_llvm;
+      }
+
+      gallivm_tier_up(variant->gallivm, &tier);
+   } else if (job->needs_caching) {
+      lp_disk_cache_insert_shader(job->screen, &job->cached,
+                                  job->ir_sha1_cache_key);
+   }
+
+   gallivm_free_ir(variant->gallivm);
+}
+
+
+static void
+lp_fs_compile_job_execute(void *data, void *gdata, int thread_index)
+{
+   struct lp_fs_compile_job *job = data;
+
+   MESA_TRACE_FUNC();
+
+   int64_t t0 = os_time_get();
+   compile_variant(job);
+   LP_COUNT_ADD_ATOMIC(llvm_compile_time, os_time_get() - t0);
+}
+
+
+static void
+lp_fs_compile_job_cleanup(void *data, void *gdata, int thread_index)
+{
+   lp_fs_compile_job_destroy(data);
+}
+
+
 /**
  * Generate a new fragment shader variant from the shader code and
  * other state indicated by the key.
+ *
+ * When the screen has a compile queue, only the IR is built here and
+ * the variant is returned while still being compiled; see
+ * lp_fragment_shader_variant::ready.
  */
 static struct lp_fragment_shader_variant *
 generate_variant(struct llvmpipe_context *lp,
@@ -3734,26 +3896,37 @@ generate_variant(struct llvmpipe_context *lp,
    memcpy(&variant->key, key, shader->variant_key_size);
 
    struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
-   struct lp_cached_code cached = { 0 };
-   unsigned char ir_sha1_cache_key[20];
-   bool needs_caching = false;
+   struct lp_fs_compile_job sync_job = { 0 };
+   struct lp_fs_compile_job *job = lp_fs_compile_job_create(screen);
+   if (!job)
+      job = &sync_job;
+
+   job->screen = screen;
+   job->variant = variant;
+
    if (shader->base.ir.nir) {
-      lp_fs_get_ir_cache_key(variant, ir_sha1_cache_key);
+      lp_fs_get_ir_cache_key(variant, job->ir_sha1_cache_key);
 
-      lp_disk_cache_find_shader(screen, &cached, ir_sha1_cache_key);
-      if (!cached.data_size)
-         needs_caching = true;
+      lp_disk_cache_find_shader(screen, &job->cached, job->ir_sha1_cache_key);
+      if (!job->cached.data_size)
+         job->needs_caching = true;
    }
 
    char module_name[64];
    snprintf(module_name, sizeof(module_name), "fs%u_variant%u",
             shader->no, shader->variants_created);
-   variant->gallivm = gallivm_create(module_name, &lp->context, &cached);
+   variant->gallivm = gallivm_create(module_name,
+                                     job->async ? &job->context : &lp->context,
+                                     &job->cached);
    if (!variant->gallivm) {
+      lp_fs_compile_job_destroy(job);
       FREE(variant);
       return NULL;
    }
 
+   /* Optimized in the background after compile_variant(), if enabled */
+   gallivm_compile_fast(variant->gallivm);
+
    variant->list_item_global.base = variant;
    variant->list_item_local.base = variant;
    variant->no = shader->variants_created++;
@@ -3807,6 +3980,48 @@ generate_variant(struct llvmpipe_context *lp,
          shader->info.cbuf[0][3].file != TGSI_FILE_NULL
          ? true : false;
 
+   /*
+    * Hierarchical depth: blocks where the whole primitive is behind the
+    * depth buffer can be skipped when a failed depth test is all that
+    * would have happened there, i.e. the depth test comes before any side
+    * effect and failing it writes no stencil.
+    */
+   const bool writes_depth =
+      nir->info.outputs_written & BITFIELD64_BIT(FRAG_RESULT_DEPTH);
+   const bool writes_stencil =
+      key->stencil[0].enabled &&
+      (key->stencil[0].writemask ||
+       (key->stencil[1].enabled && key->stencil[1].writemask));
+
+   if (key->depth.enabled && !writes_depth && !writes_stencil &&
+       (!nir->info.writes_memory || nir->info.fs.early_fragment_tests)) {
+      if (key->depth.func == PIPE_FUNC_LESS)
+         variant->hiz_cull = LP_HIZ_CULL_LESS;
+      else if (key->depth.func == PIPE_FUNC_LEQUAL)
+         variant->hiz_cull = LP_HIZ_CULL_LEQUAL;
+   }
+
+   /* Fully covered blocks are known to end up no farther than the
+    * primitive when every pixel reaches the depth write.
+    */
+   variant->hiz_update =
+      variant->hiz_cull != LP_HIZ_CULL_NONE &&
+      key->depth.writemask &&
+      !key->stencil[0].enabled &&
+      !key->alpha.enabled &&
+      !key->multisample &&
+      !key->blend.alpha_to_coverage &&
+      !nir->info.fs.uses_discard &&
+      !(nir->info.outputs_written & BITFIELD64_BIT(FRAG_RESULT_SAMPLE_MASK));
+
+   /* Only LESS, LEQUAL, EQUAL and NEVER can't increase stored depth */
+   variant->hiz_invalidate =
+      key->depth.enabled && key->depth.writemask &&
+      key->depth.func != PIPE_FUNC_LESS &&
+      key->depth.func != PIPE_FUNC_LEQUAL &&
+      key->depth.func != PIPE_FUNC_EQUAL &&
+      key->depth.func != PIPE_FUNC_NEVER;
+
    /* We only care about opaque blits for now */
    if (variant->opaque &&
        (shader->kind == LP_FS_KIND_BLIT_RGBA ||
@@ -3828,6 +4043,7 @@ generate_variant(struct llvmpipe_context *lp,
       }
 
       if (target == PIPE_TEXTURE_2D &&
+          !samp0->texture_state.microtiled &&
           min_img_filter == PIPE_TEX_FILTER_NEAREST &&
           mag_img_filter == PIPE_TEX_FILTER_NEAREST &&
           min_mip_filter == PIPE_TEX_MIPFILTER_NONE &&
@@ -3846,7 +4062,7 @@ generate_variant(struct llvmpipe_context *lp,
    /* Determine whether this shader + pipeline state is a candidate for
     * the linear path.
     */
-   const bool linear_pipeline =
+   job->linear_pipeline =
          !key->stencil[0].enabled &&
          !key->depth.enabled &&
          !nir->info.fs.uses_discard &&
@@ -3856,6 +4072,12 @@ generate_variant(struct llvmpipe_context *lp,
           key->cbuf_format[0] == PIPE_FORMAT_R8G8B8A8_UNORM ||
           key->cbuf_format[0] == PIPE_FORMAT_R8G8B8X8_UNORM);
 
+   /* The linear samplers walk texture rows directly. */
+   for (unsigned i = 0; i < MAX2(key->nr_samplers, key->nr_sampler_views); i++) {
+      if (lp_fs_variant_key_samplers(key)[i].texture_state.microtiled)
+         job->linear_pipeline = false;
+   }
+
    memcpy(&variant->key, key, sizeof *key);
 
    if ((LP_DEBUG & DEBUG_FS) || (gallivm_debug & GALLIVM_DEBUG_IR)) {
@@ -3876,7 +4098,7 @@ generate_variant(struct llvmpipe_context *lp,
       }
    }
 
-   if (linear_pipeline) {
+   if (job->linear_pipeline) {
       /* Currently keeping both the old fastpaths and new linear path
        * active.  The older code is still somewhat faster for the cases
        * it covers.
@@ -3910,54 +4132,22 @@ generate_variant(struct llvmpipe_context *lp,
     * Compile everything
     */
 
-#if GALLIVM_USE_ORCJIT
-/* module has been moved into ORCJIT after gallivm_compile_module */
-   variant->nr_instrs += lp_build_count_ir_module(variant->gallivm->module);
-
-   gallivm_compile_module(variant->gallivm);
-#else
-   gallivm_compile_module(variant->gallivm);
-
-   variant->nr_instrs += lp_build_count_ir_module(variant->gallivm->module);
-#endif
-
-   if (variant->function[RAST_EDGE_TEST]) {
-      variant->jit_function[RAST_EDGE_TEST] = (lp_jit_frag_func)
-            gallivm_jit_function(variant->gallivm,
-                                 variant->function[RAST_EDGE_TEST],
-                                 variant->function_name[RAST_EDGE_TEST]);
-   }
+   util_queue_fence_init(&variant->ready);
 
-   if (variant->function[RAST_WHOLE]) {
-      variant->jit_function[RAST_WHOLE] = (lp_jit_frag_func)
-         gallivm_jit_function(variant->gallivm,
-                              variant->function[RAST_WHOLE],
-                              variant->function_name[RAST_WHOLE]);
-   } else if (!variant->jit_function[RAST_WHOLE]) {
-      variant->jit_function[RAST_WHOLE] = (lp_jit_frag_func)
-         variant->jit_function[RAST_EDGE_TEST];
-   }
-
-   if (linear_pipeline) {
-      if (variant->linear_function) {
-         variant->jit_linear_llvm = (lp_jit_linear_llvm_func)
-            gallivm_jit_function(variant->gallivm, variant->linear_function,
-                                 variant->linear_function_name);
-      }
-
-      /*
-       * This must be done after LLVM compilation, as it will call the JIT'ed
-       * code to determine active inputs.
+   if (job->async) {
+      /* Count up front so llvmpipe_update_fs can account for the variant
+       * right away.
        */
-      lp_linear_check_variant(variant);
-   }
+      variant->nr_instrs += lp_build_count_ir_module(variant->gallivm->module);
 
-   if (needs_caching) {
-      lp_disk_cache_insert_shader(screen, &cached, ir_sha1_cache_key);
+      LP_COUNT(nr_llvm_async_compiles);
+      util_queue_add_job(&screen->fs_compile_queue, job, &variant->ready,
+                         lp_fs_compile_job_execute, lp_fs_compile_job_cleanup,
+                         0);
+   } else {
+      compile_variant(job);
    }
 
-   gallivm_free_ir(variant->gallivm);
-
    return variant;
 }
 
@@ -4116,6 +4306,9 @@ void
 llvmpipe_destroy_shader_variant(struct llvmpipe_context *lp,
                                 struct lp_fragment_shader_variant *variant)
 {
+   util_queue_fence_wait(&variant->ready);
+   util_queue_fence_destroy(&variant->ready);
+
    gallivm_destroy(variant->gallivm);
    lp_fs_reference(lp, &variant->shader, NULL);
    if (variant->function_name[RAST_EDGE_TEST])
@@ -4628,9 +4821,89 @@ make_variant_key(struct llvmpipe_context *lp,
 }
 
 
+/**
+ * Whether a variant built for a more general key gives the same results
+ * as a variant built for the key.  The sampler state which only lets the
+ * code skip LOD adjustments or use power-of-two wrapping may differ, as
+ * may occlusion counting, which is harmless without a query.
+ */
+static bool
+lp_fs_variant_key_covers(const struct lp_fragment_shader *shader,
+                         const struct lp_fragment_shader_variant_key *general,
+                         const struct lp_fragment_shader_variant_key *key)
+{
+   char store[LP_FS_MAX_VARIANT_KEY_SIZE];
+   struct lp_fragment_shader_variant_key *relaxed =
+      (struct lp_fragment_shader_variant_key *)store;
+
+   /* Make the general key as specific as the key where that's allowed */
+   memcpy(relaxed, general, shader->variant_key_size);
+
+   if (relaxed->occlusion_count && !key->occlusion_count)
+      relaxed->occlusion_count = 0;
+
+   const unsigned nr_samplers = MAX2(key->nr_samplers, key->nr_sampler_views);
+   if (relaxed->nr_samplers != key->nr_samplers ||
+       relaxed->nr_sampler_views != key->nr_sampler_views)
+      return false;
+
+   for (unsigned i = 0; i < nr_samplers; i++) {
+      struct lp_sampler_static_state *g = &lp_fs_variant_key_samplers(relaxed)[i];
+      const struct lp_sampler_static_state *k = &lp_fs_variant_key_samplers(key)[i];
+
+      g->texture_state.pot_width |= k->texture_state.pot_width;
+      g->texture_state.pot_height |= k->texture_state.pot_height;
+      g->texture_state.pot_depth |= k->texture_state.pot_depth;
+
+      if (g->sampler_state.lod_bias_non_zero && !k->sampler_state.lod_bias_non_zero)
+         g->sampler_state.lod_bias_non_zero = 0;
+      if (g->sampler_state.max_lod_pos && !k->sampler_state.max_lod_pos)
+         g->sampler_state.max_lod_pos = 0;
+
+      /* Clamping to min_lod == max_lod selects that level as well */
+      if (k->sampler_state.min_max_lod_equal) {
+         if (!g->sampler_state.min_max_lod_equal &&
+             g->sampler_state.apply_min_lod && g->sampler_state.apply_max_lod) {
+            g->sampler_state.min_max_lod_equal = 1;
+            g->sampler_state.apply_min_lod = k->sampler_state.apply_min_lod;
+            g->sampler_state.apply_max_lod = k->sampler_state.apply_max_lod;
+         }
+      } else if (!g->sampler_state.min_max_lod_equal) {
+         if (g->sampler_state.apply_min_lod && !k->sampler_state.apply_min_lod)
+            g->sampler_state.apply_min_lod = 0;
+         if (g->sampler_state.apply_max_lod && !k->sampler_state.apply_max_lod)
+            g->sampler_state.apply_max_lod = 0;
+      }
+   }
+
+   return memcmp(relaxed, key, shader->variant_key_size) == 0;
+}
+
+
+/**
+ * Find a compiled variant which can stand in for one still being
+ * compiled in the background, see lp_fs_variant_key_covers().
+ */
+static struct lp_fragment_shader_variant *
+lp_fs_find_fallback_variant(const struct lp_fragment_shader *shader,
+                            const struct lp_fragment_shader_variant *variant)
+{
+   struct lp_fs_variant_list_item *li;
+
+   LIST_FOR_EACH_ENTRY(li, &shader->variants.list, list) {
+      if (li->base != variant &&
+          util_queue_fence_is_signalled(&li->base->ready) &&
+          lp_fs_variant_key_covers(shader, &li->base->key, &variant->key))
+         return li->base;
+   }
+   return NULL;
+}
+
+
 /**
  * Update fragment shader state.  This is called just prior to drawing
- * something when some fragment-related state has changed.
+ * something when some fragment-related state has changed, or while a
+ * fallback variant is bound.
  */
 void
 llvmpipe_update_fs(struct llvmpipe_context *lp)
@@ -4714,7 +4987,7 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
       variant = generate_variant(lp, shader, key);
       int64_t t1 = os_time_get();
       int64_t dt = t1 - t0;
-      LP_COUNT_ADD(llvm_compile_time, dt);
+      LP_COUNT_ADD_ATOMIC(llvm_compile_time, dt);
       LP_COUNT_ADD(nr_llvm_compiles, 2);  /* emit vs. omit in/out test */
 
       /* Put the new variant into the list */
@@ -4727,6 +5000,18 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
       }
    }
 
+   /* Rather than have the rasterizer wait for the new variant, draw with
+    * a more general one until it's compiled.
+    */
+   struct lp_fragment_shader_variant *fallback = NULL;
+   if (variant && !util_queue_fence_is_signalled(&variant->ready))
+      fallback = lp_fs_find_fallback_variant(shader, variant);
+   lp->fs_fallback = fallback != NULL;
+   if (fallback) {
+      LP_COUNT(nr_fs_fallbacks);
+      variant = fallback;
+   }
+
    /* Bind this variant */
    lp_setup_set_fs_variant(lp->setup, variant);
 }
@@ -38,6 +38,7 @@
 #include "gallivm/lp_bld_tgsi.h" /* for lp_tgsi_info */
 #include "lp_bld_interp.h" /* for struct lp_shader_input */
 #include "util/u_inlines.h"
+#include "util/u_queue.h"
 #include "lp_jit.h"
 
 struct lp_fragment_shader;
@@ -141,6 +142,14 @@ struct lp_fs_variant_list_item
 };
 
 
+/** Which blocks a variant's fragments are known to fail the depth test in */
+enum lp_hiz_cull {
+   LP_HIZ_CULL_NONE = 0,
+   LP_HIZ_CULL_LESS,     /* no closer than the block's farthest depth */
+   LP_HIZ_CULL_LEQUAL,   /* farther than the block's farthest depth */
+};
+
+
 struct lp_fragment_shader_variant
 {
    /*
@@ -151,6 +160,14 @@ struct lp_fragment_shader_variant
    unsigned opaque:1;
    unsigned blit:1;
    unsigned linear_input_mask:16;
+
+   /*
+    * How the rasterizer's hierarchical depth applies to this variant,
+    * see lp_rast_hiz_cull().
+    */
+   unsigned hiz_cull:2;          /* enum lp_hiz_cull */
+   unsigned hiz_update:1;        /* covered pixels get written, never kept */
+   unsigned hiz_invalidate:1;    /* may move stored depth farther */
    struct pipe_reference reference;
 
    struct gallivm_state *gallivm;
@@ -187,6 +204,12 @@ struct lp_fragment_shader_variant
    /* Total number of LLVM instructions generated */
    unsigned nr_instrs;
 
+   /* Signalled once the JIT'ed functions above are valid.  Variants can
+    * be bound and binned while still being compiled in the background;
+    * the rasterizer waits on this before running any of their code.
+    */
+   struct util_queue_fence ready;
+
    struct lp_fs_variant_list_item list_item_global, list_item_local;
    struct lp_fragment_shader *shader;
 
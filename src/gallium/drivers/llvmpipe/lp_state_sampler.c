@@ -313,7 +313,7 @@ prepare_shader_sampling(struct llvmpipe_context *lp,
       struct pipe_sampler_view *view = i < num ? views[i] : NULL;
 
       if (view) {
-         struct pipe_resource *tex = view->texture;
+         struct pipe_resource *tex = llvmpipe_sampler_view_resource(view);
          struct llvmpipe_resource *lp_tex = llvmpipe_resource(tex);
          unsigned width0 = tex->width0;
          unsigned num_layers = tex->depth0;
@@ -324,7 +324,7 @@ prepare_shader_sampling(struct llvmpipe_context *lp,
 
          if (!lp_tex->dt) {
             /* regular texture - setup array of mipmap level offsets */
-            struct pipe_resource *res = view->texture;
+            struct pipe_resource *res = tex;
 
             if (llvmpipe_resource_is_texture(res)) {
                first_level = view->u.tex.first_level;
@@ -745,7 +745,7 @@ generate_setup_variant(struct lp_setup_variant_key *key,
     */
    if (LP_DEBUG & DEBUG_COUNTERS) {
       t1 = os_time_get();
-      LP_COUNT_ADD(llvm_compile_time, t1 - t0);
+      LP_COUNT_ADD_ATOMIC(llvm_compile_time, t1 - t0);
       LP_COUNT_ADD(nr_llvm_compiles, 1);
    }
 
@@ -0,0 +1,171 @@
+/*
+ * Copyright 2024 Mesa contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * @file
+ * Compute grids written by one context, read back through another one.
+ *
+ * Grids run in the background, so mapping a buffer has to wait for the
+ * grids of every context writing it, whether the buffer is bound to the
+ * grid or only reached through its address.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "nir_builder.h"
+#include "pipe/p_context.h"
+#include "pipe/p_screen.h"
+#include "pipe/p_state.h"
+#include "sw/null/null_sw_winsys.h"
+#include "frontend/sw_winsys.h"
+#include "util/u_inlines.h"
+
+#include "lp_public.h"
+
+#define BLOCK_SIZE 64
+#define NUM_BLOCKS 4096
+#define NUM_VALUES (BLOCK_SIZE * NUM_BLOCKS)
+
+static int failures;
+
+/* Writes id * 3 + 1 to the id-th dword of SSBO 0, or of the address in
+ * the first constant buffer.
+ */
+static void *
+create_shader(struct pipe_context *pipe, bool global)
+{
+   struct pipe_screen *screen = pipe->screen;
+   const nir_shader_compiler_options *options =
+      screen->get_compiler_options(screen, PIPE_SHADER_IR_NIR,
+                                   PIPE_SHADER_COMPUTE);
+   nir_builder b =
+      nir_builder_init_simple_shader(MESA_SHADER_COMPUTE, options,
+                                     global ? "write_global" : "write_ssbo");
+
+   b.shader->info.workgroup_size[0] = BLOCK_SIZE;
+   b.shader->info.workgroup_size[1] = 1;
+   b.shader->info.workgroup_size[2] = 1;
+
+   nir_def *group = nir_channel(&b, nir_load_workgroup_id(&b), 0);
+   nir_def *id = nir_iadd(&b, nir_imul_imm(&b, group, BLOCK_SIZE),
+                          nir_load_local_invocation_index(&b));
+   nir_def *value = nir_iadd_imm(&b, nir_imul_imm(&b, id, 3), 1);
+   nir_def *offset = nir_imul_imm(&b, id, 4);
+
+   if (global) {
+      b.shader->info.num_ubos = 1;
+      nir_def *addr = nir_load_ubo(&b, 1, 64, nir_imm_int(&b, 0),
+                                   nir_imm_int(&b, 0),
+                                   .align_mul = 8, .range = 8);
+      nir_store_global(&b, nir_iadd(&b, addr, nir_u2u64(&b, offset)), 4,
+                       value, 0x1);
+   } else {
+      b.shader->info.num_ssbos = 1;
+      nir_store_ssbo(&b, value, nir_imm_int(&b, 0), offset, .align_mul = 4);
+   }
+
+   nir_shader_gather_info(b.shader, nir_shader_get_entrypoint(b.shader));
+   screen->finalize_nir(screen, b.shader);
+
+   const struct pipe_compute_state state = {
+      .ir_type = PIPE_SHADER_IR_NIR,
+      .prog = b.shader,
+   };
+   return pipe->create_compute_state(pipe, &state);
+}
+
+static void
+test_write(struct pipe_screen *screen, bool global)
+{
+   struct pipe_context *writer = screen->context_create(screen, NULL, 0);
+   struct pipe_context *reader = screen->context_create(screen, NULL, 0);
+   struct pipe_resource *buffer =
+      pipe_buffer_create(screen, PIPE_BIND_SHADER_BUFFER | PIPE_BIND_GLOBAL,
+                         PIPE_USAGE_DEFAULT, NUM_VALUES * 4);
+   if (!writer || !reader || !buffer) {
+      fprintf(stderr, "failed to create the contexts and buffer\n");
+      exit(EXIT_FAILURE);
+   }
+
+   void *cs = create_shader(writer, global);
+   writer->bind_compute_state(writer, cs);
+
+   if (global) {
+      uint64_t addr = 0;
+      uint32_t *handle = (uint32_t *)&addr;
+      writer->set_global_binding(writer, 0, 1, &buffer, &handle);
+
+      const struct pipe_constant_buffer cb = {
+         .buffer_size = sizeof(addr),
+         .user_buffer = &addr,
+      };
+      writer->set_constant_buffer(writer, PIPE_SHADER_COMPUTE, 0, false, &cb);
+   } else {
+      const struct pipe_shader_buffer sb = {
+         .buffer = buffer,
+         .buffer_size = NUM_VALUES * 4,
+      };
+      writer->set_shader_buffers(writer, PIPE_SHADER_COMPUTE, 0, 1, &sb, 0x1);
+   }
+
+   const struct pipe_grid_info info = {
+      .block = { BLOCK_SIZE, 1, 1 },
+      .grid = { NUM_BLOCKS, 1, 1 },
+      .work_dim = 1,
+   };
+   writer->launch_grid(writer, &info);
+
+   /* The writer isn't flushed, mapping has to wait for its grid */
+   struct pipe_transfer *transfer;
+   const uint32_t *values =
+      pipe_buffer_map(reader, buffer, PIPE_MAP_READ, &transfer);
+   unsigned wrong = 0;
+   for (unsigned i = 0; i < NUM_VALUES; i++) {
+      if (values[i] != i * 3 + 1)
+         wrong++;
+   }
+   pipe_buffer_unmap(reader, transfer);
+
+   if (wrong) {
+      fprintf(stderr, "%s: %u of %u values not written yet\n",
+              global ? "global" : "ssbo", wrong, NUM_VALUES);
+      failures++;
+   }
+
+   if (global)
+      writer->set_global_binding(writer, 0, 1, NULL, NULL);
+   else
+      writer->set_shader_buffers(writer, PIPE_SHADER_COMPUTE, 0, 1, NULL, 0);
+   writer->set_constant_buffer(writer, PIPE_SHADER_COMPUTE, 0, false, NULL);
+   writer->bind_compute_state(writer, NULL);
+   writer->delete_compute_state(writer, cs);
+
+   pipe_resource_reference(&buffer, NULL);
+   reader->destroy(reader);
+   writer->destroy(writer);
+}
+
+int
+main(void)
+{
+   /* Grids only run in the background with worker threads */
+   setenv("LP_NUM_THREADS", "4", 0);
+
+   struct sw_winsys *winsys = null_sw_create();
+   struct pipe_screen *screen = llvmpipe_create_screen(winsys);
+   if (!screen) {
+      fprintf(stderr, "failed to create the screen\n");
+      return EXIT_FAILURE;
+   }
+
+   test_write(screen, false);
+   test_write(screen, true);
+
+   screen->destroy(screen);
+   winsys->destroy(winsys);
+
+   return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,223 @@
+/*
+ * Copyright 2024 Mesa contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * @file
+ * Vertex shading on the draw module's vertex threads.
+ *
+ * Draws of many vsplit segments are captured with stream output, which
+ * runs after the vertex threads, in segment order.  The captured vertices
+ * have to come out in draw order, and the same as with DRAW_VS_THREADS=0,
+ * including the flushing of denormals.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nir_builder.h"
+#include "pipe/p_context.h"
+#include "pipe/p_screen.h"
+#include "pipe/p_state.h"
+#include "sw/null/null_sw_winsys.h"
+#include "frontend/sw_winsys.h"
+#include "util/u_draw.h"
+#include "util/u_inlines.h"
+#include "util/u_simple_shaders.h"
+
+#include "lp_public.h"
+
+#define NUM_VERTICES  20000
+#define NUM_INSTANCES 2
+
+static int failures;
+
+/* Writes the vertex id, the instance id, and the vertex id + 1 as a
+ * denormal halved, to generic output 0.
+ */
+static void *
+create_vs(struct pipe_context *pipe)
+{
+   struct pipe_screen *screen = pipe->screen;
+   const nir_shader_compiler_options *options =
+      screen->get_compiler_options(screen, PIPE_SHADER_IR_NIR,
+                                   PIPE_SHADER_VERTEX);
+   nir_builder b =
+      nir_builder_init_simple_shader(MESA_SHADER_VERTEX, options,
+                                     "write_ids");
+
+   nir_variable *pos = nir_variable_create(b.shader, nir_var_shader_out,
+                                           glsl_vec4_type(), "gl_Position");
+   pos->data.location = VARYING_SLOT_POS;
+   pos->data.driver_location = 0;
+
+   nir_variable *ids = nir_variable_create(b.shader, nir_var_shader_out,
+                                           glsl_vec4_type(), "ids");
+   ids->data.location = VARYING_SLOT_VAR0;
+   ids->data.driver_location = 1;
+
+   b.shader->num_outputs = 2;
+
+   nir_def *vertex_id = nir_load_vertex_id(&b);
+   nir_def *instance_id = nir_load_instance_id(&b);
+   nir_def *denormal = nir_fmul_imm(&b, nir_iadd_imm(&b, vertex_id, 1), 0.5);
+
+   nir_store_var(&b, pos, nir_imm_vec4(&b, 0.0, 0.0, 0.0, 1.0), 0xf);
+   nir_store_var(&b, ids, nir_vec4(&b, vertex_id, instance_id, denormal,
+                                   nir_imm_int(&b, 0)), 0xf);
+
+   nir_shader_gather_info(b.shader, nir_shader_get_entrypoint(b.shader));
+   screen->finalize_nir(screen, b.shader);
+
+   struct pipe_shader_state state = {
+      .type = PIPE_SHADER_IR_NIR,
+      .ir.nir = b.shader,
+      .stream_output = {
+         .num_outputs = 1,
+         .stride = { 4 },
+         .output = {
+            { .register_index = 1, .num_components = 4 },
+         },
+      },
+   };
+   return pipe->create_vs_state(pipe, &state);
+}
+
+/* Runs a non-indexed and an indexed draw with as many vertex threads,
+ * returns the captured vertices of both.
+ */
+static uint32_t *
+capture(struct pipe_screen *screen, const char *threads,
+        const uint32_t *indices)
+{
+   const unsigned num_vertices = NUM_VERTICES * (NUM_INSTANCES + 1);
+   const unsigned size = num_vertices * 4 * sizeof(uint32_t);
+
+   /* Read when the context creates its draw module */
+   setenv("DRAW_VS_THREADS", threads, 1);
+
+   struct pipe_context *pipe = screen->context_create(screen, NULL, 0);
+   struct pipe_resource *buffer =
+      pipe_buffer_create(screen, PIPE_BIND_STREAM_OUTPUT, PIPE_USAGE_DEFAULT,
+                         size);
+   if (!pipe || !buffer) {
+      fprintf(stderr, "failed to create the context and buffer\n");
+      exit(EXIT_FAILURE);
+   }
+
+   const struct pipe_rasterizer_state rs = {
+      .rasterizer_discard = 1,
+      .depth_clip_near = 1,
+      .depth_clip_far = 1,
+   };
+   const struct pipe_blend_state blend = { 0 };
+   const struct pipe_depth_stencil_alpha_state dsa = { 0 };
+   const struct pipe_framebuffer_state fb = { .width = 16, .height = 16 };
+
+   void *rs_state = pipe->create_rasterizer_state(pipe, &rs);
+   void *blend_state = pipe->create_blend_state(pipe, &blend);
+   void *dsa_state = pipe->create_depth_stencil_alpha_state(pipe, &dsa);
+   void *vs = create_vs(pipe);
+   void *fs = util_make_empty_fragment_shader(pipe);
+
+   pipe->bind_rasterizer_state(pipe, rs_state);
+   pipe->bind_blend_state(pipe, blend_state);
+   pipe->bind_depth_stencil_alpha_state(pipe, dsa_state);
+   pipe->bind_vs_state(pipe, vs);
+   pipe->bind_fs_state(pipe, fs);
+   pipe->set_framebuffer_state(pipe, &fb);
+
+   struct pipe_stream_output_target *target =
+      pipe->create_stream_output_target(pipe, buffer, 0, size);
+   const unsigned offset = 0;
+   pipe->set_stream_output_targets(pipe, 1, &target, &offset);
+
+   util_draw_arrays_instanced(pipe, MESA_PRIM_POINTS, 0, NUM_VERTICES,
+                              0, NUM_INSTANCES);
+   util_draw_elements(pipe, (void *)indices, 4, 0, MESA_PRIM_POINTS,
+                      0, NUM_VERTICES);
+
+   pipe->set_stream_output_targets(pipe, 0, NULL, NULL);
+   pipe->stream_output_target_destroy(pipe, target);
+
+   uint32_t *values = malloc(size);
+   pipe_buffer_read(pipe, buffer, 0, size, values);
+
+   pipe->bind_vs_state(pipe, NULL);
+   pipe->bind_fs_state(pipe, NULL);
+   pipe->delete_vs_state(pipe, vs);
+   pipe->delete_fs_state(pipe, fs);
+   pipe->delete_rasterizer_state(pipe, rs_state);
+   pipe->delete_blend_state(pipe, blend_state);
+   pipe->delete_depth_stencil_alpha_state(pipe, dsa_state);
+
+   pipe_resource_reference(&buffer, NULL);
+   pipe->destroy(pipe);
+
+   return values;
+}
+
+static void
+check_order(const char *threads, const uint32_t *values,
+            const uint32_t *indices)
+{
+   unsigned wrong = 0;
+
+   for (unsigned i = 0; i < NUM_VERTICES * NUM_INSTANCES; i++) {
+      const uint32_t *v = &values[i * 4];
+      if (v[0] != i % NUM_VERTICES || v[1] != i / NUM_VERTICES)
+         wrong++;
+   }
+
+   values += NUM_VERTICES * NUM_INSTANCES * 4;
+   for (unsigned i = 0; i < NUM_VERTICES; i++) {
+      const uint32_t *v = &values[i * 4];
+      if (v[0] != indices[i] || v[1] != 0)
+         wrong++;
+   }
+
+   if (wrong) {
+      fprintf(stderr, "DRAW_VS_THREADS=%s: %u vertices out of order\n",
+              threads, wrong);
+      failures++;
+   }
+}
+
+int
+main(void)
+{
+   struct sw_winsys *winsys = null_sw_create();
+   struct pipe_screen *screen = llvmpipe_create_screen(winsys);
+   if (!screen) {
+      fprintf(stderr, "failed to create the screen\n");
+      return EXIT_FAILURE;
+   }
+
+   /* Jump around, so vsplit fetches through its element list */
+   uint32_t *indices = malloc(NUM_VERTICES * sizeof(uint32_t));
+   for (unsigned i = 0; i < NUM_VERTICES; i++)
+      indices[i] = (i * 7919) % NUM_VERTICES;
+
+   uint32_t *threaded = capture(screen, "3", indices);
+   uint32_t *unthreaded = capture(screen, "0", indices);
+
+   check_order("3", threaded, indices);
+   check_order("0", unthreaded, indices);
+
+   const unsigned size = NUM_VERTICES * (NUM_INSTANCES + 1) * 4 * sizeof(uint32_t);
+   if (memcmp(threaded, unthreaded, size) != 0) {
+      fprintf(stderr, "vertices shaded on threads differ\n");
+      failures++;
+   }
+
+   free(threaded);
+   free(unthreaded);
+   free(indices);
+
+   screen->destroy(screen);
+   winsys->destroy(winsys);
+
+   return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
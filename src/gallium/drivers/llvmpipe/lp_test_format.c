@@ -367,6 +367,7 @@ test_all(unsigned verbose, FILE *fp)
    unsigned use_cache;
 
    cache_ptr = align_malloc(sizeof(struct lp_build_format_cache), 16);
+   lp_build_format_cache_invalidate(cache_ptr);
 
    for (use_cache = 0; use_cache < 2; use_cache++) {
       for (format = 1; format < PIPE_FORMAT_COUNT; ++format) {
@@ -68,15 +68,21 @@ lp_llvm_texture_cache_ptr(struct gallivm_state *gallivm,
 #endif
 struct lp_build_sampler_soa *
 lp_llvm_sampler_soa_create(const struct lp_sampler_static_state *static_state,
-                           unsigned nr_samplers)
+                           unsigned nr_samplers,
+                           bool use_cache)
 {
    struct lp_build_sampler_soa *sampler;
 
    sampler = lp_bld_llvm_sampler_soa_create(static_state, nr_samplers);
 
 #if LP_USE_TEXTURE_CACHE
-   struct lp_sampler_dynamic_state *dynamic_state = lp_build_sampler_soa_dynamic_state(sampler);
-   dynamic_state->cache_ptr = lp_llvm_texture_cache_ptr;
+   if (use_cache && !(LP_PERF & PERF_NO_TEX_CACHE)) {
+      struct lp_sampler_dynamic_state *dynamic_state =
+         lp_build_sampler_soa_dynamic_state(sampler);
+      dynamic_state->cache_ptr = lp_llvm_texture_cache_ptr;
+   }
+#else
+   (void)use_cache;
 #endif
    return sampler;
 }
@@ -36,9 +36,15 @@ struct lp_sampler_static_state;
 /**
  * Whether texture cache is used for s3tc textures.
  */
-#define LP_USE_TEXTURE_CACHE 0
+#define LP_USE_TEXTURE_CACHE 1
 
+/**
+ * \param use_cache  whether the generated code may use the per-thread
+ *                   block cache in lp_jit_thread_data (fragment shaders
+ *                   only, other stages have no cache to point at).
+ */
 struct lp_build_sampler_soa *
 lp_llvm_sampler_soa_create(const struct lp_sampler_static_state *static_state,
-                           unsigned nr_samplers);
+                           unsigned nr_samplers,
+                           bool use_cache);
 #endif /* LP_TEX_SAMPLE_H */
@@ -49,6 +49,7 @@
 #endif
 
 #include "lp_context.h"
+#include "lp_debug.h"
 #include "lp_flush.h"
 #include "lp_screen.h"
 #include "lp_texture.h"
@@ -56,6 +57,8 @@
 #include "lp_state.h"
 #include "lp_rast.h"
 
+#include "gallivm/lp_bld_sample.h"
+
 #include "frontend/sw_winsys.h"
 #include "git_sha1.h"
 
@@ -84,6 +87,125 @@ static const char *driver_id = "llvmpipe" MESA_GIT_SHA1;
 
 #endif
 
+/**
+ * Whether a texture may be stored in the internal 4x4 microtiled layout.
+ * Only private, single-sampled textures of plain color formats qualify;
+ * anything whose memory is exposed to the outside must stay linear.
+ */
+static bool
+llvmpipe_texture_can_microtile(const struct pipe_resource *pt)
+{
+   if (LP_PERF & PERF_NO_MICROTILE)
+      return false;
+
+   switch (pt->target) {
+   case PIPE_TEXTURE_2D:
+   case PIPE_TEXTURE_2D_ARRAY:
+   case PIPE_TEXTURE_RECT:
+   case PIPE_TEXTURE_3D:
+   case PIPE_TEXTURE_CUBE:
+   case PIPE_TEXTURE_CUBE_ARRAY:
+      break;
+   default:
+      return false;
+   }
+
+   if (pt->nr_samples > 1 || pt->usage == PIPE_USAGE_STAGING)
+      return false;
+
+   if (pt->bind & (PIPE_BIND_DISPLAY_TARGET |
+                   PIPE_BIND_SCANOUT |
+                   PIPE_BIND_SHARED |
+                   PIPE_BIND_LINEAR |
+                   PIPE_BIND_DEPTH_STENCIL))
+      return false;
+
+   if (pt->flags & (PIPE_RESOURCE_FLAG_SPARSE |
+                    PIPE_RESOURCE_FLAG_MAP_PERSISTENT |
+                    PIPE_RESOURCE_FLAG_MAP_COHERENT))
+      return false;
+
+   const struct util_format_description *desc =
+      util_format_description(pt->format);
+   return desc->layout == UTIL_FORMAT_LAYOUT_PLAIN &&
+          desc->block.width == 1 && desc->block.height == 1 &&
+          !util_format_is_depth_or_stencil(pt->format);
+}
+
+
+/**
+ * Whether a compressed texture may keep an R8G8B8A8_UNORM copy to sample
+ * from (LP_PERF=tex_decompress).  Only read-only textures whose texels
+ * fit 8 bit unorm exactly qualify, everything else decodes on fetch.
+ */
+static bool
+llvmpipe_texture_can_decompress(const struct pipe_resource *pt)
+{
+   if (!(LP_PERF & PERF_TEX_DECOMPRESS))
+      return false;
+
+   switch (pt->target) {
+   case PIPE_TEXTURE_2D:
+   case PIPE_TEXTURE_2D_ARRAY:
+   case PIPE_TEXTURE_RECT:
+   case PIPE_TEXTURE_CUBE:
+   case PIPE_TEXTURE_CUBE_ARRAY:
+      break;
+   default:
+      return false;
+   }
+
+   if (pt->bind != PIPE_BIND_SAMPLER_VIEW || pt->usage == PIPE_USAGE_STAGING)
+      return false;
+
+   if (pt->flags & (PIPE_RESOURCE_FLAG_SPARSE |
+                    PIPE_RESOURCE_FLAG_MAP_PERSISTENT |
+                    PIPE_RESOURCE_FLAG_MAP_COHERENT))
+      return false;
+
+   const struct util_format_description *desc =
+      util_format_description(pt->format);
+   return util_format_is_compressed(pt->format) &&
+          util_format_fits_8unorm(desc) &&
+          util_format_unpack_description(pt->format)->unpack_rgba_8unorm_rect;
+}
+
+
+/**
+ * Regenerate the decompressed copy of a compressed texture for a box of
+ * one mip level, widened to whole blocks.
+ */
+static void
+llvmpipe_decompress_box(struct llvmpipe_resource *lpr, unsigned level,
+                        const struct pipe_box *box)
+{
+   struct llvmpipe_resource *dst = llvmpipe_resource(lpr->decompressed);
+   const enum pipe_format format = lpr->base.format;
+   const unsigned bw = util_format_get_blockwidth(format);
+   const unsigned bh = util_format_get_blockheight(format);
+   const unsigned x0 = ROUND_DOWN_TO(box->x, bw);
+   const unsigned y0 = ROUND_DOWN_TO(box->y, bh);
+   const unsigned x1 = MIN2(align(box->x + box->width, bw),
+                            u_minify(lpr->base.width0, level));
+   const unsigned y1 = MIN2(align(box->y + box->height, bh),
+                            u_minify(lpr->base.height0, level));
+
+   for (int z = box->z; z < box->z + box->depth; z++) {
+      const uint8_t *src = (const uint8_t *)lpr->tex_data +
+         lpr->mip_offsets[level] + (uint64_t)z * lpr->img_stride[level] +
+         (y0 / bh) * lpr->row_stride[level] +
+         (x0 / bw) * util_format_get_blocksize(format);
+      uint8_t *map = (uint8_t *)dst->tex_data +
+         dst->mip_offsets[level] + (uint64_t)z * dst->img_stride[level] +
+         y0 * dst->row_stride[level] + x0 * 4;
+
+      util_format_unpack_rgba_8unorm_rect(format, map, dst->row_stride[level],
+                                          src, lpr->row_stride[level],
+                                          x1 - x0, y1 - y0);
+   }
+}
+
+
 /**
  * Conventional allocation path for non-display textures:
  * Compute strides and allocate data (unless asked not to).
@@ -124,6 +246,16 @@ llvmpipe_texture_layout(struct llvmpipe_screen *screen,
    assert(LP_MAX_TEXTURE_2D_LEVELS <= LP_MAX_TEXTURE_LEVELS);
    assert(LP_MAX_TEXTURE_3D_LEVELS <= LP_MAX_TEXTURE_LEVELS);
 
+   /* The 4x4 alignment below already makes room for whole 4x4 blocks, so
+    * microtiling doesn't change any of the sizes.  Imported or unbacked
+    * memory may be accessed directly by the caller, so keep that linear.
+    */
+   lpr->microtiled = allocate && llvmpipe_texture_can_microtile(pt);
+   if (lpr->microtiled)
+      lpr->base.flags |= LP_RESOURCE_FLAG_MICROTILED;
+   else
+      lpr->base.flags &= ~LP_RESOURCE_FLAG_MICROTILED;
+
    uint32_t dimensions = 1;
    switch (pt->target) {
    case PIPE_TEXTURE_2D:
@@ -299,6 +431,8 @@ llvmpipe_resource_create_all(struct pipe_screen *_screen,
       return NULL;
 
    lpr->base = *templat;
+   lpr->base.flags &= ~(LP_RESOURCE_FLAG_MICROTILED |
+                        LP_RESOURCE_FLAG_DECOMPRESSED);
    lpr->screen = screen;
    pipe_reference_init(&lpr->base.reference, 1);
    lpr->base.screen = &screen->base;
@@ -330,6 +464,18 @@ llvmpipe_resource_create_all(struct pipe_screen *_screen,
 
             lpr->residency = calloc(DIV_ROUND_UP(lpr->size_required, 64 * 1024 * sizeof(uint32_t) * 8), sizeof(uint32_t));
          }
+
+         if (alloc_backing && llvmpipe_texture_can_decompress(templat)) {
+            struct pipe_resource decompressed = *templat;
+            decompressed.format = PIPE_FORMAT_R8G8B8A8_UNORM;
+            decompressed.bind = PIPE_BIND_SAMPLER_VIEW | PIPE_BIND_LINEAR;
+
+            /* without it the texture is simply decoded on fetch */
+            lpr->decompressed =
+               llvmpipe_resource_create_all(_screen, &decompressed, NULL, true);
+            if (lpr->decompressed)
+               lpr->base.flags |= LP_RESOURCE_FLAG_DECOMPRESSED;
+         }
       }
    } else {
       /* other data (vertex buffer, const buffer, etc) */
@@ -582,6 +728,8 @@ llvmpipe_resource_destroy(struct pipe_screen *pscreen,
 
    free(lpr->residency);
 
+   pipe_resource_reference(&lpr->decompressed, NULL);
+
 #if MESA_DEBUG
    simple_mtx_lock(&resource_list_mutex);
    if (!list_is_empty(&lpr->list))
@@ -707,6 +855,8 @@ llvmpipe_resource_from_handle(struct pipe_screen *_screen,
    }
 
    lpr->base = *template;
+   lpr->base.flags &= ~(LP_RESOURCE_FLAG_MICROTILED |
+                        LP_RESOURCE_FLAG_DECOMPRESSED);
    lpr->screen = screen;
    lpr->dt_format = whandle->format;
    pipe_reference_init(&lpr->base.reference, 1);
@@ -787,6 +937,100 @@ no_lpr:
 }
 
 
+/**
+ * Copy a box of texels between a microtiled image and a linear buffer.
+ */
+static void
+llvmpipe_microtile_copy_box(struct llvmpipe_resource *lpr,
+                            unsigned level,
+                            const struct pipe_box *box,
+                            uint8_t *linear,
+                            unsigned stride,
+                            uint64_t layer_stride,
+                            bool to_tiled)
+{
+   const unsigned bpp = util_format_get_blocksize(lpr->base.format);
+   const unsigned row_stride = lpr->row_stride[level];
+
+   assert(lpr->microtiled);
+
+   for (unsigned z = 0; z < box->depth; z++) {
+      uint8_t *image =
+         llvmpipe_get_texture_image_address(lpr, box->z + z, level);
+
+      for (unsigned y = 0; y < box->height; y++) {
+         uint8_t *row = linear + z * layer_stride + y * stride;
+         const unsigned ty = box->y + y;
+
+         /* Texels are contiguous up to the end of each 4x4 block row. */
+         for (unsigned x = 0; x < box->width;) {
+            const unsigned tx = box->x + x;
+            const unsigned n = MIN2(4 - tx % 4, box->width - x);
+            uint8_t *texel =
+               image + llvmpipe_microtile_offset(tx, ty, row_stride, bpp);
+
+            if (to_tiled)
+               memcpy(texel, row + x * bpp, n * bpp);
+            else
+               memcpy(row + x * bpp, texel, n * bpp);
+            x += n;
+         }
+      }
+   }
+}
+
+
+/**
+ * Convert a microtiled texture to the linear layout in place, for when its
+ * memory is handed out to someone else or mapped directly.  The texture
+ * stays linear from then on.
+ */
+bool
+llvmpipe_resource_untile(struct llvmpipe_screen *screen,
+                         struct llvmpipe_resource *lpr)
+{
+   struct pipe_resource *pt = &lpr->base;
+   uint8_t *tmp = malloc(lpr->img_stride[0]);
+   if (!tmp)
+      return false;
+
+   /* Queued scenes and compute grids of any context may still access the
+    * texture with the microtiled layout.
+    */
+   mtx_lock(&screen->ctx_mutex);
+   list_for_each_entry(struct llvmpipe_context, ctx, &screen->ctx_list, list) {
+      llvmpipe_finish((struct pipe_context *)ctx, __func__);
+   }
+   mtx_unlock(&screen->ctx_mutex);
+
+   for (unsigned level = 0; level <= pt->last_level; level++) {
+      const unsigned layers = pt->target == PIPE_TEXTURE_3D ?
+         u_minify(pt->depth0, level) : pt->array_size;
+      struct pipe_box box;
+
+      u_box_2d(0, 0, u_minify(pt->width0, level),
+               u_minify(pt->height0, level), &box);
+
+      for (box.z = 0; box.z < layers; box.z++) {
+         llvmpipe_microtile_copy_box(lpr, level, &box, tmp,
+                                     lpr->row_stride[level],
+                                     lpr->img_stride[level], false);
+         memcpy(llvmpipe_get_texture_image_address(lpr, box.z, level),
+                tmp, lpr->img_stride[level]);
+      }
+   }
+
+   free(tmp);
+
+   lpr->microtiled = false;
+   pt->flags &= ~LP_RESOURCE_FLAG_MICROTILED;
+
+   /* Shader variants of bound views have the layout in their keys. */
+   screen->timestamp++;
+   return true;
+}
+
+
 static bool
 llvmpipe_resource_get_handle(struct pipe_screen *_screen,
                              struct pipe_context *ctx,
@@ -800,6 +1044,9 @@ llvmpipe_resource_get_handle(struct pipe_screen *_screen,
 
 #if defined(HAVE_LIBDRM) && defined(HAVE_LINUX_UDMABUF_H)
    if (!lpr->dt && whandle->type == WINSYS_HANDLE_TYPE_FD) {
+      if (lpr->microtiled && !llvmpipe_resource_untile(screen, lpr))
+         return false;
+
       if (!lpr->dmabuf_alloc) {
          lpr->dmabuf_alloc = (struct llvmpipe_memory_allocation*)_screen->allocate_memory_fd(_screen, lpr->size_required, (int*)&whandle->handle, true);
          if (!lpr->dmabuf_alloc)
@@ -902,6 +1149,13 @@ llvmpipe_transfer_map_ms(struct pipe_context *pipe,
    assert(resource);
    assert(level <= resource->last_level);
 
+   /* Microtiled textures are mapped through a staging copy of the box,
+    * unless the caller needs the real storage.
+    */
+   if (lpr->microtiled && (usage & PIPE_MAP_DIRECTLY) &&
+       !llvmpipe_resource_untile(screen, lpr))
+      return NULL;
+
    /*
     * Transfers, like other pipe operations, must happen in order, so flush
     * the context if necessary.
@@ -1016,6 +1270,32 @@ llvmpipe_transfer_map_ms(struct pipe_context *pipe,
       return lpt->map;
    }
 
+   if (lpr->microtiled) {
+      pt->stride = box->width * util_format_get_blocksize(format);
+      pt->layer_stride = (uint64_t)pt->stride * box->height;
+
+      lpt->map = malloc(pt->layer_stride * box->depth);
+      if (!lpt->map) {
+         pipe_resource_reference(&pt->resource, NULL);
+         FREE(lpt);
+         *transfer = NULL;
+         return NULL;
+      }
+
+      /* Detile unless the caller is going to overwrite the whole box. */
+      if ((usage & PIPE_MAP_READ) ||
+          !(usage & (PIPE_MAP_DISCARD_RANGE |
+                     PIPE_MAP_DISCARD_WHOLE_RESOURCE))) {
+         llvmpipe_microtile_copy_box(lpr, level, box, lpt->map,
+                                     pt->stride, pt->layer_stride, false);
+      }
+
+      if (usage & PIPE_MAP_WRITE)
+         screen->timestamp++;
+
+      return lpt->map;
+   }
+
    map = llvmpipe_resource_map(resource, level, box->z, tex_usage);
 
 
@@ -1135,6 +1415,22 @@ llvmpipe_transfer_unmap(struct pipe_context *pipe,
       }
    }
 
+   if (lpr->microtiled && (transfer->usage & PIPE_MAP_WRITE)) {
+      llvmpipe_microtile_copy_box(lpr, transfer->level, &transfer->box,
+                                  lpt->map, transfer->stride,
+                                  transfer->layer_stride, true);
+   }
+
+   if ((transfer->usage & PIPE_MAP_WRITE) &&
+       llvmpipe_resource_is_texture(resource) &&
+       util_format_is_compressed(resource->format)) {
+      if (lpr->decompressed)
+         llvmpipe_decompress_box(lpr, transfer->level, &transfer->box);
+
+      /* the rasterizer threads may hold decoded copies of the old blocks */
+      lp_rast_invalidate_texture_cache(lpr->screen->rast);
+   }
+
    llvmpipe_resource_unmap(resource,
                            transfer->level,
                            transfer->box.z);
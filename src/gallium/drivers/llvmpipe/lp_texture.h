@@ -31,6 +31,7 @@
 
 #include "pipe/p_state.h"
 #include "util/u_debug.h"
+#include "util/format/u_format.h"
 #include "lp_limits.h"
 #include "util/bitset.h"
 #if MESA_DEBUG
@@ -115,6 +116,17 @@ struct llvmpipe_resource
    bool backable;
    bool imported_memory;
    bool dmabuf;
+   /**
+    * Images are stored as rows of 4x4 texel blocks, see
+    * llvmpipe_microtile_offset().  Mirrored in base.flags for gallivm.
+    */
+   bool microtiled;
+   /**
+    * R8G8B8A8_UNORM copy of a compressed texture, kept up to date on
+    * upload and sampled instead of it by views of the same format
+    * (LP_PERF=tex_decompress).  Mirrored in base.flags for gallivm.
+    */
+   struct pipe_resource *decompressed;
 #if MESA_DEBUG
    struct list_head list;
 #endif
@@ -202,6 +214,35 @@ llvmpipe_resource_is_texture(const struct pipe_resource *resource)
 }
 
 
+/**
+ * The resource a sampler view really samples from, see
+ * llvmpipe_resource::decompressed.
+ */
+static inline struct pipe_resource *
+llvmpipe_sampler_view_resource(const struct pipe_sampler_view *view)
+{
+   struct llvmpipe_resource *lpr = llvmpipe_resource(view->texture);
+
+   if (lpr->decompressed && view->format == view->texture->format)
+      return lpr->decompressed;
+   return view->texture;
+}
+
+
+/**
+ * Whether a compressed texture's memory may be written without llvmpipe
+ * seeing it, so blocks decoded in earlier scenes can't be trusted.
+ */
+static inline bool
+llvmpipe_resource_is_volatile_compressed(struct pipe_resource *resource)
+{
+   const struct llvmpipe_resource *lpr = llvmpipe_resource(resource);
+
+   return (lpr->backable || lpr->imported_memory || lpr->user_ptr) &&
+          util_format_is_compressed(resource->format);
+}
+
+
 static inline bool
 llvmpipe_resource_is_1d(const struct pipe_resource *resource)
 {
@@ -252,6 +293,24 @@ llvmpipe_sample_stride(struct pipe_resource *resource)
 }
 
 
+/**
+ * Byte offset of texel (x, y) within a microtiled image with the given
+ * row stride: each row of the image holds four texel rows stored as 4x4
+ * blocks.
+ */
+static inline unsigned
+llvmpipe_microtile_offset(unsigned x, unsigned y,
+                          unsigned stride, unsigned bpp)
+{
+   return (y / 4) * 4 * stride + ((x / 4) * 16 + (y % 4) * 4 + x % 4) * bpp;
+}
+
+
+bool
+llvmpipe_resource_untile(struct llvmpipe_screen *screen,
+                         struct llvmpipe_resource *lpr);
+
+
 void *
 llvmpipe_resource_map(struct pipe_resource *resource,
                       unsigned level,
@@ -24,6 +24,7 @@
 #include "lp_context.h"
 #include "lp_texture_handle.h"
 #include "lp_screen.h"
+#include "lp_texture.h"
 
 #include "gallivm/lp_bld_const.h"
 #include "gallivm/lp_bld_debug.h"
@@ -42,19 +43,29 @@ static const char *size_function_base_hash = "6d249ab9c1106c68b87ec9fdb5ade28368
 static const char *jit_sample_function_base_hash = "21de75bb5dbcfea1f90d03b8b688f19bdb0d96f95681cbe8b26853e1723846e4";
 
 static void
-llvmpipe_register_texture(struct llvmpipe_context *ctx, struct lp_static_texture_state *state, bool sampled);
+llvmpipe_register_texture(struct lp_sampler_matrix *matrix, struct lp_static_texture_state *state, bool sampled);
 
 static void
-llvmpipe_register_sampler(struct llvmpipe_context *ctx, struct lp_static_sampler_state *state);
+llvmpipe_register_sampler(struct lp_sampler_matrix *matrix, struct lp_static_sampler_state *state);
 
 static uint64_t
 llvmpipe_create_texture_handle(struct pipe_context *pctx, struct pipe_sampler_view *view, const struct pipe_sampler_state *sampler)
 {
-   struct llvmpipe_context *ctx = llvmpipe_context(pctx);
-   struct lp_sampler_matrix *matrix = &ctx->sampler_matrix;
+   struct lp_sampler_matrix *matrix = &llvmpipe_screen(pctx->screen)->sampler_matrix;
 
    struct lp_texture_handle *handle = calloc(1, sizeof(struct lp_texture_handle));
 
+   /* Handles outlive any layout change, so give them a linear texture.
+    * Untiling waits for all contexts, don't hold the lock meanwhile.
+    */
+   if (view) {
+      struct llvmpipe_resource *lpr = llvmpipe_resource(view->texture);
+      if (lpr && lpr->microtiled)
+         llvmpipe_resource_untile(llvmpipe_screen(pctx->screen), lpr);
+   }
+
+   simple_mtx_lock(&matrix->lock);
+
    if (view) {
       struct lp_static_texture_state state;
       lp_sampler_static_texture_state(&state, view);
@@ -64,7 +75,7 @@ llvmpipe_create_texture_handle(struct pipe_context *pctx, struct pipe_sampler_vi
       state.pot_height = false;
       state.pot_depth = false;
 
-      llvmpipe_register_texture(ctx, &state, true);
+      llvmpipe_register_texture(matrix, &state, true);
 
       bool found = false;
       for (uint32_t i = 0; i < matrix->texture_count; i++) {
@@ -81,7 +92,7 @@ llvmpipe_create_texture_handle(struct pipe_context *pctx, struct pipe_sampler_vi
       struct lp_static_sampler_state state;
       lp_sampler_static_sampler_state(&state, sampler);
 
-      llvmpipe_register_sampler(ctx, &state);
+      llvmpipe_register_sampler(matrix, &state);
 
       bool found = false;
       for (uint32_t i = 0; i < matrix->sampler_count; i++) {
@@ -94,6 +105,8 @@ llvmpipe_create_texture_handle(struct pipe_context *pctx, struct pipe_sampler_vi
       assert(found);
    }
 
+   simple_mtx_unlock(&matrix->lock);
+
    return (uint64_t)(uintptr_t)handle;
 }
 
@@ -106,11 +119,14 @@ llvmpipe_delete_texture_handle(struct pipe_context *pctx, uint64_t handle)
 static uint64_t
 llvmpipe_create_image_handle(struct pipe_context *pctx, const struct pipe_image_view *view)
 {
-   struct llvmpipe_context *ctx = llvmpipe_context(pctx);
-   struct lp_sampler_matrix *matrix = &ctx->sampler_matrix;
+   struct lp_sampler_matrix *matrix = &llvmpipe_screen(pctx->screen)->sampler_matrix;
 
    struct lp_texture_handle *handle = calloc(1, sizeof(struct lp_texture_handle));
 
+   struct llvmpipe_resource *lpr = llvmpipe_resource(view->resource);
+   if (lpr && lpr->microtiled)
+      llvmpipe_resource_untile(llvmpipe_screen(pctx->screen), lpr);
+
    struct lp_static_texture_state state;
    lp_sampler_static_texture_state_image(&state, view);
 
@@ -128,7 +144,9 @@ llvmpipe_create_image_handle(struct pipe_context *pctx, const struct pipe_image_
          state.target = PIPE_TEXTURE_CUBE;
    }
 
-   llvmpipe_register_texture(ctx, &state, false);
+   simple_mtx_lock(&matrix->lock);
+
+   llvmpipe_register_texture(matrix, &state, false);
 
    bool found = false;
    for (uint32_t i = 0; i < matrix->texture_count; i++) {
@@ -140,6 +158,8 @@ llvmpipe_create_image_handle(struct pipe_context *pctx, const struct pipe_image_
    }
    assert(found);
 
+   simple_mtx_unlock(&matrix->lock);
+
    return (uint64_t)(uintptr_t)handle;
 }
 
@@ -177,18 +197,38 @@ replace_sample_function_cache_locked(struct lp_sampler_matrix *matrix, struct ha
 }
 
 void
-llvmpipe_init_sampler_matrix(struct llvmpipe_context *ctx)
+llvmpipe_sampler_matrix_add_context(struct llvmpipe_context *ctx)
 {
    ctx->pipe.create_texture_handle = llvmpipe_create_texture_handle;
    ctx->pipe.delete_texture_handle = llvmpipe_delete_texture_handle;
    ctx->pipe.create_image_handle = llvmpipe_create_image_handle;
    ctx->pipe.delete_image_handle = llvmpipe_delete_image_handle;
 
-   struct lp_sampler_matrix *matrix = &ctx->sampler_matrix;
+   struct lp_sampler_matrix *matrix = &llvmpipe_screen(ctx->pipe.screen)->sampler_matrix;
+
+   simple_mtx_lock(&matrix->lock);
+   matrix->context_count++;
+   simple_mtx_unlock(&matrix->lock);
+}
+
+void
+llvmpipe_sampler_matrix_remove_context(struct llvmpipe_context *ctx)
+{
+   struct lp_sampler_matrix *matrix = &llvmpipe_screen(ctx->pipe.screen)->sampler_matrix;
+
+   simple_mtx_lock(&matrix->lock);
+   matrix->context_count--;
+   simple_mtx_unlock(&matrix->lock);
+}
+
+void
+llvmpipe_init_sampler_matrix(struct llvmpipe_screen *screen)
+{
+   struct lp_sampler_matrix *matrix = &screen->sampler_matrix;
 
    util_dynarray_init(&matrix->gallivms, NULL);
 
-   matrix->ctx = ctx;
+   matrix->screen = screen;
 
    matrix->compile_function = get_sample_function;
 
@@ -200,9 +240,9 @@ llvmpipe_init_sampler_matrix(struct llvmpipe_context *ctx)
 }
 
 void
-llvmpipe_sampler_matrix_destroy(struct llvmpipe_context *ctx)
+llvmpipe_sampler_matrix_destroy(struct llvmpipe_screen *screen)
 {
-   struct lp_sampler_matrix *matrix = &ctx->sampler_matrix;
+   struct lp_sampler_matrix *matrix = &screen->sampler_matrix;
 
    simple_mtx_destroy(&matrix->lock);
 
@@ -240,10 +280,8 @@ llvmpipe_sampler_matrix_destroy(struct llvmpipe_context *ctx)
 }
 
 static lp_context_ref *
-get_llvm_context(struct llvmpipe_context *ctx)
+get_llvm_context(struct lp_sampler_matrix *matrix)
 {
-   struct lp_sampler_matrix *matrix = &ctx->sampler_matrix;
-
    if (!matrix->context.ref)
       lp_context_create(&matrix->context);
 
@@ -251,7 +289,7 @@ get_llvm_context(struct llvmpipe_context *ctx)
 }
 
 static void *
-compile_function(struct llvmpipe_context *ctx, struct gallivm_state *gallivm, LLVMValueRef function,
+compile_function(struct lp_sampler_matrix *matrix, struct gallivm_state *gallivm, LLVMValueRef function,
                  const char *func_name,
                  bool needs_caching,
                  uint8_t cache_key[SHA1_DIGEST_LENGTH])
@@ -262,20 +300,50 @@ compile_function(struct llvmpipe_context *ctx, struct gallivm_state *gallivm, LL
    void *function_ptr = func_to_pointer(gallivm_jit_function(gallivm, function, func_name));
 
    if (needs_caching)
-      lp_disk_cache_insert_shader(llvmpipe_screen(ctx->pipe.screen), gallivm->cache, cache_key);
+      lp_disk_cache_insert_shader(matrix->screen, gallivm->cache, cache_key);
 
    gallivm_free_ir(gallivm);
 
-   util_dynarray_append(&ctx->sampler_matrix.gallivms, struct gallivm_state *, gallivm);
+   util_dynarray_append(&matrix->gallivms, struct gallivm_state *, gallivm);
 
    return function_ptr;
 }
 
-static void *
-compile_image_function(struct llvmpipe_context *ctx, struct lp_static_texture_state *texture, uint32_t op)
+static void
+get_image_function_cache_key(struct lp_static_texture_state *texture, uint32_t op, bool ms,
+                             uint8_t cache_key[SHA1_DIGEST_LENGTH])
+{
+   struct mesa_sha1 hash_ctx;
+   _mesa_sha1_init(&hash_ctx);
+   _mesa_sha1_update(&hash_ctx, image_function_base_hash, strlen(image_function_base_hash));
+   _mesa_sha1_update(&hash_ctx, texture, sizeof(*texture));
+   _mesa_sha1_update(&hash_ctx, &op, sizeof(op));
+   _mesa_sha1_update(&hash_ctx, &ms, sizeof(ms));
+   _mesa_sha1_final(&hash_ctx, cache_key);
+}
+
+static bool
+image_function_supported(struct lp_static_texture_state *texture, uint32_t op)
 {
    const struct util_format_description *desc = util_format_description(texture->format);
    if (desc->colorspace != UTIL_FORMAT_COLORSPACE_ZS && !lp_storage_render_image_format_supported(texture->format))
+      return false;
+
+   if (op >= LP_TOTAL_IMAGE_OP_COUNT / 2)
+      op -= LP_TOTAL_IMAGE_OP_COUNT / 2;
+
+   /* Loads need to support a wider range of formats for input attachments. */
+   if (op != LP_IMG_LOAD)
+      if (texture->format != PIPE_FORMAT_NONE && !lp_storage_image_format_supported(texture->format))
+         return false;
+
+   return true;
+}
+
+static void *
+compile_image_function(struct lp_sampler_matrix *matrix, struct lp_static_texture_state *texture, uint32_t op)
+{
+   if (!image_function_supported(texture, op))
       return NULL;
 
    bool ms = op >= LP_TOTAL_IMAGE_OP_COUNT / 2;
@@ -292,25 +360,14 @@ compile_image_function(struct llvmpipe_context *ctx, struct lp_static_texture_st
       params.img_op = LP_IMG_ATOMIC_CAS;
    }
 
-   /* Loads need to support a wider range of formats for input attachments. */
-   if (params.img_op != LP_IMG_LOAD)
-      if (texture->format != PIPE_FORMAT_NONE && !lp_storage_image_format_supported(texture->format))
-         return NULL;
-
    uint8_t cache_key[SHA1_DIGEST_LENGTH];
-   struct mesa_sha1 hash_ctx;
-   _mesa_sha1_init(&hash_ctx);
-   _mesa_sha1_update(&hash_ctx, image_function_base_hash, strlen(image_function_base_hash));
-   _mesa_sha1_update(&hash_ctx, texture, sizeof(*texture));
-   _mesa_sha1_update(&hash_ctx, &op, sizeof(op));
-   _mesa_sha1_update(&hash_ctx, &ms, sizeof(ms));
-   _mesa_sha1_final(&hash_ctx, cache_key);
+   get_image_function_cache_key(texture, op, ms, cache_key);
 
    struct lp_cached_code cached = { 0 };
-   lp_disk_cache_find_shader(llvmpipe_screen(ctx->pipe.screen), &cached, cache_key);
+   lp_disk_cache_find_shader(matrix->screen, &cached, cache_key);
    bool needs_caching = !cached.data_size;
 
-   struct gallivm_state *gallivm = gallivm_create("sample_function", get_llvm_context(ctx), &cached);
+   struct gallivm_state *gallivm = gallivm_create("sample_function", get_llvm_context(matrix), &cached);
 
    struct lp_image_static_state state = {
       .image_state = *texture,
@@ -392,11 +449,24 @@ compile_image_function(struct llvmpipe_context *ctx, struct lp_static_texture_st
 
    free(image_soa);
 
-   return compile_function(ctx, gallivm, function, "image", needs_caching, cache_key);
+   return compile_function(matrix, gallivm, function, "image", needs_caching, cache_key);
+}
+
+static void
+get_sample_function_cache_key(struct lp_static_texture_state *texture, struct lp_static_sampler_state *sampler,
+                              uint32_t sample_key, uint8_t cache_key[SHA1_DIGEST_LENGTH])
+{
+   struct mesa_sha1 hash_ctx;
+   _mesa_sha1_init(&hash_ctx);
+   _mesa_sha1_update(&hash_ctx, sample_function_base_hash, strlen(sample_function_base_hash));
+   _mesa_sha1_update(&hash_ctx, texture, sizeof(*texture));
+   _mesa_sha1_update(&hash_ctx, sampler, sizeof(*sampler));
+   _mesa_sha1_update(&hash_ctx, &sample_key, sizeof(sample_key));
+   _mesa_sha1_final(&hash_ctx, cache_key);
 }
 
 static void *
-compile_sample_function(struct llvmpipe_context *ctx, struct lp_static_texture_state *texture,
+compile_sample_function(struct lp_sampler_matrix *matrix, struct lp_static_texture_state *texture,
                         struct lp_static_sampler_state *sampler, uint32_t sample_key)
 {
    enum lp_sampler_lod_control lod_control = (sample_key & LP_SAMPLER_LOD_CONTROL_MASK) >> LP_SAMPLER_LOD_CONTROL_SHIFT;
@@ -451,30 +521,24 @@ compile_sample_function(struct llvmpipe_context *ctx, struct lp_static_texture_s
          return NULL;
 
       uint32_t bind = op_type == LP_SAMPLER_OP_FETCH ? PIPE_BIND_CONSTANT_BUFFER : PIPE_BIND_SAMPLER_VIEW;
-      if (!ctx->pipe.screen->is_format_supported(ctx->pipe.screen, texture->format, texture->target, 0, 0, bind))
+      if (!matrix->screen->base.is_format_supported(&matrix->screen->base, texture->format, texture->target, 0, 0, bind))
          supported = false;
    }
 
    uint8_t cache_key[SHA1_DIGEST_LENGTH];
-   struct mesa_sha1 hash_ctx;
-   _mesa_sha1_init(&hash_ctx);
-   _mesa_sha1_update(&hash_ctx, sample_function_base_hash, strlen(sample_function_base_hash));
-   _mesa_sha1_update(&hash_ctx, texture, sizeof(*texture));
-   _mesa_sha1_update(&hash_ctx, sampler, sizeof(*sampler));
-   _mesa_sha1_update(&hash_ctx, &sample_key, sizeof(sample_key));
-   _mesa_sha1_final(&hash_ctx, cache_key);
+   get_sample_function_cache_key(texture, sampler, sample_key, cache_key);
 
    struct lp_cached_code cached = { 0 };
-   lp_disk_cache_find_shader(llvmpipe_screen(ctx->pipe.screen), &cached, cache_key);
+   lp_disk_cache_find_shader(matrix->screen, &cached, cache_key);
    bool needs_caching = !cached.data_size;
 
-   struct gallivm_state *gallivm = gallivm_create("sample_function", get_llvm_context(ctx), &cached);
+   struct gallivm_state *gallivm = gallivm_create("sample_function", get_llvm_context(matrix), &cached);
 
    struct lp_sampler_static_state state = {
       .texture_state = *texture,
       .sampler_state = *sampler,
    };
-   struct lp_build_sampler_soa *sampler_soa = lp_llvm_sampler_soa_create(&state, 1);
+   struct lp_build_sampler_soa *sampler_soa = lp_llvm_sampler_soa_create(&state, 1, false);
 
    struct lp_type type;
    memset(&type, 0, sizeof type);
@@ -545,7 +609,7 @@ compile_sample_function(struct llvmpipe_context *ctx, struct lp_static_texture_s
 
    free(sampler_soa);
 
-   return compile_function(ctx, gallivm, function, "sample", needs_caching, cache_key);
+   return compile_function(matrix, gallivm, function, "sample", needs_caching, cache_key);
 }
 
 static uint64_t
@@ -575,7 +639,7 @@ get_sample_function(uint64_t _matrix, uint64_t _texture_functions, uint64_t _sam
       struct hash_entry *entry = _mesa_hash_table_search(current_cache, &key);
       result = entry ? entry->data : NULL;
       if (!result) {
-         result = compile_sample_function(matrix->ctx, &texture_functions->state, matrix->samplers + sampler_index, sample_key);
+         result = compile_sample_function(matrix, &texture_functions->state, matrix->samplers + sampler_index, sample_key);
          struct sample_function_cache_key *allocated_key = malloc(sizeof(struct sample_function_cache_key));
          *allocated_key = key;
          /* RCU style update: swap in an updated copy of the cache.
@@ -605,7 +669,7 @@ lp_build_compile_function_type(struct gallivm_state *gallivm)
 }
 
 static void *
-compile_jit_sample_function(struct llvmpipe_context *ctx, uint32_t sample_key)
+compile_jit_sample_function(struct lp_sampler_matrix *matrix, uint32_t sample_key)
 {
    uint8_t cache_key[SHA1_DIGEST_LENGTH];
    struct mesa_sha1 hash_ctx;
@@ -615,10 +679,10 @@ compile_jit_sample_function(struct llvmpipe_context *ctx, uint32_t sample_key)
    _mesa_sha1_final(&hash_ctx, cache_key);
 
    struct lp_cached_code cached = { 0 };
-   lp_disk_cache_find_shader(llvmpipe_screen(ctx->pipe.screen), &cached, cache_key);
+   lp_disk_cache_find_shader(matrix->screen, &cached, cache_key);
    bool needs_caching = !cached.data_size;
 
-   struct gallivm_state *gallivm = gallivm_create("jit_sample_function", get_llvm_context(ctx), &cached);
+   struct gallivm_state *gallivm = gallivm_create("jit_sample_function", get_llvm_context(matrix), &cached);
 
    struct lp_type type;
    memset(&type, 0, sizeof type);
@@ -707,11 +771,11 @@ compile_jit_sample_function(struct llvmpipe_context *ctx, uint32_t sample_key)
    LLVMDisposeBuilder(gallivm->builder);
    gallivm->builder = old_builder;
 
-   return compile_function(ctx, gallivm, function, "sample", needs_caching, cache_key);
+   return compile_function(matrix, gallivm, function, "sample", needs_caching, cache_key);
 }
 
 static void *
-compile_size_function(struct llvmpipe_context *ctx, struct lp_static_texture_state *texture, bool samples)
+compile_size_function(struct lp_sampler_matrix *matrix, struct lp_static_texture_state *texture, bool samples)
 {
    uint8_t cache_key[SHA1_DIGEST_LENGTH];
    struct mesa_sha1 hash_ctx;
@@ -722,15 +786,15 @@ compile_size_function(struct llvmpipe_context *ctx, struct lp_static_texture_sta
    _mesa_sha1_final(&hash_ctx, cache_key);
 
    struct lp_cached_code cached = { 0 };
-   lp_disk_cache_find_shader(llvmpipe_screen(ctx->pipe.screen), &cached, cache_key);
+   lp_disk_cache_find_shader(matrix->screen, &cached, cache_key);
    bool needs_caching = !cached.data_size;
 
-   struct gallivm_state *gallivm = gallivm_create("sample_function", get_llvm_context(ctx), &cached);
+   struct gallivm_state *gallivm = gallivm_create("sample_function", get_llvm_context(matrix), &cached);
 
    struct lp_sampler_static_state state = {
       .texture_state = *texture,
    };
-   struct lp_build_sampler_soa *sampler_soa = lp_llvm_sampler_soa_create(&state, 1);
+   struct lp_build_sampler_soa *sampler_soa = lp_llvm_sampler_soa_create(&state, 1, false);
 
    struct lp_type type;
    memset(&type, 0, sizeof type);
@@ -789,11 +853,11 @@ compile_size_function(struct llvmpipe_context *ctx, struct lp_static_texture_sta
 
    free(sampler_soa);
 
-   return compile_function(ctx, gallivm, function, "size", needs_caching, cache_key);
+   return compile_function(matrix, gallivm, function, "size", needs_caching, cache_key);
 }
 
 static void
-compile_sample_functions(struct llvmpipe_context *ctx, struct lp_static_texture_state *texture,
+compile_sample_functions(struct lp_sampler_matrix *matrix, struct lp_static_texture_state *texture,
                         struct lp_static_sampler_state *sampler, void ***dst)
 {
    void **functions;
@@ -810,7 +874,24 @@ compile_sample_functions(struct llvmpipe_context *ctx, struct lp_static_texture_
    if (!sampler)
       sampler = &dummy_sampler;
 
-   struct lp_sampler_matrix *matrix = &ctx->sampler_matrix;
+   /* Each function is a disk cache lookup, load all of them at once.
+    * Multi-planar formats don't get any sample functions.
+    */
+   if (!has_sampler &&
+       (texture->format == PIPE_FORMAT_NONE || util_format_get_num_planes(texture->format) == 1)) {
+      uint8_t (*cache_keys)[SHA1_DIGEST_LENGTH] = malloc(LP_SAMPLE_KEY_COUNT * SHA1_DIGEST_LENGTH);
+      uint32_t key_count = 0;
+
+      uint32_t sample_key;
+      BITSET_FOREACH_SET (sample_key, matrix->sample_keys, LP_SAMPLE_KEY_COUNT) {
+         if (!functions[sample_key] && cache_keys)
+            get_sample_function_cache_key(texture, sampler, sample_key, cache_keys[key_count++]);
+      }
+
+      lp_disk_cache_prefetch_shaders(matrix->screen, cache_keys, key_count);
+      free(cache_keys);
+   }
+
    for (uint32_t sample_key = 0; sample_key < LP_SAMPLE_KEY_COUNT; sample_key++) {
       if (!BITSET_TEST(matrix->sample_keys, sample_key))
          continue;
@@ -823,16 +904,15 @@ compile_sample_functions(struct llvmpipe_context *ctx, struct lp_static_texture_
          if (has_sampler)
             functions[sample_key] = matrix->jit_sample_functions[sample_key];
          else
-            functions[sample_key] = compile_sample_function(ctx, texture, sampler, sample_key);
+            functions[sample_key] = compile_sample_function(matrix, texture, sampler, sample_key);
       }
    }
 }
 
+/* Called with the matrix lock held. */
 static void
-llvmpipe_register_texture(struct llvmpipe_context *ctx, struct lp_static_texture_state *state, bool sampled)
+llvmpipe_register_texture(struct lp_sampler_matrix *matrix, struct lp_static_texture_state *state, bool sampled)
 {
-   struct lp_sampler_matrix *matrix = &ctx->sampler_matrix;
-
    bool packed = true;
    uint32_t dst_index = matrix->texture_count;
    for (uint32_t i = 0; i < matrix->texture_count; i++) {
@@ -868,8 +948,6 @@ llvmpipe_register_texture(struct llvmpipe_context *ctx, struct lp_static_texture
    else
       entry->storage = true;
 
-   simple_mtx_lock(&matrix->lock);
-
    if (entry->sampled) {
       if (entry->sample_functions) {
          entry->sample_functions = realloc(entry->sample_functions, matrix->sampler_count * sizeof(void **));
@@ -881,37 +959,48 @@ llvmpipe_register_texture(struct llvmpipe_context *ctx, struct lp_static_texture
 
       if (state->format == PIPE_FORMAT_NONE) {
          if (matrix->sampler_count)
-            compile_sample_functions(ctx, state, NULL, entry->sample_functions);
+            compile_sample_functions(matrix, state, NULL, entry->sample_functions);
          for (uint32_t i = 1; i < matrix->sampler_count; i++)
             entry->sample_functions[i] = entry->sample_functions[0];
       } else {
          for (uint32_t i = 0; i < matrix->sampler_count; i++)
-            compile_sample_functions(ctx, state, matrix->samplers + i, entry->sample_functions + i);
+            compile_sample_functions(matrix, state, matrix->samplers + i, entry->sample_functions + i);
       }
 
-      compile_sample_functions(ctx, state, NULL, &entry->fetch_functions);
+      compile_sample_functions(matrix, state, NULL, &entry->fetch_functions);
 
       if (!entry->size_function)
-         entry->size_function = compile_size_function(ctx, state, false);
+         entry->size_function = compile_size_function(matrix, state, false);
 
       if (!entry->samples_function)
-         entry->samples_function = compile_size_function(ctx, state, true);
+         entry->samples_function = compile_size_function(matrix, state, true);
    }
 
    if (entry->storage) {
+      uint8_t cache_keys[LP_TOTAL_IMAGE_OP_COUNT][SHA1_DIGEST_LENGTH];
+      uint32_t key_count = 0;
+
       uint32_t image_op;
+      BITSET_FOREACH_SET (image_op, matrix->image_ops, LP_TOTAL_IMAGE_OP_COUNT) {
+         if (!entry->image_functions[image_op] && image_function_supported(state, image_op)) {
+            bool ms = image_op >= LP_TOTAL_IMAGE_OP_COUNT / 2;
+            get_image_function_cache_key(state, ms ? image_op - LP_TOTAL_IMAGE_OP_COUNT / 2 : image_op, ms,
+                                         cache_keys[key_count++]);
+         }
+      }
+
+      lp_disk_cache_prefetch_shaders(matrix->screen, cache_keys, key_count);
+
       BITSET_FOREACH_SET (image_op, matrix->image_ops, LP_TOTAL_IMAGE_OP_COUNT)
          if (!entry->image_functions[image_op])
-            entry->image_functions[image_op] = compile_image_function(ctx, state, image_op);
+            entry->image_functions[image_op] = compile_image_function(matrix, state, image_op);
    }
-
-   simple_mtx_unlock(&matrix->lock);
 }
 
+/* Called with the matrix lock held. */
 static void
-llvmpipe_register_sampler(struct llvmpipe_context *ctx, struct lp_static_sampler_state *state)
+llvmpipe_register_sampler(struct lp_sampler_matrix *matrix, struct lp_static_sampler_state *state)
 {
-   struct lp_sampler_matrix *matrix = &ctx->sampler_matrix;
    for (uint32_t i = 0; i < matrix->sampler_count; i++)
       if (!memcmp(matrix->samplers + i, state, sizeof(struct lp_static_sampler_state)))
          return;
@@ -921,8 +1010,6 @@ llvmpipe_register_sampler(struct llvmpipe_context *ctx, struct lp_static_sampler
 
    matrix->samplers[matrix->sampler_count - 1] = *state;
 
-   simple_mtx_lock(&matrix->lock);
-
    for (uint32_t i = 0; i < matrix->texture_count; i++) {
       struct lp_texture_functions *texture = matrix->textures[i];
       if (!texture->sampled)
@@ -936,7 +1023,7 @@ llvmpipe_register_sampler(struct llvmpipe_context *ctx, struct lp_static_sampler
       if (texture->state.format == PIPE_FORMAT_NONE)  {
          if (matrix->sampler_count == 1) {
             *dst = NULL;
-            compile_sample_functions(ctx, &texture->state, NULL, dst);
+            compile_sample_functions(matrix, &texture->state, NULL, dst);
          } else {
             *dst = texture->sample_functions[0];
          }
@@ -945,24 +1032,23 @@ llvmpipe_register_sampler(struct llvmpipe_context *ctx, struct lp_static_sampler
       }
 
       *dst = NULL;
-      compile_sample_functions(ctx, &texture->state, state, dst);
+      compile_sample_functions(matrix, &texture->state, state, dst);
    }
-
-   simple_mtx_unlock(&matrix->lock);
 }
 
 static void
-register_sample_key(struct llvmpipe_context *ctx, uint32_t sample_key)
+register_sample_key(struct lp_sampler_matrix *matrix, uint32_t sample_key)
 {
-   struct lp_sampler_matrix *matrix = &ctx->sampler_matrix;
-   if (BITSET_TEST(matrix->sample_keys, sample_key))
+   simple_mtx_lock(&matrix->lock);
+
+   if (BITSET_TEST(matrix->sample_keys, sample_key)) {
+      simple_mtx_unlock(&matrix->lock);
       return;
+   }
 
    BITSET_SET(matrix->sample_keys, sample_key);
 
-   simple_mtx_lock(&matrix->lock);
-
-   matrix->jit_sample_functions[sample_key] = compile_jit_sample_function(ctx, sample_key);
+   matrix->jit_sample_functions[sample_key] = compile_jit_sample_function(matrix, sample_key);
 
    for (uint32_t texture_index = 0; texture_index < matrix->texture_count; texture_index++) {
       struct lp_texture_functions *texture = matrix->textures[texture_index];
@@ -972,14 +1058,14 @@ register_sample_key(struct llvmpipe_context *ctx, uint32_t sample_key)
       enum lp_sampler_op_type op_type = (sample_key & LP_SAMPLER_OP_TYPE_MASK) >> LP_SAMPLER_OP_TYPE_SHIFT;
       if (op_type == LP_SAMPLER_OP_FETCH) {
          struct lp_static_sampler_state dummy_sampler = { 0 };
-         texture->fetch_functions[sample_key] = compile_sample_function(ctx, &texture->state, &dummy_sampler, sample_key);
+         texture->fetch_functions[sample_key] = compile_sample_function(matrix, &texture->state, &dummy_sampler, sample_key);
          continue;
       }
 
       if (texture->state.format == PIPE_FORMAT_NONE) {
          if (matrix->sampler_count) {
             struct lp_static_sampler_state dummy_sampler = { 0 };
-            texture->sample_functions[0][sample_key] = compile_sample_function(ctx, &texture->state, &dummy_sampler, sample_key);
+            texture->sample_functions[0][sample_key] = compile_sample_function(matrix, &texture->state, &dummy_sampler, sample_key);
          }
          continue;
       }
@@ -992,20 +1078,21 @@ register_sample_key(struct llvmpipe_context *ctx, uint32_t sample_key)
 }
 
 static void
-register_image_op(struct llvmpipe_context *ctx, uint32_t op)
+register_image_op(struct lp_sampler_matrix *matrix, uint32_t op)
 {
-   struct lp_sampler_matrix *matrix = &ctx->sampler_matrix;
-   if (BITSET_TEST(matrix->image_ops, op))
+   simple_mtx_lock(&matrix->lock);
+
+   if (BITSET_TEST(matrix->image_ops, op)) {
+      simple_mtx_unlock(&matrix->lock);
       return;
+   }
 
    BITSET_SET(matrix->image_ops, op);
 
-   simple_mtx_lock(&matrix->lock);
-
    for (uint32_t texture_index = 0; texture_index < matrix->texture_count; texture_index++) {
       struct lp_texture_functions *texture = matrix->textures[texture_index];
       if (texture->storage)
-         texture->image_functions[op] = compile_image_function(ctx, &texture->state, op);
+         texture->image_functions[op] = compile_image_function(matrix, &texture->state, op);
    }
 
    simple_mtx_unlock(&matrix->lock);
@@ -1014,13 +1101,13 @@ register_image_op(struct llvmpipe_context *ctx, uint32_t op)
 static bool
 register_instr(nir_builder *b, nir_instr *instr, void *data)
 {
-   struct llvmpipe_context *ctx = data;
+   struct lp_sampler_matrix *matrix = data;
 
    if (instr->type == nir_instr_type_tex) {
       nir_tex_instr *tex = nir_instr_as_tex(instr);
       uint32_t sample_key = lp_build_nir_sample_key(b->shader->info.stage, tex);
 
-      register_sample_key(ctx, sample_key);
+      register_sample_key(matrix, sample_key);
    } else if (instr->type == nir_instr_type_intrinsic) {
       nir_intrinsic_instr *intrin = nir_instr_as_intrinsic(instr);
 
@@ -1040,7 +1127,7 @@ register_instr(nir_builder *b, nir_instr *instr, void *data)
           nir_intrinsic_image_dim(intrin) == GLSL_SAMPLER_DIM_SUBPASS_MS)
          op += LP_TOTAL_IMAGE_OP_COUNT / 2;
 
-      register_image_op(ctx, op);
+      register_image_op(matrix, op);
    }
 
    return false;
@@ -1050,7 +1137,8 @@ void
 llvmpipe_register_shader(struct pipe_context *ctx, const struct pipe_shader_state *shader)
 {
    if (shader->type == PIPE_SHADER_IR_NIR)
-      nir_shader_instructions_pass(shader->ir.nir, register_instr, nir_metadata_all, ctx);
+      nir_shader_instructions_pass(shader->ir.nir, register_instr, nir_metadata_all,
+                                   &llvmpipe_screen(ctx->screen)->sampler_matrix);
 }
 
 void
@@ -1059,13 +1147,29 @@ llvmpipe_clear_sample_functions_cache(struct llvmpipe_context *ctx, struct pipe_
    if (!fence)
       return;
 
-   struct lp_sampler_matrix *matrix = &ctx->sampler_matrix;
+   struct pipe_screen *screen = ctx->pipe.screen;
+   struct lp_sampler_matrix *matrix = &llvmpipe_screen(screen)->sampler_matrix;
 
+   /* Shaders of other contexts may look at the cache at any time, leave it
+    * alone until this is the only context left.
+    */
+   simple_mtx_lock(&matrix->lock);
+   bool only_context = matrix->context_count == 1;
    /* If the cache is empty, there is nothing to do. */
-   if (!_mesa_hash_table_num_entries(acquire_latest_sample_function_cache(matrix)))
+   bool empty = !_mesa_hash_table_num_entries(acquire_latest_sample_function_cache(matrix));
+   simple_mtx_unlock(&matrix->lock);
+
+   if (!only_context || empty)
       return;
 
-   ctx->pipe.screen->fence_finish(ctx->pipe.screen, NULL, *fence, OS_TIMEOUT_INFINITE);
+   screen->fence_finish(screen, NULL, *fence, OS_TIMEOUT_INFINITE);
+
+   simple_mtx_lock(&matrix->lock);
+
+   if (matrix->context_count != 1) {
+      simple_mtx_unlock(&matrix->lock);
+      return;
+   }
 
    /* All work is finished, it's safe to move cache entries into the table. */
    hash_table_foreach_remove(acquire_latest_sample_function_cache(matrix), entry) {
@@ -1077,4 +1181,6 @@ llvmpipe_clear_sample_functions_cache(struct llvmpipe_context *ctx, struct pipe_
    util_dynarray_foreach (&matrix->trash_caches, struct hash_table *, trash)
       _mesa_hash_table_destroy(*trash, NULL);
    util_dynarray_clear(&matrix->trash_caches);
+
+   simple_mtx_unlock(&matrix->lock);
 }
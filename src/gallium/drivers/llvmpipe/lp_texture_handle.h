@@ -32,6 +32,9 @@
 #include "gallivm/lp_bld_sample.h"
 #include "gallivm/lp_bld_jit_sample.h"
 
+/* Shared by all contexts of a screen, so texture and image handles can be
+ * used on any of them.  Everything in here is only modified under lock.
+ */
 struct lp_sampler_matrix {
    struct lp_texture_functions **textures;
    struct lp_static_sampler_state *samplers;
@@ -49,7 +52,9 @@ struct lp_sampler_matrix {
    struct util_dynarray trash_caches;
    simple_mtx_t lock;
 
-   struct llvmpipe_context *ctx;
+   struct llvmpipe_screen *screen;
+   /* Contexts which may run shaders looking at the caches above. */
+   uint32_t context_count;
 
    /* Use a separate LLVMContext since it is not thread safe but can be accessed by shaders. */
    lp_context_ref context;
@@ -57,9 +62,13 @@ struct lp_sampler_matrix {
    struct util_dynarray gallivms;
 };
 
-void llvmpipe_init_sampler_matrix(struct llvmpipe_context *ctx);
+void llvmpipe_sampler_matrix_add_context(struct llvmpipe_context *ctx);
+
+void llvmpipe_sampler_matrix_remove_context(struct llvmpipe_context *ctx);
+
+void llvmpipe_init_sampler_matrix(struct llvmpipe_screen *screen);
 
-void llvmpipe_sampler_matrix_destroy(struct llvmpipe_context *ctx);
+void llvmpipe_sampler_matrix_destroy(struct llvmpipe_screen *screen);
 
 void llvmpipe_register_shader(struct pipe_context *ctx, const struct pipe_shader_state *shader);
 
@@ -30,6 +30,7 @@
 static void
 lvp_cmd_buffer_destroy(struct vk_command_buffer *cmd_buffer)
 {
+   lvp_cmd_buffer_free_stream(container_of(cmd_buffer, struct lvp_cmd_buffer, vk));
    vk_command_buffer_finish(cmd_buffer);
    vk_free(&cmd_buffer->pool->alloc, cmd_buffer);
 }
@@ -56,6 +57,7 @@ lvp_create_cmd_buffer(struct vk_command_pool *pool,
    }
 
    cmd_buffer->device = device;
+   cmd_buffer->stream = NULL;
 
    *cmd_buffer_out = &cmd_buffer->vk;
 
@@ -66,6 +68,7 @@ static void
 lvp_reset_cmd_buffer(struct vk_command_buffer *vk_cmd_buffer,
                      UNUSED VkCommandBufferResetFlags flags)
 {
+   lvp_cmd_buffer_free_stream(container_of(vk_cmd_buffer, struct lvp_cmd_buffer, vk));
    vk_command_buffer_reset(vk_cmd_buffer);
 }
 
@@ -82,6 +85,8 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_BeginCommandBuffer(
    LVP_FROM_HANDLE(lvp_cmd_buffer, cmd_buffer, commandBuffer);
 
    vk_command_buffer_begin(&cmd_buffer->vk, pBeginInfo);
+   cmd_buffer->one_time_submit =
+      pBeginInfo->flags & VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
    return VK_SUCCESS;
 }
@@ -91,5 +96,14 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_EndCommandBuffer(
 {
    LVP_FROM_HANDLE(lvp_cmd_buffer, cmd_buffer, commandBuffer);
 
-   return vk_command_buffer_end(&cmd_buffer->vk);
+   VkResult result = vk_command_buffer_end(&cmd_buffer->vk);
+
+   /* Only worth it if the command buffer is reused, and LVP_CMD_DEBUG prints
+    * the commands from the queue.
+    */
+   if (result == VK_SUCCESS && !cmd_buffer->one_time_submit &&
+       !cmd_buffer->device->print_cmds)
+      lvp_compile_cmd_buffer(cmd_buffer);
+
+   return result;
 }
@@ -187,6 +187,17 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_CreateDescriptorSetLayout(
 
    set_layout->dynamic_offset_count = dynamic_offset_count;
 
+   const VkDescriptorSetLayoutBindingFlagsCreateInfo *binding_flags =
+      vk_find_struct_const(pCreateInfo->pNext, DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO);
+   if (binding_flags) {
+      for (uint32_t i = 0; i < binding_flags->bindingCount; i++) {
+         if (binding_flags->pBindingFlags[i] &
+             (VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+              VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT))
+            set_layout->update_after_bind = true;
+      }
+   }
+
    if (set_layout->binding_count == set_layout->immutable_sampler_count) {
       /* create a bindable set with all the immutable samplers */
       lvp_descriptor_set_create(device, set_layout, &set_layout->immutable_set);
@@ -413,6 +424,9 @@ VKAPI_ATTR VkResult VKAPI_CALL lvp_AllocateDescriptorSets(
       if (result != VK_SUCCESS)
          break;
 
+      set->update_after_bind =
+         (pool->flags & VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT) ||
+         layout->update_after_bind;
       list_addtail(&set->link, &pool->sets);
       pDescriptorSets[i] = lvp_descriptor_set_to_handle(set);
    }
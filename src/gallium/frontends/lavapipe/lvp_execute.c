@@ -82,6 +82,7 @@ struct lvp_render_attachment {
 struct rendering_state {
    struct pipe_context *pctx;
    struct lvp_device *device; //for uniform inlining only
+   struct lvp_queue *queue;
    struct u_upload_mgr *uploader;
    struct cso_context *cso;
 
@@ -206,10 +207,39 @@ struct rendering_state {
    struct lvp_pipeline *exec_graph;
 };
 
+/* The commands of a command buffer as prepared by lvp_compile_cmd_buffer().
+ * No-op commands and redundant barriers are left out, and the descriptor set
+ * copies for dynamic offsets and the clamped vertex buffers are created only
+ * once.  Every op still goes through lvp_execute_cmd() on each submission,
+ * so binding CSOs, setting up draws and emitting state isn't saved.
+ */
+struct lvp_cmd_stream {
+   /* struct lvp_cmd_op, in execution order */
+   struct util_dynarray ops;
+
+   /* Descriptor sets and buffers created for the ops */
+   struct util_dynarray desc_sets;
+   struct util_dynarray buffers;
+};
+
+struct lvp_cmd_op {
+   struct vk_cmd_queue_entry *cmd;
+
+   /* What was resolved ahead of time, or NULL if it's done on execution */
+   union {
+      /* VK_CMD_BIND_DESCRIPTOR_SETS2_KHR: the sets visited by
+       * handle_descriptor_sets(), with the dynamic offsets applied
+       */
+      struct lvp_descriptor_set **desc_sets;
+
+      /* VK_CMD_BIND_VERTEX_BUFFERS2: buffers clamped to the binding size */
+      struct pipe_resource **vbs;
+   };
+};
+
 static struct pipe_resource *
-get_buffer_resource(struct pipe_context *ctx, void *mem)
+get_buffer_resource(struct pipe_screen *pscreen, void *mem)
 {
-   struct pipe_screen *pscreen = ctx->screen;
    struct pipe_resource templ = {0};
 
    if (!mem)
@@ -295,6 +325,31 @@ update_pcbuf(struct rendering_state *state, enum pipe_shader_type pstage,
    state->pcbuf_dirty[api_stage] = false;
 }
 
+/* CSOs only work on the context of the queue they were created for.  The
+ * first queue usually gets them along with the pipeline, anything missing
+ * (other queues, pipelines linked from libraries) is compiled on first bind.
+ */
+static void *
+get_shader_cso(struct rendering_state *state, struct lvp_shader *shader, bool tess_ccw)
+{
+   void **cso = lvp_shader_cso(shader, state->queue->vk.index_in_family, tess_ccw);
+   struct lvp_pipeline_nir *pipeline_nir = tess_ccw ? shader->tess_ccw : shader->pipeline_nir;
+
+   if (!*cso && pipeline_nir)
+      *cso = lvp_shader_compile_on_queue(state->queue, shader, nir_shader_clone(NULL, pipeline_nir->nir));
+
+   return *cso;
+}
+
+static nir_shader *
+create_inline_variant_nir(struct lvp_shader *shader, nir_shader *base_nir, const struct lvp_inline_variant *v)
+{
+   nir_shader *nir = nir_shader_clone(NULL, base_nir);
+   NIR_PASS_V(nir, lvp_inline_uniforms, shader, v->vals[0], 0);
+   lvp_shader_optimize(nir);
+   return nir;
+}
+
 static void
 update_inline_shader_state(struct rendering_state *state, enum pipe_shader_type sh, bool pcbuf_dirty)
 {
@@ -323,32 +378,42 @@ update_inline_shader_state(struct rendering_state *state, enum pipe_shader_type
       for (unsigned i = count; i < MAX_INLINABLE_UNIFORMS; i++)
          v.vals[0][i] = 0;
    }
-   bool found = false;
-   struct set_entry *entry = _mesa_set_search_or_add_pre_hashed(&shader->inlines.variants, v.mask, &v, &found);
+   uint32_t queue_index = state->queue->vk.index_in_family;
    void *shader_state;
-   if (found) {
-      const struct lvp_inline_variant *variant = entry->key;
-      shader_state = variant->cso;
+   /* Variants are shared by the queues, each compiles its own CSOs */
+   simple_mtx_lock(&state->device->inline_lock);
+   if (shader->inlines.stop_inlining) {
+      shader_state = get_shader_cso(state, shader, false);
    } else {
-      nir_shader *nir = nir_shader_clone(NULL, base_nir);
-      NIR_PASS_V(nir, lvp_inline_uniforms, shader, v.vals[0], 0);
-      lvp_shader_optimize(nir);
-      impl = nir_shader_get_entrypoint(nir);
-      if (ssa_alloc - impl->ssa_alloc < ssa_alloc / 2 &&
-         !shader->inlines.must_inline) {
-         /* not enough change; don't inline further */
-         shader->inlines.can_inline = 0;
-         ralloc_free(nir);
-         shader->shader_cso = lvp_shader_compile(state->device, shader, nir_shader_clone(NULL, shader->pipeline_nir->nir), true);
-         _mesa_set_remove(&shader->inlines.variants, entry);
-         shader_state = shader->shader_cso;
+      bool found = false;
+      struct set_entry *entry = _mesa_set_search_or_add_pre_hashed(&shader->inlines.variants, v.mask, &v, &found);
+      if (found) {
+         struct lvp_inline_variant *variant = (void *)entry->key;
+         if (!variant->cso[queue_index]) {
+            nir_shader *nir = create_inline_variant_nir(shader, base_nir, variant);
+            variant->cso[queue_index] = lvp_shader_compile_on_queue(state->queue, shader, nir);
+         }
+         shader_state = variant->cso[queue_index];
       } else {
-         shader_state = lvp_shader_compile(state->device, shader, nir, true);
-         struct lvp_inline_variant *variant = mem_dup(&v, sizeof(v));
-         variant->cso = shader_state;
-         entry->key = variant;
+         nir_shader *nir = create_inline_variant_nir(shader, base_nir, &v);
+         impl = nir_shader_get_entrypoint(nir);
+         if (ssa_alloc - impl->ssa_alloc < ssa_alloc / 2 &&
+            !shader->inlines.must_inline) {
+            /* not enough change; don't inline further */
+            shader->inlines.stop_inlining = true;
+            ralloc_free(nir);
+            _mesa_set_remove(&shader->inlines.variants, entry);
+            shader_state = get_shader_cso(state, shader, false);
+         } else {
+            shader_state = lvp_shader_compile_on_queue(state->queue, shader, nir);
+            struct lvp_inline_variant *variant = mem_dup(&v, sizeof(v));
+            memset(variant->cso, 0, sizeof(variant->cso));
+            variant->cso[queue_index] = shader_state;
+            entry->key = variant;
+         }
       }
    }
+   simple_mtx_unlock(&state->device->inline_lock);
    switch (sh) {
    case MESA_SHADER_VERTEX:
       state->pctx->bind_vs_state(state->pctx, shader_state);
@@ -396,7 +461,7 @@ static void emit_compute_state(struct rendering_state *state)
        state->shaders[MESA_SHADER_COMPUTE]->inlines.can_inline) {
       update_inline_shader_state(state, MESA_SHADER_COMPUTE, pcbuf_dirty);
    } else if (state->compute_shader_dirty) {
-      state->pctx->bind_compute_state(state->pctx, state->shaders[MESA_SHADER_COMPUTE]->shader_cso);
+      state->pctx->bind_compute_state(state->pctx, get_shader_cso(state, state->shaders[MESA_SHADER_COMPUTE], false));
    }
 
    state->compute_shader_dirty = false;
@@ -449,7 +514,7 @@ static void update_vertex_elements_buffer_index(struct rendering_state *state)
 static void emit_state(struct rendering_state *state)
 {
    if (!state->shaders[MESA_SHADER_FRAGMENT] && !state->noop_fs_bound) {
-      state->pctx->bind_fs_state(state->pctx, state->device->noop_fs);
+      state->pctx->bind_fs_state(state->pctx, state->queue->noop_fs);
       state->noop_fs_bound = true;
    }
    if (state->blend_dirty) {
@@ -698,25 +763,25 @@ handle_graphics_stages(struct rendering_state *state, VkShaderStageFlagBits shad
       case VK_SHADER_STAGE_FRAGMENT_BIT:
          state->inlines_dirty[MESA_SHADER_FRAGMENT] = state->shaders[MESA_SHADER_FRAGMENT]->inlines.can_inline;
          if (!state->shaders[MESA_SHADER_FRAGMENT]->inlines.can_inline) {
-            state->pctx->bind_fs_state(state->pctx, state->shaders[MESA_SHADER_FRAGMENT]->shader_cso);
+            state->pctx->bind_fs_state(state->pctx, get_shader_cso(state, state->shaders[MESA_SHADER_FRAGMENT], false));
             state->noop_fs_bound = false;
          }
          break;
       case VK_SHADER_STAGE_VERTEX_BIT:
          state->inlines_dirty[MESA_SHADER_VERTEX] = state->shaders[MESA_SHADER_VERTEX]->inlines.can_inline;
          if (!state->shaders[MESA_SHADER_VERTEX]->inlines.can_inline)
-            state->pctx->bind_vs_state(state->pctx, state->shaders[MESA_SHADER_VERTEX]->shader_cso);
+            state->pctx->bind_vs_state(state->pctx, get_shader_cso(state, state->shaders[MESA_SHADER_VERTEX], false));
          break;
       case VK_SHADER_STAGE_GEOMETRY_BIT:
          state->inlines_dirty[MESA_SHADER_GEOMETRY] = state->shaders[MESA_SHADER_GEOMETRY]->inlines.can_inline;
          if (!state->shaders[MESA_SHADER_GEOMETRY]->inlines.can_inline)
-            state->pctx->bind_gs_state(state->pctx, state->shaders[MESA_SHADER_GEOMETRY]->shader_cso);
+            state->pctx->bind_gs_state(state->pctx, get_shader_cso(state, state->shaders[MESA_SHADER_GEOMETRY], false));
          state->gs_output_lines = state->shaders[MESA_SHADER_GEOMETRY]->pipeline_nir->nir->info.gs.output_primitive == MESA_PRIM_LINES ? GS_OUTPUT_LINES : GS_OUTPUT_NOT_LINES;
          break;
       case VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT:
          state->inlines_dirty[MESA_SHADER_TESS_CTRL] = state->shaders[MESA_SHADER_TESS_CTRL]->inlines.can_inline;
          if (!state->shaders[MESA_SHADER_TESS_CTRL]->inlines.can_inline)
-            state->pctx->bind_tcs_state(state->pctx, state->shaders[MESA_SHADER_TESS_CTRL]->shader_cso);
+            state->pctx->bind_tcs_state(state->pctx, get_shader_cso(state, state->shaders[MESA_SHADER_TESS_CTRL], false));
          break;
       case VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT:
          state->inlines_dirty[MESA_SHADER_TESS_EVAL] = state->shaders[MESA_SHADER_TESS_EVAL]->inlines.can_inline;
@@ -724,11 +789,11 @@ handle_graphics_stages(struct rendering_state *state, VkShaderStageFlagBits shad
          state->tess_states[1] = NULL;
          if (!state->shaders[MESA_SHADER_TESS_EVAL]->inlines.can_inline) {
             if (dynamic_tess_origin) {
-               state->tess_states[0] = state->shaders[MESA_SHADER_TESS_EVAL]->shader_cso;
-               state->tess_states[1] = state->shaders[MESA_SHADER_TESS_EVAL]->tess_ccw_cso;
+               state->tess_states[0] = get_shader_cso(state, state->shaders[MESA_SHADER_TESS_EVAL], false);
+               state->tess_states[1] = get_shader_cso(state, state->shaders[MESA_SHADER_TESS_EVAL], true);
                state->pctx->bind_tes_state(state->pctx, state->tess_states[state->tess_ccw]);
             } else {
-               state->pctx->bind_tes_state(state->pctx, state->shaders[MESA_SHADER_TESS_EVAL]->shader_cso);
+               state->pctx->bind_tes_state(state->pctx, get_shader_cso(state, state->shaders[MESA_SHADER_TESS_EVAL], false));
             }
          }
          if (!dynamic_tess_origin)
@@ -737,12 +802,12 @@ handle_graphics_stages(struct rendering_state *state, VkShaderStageFlagBits shad
       case VK_SHADER_STAGE_TASK_BIT_EXT:
          state->inlines_dirty[MESA_SHADER_TASK] = state->shaders[MESA_SHADER_TASK]->inlines.can_inline;
          if (!state->shaders[MESA_SHADER_TASK]->inlines.can_inline)
-            state->pctx->bind_ts_state(state->pctx, state->shaders[MESA_SHADER_TASK]->shader_cso);
+            state->pctx->bind_ts_state(state->pctx, get_shader_cso(state, state->shaders[MESA_SHADER_TASK], false));
          break;
       case VK_SHADER_STAGE_MESH_BIT_EXT:
          state->inlines_dirty[MESA_SHADER_MESH] = state->shaders[MESA_SHADER_MESH]->inlines.can_inline;
          if (!state->shaders[MESA_SHADER_MESH]->inlines.can_inline)
-            state->pctx->bind_ms_state(state->pctx, state->shaders[MESA_SHADER_MESH]->shader_cso);
+            state->pctx->bind_ms_state(state->pctx, get_shader_cso(state, state->shaders[MESA_SHADER_MESH], false));
          break;
       default:
          assert(0);
@@ -808,7 +873,6 @@ static void handle_graphics_pipeline(struct lvp_pipeline *pipeline,
                                      struct rendering_state *state)
 {
    const struct vk_graphics_pipeline_state *ps = &pipeline->graphics_state;
-   lvp_pipeline_shaders_compile(pipeline, true);
    bool dynamic_tess_origin = BITSET_TEST(ps->dynamic, MESA_VK_DYNAMIC_TS_DOMAIN_ORIGIN);
    unbind_graphics_stages(state,
                           (~pipeline->graphics_state.shader_stages) &
@@ -1146,6 +1210,7 @@ handle_graphics_pipeline_group(struct vk_cmd_queue_entry *cmd, struct rendering_
 }
 
 static void handle_vertex_buffers2(struct vk_cmd_queue_entry *cmd,
+                                   struct pipe_resource **baked_vbs,
                                    struct rendering_state *state)
 {
    struct vk_cmd_bind_vertex_buffers2 *vcb = &cmd->u.bind_vertex_buffers2;
@@ -1158,14 +1223,18 @@ static void handle_vertex_buffers2(struct vk_cmd_queue_entry *cmd,
       if (state->vb_sizes[idx] != UINT32_MAX)
          pipe_resource_reference(&state->vb[idx].buffer.resource, NULL);
       state->vb[idx].buffer.resource = vcb->buffers[i] && (!vcb->sizes || vcb->sizes[i]) ? lvp_buffer_from_handle(vcb->buffers[i])->bo : NULL;
-      if (state->vb[idx].buffer.resource && vcb->sizes) {
+      if (baked_vbs && baked_vbs[i]) {
+         /* owned by the command stream */
+         state->vb[idx].buffer.resource = baked_vbs[i];
+         state->vb_sizes[idx] = UINT32_MAX;
+      } else if (state->vb[idx].buffer.resource && vcb->sizes) {
          if (vcb->sizes[i] == VK_WHOLE_SIZE || vcb->offsets[i] + vcb->sizes[i] >= state->vb[idx].buffer.resource->width0) {
             state->vb_sizes[idx] = UINT32_MAX;
          } else {
             struct pipe_transfer *xfer;
             uint8_t *mem = pipe_buffer_map(state->pctx, state->vb[idx].buffer.resource, 0, &xfer);
             state->pctx->buffer_unmap(state->pctx, xfer);
-            state->vb[idx].buffer.resource = get_buffer_resource(state->pctx, mem);
+            state->vb[idx].buffer.resource = get_buffer_resource(state->pctx->screen, mem);
             state->vb[idx].buffer.resource->width0 = MIN2(vcb->offsets[i] + vcb->sizes[i], state->vb[idx].buffer.resource->width0);
             state->vb_sizes[idx] = vcb->sizes[i];
          }
@@ -1215,7 +1284,7 @@ static void handle_set_stage(struct rendering_state *state,
 
 static void
 apply_dynamic_offsets(struct lvp_descriptor_set **out_set, const uint32_t *offsets, uint32_t offset_count,
-                      struct rendering_state *state)
+                      struct lvp_device *device, struct util_dynarray *owned_sets)
 {
    if (!offset_count)
       return;
@@ -1223,9 +1292,10 @@ apply_dynamic_offsets(struct lvp_descriptor_set **out_set, const uint32_t *offse
    struct lvp_descriptor_set *in_set = *out_set;
 
    struct lvp_descriptor_set *set;
-   lvp_descriptor_set_create(state->device, in_set->layout, &set);
+   if (lvp_descriptor_set_create(device, in_set->layout, &set) != VK_SUCCESS)
+      return;
 
-   util_dynarray_append(&state->push_desc_sets, struct lvp_descriptor_set *, set);
+   util_dynarray_append(owned_sets, struct lvp_descriptor_set *, set);
 
    memcpy(set->map, in_set->map, in_set->bo->width0);
 
@@ -1251,11 +1321,14 @@ apply_dynamic_offsets(struct lvp_descriptor_set **out_set, const uint32_t *offse
 }
 
 static void
-handle_descriptor_sets(VkBindDescriptorSetsInfoKHR *bds, struct rendering_state *state)
+handle_descriptor_sets(VkBindDescriptorSetsInfoKHR *bds,
+                       struct lvp_descriptor_set **baked_sets,
+                       struct rendering_state *state)
 {
    LVP_FROM_HANDLE(lvp_pipeline_layout, layout, bds->layout);
 
    uint32_t dynamic_offset_index = 0;
+   unsigned baked_index = 0;
 
    uint32_t types = lvp_pipeline_types_from_shader_stages(bds->stageFlags);
    u_foreach_bit(pipeline_type, types) {
@@ -1282,8 +1355,13 @@ handle_descriptor_sets(VkBindDescriptorSetsInfoKHR *bds, struct rendering_state
          if (!set)
             continue;
 
-         apply_dynamic_offsets(&set, bds->pDynamicOffsets + dynamic_offset_index,
-                              bds->dynamicOffsetCount - dynamic_offset_index, state);
+         if (baked_sets) {
+            set = baked_sets[baked_index++];
+         } else {
+            apply_dynamic_offsets(&set, bds->pDynamicOffsets + dynamic_offset_index,
+                                  bds->dynamicOffsetCount - dynamic_offset_index,
+                                  state->device, &state->push_desc_sets);
+         }
 
          dynamic_offset_index += set->layout->dynamic_offset_count;
 
@@ -1324,10 +1402,12 @@ handle_descriptor_sets(VkBindDescriptorSetsInfoKHR *bds, struct rendering_state
 }
 
 static void
-handle_descriptor_sets_cmd(struct vk_cmd_queue_entry *cmd, struct rendering_state *state)
+handle_descriptor_sets_cmd(struct vk_cmd_queue_entry *cmd,
+                           struct lvp_descriptor_set **baked_sets,
+                           struct rendering_state *state)
 {
    VkBindDescriptorSetsInfoKHR *bds = cmd->u.bind_descriptor_sets2_khr.bind_descriptor_sets_info;
-   handle_descriptor_sets(bds, state);
+   handle_descriptor_sets(bds, baked_sets, state);
 }
 
 static struct pipe_surface *create_img_surface_bo(struct rendering_state *state,
@@ -2701,7 +2781,7 @@ static void handle_draw_indirect(struct vk_cmd_queue_entry *cmd,
          struct pipe_transfer *xfer;
          uint8_t *mem = pipe_buffer_map(state->pctx, state->index_buffer, 0, &xfer);
          state->pctx->buffer_unmap(state->pctx, xfer);
-         index = get_buffer_resource(state->pctx, mem + state->index_offset);
+         index = get_buffer_resource(state->pctx->screen, mem + state->index_offset);
          index->width0 = MIN2(state->index_buffer->width0 - state->index_offset, state->index_buffer_size);
          state->info.index.resource = index;
       }
@@ -2816,13 +2896,18 @@ static void handle_push_constants(struct vk_cmd_queue_entry *cmd,
 
 static void lvp_execute_cmd_buffer(struct list_head *cmds,
                                    struct rendering_state *state, bool print_cmds);
+static void lvp_execute_cmd_stream(const struct lvp_cmd_stream *stream,
+                                   struct rendering_state *state);
 
 static void handle_execute_commands(struct vk_cmd_queue_entry *cmd,
                                     struct rendering_state *state, bool print_cmds)
 {
    for (unsigned i = 0; i < cmd->u.execute_commands.command_buffer_count; i++) {
       LVP_FROM_HANDLE(lvp_cmd_buffer, secondary_buf, cmd->u.execute_commands.command_buffers[i]);
-      lvp_execute_cmd_buffer(&secondary_buf->vk.cmd_queue.cmds, state, print_cmds);
+      if (secondary_buf->stream)
+         lvp_execute_cmd_stream(secondary_buf->stream, state);
+      else
+         lvp_execute_cmd_buffer(&secondary_buf->vk.cmd_queue.cmds, state, print_cmds);
    }
 }
 
@@ -3261,7 +3346,7 @@ static void handle_draw_indirect_count(struct vk_cmd_queue_entry *cmd,
          struct pipe_transfer *xfer;
          uint8_t *mem = pipe_buffer_map(state->pctx, state->index_buffer, 0, &xfer);
          state->pctx->buffer_unmap(state->pctx, xfer);
-         index = get_buffer_resource(state->pctx, mem + state->index_offset);
+         index = get_buffer_resource(state->pctx->screen, mem + state->index_offset);
          index->width0 = MIN2(state->index_buffer->width0 - state->index_offset, state->index_buffer_size);
          state->info.index.resource = index;
       }
@@ -3311,7 +3396,7 @@ static void handle_push_descriptor_set(struct vk_cmd_queue_entry *cmd,
          .descriptorSetCount = 1,
          .pDescriptorSets = &set_handle,
       };
-      handle_descriptor_sets(&bind_info, state);
+      handle_descriptor_sets(&bind_info, NULL, state);
    }
 }
 
@@ -3343,7 +3428,7 @@ static void handle_push_descriptor_set_with_template(struct vk_cmd_queue_entry *
       .descriptorSetCount = 1,
       .pDescriptorSets = &set_handle,
    };
-   handle_descriptor_sets(&bind_cmd, state);
+   handle_descriptor_sets(&bind_cmd, NULL, state);
 }
 
 static void handle_bind_transform_feedback_buffers(struct vk_cmd_queue_entry *cmd,
@@ -4160,7 +4245,7 @@ handle_descriptor_buffers(struct vk_cmd_queue_entry *cmd, struct rendering_state
 {
    const struct vk_cmd_bind_descriptor_buffers_ext *bind = &cmd->u.bind_descriptor_buffers_ext;
    for (unsigned i = 0; i < bind->buffer_count; i++) {
-      struct pipe_resource *pres = get_buffer_resource(state->pctx, (void *)(uintptr_t)bind->binding_infos[i].address);
+      struct pipe_resource *pres = get_buffer_resource(state->pctx->screen, (void *)(uintptr_t)bind->binding_infos[i].address);
       state->desc_buffer_addrs[i] = (void *)(uintptr_t)bind->binding_infos[i].address;
       pipe_resource_reference(&state->desc_buffers[i], pres);
       /* leave only one ref on rendering_state */
@@ -4541,7 +4626,7 @@ static void emit_ray_tracing_state(struct rendering_state *state)
       state->constbuf_dirty[MESA_SHADER_RAYGEN] = false;
    }
 
-   state->pctx->bind_compute_state(state->pctx, state->shaders[MESA_SHADER_RAYGEN]->shader_cso);
+   state->pctx->bind_compute_state(state->pctx, get_shader_cso(state, state->shaders[MESA_SHADER_RAYGEN], false));
 
    state->pcbuf_dirty[MESA_SHADER_COMPUTE] = true;
    state->constbuf_dirty[MESA_SHADER_COMPUTE] = true;
@@ -4814,6 +4899,396 @@ void lvp_add_enqueue_cmd_entrypoints(struct vk_device_dispatch_table *disp)
 #undef ENQUEUE_CMD
 }
 
+/* op is the pre-resolved part of the command if it's from a lvp_cmd_stream */
+static void lvp_execute_cmd(struct vk_cmd_queue_entry *cmd,
+                            const struct lvp_cmd_op *op,
+                            struct rendering_state *state, bool print_cmds)
+{
+   switch (cmd->type) {
+   case VK_CMD_BIND_PIPELINE:
+      handle_pipeline(cmd, state);
+      break;
+   case VK_CMD_SET_VIEWPORT:
+      handle_set_viewport(cmd, state);
+      break;
+   case VK_CMD_SET_VIEWPORT_WITH_COUNT:
+      handle_set_viewport_with_count(cmd, state);
+      break;
+   case VK_CMD_SET_SCISSOR:
+      handle_set_scissor(cmd, state);
+      break;
+   case VK_CMD_SET_SCISSOR_WITH_COUNT:
+      handle_set_scissor_with_count(cmd, state);
+      break;
+   case VK_CMD_SET_LINE_WIDTH:
+      handle_set_line_width(cmd, state);
+      break;
+   case VK_CMD_SET_DEPTH_BIAS:
+      handle_set_depth_bias(cmd, state);
+      break;
+   case VK_CMD_SET_BLEND_CONSTANTS:
+      handle_set_blend_constants(cmd, state);
+      break;
+   case VK_CMD_SET_DEPTH_BOUNDS:
+      handle_set_depth_bounds(cmd, state);
+      break;
+   case VK_CMD_SET_STENCIL_COMPARE_MASK:
+      handle_set_stencil_compare_mask(cmd, state);
+      break;
+   case VK_CMD_SET_STENCIL_WRITE_MASK:
+      handle_set_stencil_write_mask(cmd, state);
+      break;
+   case VK_CMD_SET_STENCIL_REFERENCE:
+      handle_set_stencil_reference(cmd, state);
+      break;
+   case VK_CMD_BIND_DESCRIPTOR_SETS2_KHR:
+      handle_descriptor_sets_cmd(cmd, op ? op->desc_sets : NULL, state);
+      break;
+   case VK_CMD_BIND_INDEX_BUFFER:
+      handle_index_buffer(cmd, state);
+      break;
+   case VK_CMD_BIND_INDEX_BUFFER2_KHR:
+      handle_index_buffer2(cmd, state);
+      break;
+   case VK_CMD_BIND_VERTEX_BUFFERS2:
+      handle_vertex_buffers2(cmd, op ? op->vbs : NULL, state);
+      break;
+   case VK_CMD_DRAW:
+      emit_state(state);
+      handle_draw(cmd, state);
+      break;
+   case VK_CMD_DRAW_MULTI_EXT:
+      emit_state(state);
+      handle_draw_multi(cmd, state);
+      break;
+   case VK_CMD_DRAW_INDEXED:
+      emit_state(state);
+      handle_draw_indexed(cmd, state);
+      break;
+   case VK_CMD_DRAW_INDIRECT:
+      emit_state(state);
+      handle_draw_indirect(cmd, state, false);
+      break;
+   case VK_CMD_DRAW_INDEXED_INDIRECT:
+      emit_state(state);
+      handle_draw_indirect(cmd, state, true);
+      break;
+   case VK_CMD_DRAW_MULTI_INDEXED_EXT:
+      emit_state(state);
+      handle_draw_multi_indexed(cmd, state);
+      break;
+   case VK_CMD_DISPATCH:
+      emit_compute_state(state);
+      handle_dispatch(cmd, state);
+      break;
+   case VK_CMD_DISPATCH_BASE:
+      emit_compute_state(state);
+      handle_dispatch_base(cmd, state);
+      break;
+   case VK_CMD_DISPATCH_INDIRECT:
+      emit_compute_state(state);
+      handle_dispatch_indirect(cmd, state);
+      break;
+   case VK_CMD_COPY_BUFFER2:
+      handle_copy_buffer(cmd, state);
+      break;
+   case VK_CMD_COPY_IMAGE2:
+      handle_copy_image(cmd, state);
+      break;
+   case VK_CMD_BLIT_IMAGE2:
+      handle_blit_image(cmd, state);
+      break;
+   case VK_CMD_COPY_BUFFER_TO_IMAGE2:
+      handle_copy_buffer_to_image(cmd, state);
+      break;
+   case VK_CMD_COPY_IMAGE_TO_BUFFER2:
+      handle_copy_image_to_buffer2(cmd, state);
+      break;
+   case VK_CMD_UPDATE_BUFFER:
+      handle_update_buffer(cmd, state);
+      break;
+   case VK_CMD_FILL_BUFFER:
+      handle_fill_buffer(cmd, state);
+      break;
+   case VK_CMD_CLEAR_COLOR_IMAGE:
+      handle_clear_color_image(cmd, state);
+      break;
+   case VK_CMD_CLEAR_DEPTH_STENCIL_IMAGE:
+      handle_clear_ds_image(cmd, state);
+      break;
+   case VK_CMD_CLEAR_ATTACHMENTS:
+      handle_clear_attachments(cmd, state);
+      break;
+   case VK_CMD_RESOLVE_IMAGE2:
+      handle_resolve_image(cmd, state);
+      break;
+   case VK_CMD_PIPELINE_BARRIER2:
+      handle_pipeline_barrier(cmd, state);
+      break;
+   case VK_CMD_BEGIN_QUERY_INDEXED_EXT:
+      handle_begin_query_indexed_ext(cmd, state);
+      break;
+   case VK_CMD_END_QUERY_INDEXED_EXT:
+      handle_end_query_indexed_ext(cmd, state);
+      break;
+   case VK_CMD_BEGIN_QUERY:
+      handle_begin_query(cmd, state);
+      break;
+   case VK_CMD_END_QUERY:
+      handle_end_query(cmd, state);
+      break;
+   case VK_CMD_RESET_QUERY_POOL:
+      handle_reset_query_pool(cmd, state);
+      break;
+   case VK_CMD_COPY_QUERY_POOL_RESULTS:
+      handle_copy_query_pool_results(cmd, state);
+      break;
+   case VK_CMD_PUSH_CONSTANTS2_KHR:
+      handle_push_constants(cmd, state);
+      break;
+   case VK_CMD_EXECUTE_COMMANDS:
+      handle_execute_commands(cmd, state, print_cmds);
+      break;
+   case VK_CMD_DRAW_INDIRECT_COUNT:
+      emit_state(state);
+      handle_draw_indirect_count(cmd, state, false);
+      break;
+   case VK_CMD_DRAW_INDEXED_INDIRECT_COUNT:
+      emit_state(state);
+      handle_draw_indirect_count(cmd, state, true);
+      break;
+   case VK_CMD_PUSH_DESCRIPTOR_SET2_KHR:
+      handle_push_descriptor_set(cmd, state);
+      break;
+   case VK_CMD_PUSH_DESCRIPTOR_SET_WITH_TEMPLATE2_KHR:
+      handle_push_descriptor_set_with_template(cmd, state);
+      break;
+   case VK_CMD_BIND_TRANSFORM_FEEDBACK_BUFFERS_EXT:
+      handle_bind_transform_feedback_buffers(cmd, state);
+      break;
+   case VK_CMD_BEGIN_TRANSFORM_FEEDBACK_EXT:
+      handle_begin_transform_feedback(cmd, state);
+      break;
+   case VK_CMD_END_TRANSFORM_FEEDBACK_EXT:
+      handle_end_transform_feedback(cmd, state);
+      break;
+   case VK_CMD_DRAW_INDIRECT_BYTE_COUNT_EXT:
+      emit_state(state);
+      handle_draw_indirect_byte_count(cmd, state);
+      break;
+   case VK_CMD_BEGIN_CONDITIONAL_RENDERING_EXT:
+      handle_begin_conditional_rendering(cmd, state);
+      break;
+   case VK_CMD_END_CONDITIONAL_RENDERING_EXT:
+      handle_end_conditional_rendering(state);
+      break;
+   case VK_CMD_SET_VERTEX_INPUT_EXT:
+      handle_set_vertex_input(cmd, state);
+      break;
+   case VK_CMD_SET_CULL_MODE:
+      handle_set_cull_mode(cmd, state);
+      break;
+   case VK_CMD_SET_FRONT_FACE:
+      handle_set_front_face(cmd, state);
+      break;
+   case VK_CMD_SET_PRIMITIVE_TOPOLOGY:
+      handle_set_primitive_topology(cmd, state);
+      break;
+   case VK_CMD_SET_DEPTH_TEST_ENABLE:
+      handle_set_depth_test_enable(cmd, state);
+      break;
+   case VK_CMD_SET_DEPTH_WRITE_ENABLE:
+      handle_set_depth_write_enable(cmd, state);
+      break;
+   case VK_CMD_SET_DEPTH_COMPARE_OP:
+      handle_set_depth_compare_op(cmd, state);
+      break;
+   case VK_CMD_SET_DEPTH_BOUNDS_TEST_ENABLE:
+      handle_set_depth_bounds_test_enable(cmd, state);
+      break;
+   case VK_CMD_SET_STENCIL_TEST_ENABLE:
+      handle_set_stencil_test_enable(cmd, state);
+      break;
+   case VK_CMD_SET_STENCIL_OP:
+      handle_set_stencil_op(cmd, state);
+      break;
+   case VK_CMD_SET_LINE_STIPPLE_KHR:
+      handle_set_line_stipple(cmd, state);
+      break;
+   case VK_CMD_SET_DEPTH_BIAS_ENABLE:
+      handle_set_depth_bias_enable(cmd, state);
+      break;
+   case VK_CMD_SET_LOGIC_OP_EXT:
+      handle_set_logic_op(cmd, state);
+      break;
+   case VK_CMD_SET_PATCH_CONTROL_POINTS_EXT:
+      handle_set_patch_control_points(cmd, state);
+      break;
+   case VK_CMD_SET_PRIMITIVE_RESTART_ENABLE:
+      handle_set_primitive_restart_enable(cmd, state);
+      break;
+   case VK_CMD_SET_RASTERIZER_DISCARD_ENABLE:
+      handle_set_rasterizer_discard_enable(cmd, state);
+      break;
+   case VK_CMD_SET_COLOR_WRITE_ENABLE_EXT:
+      handle_set_color_write_enable(cmd, state);
+      break;
+   case VK_CMD_BEGIN_RENDERING:
+      handle_begin_rendering(cmd, state);
+      break;
+   case VK_CMD_END_RENDERING:
+      handle_end_rendering(cmd, state);
+      break;
+   case VK_CMD_SET_DEVICE_MASK:
+      /* no-op */
+      break;
+   case VK_CMD_RESET_EVENT2:
+      handle_event_reset2(cmd, state);
+      break;
+   case VK_CMD_SET_EVENT2:
+      handle_event_set2(cmd, state);
+      break;
+   case VK_CMD_WAIT_EVENTS2:
+      handle_wait_events2(cmd, state);
+      break;
+   case VK_CMD_WRITE_TIMESTAMP2:
+      handle_write_timestamp2(cmd, state);
+      break;
+   case VK_CMD_SET_POLYGON_MODE_EXT:
+      handle_set_polygon_mode(cmd, state);
+      break;
+   case VK_CMD_SET_TESSELLATION_DOMAIN_ORIGIN_EXT:
+      handle_set_tessellation_domain_origin(cmd, state);
+      break;
+   case VK_CMD_SET_DEPTH_CLAMP_ENABLE_EXT:
+      handle_set_depth_clamp_enable(cmd, state);
+      break;
+   case VK_CMD_SET_DEPTH_CLIP_ENABLE_EXT:
+      handle_set_depth_clip_enable(cmd, state);
+      break;
+   case VK_CMD_SET_LOGIC_OP_ENABLE_EXT:
+      handle_set_logic_op_enable(cmd, state);
+      break;
+   case VK_CMD_SET_SAMPLE_MASK_EXT:
+      handle_set_sample_mask(cmd, state);
+      break;
+   case VK_CMD_SET_RASTERIZATION_SAMPLES_EXT:
+      handle_set_samples(cmd, state);
+      break;
+   case VK_CMD_SET_ALPHA_TO_COVERAGE_ENABLE_EXT:
+      handle_set_alpha_to_coverage(cmd, state);
+      break;
+   case VK_CMD_SET_ALPHA_TO_ONE_ENABLE_EXT:
+      handle_set_alpha_to_one(cmd, state);
+      break;
+   case VK_CMD_SET_DEPTH_CLIP_NEGATIVE_ONE_TO_ONE_EXT:
+      handle_set_halfz(cmd, state);
+      break;
+   case VK_CMD_SET_LINE_RASTERIZATION_MODE_EXT:
+      handle_set_line_rasterization_mode(cmd, state);
+      break;
+   case VK_CMD_SET_LINE_STIPPLE_ENABLE_EXT:
+      handle_set_line_stipple_enable(cmd, state);
+      break;
+   case VK_CMD_SET_PROVOKING_VERTEX_MODE_EXT:
+      handle_set_provoking_vertex_mode(cmd, state);
+      break;
+   case VK_CMD_SET_COLOR_BLEND_ENABLE_EXT:
+      handle_set_color_blend_enable(cmd, state);
+      break;
+   case VK_CMD_SET_COLOR_WRITE_MASK_EXT:
+      handle_set_color_write_mask(cmd, state);
+      break;
+   case VK_CMD_SET_COLOR_BLEND_EQUATION_EXT:
+      handle_set_color_blend_equation(cmd, state);
+      break;
+   case VK_CMD_BIND_SHADERS_EXT:
+      handle_shaders(cmd, state);
+      break;
+   case VK_CMD_SET_ATTACHMENT_FEEDBACK_LOOP_ENABLE_EXT:
+      break;
+   case VK_CMD_DRAW_MESH_TASKS_EXT:
+      emit_state(state);
+      handle_draw_mesh_tasks(cmd, state);
+      break;
+   case VK_CMD_DRAW_MESH_TASKS_INDIRECT_EXT:
+      emit_state(state);
+      handle_draw_mesh_tasks_indirect(cmd, state);
+      break;
+   case VK_CMD_DRAW_MESH_TASKS_INDIRECT_COUNT_EXT:
+      emit_state(state);
+      handle_draw_mesh_tasks_indirect_count(cmd, state);
+      break;
+   case VK_CMD_BIND_PIPELINE_SHADER_GROUP_NV:
+      handle_graphics_pipeline_group(cmd, state);
+      break;
+   case VK_CMD_PREPROCESS_GENERATED_COMMANDS_NV:
+      handle_preprocess_generated_commands(cmd, state, print_cmds);
+      break;
+   case VK_CMD_EXECUTE_GENERATED_COMMANDS_NV:
+      handle_execute_generated_commands(cmd, state, print_cmds);
+      break;
+   case VK_CMD_BIND_DESCRIPTOR_BUFFERS_EXT:
+      handle_descriptor_buffers(cmd, state);
+      break;
+   case VK_CMD_SET_DESCRIPTOR_BUFFER_OFFSETS2_EXT:
+      handle_descriptor_buffer_offsets(cmd, state);
+      break;
+   case VK_CMD_BIND_DESCRIPTOR_BUFFER_EMBEDDED_SAMPLERS2_EXT:
+      handle_descriptor_buffer_embedded_samplers(cmd, state);
+      break;
+#ifdef VK_ENABLE_BETA_EXTENSIONS
+   case VK_CMD_INITIALIZE_GRAPH_SCRATCH_MEMORY_AMDX:
+      break;
+   case VK_CMD_DISPATCH_GRAPH_INDIRECT_COUNT_AMDX:
+      break;
+   case VK_CMD_DISPATCH_GRAPH_INDIRECT_AMDX:
+      break;
+   case VK_CMD_DISPATCH_GRAPH_AMDX:
+      handle_dispatch_graph(cmd, state);
+      break;
+#endif
+   case VK_CMD_SET_RENDERING_ATTACHMENT_LOCATIONS_KHR:
+      handle_rendering_attachment_locations(cmd, state);
+      break;
+   case VK_CMD_SET_RENDERING_INPUT_ATTACHMENT_INDICES_KHR:
+      handle_rendering_input_attachment_indices(cmd, state);
+      break;
+   case VK_CMD_COPY_ACCELERATION_STRUCTURE_KHR:
+      handle_copy_acceleration_structure(cmd, state);
+      break;
+   case VK_CMD_COPY_MEMORY_TO_ACCELERATION_STRUCTURE_KHR:
+      handle_copy_memory_to_acceleration_structure(cmd, state);
+      break;
+   case VK_CMD_COPY_ACCELERATION_STRUCTURE_TO_MEMORY_KHR:
+      handle_copy_acceleration_structure_to_memory(cmd, state);
+      break;
+   case VK_CMD_BUILD_ACCELERATION_STRUCTURES_KHR:
+      handle_build_acceleration_structures(cmd, state);
+      break;
+   case VK_CMD_BUILD_ACCELERATION_STRUCTURES_INDIRECT_KHR:
+      break;
+   case VK_CMD_WRITE_ACCELERATION_STRUCTURES_PROPERTIES_KHR:
+      handle_write_acceleration_structures_properties(cmd, state);
+      break;
+   case VK_CMD_SET_RAY_TRACING_PIPELINE_STACK_SIZE_KHR:
+      break;
+   case VK_CMD_TRACE_RAYS_INDIRECT2_KHR:
+      handle_trace_rays_indirect2(cmd, state);
+      break;
+   case VK_CMD_TRACE_RAYS_INDIRECT_KHR:
+      handle_trace_rays_indirect(cmd, state);
+      break;
+   case VK_CMD_TRACE_RAYS_KHR:
+      handle_trace_rays(cmd, state);
+      break;
+   default:
+      fprintf(stderr, "Unsupported command %s\n", vk_cmd_queue_type_names[cmd->type]);
+      unreachable("Unsupported command");
+      break;
+   }
+}
+
 static void lvp_execute_cmd_buffer(struct list_head *cmds,
                                    struct rendering_state *state, bool print_cmds)
 {
@@ -4823,399 +5298,27 @@ static void lvp_execute_cmd_buffer(struct list_head *cmds,
    LIST_FOR_EACH_ENTRY(cmd, cmds, cmd_link) {
       if (print_cmds)
          fprintf(stderr, "%s\n", vk_cmd_queue_type_names[cmd->type]);
-      switch (cmd->type) {
-      case VK_CMD_BIND_PIPELINE:
-         handle_pipeline(cmd, state);
-         break;
-      case VK_CMD_SET_VIEWPORT:
-         handle_set_viewport(cmd, state);
-         break;
-      case VK_CMD_SET_VIEWPORT_WITH_COUNT:
-         handle_set_viewport_with_count(cmd, state);
-         break;
-      case VK_CMD_SET_SCISSOR:
-         handle_set_scissor(cmd, state);
-         break;
-      case VK_CMD_SET_SCISSOR_WITH_COUNT:
-         handle_set_scissor_with_count(cmd, state);
-         break;
-      case VK_CMD_SET_LINE_WIDTH:
-         handle_set_line_width(cmd, state);
-         break;
-      case VK_CMD_SET_DEPTH_BIAS:
-         handle_set_depth_bias(cmd, state);
-         break;
-      case VK_CMD_SET_BLEND_CONSTANTS:
-         handle_set_blend_constants(cmd, state);
-         break;
-      case VK_CMD_SET_DEPTH_BOUNDS:
-         handle_set_depth_bounds(cmd, state);
-         break;
-      case VK_CMD_SET_STENCIL_COMPARE_MASK:
-         handle_set_stencil_compare_mask(cmd, state);
-         break;
-      case VK_CMD_SET_STENCIL_WRITE_MASK:
-         handle_set_stencil_write_mask(cmd, state);
-         break;
-      case VK_CMD_SET_STENCIL_REFERENCE:
-         handle_set_stencil_reference(cmd, state);
-         break;
-      case VK_CMD_BIND_DESCRIPTOR_SETS2_KHR:
-         handle_descriptor_sets_cmd(cmd, state);
-         break;
-      case VK_CMD_BIND_INDEX_BUFFER:
-         handle_index_buffer(cmd, state);
-         break;
-      case VK_CMD_BIND_INDEX_BUFFER2_KHR:
-         handle_index_buffer2(cmd, state);
-         break;
-      case VK_CMD_BIND_VERTEX_BUFFERS2:
-         handle_vertex_buffers2(cmd, state);
-         break;
-      case VK_CMD_DRAW:
-         emit_state(state);
-         handle_draw(cmd, state);
-         break;
-      case VK_CMD_DRAW_MULTI_EXT:
-         emit_state(state);
-         handle_draw_multi(cmd, state);
-         break;
-      case VK_CMD_DRAW_INDEXED:
-         emit_state(state);
-         handle_draw_indexed(cmd, state);
-         break;
-      case VK_CMD_DRAW_INDIRECT:
-         emit_state(state);
-         handle_draw_indirect(cmd, state, false);
-         break;
-      case VK_CMD_DRAW_INDEXED_INDIRECT:
-         emit_state(state);
-         handle_draw_indirect(cmd, state, true);
-         break;
-      case VK_CMD_DRAW_MULTI_INDEXED_EXT:
-         emit_state(state);
-         handle_draw_multi_indexed(cmd, state);
-         break;
-      case VK_CMD_DISPATCH:
-         emit_compute_state(state);
-         handle_dispatch(cmd, state);
-         break;
-      case VK_CMD_DISPATCH_BASE:
-         emit_compute_state(state);
-         handle_dispatch_base(cmd, state);
-         break;
-      case VK_CMD_DISPATCH_INDIRECT:
-         emit_compute_state(state);
-         handle_dispatch_indirect(cmd, state);
-         break;
-      case VK_CMD_COPY_BUFFER2:
-         handle_copy_buffer(cmd, state);
-         break;
-      case VK_CMD_COPY_IMAGE2:
-         handle_copy_image(cmd, state);
-         break;
-      case VK_CMD_BLIT_IMAGE2:
-         handle_blit_image(cmd, state);
-         break;
-      case VK_CMD_COPY_BUFFER_TO_IMAGE2:
-         handle_copy_buffer_to_image(cmd, state);
-         break;
-      case VK_CMD_COPY_IMAGE_TO_BUFFER2:
-         handle_copy_image_to_buffer2(cmd, state);
-         break;
-      case VK_CMD_UPDATE_BUFFER:
-         handle_update_buffer(cmd, state);
-         break;
-      case VK_CMD_FILL_BUFFER:
-         handle_fill_buffer(cmd, state);
-         break;
-      case VK_CMD_CLEAR_COLOR_IMAGE:
-         handle_clear_color_image(cmd, state);
-         break;
-      case VK_CMD_CLEAR_DEPTH_STENCIL_IMAGE:
-         handle_clear_ds_image(cmd, state);
-         break;
-      case VK_CMD_CLEAR_ATTACHMENTS:
-         handle_clear_attachments(cmd, state);
-         break;
-      case VK_CMD_RESOLVE_IMAGE2:
-         handle_resolve_image(cmd, state);
-         break;
-      case VK_CMD_PIPELINE_BARRIER2:
+      if (cmd->type == VK_CMD_PIPELINE_BARRIER2) {
          /* flushes are actually stalls, so multiple flushes are redundant */
-         if (did_flush)
-            continue;
-         handle_pipeline_barrier(cmd, state);
+         if (!did_flush)
+            lvp_execute_cmd(cmd, NULL, state, print_cmds);
          did_flush = true;
          continue;
-      case VK_CMD_BEGIN_QUERY_INDEXED_EXT:
-         handle_begin_query_indexed_ext(cmd, state);
-         break;
-      case VK_CMD_END_QUERY_INDEXED_EXT:
-         handle_end_query_indexed_ext(cmd, state);
-         break;
-      case VK_CMD_BEGIN_QUERY:
-         handle_begin_query(cmd, state);
-         break;
-      case VK_CMD_END_QUERY:
-         handle_end_query(cmd, state);
-         break;
-      case VK_CMD_RESET_QUERY_POOL:
-         handle_reset_query_pool(cmd, state);
-         break;
-      case VK_CMD_COPY_QUERY_POOL_RESULTS:
-         handle_copy_query_pool_results(cmd, state);
-         break;
-      case VK_CMD_PUSH_CONSTANTS2_KHR:
-         handle_push_constants(cmd, state);
-         break;
-      case VK_CMD_EXECUTE_COMMANDS:
-         handle_execute_commands(cmd, state, print_cmds);
-         break;
-      case VK_CMD_DRAW_INDIRECT_COUNT:
-         emit_state(state);
-         handle_draw_indirect_count(cmd, state, false);
-         break;
-      case VK_CMD_DRAW_INDEXED_INDIRECT_COUNT:
-         emit_state(state);
-         handle_draw_indirect_count(cmd, state, true);
-         break;
-      case VK_CMD_PUSH_DESCRIPTOR_SET2_KHR:
-         handle_push_descriptor_set(cmd, state);
-         break;
-      case VK_CMD_PUSH_DESCRIPTOR_SET_WITH_TEMPLATE2_KHR:
-         handle_push_descriptor_set_with_template(cmd, state);
-         break;
-      case VK_CMD_BIND_TRANSFORM_FEEDBACK_BUFFERS_EXT:
-         handle_bind_transform_feedback_buffers(cmd, state);
-         break;
-      case VK_CMD_BEGIN_TRANSFORM_FEEDBACK_EXT:
-         handle_begin_transform_feedback(cmd, state);
-         break;
-      case VK_CMD_END_TRANSFORM_FEEDBACK_EXT:
-         handle_end_transform_feedback(cmd, state);
-         break;
-      case VK_CMD_DRAW_INDIRECT_BYTE_COUNT_EXT:
-         emit_state(state);
-         handle_draw_indirect_byte_count(cmd, state);
-         break;
-      case VK_CMD_BEGIN_CONDITIONAL_RENDERING_EXT:
-         handle_begin_conditional_rendering(cmd, state);
-         break;
-      case VK_CMD_END_CONDITIONAL_RENDERING_EXT:
-         handle_end_conditional_rendering(state);
-         break;
-      case VK_CMD_SET_VERTEX_INPUT_EXT:
-         handle_set_vertex_input(cmd, state);
-         break;
-      case VK_CMD_SET_CULL_MODE:
-         handle_set_cull_mode(cmd, state);
-         break;
-      case VK_CMD_SET_FRONT_FACE:
-         handle_set_front_face(cmd, state);
-         break;
-      case VK_CMD_SET_PRIMITIVE_TOPOLOGY:
-         handle_set_primitive_topology(cmd, state);
-         break;
-      case VK_CMD_SET_DEPTH_TEST_ENABLE:
-         handle_set_depth_test_enable(cmd, state);
-         break;
-      case VK_CMD_SET_DEPTH_WRITE_ENABLE:
-         handle_set_depth_write_enable(cmd, state);
-         break;
-      case VK_CMD_SET_DEPTH_COMPARE_OP:
-         handle_set_depth_compare_op(cmd, state);
-         break;
-      case VK_CMD_SET_DEPTH_BOUNDS_TEST_ENABLE:
-         handle_set_depth_bounds_test_enable(cmd, state);
-         break;
-      case VK_CMD_SET_STENCIL_TEST_ENABLE:
-         handle_set_stencil_test_enable(cmd, state);
-         break;
-      case VK_CMD_SET_STENCIL_OP:
-         handle_set_stencil_op(cmd, state);
-         break;
-      case VK_CMD_SET_LINE_STIPPLE_KHR:
-         handle_set_line_stipple(cmd, state);
-         break;
-      case VK_CMD_SET_DEPTH_BIAS_ENABLE:
-         handle_set_depth_bias_enable(cmd, state);
-         break;
-      case VK_CMD_SET_LOGIC_OP_EXT:
-         handle_set_logic_op(cmd, state);
-         break;
-      case VK_CMD_SET_PATCH_CONTROL_POINTS_EXT:
-         handle_set_patch_control_points(cmd, state);
-         break;
-      case VK_CMD_SET_PRIMITIVE_RESTART_ENABLE:
-         handle_set_primitive_restart_enable(cmd, state);
-         break;
-      case VK_CMD_SET_RASTERIZER_DISCARD_ENABLE:
-         handle_set_rasterizer_discard_enable(cmd, state);
-         break;
-      case VK_CMD_SET_COLOR_WRITE_ENABLE_EXT:
-         handle_set_color_write_enable(cmd, state);
-         break;
-      case VK_CMD_BEGIN_RENDERING:
-         handle_begin_rendering(cmd, state);
-         break;
-      case VK_CMD_END_RENDERING:
-         handle_end_rendering(cmd, state);
-         break;
-      case VK_CMD_SET_DEVICE_MASK:
-         /* no-op */
-         break;
-      case VK_CMD_RESET_EVENT2:
-         handle_event_reset2(cmd, state);
-         break;
-      case VK_CMD_SET_EVENT2:
-         handle_event_set2(cmd, state);
-         break;
-      case VK_CMD_WAIT_EVENTS2:
-         handle_wait_events2(cmd, state);
-         break;
-      case VK_CMD_WRITE_TIMESTAMP2:
-         handle_write_timestamp2(cmd, state);
-         break;
-      case VK_CMD_SET_POLYGON_MODE_EXT:
-         handle_set_polygon_mode(cmd, state);
-         break;
-      case VK_CMD_SET_TESSELLATION_DOMAIN_ORIGIN_EXT:
-         handle_set_tessellation_domain_origin(cmd, state);
-         break;
-      case VK_CMD_SET_DEPTH_CLAMP_ENABLE_EXT:
-         handle_set_depth_clamp_enable(cmd, state);
-         break;
-      case VK_CMD_SET_DEPTH_CLIP_ENABLE_EXT:
-         handle_set_depth_clip_enable(cmd, state);
-         break;
-      case VK_CMD_SET_LOGIC_OP_ENABLE_EXT:
-         handle_set_logic_op_enable(cmd, state);
-         break;
-      case VK_CMD_SET_SAMPLE_MASK_EXT:
-         handle_set_sample_mask(cmd, state);
-         break;
-      case VK_CMD_SET_RASTERIZATION_SAMPLES_EXT:
-         handle_set_samples(cmd, state);
-         break;
-      case VK_CMD_SET_ALPHA_TO_COVERAGE_ENABLE_EXT:
-         handle_set_alpha_to_coverage(cmd, state);
-         break;
-      case VK_CMD_SET_ALPHA_TO_ONE_ENABLE_EXT:
-         handle_set_alpha_to_one(cmd, state);
-         break;
-      case VK_CMD_SET_DEPTH_CLIP_NEGATIVE_ONE_TO_ONE_EXT:
-         handle_set_halfz(cmd, state);
-         break;
-      case VK_CMD_SET_LINE_RASTERIZATION_MODE_EXT:
-         handle_set_line_rasterization_mode(cmd, state);
-         break;
-      case VK_CMD_SET_LINE_STIPPLE_ENABLE_EXT:
-         handle_set_line_stipple_enable(cmd, state);
-         break;
-      case VK_CMD_SET_PROVOKING_VERTEX_MODE_EXT:
-         handle_set_provoking_vertex_mode(cmd, state);
-         break;
-      case VK_CMD_SET_COLOR_BLEND_ENABLE_EXT:
-         handle_set_color_blend_enable(cmd, state);
-         break;
-      case VK_CMD_SET_COLOR_WRITE_MASK_EXT:
-         handle_set_color_write_mask(cmd, state);
-         break;
-      case VK_CMD_SET_COLOR_BLEND_EQUATION_EXT:
-         handle_set_color_blend_equation(cmd, state);
-         break;
-      case VK_CMD_BIND_SHADERS_EXT:
-         handle_shaders(cmd, state);
-         break;
-      case VK_CMD_SET_ATTACHMENT_FEEDBACK_LOOP_ENABLE_EXT:
-         break;
-      case VK_CMD_DRAW_MESH_TASKS_EXT:
-         emit_state(state);
-         handle_draw_mesh_tasks(cmd, state);
-         break;
-      case VK_CMD_DRAW_MESH_TASKS_INDIRECT_EXT:
-         emit_state(state);
-         handle_draw_mesh_tasks_indirect(cmd, state);
-         break;
-      case VK_CMD_DRAW_MESH_TASKS_INDIRECT_COUNT_EXT:
-         emit_state(state);
-         handle_draw_mesh_tasks_indirect_count(cmd, state);
-         break;
-      case VK_CMD_BIND_PIPELINE_SHADER_GROUP_NV:
-         handle_graphics_pipeline_group(cmd, state);
-         break;
-      case VK_CMD_PREPROCESS_GENERATED_COMMANDS_NV:
-         handle_preprocess_generated_commands(cmd, state, print_cmds);
-         break;
-      case VK_CMD_EXECUTE_GENERATED_COMMANDS_NV:
-         handle_execute_generated_commands(cmd, state, print_cmds);
-         break;
-      case VK_CMD_BIND_DESCRIPTOR_BUFFERS_EXT:
-         handle_descriptor_buffers(cmd, state);
-         break;
-      case VK_CMD_SET_DESCRIPTOR_BUFFER_OFFSETS2_EXT:
-         handle_descriptor_buffer_offsets(cmd, state);
-         break;
-      case VK_CMD_BIND_DESCRIPTOR_BUFFER_EMBEDDED_SAMPLERS2_EXT:
-         handle_descriptor_buffer_embedded_samplers(cmd, state);
-         break;
-#ifdef VK_ENABLE_BETA_EXTENSIONS
-      case VK_CMD_INITIALIZE_GRAPH_SCRATCH_MEMORY_AMDX:
-         break;
-      case VK_CMD_DISPATCH_GRAPH_INDIRECT_COUNT_AMDX:
-         break;
-      case VK_CMD_DISPATCH_GRAPH_INDIRECT_AMDX:
-         break;
-      case VK_CMD_DISPATCH_GRAPH_AMDX:
-         handle_dispatch_graph(cmd, state);
-         break;
-#endif
-      case VK_CMD_SET_RENDERING_ATTACHMENT_LOCATIONS_KHR:
-         handle_rendering_attachment_locations(cmd, state);
-         break;
-      case VK_CMD_SET_RENDERING_INPUT_ATTACHMENT_INDICES_KHR:
-         handle_rendering_input_attachment_indices(cmd, state);
-         break;
-      case VK_CMD_COPY_ACCELERATION_STRUCTURE_KHR:
-         handle_copy_acceleration_structure(cmd, state);
-         break;
-      case VK_CMD_COPY_MEMORY_TO_ACCELERATION_STRUCTURE_KHR:
-         handle_copy_memory_to_acceleration_structure(cmd, state);
-         break;
-      case VK_CMD_COPY_ACCELERATION_STRUCTURE_TO_MEMORY_KHR:
-         handle_copy_acceleration_structure_to_memory(cmd, state);
-         break;
-      case VK_CMD_BUILD_ACCELERATION_STRUCTURES_KHR:
-         handle_build_acceleration_structures(cmd, state);
-         break;
-      case VK_CMD_BUILD_ACCELERATION_STRUCTURES_INDIRECT_KHR:
-         break;
-      case VK_CMD_WRITE_ACCELERATION_STRUCTURES_PROPERTIES_KHR:
-         handle_write_acceleration_structures_properties(cmd, state);
-         break;
-      case VK_CMD_SET_RAY_TRACING_PIPELINE_STACK_SIZE_KHR:
-         break;
-      case VK_CMD_TRACE_RAYS_INDIRECT2_KHR:
-         handle_trace_rays_indirect2(cmd, state);
-         break;
-      case VK_CMD_TRACE_RAYS_INDIRECT_KHR:
-         handle_trace_rays_indirect(cmd, state);
-         break;
-      case VK_CMD_TRACE_RAYS_KHR:
-         handle_trace_rays(cmd, state);
-         break;
-      default:
-         fprintf(stderr, "Unsupported command %s\n", vk_cmd_queue_type_names[cmd->type]);
-         unreachable("Unsupported command");
-         break;
       }
+      lvp_execute_cmd(cmd, NULL, state, print_cmds);
       did_flush = false;
       if (!cmd->cmd_link.next)
          break;
    }
 }
 
+static void lvp_execute_cmd_stream(const struct lvp_cmd_stream *stream,
+                                   struct rendering_state *state)
+{
+   util_dynarray_foreach(&stream->ops, struct lvp_cmd_op, op)
+      lvp_execute_cmd(op->cmd, op, state, false);
+}
+
 VkResult lvp_execute_cmds(struct lvp_device *device,
                           struct lvp_queue *queue,
                           struct lvp_cmd_buffer *cmd_buffer)
@@ -5224,6 +5327,7 @@ VkResult lvp_execute_cmds(struct lvp_device *device,
    memset(state, 0, sizeof(*state));
    state->pctx = queue->ctx;
    state->device = device;
+   state->queue = queue;
    state->uploader = queue->uploader;
    state->cso = queue->cso;
    state->blend_dirty = true;
@@ -5259,7 +5363,10 @@ VkResult lvp_execute_cmds(struct lvp_device *device,
    state->index_buffer = state->device->zero_buffer;
 
    /* create a gallium context */
-   lvp_execute_cmd_buffer(&cmd_buffer->vk.cmd_queue.cmds, state, device->print_cmds);
+   if (cmd_buffer->stream)
+      lvp_execute_cmd_stream(cmd_buffer->stream, state);
+   else
+      lvp_execute_cmd_buffer(&cmd_buffer->vk.cmd_queue.cmds, state, device->print_cmds);
 
    state->start_vb = -1;
    state->num_vb = 0;
@@ -5288,6 +5395,171 @@ VkResult lvp_execute_cmds(struct lvp_device *device,
    return VK_SUCCESS;
 }
 
+static struct lvp_descriptor_set **
+compile_descriptor_sets(struct lvp_device *device, struct lvp_cmd_stream *stream,
+                        VkBindDescriptorSetsInfoKHR *bds)
+{
+   /* Copying the sets for the dynamic offsets is the expensive part */
+   if (!bds->dynamicOffsetCount)
+      return NULL;
+
+   /* Sets with update-after-bind or update-unused-while-pending bindings may
+    * still change before submission.
+    */
+   for (uint32_t i = 0; i < bds->descriptorSetCount; i++) {
+      struct lvp_descriptor_set *set = lvp_descriptor_set_from_handle(bds->pDescriptorSets[i]);
+      if (set && set->update_after_bind)
+         return NULL;
+   }
+
+   LVP_FROM_HANDLE(lvp_pipeline_layout, layout, bds->layout);
+   uint32_t types = lvp_pipeline_types_from_shader_stages(bds->stageFlags);
+
+   struct lvp_descriptor_set **sets =
+      ralloc_array(stream, struct lvp_descriptor_set *,
+                   util_bitcount(types) * bds->descriptorSetCount);
+   if (!sets)
+      return NULL;
+
+   /* This must visit the sets in the same order as handle_descriptor_sets() */
+   uint32_t dynamic_offset_index = 0;
+   unsigned baked_index = 0;
+   u_foreach_bit(pipeline_type, types) {
+      for (uint32_t i = 0; i < bds->descriptorSetCount; i++) {
+         if (!layout->vk.set_layouts[bds->firstSet + i])
+            continue;
+
+         struct lvp_descriptor_set *set = lvp_descriptor_set_from_handle(bds->pDescriptorSets[i]);
+         if (!set)
+            continue;
+
+         apply_dynamic_offsets(&set, bds->pDynamicOffsets + dynamic_offset_index,
+                               bds->dynamicOffsetCount - dynamic_offset_index,
+                               device, &stream->desc_sets);
+
+         dynamic_offset_index += set->layout->dynamic_offset_count;
+         sets[baked_index++] = set;
+      }
+   }
+
+   return sets;
+}
+
+static struct pipe_resource **
+compile_vertex_buffers(struct lvp_device *device, struct lvp_cmd_stream *stream,
+                       struct vk_cmd_bind_vertex_buffers2 *vcb)
+{
+   if (!vcb->sizes)
+      return NULL;
+
+   struct pipe_resource **vbs = NULL;
+   for (uint32_t i = 0; i < vcb->binding_count; i++) {
+      if (!vcb->buffers[i] || !vcb->sizes[i] || vcb->sizes[i] == VK_WHOLE_SIZE)
+         continue;
+
+      LVP_FROM_HANDLE(lvp_buffer, buffer, vcb->buffers[i]);
+      if (vcb->offsets[i] + vcb->sizes[i] >= buffer->bo->width0)
+         continue;
+
+      /* sparse buffers aren't contiguous in memory */
+      if (buffer->vk.create_flags & VK_BUFFER_CREATE_SPARSE_BINDING_BIT)
+         continue;
+
+      if (!vbs) {
+         vbs = rzalloc_array(stream, struct pipe_resource *, vcb->binding_count);
+         if (!vbs)
+            return NULL;
+      }
+
+      vbs[i] = get_buffer_resource(device->pscreen, buffer->map);
+      if (!vbs[i])
+         continue;
+
+      vbs[i]->width0 = vcb->offsets[i] + vcb->sizes[i];
+      util_dynarray_append(&stream->buffers, struct pipe_resource *, vbs[i]);
+   }
+
+   return vbs;
+}
+
+/* Prepares the parts of the commands that come out the same on every
+ * submission, which is only worth it for command buffers submitted more than
+ * once.  Failing isn't an error, the commands are then executed from the
+ * vk_cmd_queue as usual.
+ */
+void
+lvp_compile_cmd_buffer(struct lvp_cmd_buffer *cmd_buffer)
+{
+   struct lvp_device *device = cmd_buffer->device;
+
+   assert(!cmd_buffer->stream);
+
+   struct lvp_cmd_stream *stream = rzalloc(NULL, struct lvp_cmd_stream);
+   if (!stream)
+      return;
+
+   util_dynarray_init(&stream->ops, stream);
+   util_dynarray_init(&stream->desc_sets, stream);
+   util_dynarray_init(&stream->buffers, stream);
+
+   bool did_flush = false;
+   list_for_each_entry(struct vk_cmd_queue_entry, cmd,
+                       &cmd_buffer->vk.cmd_queue.cmds, cmd_link) {
+      struct lvp_cmd_op op = { .cmd = cmd };
+
+      switch (cmd->type) {
+      case VK_CMD_PIPELINE_BARRIER2:
+         /* flushes are actually stalls, so multiple flushes are redundant */
+         if (did_flush)
+            continue;
+         break;
+      case VK_CMD_SET_DEVICE_MASK:
+      case VK_CMD_SET_ATTACHMENT_FEEDBACK_LOOP_ENABLE_EXT:
+      case VK_CMD_BUILD_ACCELERATION_STRUCTURES_INDIRECT_KHR:
+      case VK_CMD_SET_RAY_TRACING_PIPELINE_STACK_SIZE_KHR:
+#ifdef VK_ENABLE_BETA_EXTENSIONS
+      case VK_CMD_INITIALIZE_GRAPH_SCRATCH_MEMORY_AMDX:
+      case VK_CMD_DISPATCH_GRAPH_INDIRECT_COUNT_AMDX:
+      case VK_CMD_DISPATCH_GRAPH_INDIRECT_AMDX:
+#endif
+         /* no-op */
+         continue;
+      case VK_CMD_BIND_DESCRIPTOR_SETS2_KHR:
+         op.desc_sets = compile_descriptor_sets(device, stream,
+            cmd->u.bind_descriptor_sets2_khr.bind_descriptor_sets_info);
+         break;
+      case VK_CMD_BIND_VERTEX_BUFFERS2:
+         op.vbs = compile_vertex_buffers(device, stream,
+                                         &cmd->u.bind_vertex_buffers2);
+         break;
+      default:
+         break;
+      }
+
+      did_flush = cmd->type == VK_CMD_PIPELINE_BARRIER2;
+      util_dynarray_append(&stream->ops, struct lvp_cmd_op, op);
+   }
+
+   cmd_buffer->stream = stream;
+}
+
+void
+lvp_cmd_buffer_free_stream(struct lvp_cmd_buffer *cmd_buffer)
+{
+   struct lvp_cmd_stream *stream = cmd_buffer->stream;
+   if (!stream)
+      return;
+
+   util_dynarray_foreach(&stream->desc_sets, struct lvp_descriptor_set *, set)
+      lvp_descriptor_set_destroy(cmd_buffer->device, *set);
+
+   util_dynarray_foreach(&stream->buffers, struct pipe_resource *, buffer)
+      pipe_resource_reference(buffer, NULL);
+
+   ralloc_free(stream);
+   cmd_buffer->stream = NULL;
+}
+
 size_t
 lvp_get_rendering_state_size(void)
 {
@@ -48,34 +48,43 @@ shader_destroy(struct lvp_device *device, struct lvp_shader *shader, bool locked
    if (!shader->pipeline_nir)
       return;
    gl_shader_stage stage = shader->pipeline_nir->nir->info.stage;
-   cso_destroy_func destroy[] = {
-      device->queue.ctx->delete_vs_state,
-      device->queue.ctx->delete_tcs_state,
-      device->queue.ctx->delete_tes_state,
-      device->queue.ctx->delete_gs_state,
-      device->queue.ctx->delete_fs_state,
-      device->queue.ctx->delete_compute_state,
-      device->queue.ctx->delete_ts_state,
-      device->queue.ctx->delete_ms_state,
-   };
 
-   if (!locked)
-      simple_mtx_lock(&device->queue.lock);
+   for (uint32_t i = 0; i <= device->extra_queue_count; i++) {
+      struct lvp_queue *queue = lvp_device_queue(device, i);
+      cso_destroy_func destroy[] = {
+         queue->ctx->delete_vs_state,
+         queue->ctx->delete_tcs_state,
+         queue->ctx->delete_tes_state,
+         queue->ctx->delete_gs_state,
+         queue->ctx->delete_fs_state,
+         queue->ctx->delete_compute_state,
+         queue->ctx->delete_ts_state,
+         queue->ctx->delete_ms_state,
+      };
 
-   set_foreach(&shader->inlines.variants, entry) {
-      struct lvp_inline_variant *variant = (void*)entry->key;
-      destroy[stage](device->queue.ctx, variant->cso);
-      free(variant);
-   }
-   ralloc_free(shader->inlines.variants.table);
+      if (i || !locked)
+         simple_mtx_lock(&queue->lock);
 
-   if (shader->shader_cso)
-      destroy[stage](device->queue.ctx, shader->shader_cso);
-   if (shader->tess_ccw_cso)
-      destroy[stage](device->queue.ctx, shader->tess_ccw_cso);
+      set_foreach(&shader->inlines.variants, entry) {
+         const struct lvp_inline_variant *variant = entry->key;
+         if (variant->cso[i])
+            destroy[stage](queue->ctx, variant->cso[i]);
+      }
 
-   if (!locked)
-      simple_mtx_unlock(&device->queue.lock);
+      void **cso = lvp_shader_cso(shader, i, false);
+      if (*cso)
+         destroy[stage](queue->ctx, *cso);
+      cso = lvp_shader_cso(shader, i, true);
+      if (*cso)
+         destroy[stage](queue->ctx, *cso);
+
+      if (i || !locked)
+         simple_mtx_unlock(&queue->lock);
+   }
+
+   set_foreach(&shader->inlines.variants, entry)
+      free((void *)entry->key);
+   ralloc_free(shader->inlines.variants.table);
 
    lvp_pipeline_nir_ref(&shader->pipeline_nir, NULL);
    lvp_pipeline_nir_ref(&shader->tess_ccw, NULL);
@@ -594,14 +603,14 @@ lvp_pipeline_xfb_init(struct lvp_pipeline *pipeline)
 }
 
 static void *
-lvp_shader_compile_stage(struct lvp_device *device, struct lvp_shader *shader, nir_shader *nir)
+lvp_shader_compile_stage(struct pipe_context *ctx, struct lvp_shader *shader, nir_shader *nir)
 {
    if (nir->info.stage == MESA_SHADER_COMPUTE) {
       struct pipe_compute_state shstate = {0};
       shstate.prog = nir;
       shstate.ir_type = PIPE_SHADER_IR_NIR;
       shstate.static_shared_mem = nir->info.shared_size;
-      return device->queue.ctx->create_compute_state(device->queue.ctx, &shstate);
+      return ctx->create_compute_state(ctx, &shstate);
    } else {
       struct pipe_shader_state shstate = {0};
       shstate.type = PIPE_SHADER_IR_NIR;
@@ -610,19 +619,19 @@ lvp_shader_compile_stage(struct lvp_device *device, struct lvp_shader *shader, n
 
       switch (nir->info.stage) {
       case MESA_SHADER_FRAGMENT:
-         return device->queue.ctx->create_fs_state(device->queue.ctx, &shstate);
+         return ctx->create_fs_state(ctx, &shstate);
       case MESA_SHADER_VERTEX:
-         return device->queue.ctx->create_vs_state(device->queue.ctx, &shstate);
+         return ctx->create_vs_state(ctx, &shstate);
       case MESA_SHADER_GEOMETRY:
-         return device->queue.ctx->create_gs_state(device->queue.ctx, &shstate);
+         return ctx->create_gs_state(ctx, &shstate);
       case MESA_SHADER_TESS_CTRL:
-         return device->queue.ctx->create_tcs_state(device->queue.ctx, &shstate);
+         return ctx->create_tcs_state(ctx, &shstate);
       case MESA_SHADER_TESS_EVAL:
-         return device->queue.ctx->create_tes_state(device->queue.ctx, &shstate);
+         return ctx->create_tes_state(ctx, &shstate);
       case MESA_SHADER_TASK:
-         return device->queue.ctx->create_ts_state(device->queue.ctx, &shstate);
+         return ctx->create_ts_state(ctx, &shstate);
       case MESA_SHADER_MESH:
-         return device->queue.ctx->create_ms_state(device->queue.ctx, &shstate);
+         return ctx->create_ms_state(ctx, &shstate);
       default:
          unreachable("illegal shader");
          break;
@@ -639,7 +648,7 @@ lvp_shader_compile(struct lvp_device *device, struct lvp_shader *shader, nir_sha
    if (!locked)
       simple_mtx_lock(&device->queue.lock);
 
-   void *state = lvp_shader_compile_stage(device, shader, nir);
+   void *state = lvp_shader_compile_stage(device->queue.ctx, shader, nir);
 
    if (!locked)
       simple_mtx_unlock(&device->queue.lock);
@@ -647,6 +656,18 @@ lvp_shader_compile(struct lvp_device *device, struct lvp_shader *shader, nir_sha
    return state;
 }
 
+/* Compiles for the context of a queue which is executing commands, the
+ * queue lock is held already.
+ */
+void *
+lvp_shader_compile_on_queue(struct lvp_queue *queue, struct lvp_shader *shader, nir_shader *nir)
+{
+   struct pipe_screen *pscreen = queue->device->pscreen;
+   pscreen->finalize_nir(pscreen, nir);
+
+   return lvp_shader_compile_stage(queue->ctx, shader, nir);
+}
+
 #ifndef NDEBUG
 static bool
 layouts_equal(const struct lvp_descriptor_set_layout *a, const struct lvp_descriptor_set_layout *b)
@@ -106,6 +106,7 @@ extern "C" {
 #define MAX_DGC_TOKENS 16
 /* Currently lavapipe does not support more than 1 image plane */
 #define LVP_MAX_PLANE_COUNT 1
+#define LVP_MAX_QUEUES 4
 
 #ifdef _WIN32
 #define lvp_printflike(a, b)
@@ -184,6 +185,12 @@ void lvp_finish_wsi(struct lvp_physical_device *physical_device);
 bool lvp_physical_device_extension_supported(struct lvp_physical_device *dev,
                                               const char *name);
 
+/* Every queue executes on a gallium context of its own.  Shader CSOs are
+ * per context as well, see lvp_shader_cso().
+ *
+ * The lock of the first queue also guards the objects the device creates on
+ * its context.  When taking several queue locks, take them in queue order.
+ */
 struct lvp_queue {
    struct vk_queue vk;
    struct lvp_device *                         device;
@@ -192,6 +199,7 @@ struct lvp_queue {
    struct u_upload_mgr *uploader;
    struct pipe_fence_handle *last_fence;
    void *state;
+   void *noop_fs;
    struct util_dynarray pipeline_destroys;
    simple_mtx_t lock;
 };
@@ -206,10 +214,13 @@ struct lvp_device {
    struct vk_device vk;
 
    struct lvp_queue queue;
+   struct lvp_queue extra_queues[LVP_MAX_QUEUES - 1];
+   uint32_t extra_queue_count;
    struct lvp_instance *                       instance;
    struct lvp_physical_device *physical_device;
    struct pipe_screen *pscreen;
-   void *noop_fs;
+   /* Guards the inline variants of all shaders */
+   simple_mtx_t inline_lock;
    simple_mtx_t bda_lock;
    struct hash_table bda;
    struct pipe_resource *zero_buffer; /* for zeroed bda */
@@ -224,6 +235,12 @@ struct lvp_device {
    uint32_t group_handle_alloc;
 };
 
+static inline struct lvp_queue *
+lvp_device_queue(struct lvp_device *device, uint32_t index)
+{
+   return index ? &device->extra_queues[index - 1] : &device->queue;
+}
+
 void lvp_device_get_cache_uuid(void *uuid);
 
 enum lvp_device_memory_type {
@@ -354,6 +371,9 @@ struct lvp_descriptor_set_layout {
    /* Number of dynamic offsets used by this descriptor set */
    uint32_t dynamic_offset_count;
 
+   /* Some bindings may be updated while a set is bound or in use */
+   bool update_after_bind;
+
    /* if this layout is comprised solely of immutable samplers, this will be a bindable set */
    struct lvp_descriptor_set *immutable_set;
 
@@ -376,6 +396,12 @@ struct lvp_descriptor_set {
    struct pipe_memory_allocation *pmem;
    struct pipe_resource *bo;
    void *map;
+
+   /* Allocated from a VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT pool,
+    * or the layout has update-after-bind or update-unused-while-pending
+    * bindings.
+    */
+   bool update_after_bind;
 };
 
 struct lvp_descriptor_pool {
@@ -442,7 +468,8 @@ lvp_pipeline_nir_ref(struct lvp_pipeline_nir **dst, struct lvp_pipeline_nir *src
 struct lvp_inline_variant {
    uint32_t mask;
    uint32_t vals[PIPE_MAX_CONSTANT_BUFFERS][MAX_INLINABLE_UNIFORMS];
-   void *cso;
+   /* per queue */
+   void *cso[LVP_MAX_QUEUES];
 };
 
 struct lvp_shader {
@@ -452,17 +479,34 @@ struct lvp_shader {
    struct lvp_pipeline_nir *tess_ccw;
    void *shader_cso;
    void *tess_ccw_cso;
+   /* CSOs of the other queues, created when they first bind the shader */
+   struct {
+      void *shader_cso;
+      void *tess_ccw_cso;
+   } queue_csos[LVP_MAX_QUEUES - 1];
    struct {
       uint32_t uniform_offsets[PIPE_MAX_CONSTANT_BUFFERS][MAX_INLINABLE_UNIFORMS];
       uint8_t count[PIPE_MAX_CONSTANT_BUFFERS];
       bool must_inline;
       uint32_t can_inline; //bitmask
+      bool stop_inlining; //variants aren't worth it, use shader_cso
       struct set variants;
    } inlines;
    struct pipe_stream_output_info stream_output;
    struct blob blob; //preserved for GetShaderBinaryDataEXT
 };
 
+/* Where the CSO of the shader for the context of the queue lives. */
+static inline void **
+lvp_shader_cso(struct lvp_shader *shader, uint32_t queue_index, bool tess_ccw)
+{
+   if (!queue_index)
+      return tess_ccw ? &shader->tess_ccw_cso : &shader->shader_cso;
+
+   return tess_ccw ? &shader->queue_csos[queue_index - 1].tess_ccw_cso :
+                     &shader->queue_csos[queue_index - 1].shader_cso;
+}
+
 enum lvp_pipeline_type {
    LVP_PIPELINE_GRAPHICS,
    LVP_PIPELINE_COMPUTE,
@@ -628,6 +672,12 @@ struct lvp_cmd_buffer {
 
    struct lvp_device *                          device;
 
+   /* VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT was set at begin */
+   bool one_time_submit;
+
+   /* Commands with some of their work done at end, see lvp_cmd_stream */
+   struct lvp_cmd_stream *stream;
+
    uint8_t push_constants[MAX_PUSH_CONSTANTS_SIZE];
 };
 
@@ -714,6 +764,8 @@ VkResult lvp_image_bind_sparse(struct lvp_device *device,
 VkResult lvp_execute_cmds(struct lvp_device *device,
                           struct lvp_queue *queue,
                           struct lvp_cmd_buffer *cmd_buffer);
+void lvp_compile_cmd_buffer(struct lvp_cmd_buffer *cmd_buffer);
+void lvp_cmd_buffer_free_stream(struct lvp_cmd_buffer *cmd_buffer);
 size_t
 lvp_get_rendering_state_size(void);
 struct lvp_image *lvp_swapchain_get_image(VkSwapchainKHR swapchain,
@@ -782,6 +834,8 @@ void
 lvp_inline_uniforms(nir_shader *nir, const struct lvp_shader *shader, const uint32_t *uniform_values, uint32_t ubo);
 void *
 lvp_shader_compile(struct lvp_device *device, struct lvp_shader *shader, nir_shader *nir, bool locked);
+void *
+lvp_shader_compile_on_queue(struct lvp_queue *queue, struct lvp_shader *shader, nir_shader *nir);
 bool
 lvp_nir_lower_ray_queries(struct nir_shader *shader);
 bool
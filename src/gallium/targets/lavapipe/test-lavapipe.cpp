@@ -0,0 +1,574 @@
+/*
+ * Copyright 2024 Mesa contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <cstdint>
+#include <cstring>
+
+#include <gtest/gtest.h>
+
+#include "vulkan/vulkan_core.h"
+
+extern "C" VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL
+vk_icdGetInstanceProcAddr(VkInstance instance, const char *pName);
+
+#define LVP_TEST_FUNCS(X)                     \
+   X(DestroyInstance)                         \
+   X(EnumeratePhysicalDevices)                \
+   X(GetPhysicalDeviceMemoryProperties)       \
+   X(GetPhysicalDeviceQueueFamilyProperties)  \
+   X(CreateDevice)                            \
+   X(DestroyDevice)                           \
+   X(GetDeviceQueue)                          \
+   X(QueueSubmit)                             \
+   X(QueueWaitIdle)                           \
+   X(DeviceWaitIdle)                          \
+   X(CreateBuffer)                            \
+   X(DestroyBuffer)                           \
+   X(GetBufferMemoryRequirements)             \
+   X(AllocateMemory)                          \
+   X(FreeMemory)                              \
+   X(BindBufferMemory)                        \
+   X(MapMemory)                               \
+   X(CreateShaderModule)                      \
+   X(DestroyShaderModule)                     \
+   X(CreateDescriptorSetLayout)               \
+   X(DestroyDescriptorSetLayout)              \
+   X(CreatePipelineLayout)                    \
+   X(DestroyPipelineLayout)                   \
+   X(CreateComputePipelines)                  \
+   X(DestroyPipeline)                         \
+   X(CreateDescriptorPool)                    \
+   X(DestroyDescriptorPool)                   \
+   X(AllocateDescriptorSets)                  \
+   X(UpdateDescriptorSets)                    \
+   X(CreateCommandPool)                       \
+   X(DestroyCommandPool)                      \
+   X(AllocateCommandBuffers)                  \
+   X(BeginCommandBuffer)                      \
+   X(EndCommandBuffer)                        \
+   X(CmdBindPipeline)                         \
+   X(CmdBindDescriptorSets)                   \
+   X(CmdPipelineBarrier)                      \
+   X(CmdDispatch)
+
+/* Copies the first uint of set 1 binding 0 to set 0 binding 0. */
+static const uint32_t copy_spv[] = {
+   /*
+               OpCapability Shader
+               OpMemoryModel Logical GLSL450
+               OpEntryPoint GLCompute %1 "main"
+               OpExecutionMode %1 LocalSize 1 1 1
+               OpMemberDecorate %5 0 Offset 0
+               OpDecorate %5 BufferBlock
+               OpDecorate %7 DescriptorSet 0
+               OpDecorate %7 Binding 0
+               OpDecorate %8 DescriptorSet 1
+               OpDecorate %8 Binding 0
+          %2 = OpTypeVoid
+          %3 = OpTypeFunction %2
+          %4 = OpTypeInt 32 0
+          %5 = OpTypeStruct %4
+          %6 = OpTypePointer Uniform %5
+          %7 = OpVariable %6 Uniform
+          %8 = OpVariable %6 Uniform
+          %9 = OpTypeInt 32 1
+         %10 = OpConstant %9 0
+         %11 = OpTypePointer Uniform %4
+          %1 = OpFunction %2 None %3
+         %12 = OpLabel
+         %13 = OpAccessChain %11 %8 %10
+         %14 = OpLoad %4 %13
+         %15 = OpAccessChain %11 %7 %10
+               OpStore %15 %14
+               OpReturn
+               OpFunctionEnd
+   */
+   0x07230203, 0x00010000, 0x00000000, 0x00000010, 0x00000000, 0x00020011,
+   0x00000001, 0x0003000e, 0x00000000, 0x00000001, 0x0005000f, 0x00000005,
+   0x00000001, 0x6e69616d, 0x00000000, 0x00060010, 0x00000001, 0x00000011,
+   0x00000001, 0x00000001, 0x00000001, 0x00050048, 0x00000005, 0x00000000,
+   0x00000023, 0x00000000, 0x00030047, 0x00000005, 0x00000003, 0x00040047,
+   0x00000007, 0x00000022, 0x00000000, 0x00040047, 0x00000007, 0x00000021,
+   0x00000000, 0x00040047, 0x00000008, 0x00000022, 0x00000001, 0x00040047,
+   0x00000008, 0x00000021, 0x00000000, 0x00020013, 0x00000002, 0x00030021,
+   0x00000003, 0x00000002, 0x00040015, 0x00000004, 0x00000020, 0x00000000,
+   0x0003001e, 0x00000005, 0x00000004, 0x00040020, 0x00000006, 0x00000002,
+   0x00000005, 0x0004003b, 0x00000006, 0x00000007, 0x00000002, 0x0004003b,
+   0x00000006, 0x00000008, 0x00000002, 0x00040015, 0x00000009, 0x00000020,
+   0x00000001, 0x0004002b, 0x00000009, 0x0000000a, 0x00000000, 0x00040020,
+   0x0000000b, 0x00000002, 0x00000004, 0x00050036, 0x00000002, 0x00000001,
+   0x00000000, 0x00000003, 0x000200f8, 0x0000000c, 0x00050041, 0x0000000b,
+   0x0000000d, 0x00000008, 0x0000000a, 0x0004003d, 0x00000004, 0x0000000e,
+   0x0000000d, 0x00050041, 0x0000000b, 0x0000000f, 0x00000007, 0x0000000a,
+   0x0003003e, 0x0000000f, 0x0000000e, 0x000100fd, 0x00010038,
+};
+
+struct test_buffer {
+   VkBuffer buffer;
+   VkDeviceMemory memory;
+   uint32_t *map;
+};
+
+/* A copy_spv pipeline and a descriptor set for each of its two sets */
+struct copy_pipeline {
+   VkDescriptorSetLayout set_layouts[2];
+   VkPipelineLayout layout;
+   VkShaderModule module;
+   VkPipeline pipeline;
+   VkDescriptorPool pools[2];
+   VkDescriptorSet sets[2];
+};
+
+class Lavapipe : public ::testing::Test {
+protected:
+   VkInstance instance = VK_NULL_HANDLE;
+   VkPhysicalDevice pdev = VK_NULL_HANDLE;
+   VkDevice device = VK_NULL_HANDLE;
+   uint32_t queue_count = 0;
+   uint32_t memory_type = 0;
+
+#define DECL_FUNC(name) PFN_vk##name name = NULL;
+   LVP_TEST_FUNCS(DECL_FUNC)
+#undef DECL_FUNC
+
+   void SetUp() override
+   {
+      auto CreateInstance = (PFN_vkCreateInstance)
+         vk_icdGetInstanceProcAddr(VK_NULL_HANDLE, "vkCreateInstance");
+      ASSERT_NE(CreateInstance, nullptr);
+
+      VkApplicationInfo app_info = {};
+      app_info.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+      app_info.apiVersion = VK_API_VERSION_1_3;
+
+      VkInstanceCreateInfo instance_info = {};
+      instance_info.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+      instance_info.pApplicationInfo = &app_info;
+      ASSERT_EQ(CreateInstance(&instance_info, NULL, &instance), VK_SUCCESS);
+
+#define LOAD_FUNC(name)                                                   \
+      name = (PFN_vk##name)vk_icdGetInstanceProcAddr(instance, "vk" #name); \
+      ASSERT_NE(name, nullptr);
+      LVP_TEST_FUNCS(LOAD_FUNC)
+#undef LOAD_FUNC
+
+      uint32_t count = 1;
+      ASSERT_GE(EnumeratePhysicalDevices(instance, &count, &pdev), 0);
+      ASSERT_EQ(count, 1u);
+
+      VkQueueFamilyProperties family;
+      count = 1;
+      GetPhysicalDeviceQueueFamilyProperties(pdev, &count, &family);
+      ASSERT_EQ(count, 1u);
+      queue_count = family.queueCount;
+
+      VkPhysicalDeviceMemoryProperties mem_props;
+      GetPhysicalDeviceMemoryProperties(pdev, &mem_props);
+      const VkMemoryPropertyFlags host_flags =
+         VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+         VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+      for (memory_type = 0; memory_type < mem_props.memoryTypeCount; memory_type++) {
+         if ((mem_props.memoryTypes[memory_type].propertyFlags & host_flags) ==
+             host_flags)
+            break;
+      }
+      ASSERT_LT(memory_type, mem_props.memoryTypeCount);
+
+      float priorities[8] = { 0 };
+      ASSERT_LE(queue_count, 8u);
+      VkDeviceQueueCreateInfo queue_info = {};
+      queue_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+      queue_info.queueFamilyIndex = 0;
+      queue_info.queueCount = queue_count;
+      queue_info.pQueuePriorities = priorities;
+
+      VkPhysicalDeviceVulkan12Features features12 = {};
+      features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+      features12.descriptorIndexing = VK_TRUE;
+      features12.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+      features12.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+
+      VkDeviceCreateInfo device_info = {};
+      device_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+      device_info.pNext = &features12;
+      device_info.queueCreateInfoCount = 1;
+      device_info.pQueueCreateInfos = &queue_info;
+      ASSERT_EQ(CreateDevice(pdev, &device_info, NULL, &device), VK_SUCCESS);
+   }
+
+   void TearDown() override
+   {
+      if (device)
+         DestroyDevice(device, NULL);
+      if (instance)
+         DestroyInstance(instance, NULL);
+   }
+
+   void create_buffer(struct test_buffer *buf, VkDeviceSize size)
+   {
+      VkBufferCreateInfo buffer_info = {};
+      buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+      buffer_info.size = size;
+      buffer_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                          VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+      ASSERT_EQ(CreateBuffer(device, &buffer_info, NULL, &buf->buffer),
+                VK_SUCCESS);
+
+      VkMemoryRequirements reqs;
+      GetBufferMemoryRequirements(device, buf->buffer, &reqs);
+
+      VkMemoryAllocateInfo alloc_info = {};
+      alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+      alloc_info.allocationSize = reqs.size;
+      alloc_info.memoryTypeIndex = memory_type;
+      ASSERT_EQ(AllocateMemory(device, &alloc_info, NULL, &buf->memory),
+                VK_SUCCESS);
+      ASSERT_EQ(BindBufferMemory(device, buf->buffer, buf->memory, 0),
+                VK_SUCCESS);
+      ASSERT_EQ(MapMemory(device, buf->memory, 0, VK_WHOLE_SIZE, 0,
+                          (void **)&buf->map), VK_SUCCESS);
+      memset(buf->map, 0, size);
+   }
+
+   void destroy_buffer(struct test_buffer *buf)
+   {
+      DestroyBuffer(device, buf->buffer, NULL);
+      FreeMemory(device, buf->memory, NULL);
+   }
+
+   /* Set 0 holds the output behind a dynamic offset, set 1 the input. */
+   void create_copy_pipeline(struct copy_pipeline *p, bool update_after_bind)
+   {
+      VkDescriptorSetLayoutBinding out_binding = {};
+      out_binding.binding = 0;
+      out_binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+      out_binding.descriptorCount = 1;
+      out_binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+      VkDescriptorSetLayoutBinding in_binding = out_binding;
+      in_binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+
+      const VkDescriptorBindingFlags in_flags =
+         VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+         VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+      VkDescriptorSetLayoutBindingFlagsCreateInfo flags_info = {};
+      flags_info.sType =
+         VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+      flags_info.bindingCount = 1;
+      flags_info.pBindingFlags = &in_flags;
+
+      VkDescriptorSetLayoutCreateInfo layout_info = {};
+      layout_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+      layout_info.bindingCount = 1;
+      layout_info.pBindings = &out_binding;
+      ASSERT_EQ(CreateDescriptorSetLayout(device, &layout_info, NULL,
+                                          &p->set_layouts[0]), VK_SUCCESS);
+      if (update_after_bind) {
+         layout_info.pNext = &flags_info;
+         layout_info.flags =
+            VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+      }
+      layout_info.pBindings = &in_binding;
+      ASSERT_EQ(CreateDescriptorSetLayout(device, &layout_info, NULL,
+                                          &p->set_layouts[1]), VK_SUCCESS);
+
+      VkPipelineLayoutCreateInfo pipeline_layout_info = {};
+      pipeline_layout_info.sType =
+         VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+      pipeline_layout_info.setLayoutCount = 2;
+      pipeline_layout_info.pSetLayouts = p->set_layouts;
+      ASSERT_EQ(CreatePipelineLayout(device, &pipeline_layout_info, NULL,
+                                     &p->layout), VK_SUCCESS);
+
+      VkShaderModuleCreateInfo module_info = {};
+      module_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+      module_info.codeSize = sizeof(copy_spv);
+      module_info.pCode = copy_spv;
+      ASSERT_EQ(CreateShaderModule(device, &module_info, NULL, &p->module),
+                VK_SUCCESS);
+
+      VkComputePipelineCreateInfo pipeline_info = {};
+      pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+      pipeline_info.stage.sType =
+         VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+      pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+      pipeline_info.stage.module = p->module;
+      pipeline_info.stage.pName = "main";
+      pipeline_info.layout = p->layout;
+      ASSERT_EQ(CreateComputePipelines(device, VK_NULL_HANDLE, 1,
+                                       &pipeline_info, NULL, &p->pipeline),
+                VK_SUCCESS);
+
+      VkDescriptorPoolSize pool_sizes[2] = {
+         { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1 },
+         { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 },
+      };
+      VkDescriptorPoolCreateInfo pool_info = {};
+      pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+      pool_info.maxSets = 1;
+      pool_info.poolSizeCount = 1;
+      pool_info.pPoolSizes = &pool_sizes[0];
+      ASSERT_EQ(CreateDescriptorPool(device, &pool_info, NULL, &p->pools[0]),
+                VK_SUCCESS);
+      if (update_after_bind)
+         pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+      pool_info.pPoolSizes = &pool_sizes[1];
+      ASSERT_EQ(CreateDescriptorPool(device, &pool_info, NULL, &p->pools[1]),
+                VK_SUCCESS);
+
+      for (unsigned i = 0; i < 2; i++) {
+         VkDescriptorSetAllocateInfo set_info = {};
+         set_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+         set_info.descriptorPool = p->pools[i];
+         set_info.descriptorSetCount = 1;
+         set_info.pSetLayouts = &p->set_layouts[i];
+         ASSERT_EQ(AllocateDescriptorSets(device, &set_info, &p->sets[i]),
+                   VK_SUCCESS);
+      }
+   }
+
+   void destroy_copy_pipeline(struct copy_pipeline *p)
+   {
+      DestroyDescriptorPool(device, p->pools[0], NULL);
+      DestroyDescriptorPool(device, p->pools[1], NULL);
+      DestroyPipeline(device, p->pipeline, NULL);
+      DestroyShaderModule(device, p->module, NULL);
+      DestroyPipelineLayout(device, p->layout, NULL);
+      DestroyDescriptorSetLayout(device, p->set_layouts[0], NULL);
+      DestroyDescriptorSetLayout(device, p->set_layouts[1], NULL);
+   }
+
+   /* Points set 0 (the output) or set 1 (the input) at the first uint of
+    * the buffer.
+    */
+   void write_copy_set(struct copy_pipeline *p, unsigned set, VkBuffer buffer)
+   {
+      VkDescriptorBufferInfo buffer_info = { buffer, 0, 4 };
+      VkWriteDescriptorSet write = {};
+      write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      write.dstSet = p->sets[set];
+      write.descriptorCount = 1;
+      write.descriptorType = set ? VK_DESCRIPTOR_TYPE_STORAGE_BUFFER :
+                                   VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+      write.pBufferInfo = &buffer_info;
+      UpdateDescriptorSets(device, 1, &write, 0, NULL);
+   }
+
+   VkCommandBuffer begin_cmd_buffer(VkCommandPool pool,
+                                    VkCommandBufferUsageFlags flags = 0)
+   {
+      VkCommandBufferAllocateInfo alloc_info = {};
+      alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+      alloc_info.commandPool = pool;
+      alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+      alloc_info.commandBufferCount = 1;
+
+      VkCommandBuffer cmd = VK_NULL_HANDLE;
+      EXPECT_EQ(AllocateCommandBuffers(device, &alloc_info, &cmd), VK_SUCCESS);
+
+      /* Unless one-time-submit, lavapipe compiles it at End. */
+      VkCommandBufferBeginInfo begin_info = {};
+      begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+      begin_info.flags = flags;
+      EXPECT_EQ(BeginCommandBuffer(cmd, &begin_info), VK_SUCCESS);
+      return cmd;
+   }
+
+   void submit(VkQueue queue, VkCommandBuffer cmd)
+   {
+      VkSubmitInfo submit_info = {};
+      submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+      submit_info.commandBufferCount = 1;
+      submit_info.pCommandBuffers = &cmd;
+      ASSERT_EQ(QueueSubmit(queue, 1, &submit_info, VK_NULL_HANDLE),
+                VK_SUCCESS);
+   }
+};
+
+/* Command buffers that aren't one-time-submit have their dynamic offsets
+ * applied at vkEndCommandBuffer, which must not bake descriptors that can
+ * still be updated before submission.
+ */
+TEST_F(Lavapipe, UpdateAfterBindAfterEnd)
+{
+   struct test_buffer out, in[2];
+   create_buffer(&out, 512);
+   create_buffer(&in[0], 16);
+   create_buffer(&in[1], 16);
+   in[0].map[0] = 0x1111;
+   in[1].map[0] = 0x2222;
+
+   /* The input set is updated after the command buffer is recorded. */
+   struct copy_pipeline p;
+   create_copy_pipeline(&p, true);
+   write_copy_set(&p, 0, out.buffer);
+   write_copy_set(&p, 1, in[0].buffer);
+
+   VkCommandPoolCreateInfo cmd_pool_info = {};
+   cmd_pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+   VkCommandPool cmd_pool;
+   ASSERT_EQ(CreateCommandPool(device, &cmd_pool_info, NULL, &cmd_pool),
+             VK_SUCCESS);
+
+   const uint32_t dynamic_offset = 256;
+   VkCommandBuffer cmd = begin_cmd_buffer(cmd_pool);
+   CmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, p.pipeline);
+   CmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, p.layout,
+                         0, 2, p.sets, 1, &dynamic_offset);
+   CmdDispatch(cmd, 1, 1, 1);
+   ASSERT_EQ(EndCommandBuffer(cmd), VK_SUCCESS);
+
+   VkQueue queue;
+   GetDeviceQueue(device, 0, 0, &queue);
+
+   /* Every submission uses the descriptor as it is at submission time. */
+   for (unsigned i = 0; i < 2; i++) {
+      write_copy_set(&p, 1, in[(i + 1) % 2].buffer);
+
+      submit(queue, cmd);
+      ASSERT_EQ(QueueWaitIdle(queue), VK_SUCCESS);
+      EXPECT_EQ(out.map[dynamic_offset / 4], in[(i + 1) % 2].map[0]);
+      EXPECT_EQ(out.map[0], 0u);
+   }
+
+   DestroyCommandPool(device, cmd_pool, NULL);
+   destroy_copy_pipeline(&p);
+   destroy_buffer(&in[1]);
+   destroy_buffer(&in[0]);
+   destroy_buffer(&out);
+}
+
+/* Reusable command buffers are replayed from what vkEndCommandBuffer made of
+ * them, one-time-submit ones are executed from the recorded commands.  Both
+ * must write the same.
+ */
+TEST_F(Lavapipe, ReplayMatchesDirect)
+{
+   static const uint32_t dynamic_offsets[] = { 0, 256, 512 };
+   struct test_buffer out[2], in;
+   create_buffer(&out[0], 1024);
+   create_buffer(&out[1], 1024);
+   create_buffer(&in, 16);
+
+   struct copy_pipeline p;
+   create_copy_pipeline(&p, false);
+   write_copy_set(&p, 1, in.buffer);
+
+   VkCommandPoolCreateInfo cmd_pool_info = {};
+   cmd_pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+   VkCommandPool cmd_pool;
+   ASSERT_EQ(CreateCommandPool(device, &cmd_pool_info, NULL, &cmd_pool),
+             VK_SUCCESS);
+
+   VkMemoryBarrier barrier = {};
+   barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+   barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+   barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT |
+                           VK_ACCESS_SHADER_WRITE_BIT;
+
+   VkQueue queue;
+   GetDeviceQueue(device, 0, 0, &queue);
+
+   const unsigned num_offsets =
+      sizeof(dynamic_offsets) / sizeof(dynamic_offsets[0]);
+   in.map[0] = 0x1000;
+
+   VkCommandBuffer cmds[2];
+   for (unsigned i = 0; i < 2; i++) {
+      write_copy_set(&p, 0, out[i].buffer);
+
+      cmds[i] = begin_cmd_buffer(cmd_pool, i == 0 ?
+         VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT : 0);
+      CmdBindPipeline(cmds[i], VK_PIPELINE_BIND_POINT_COMPUTE, p.pipeline);
+      for (unsigned j = 0; j < num_offsets; j++) {
+         CmdBindDescriptorSets(cmds[i], VK_PIPELINE_BIND_POINT_COMPUTE,
+                               p.layout, 0, 2, p.sets, 1,
+                               &dynamic_offsets[j]);
+         CmdDispatch(cmds[i], 1, 1, 1);
+
+         /* Back-to-back barriers, of which only the first is replayed */
+         for (unsigned k = 0; k < 2; k++) {
+            CmdPipelineBarrier(cmds[i], VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                               VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+                               1, &barrier, 0, NULL, 0, NULL);
+         }
+      }
+      ASSERT_EQ(EndCommandBuffer(cmds[i]), VK_SUCCESS);
+
+      submit(queue, cmds[i]);
+      ASSERT_EQ(QueueWaitIdle(queue), VK_SUCCESS);
+   }
+
+   for (unsigned j = 0; j < num_offsets; j++)
+      EXPECT_EQ(out[0].map[dynamic_offsets[j] / 4], in.map[0]);
+   EXPECT_EQ(memcmp(out[0].map, out[1].map, 1024), 0);
+
+   /* Replaying again picks up the new buffer contents */
+   for (unsigned n = 1; n < 3; n++) {
+      in.map[0] = 0x1000 + n;
+      memset(out[1].map, 0, 1024);
+
+      submit(queue, cmds[1]);
+      ASSERT_EQ(QueueWaitIdle(queue), VK_SUCCESS);
+
+      for (unsigned j = 0; j < num_offsets; j++)
+         EXPECT_EQ(out[1].map[dynamic_offsets[j] / 4], in.map[0]);
+   }
+
+   DestroyCommandPool(device, cmd_pool, NULL);
+   destroy_copy_pipeline(&p);
+   destroy_buffer(&in);
+   destroy_buffer(&out[1]);
+   destroy_buffer(&out[0]);
+}
+
+/* Every queue runs on a gallium context of its own, the pipeline and
+ * descriptor sets created on the device have to work on all of them.
+ */
+TEST_F(Lavapipe, MultipleQueues)
+{
+   ASSERT_GE(queue_count, 2u);
+
+   struct test_buffer out, in;
+   create_buffer(&out, 256 * queue_count);
+   create_buffer(&in, 16);
+   in.map[0] = 0x3333;
+
+   struct copy_pipeline p;
+   create_copy_pipeline(&p, false);
+   write_copy_set(&p, 0, out.buffer);
+   write_copy_set(&p, 1, in.buffer);
+
+   VkCommandPoolCreateInfo cmd_pool_info = {};
+   cmd_pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+   VkCommandPool cmd_pool;
+   ASSERT_EQ(CreateCommandPool(device, &cmd_pool_info, NULL, &cmd_pool),
+             VK_SUCCESS);
+
+   /* Each queue writes its own slot, all of them run at the same time */
+   for (uint32_t i = 0; i < queue_count; i++) {
+      const uint32_t dynamic_offset = 256 * i;
+      VkCommandBuffer cmd = begin_cmd_buffer(cmd_pool);
+      CmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, p.pipeline);
+      CmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, p.layout,
+                            0, 2, p.sets, 1, &dynamic_offset);
+      CmdDispatch(cmd, 1, 1, 1);
+      ASSERT_EQ(EndCommandBuffer(cmd), VK_SUCCESS);
+
+      VkQueue queue;
+      GetDeviceQueue(device, 0, i, &queue);
+      ASSERT_NE(queue, (VkQueue)VK_NULL_HANDLE);
+      submit(queue, cmd);
+   }
+   ASSERT_EQ(DeviceWaitIdle(device), VK_SUCCESS);
+
+   for (uint32_t i = 0; i < queue_count; i++)
+      EXPECT_EQ(out.map[64 * i], in.map[0]);
+
+   DestroyCommandPool(device, cmd_pool, NULL);
+   destroy_copy_pipeline(&p);
+   destroy_buffer(&in);
+   destroy_buffer(&out);
+}
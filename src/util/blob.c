@@ -211,6 +211,21 @@ BLOB_WRITE_TYPE(blob_write_uint32, uint32_t)
 BLOB_WRITE_TYPE(blob_write_uint64, uint64_t)
 BLOB_WRITE_TYPE(blob_write_intptr, intptr_t)
 
+bool
+blob_write_varint32(struct blob *blob, uint32_t value)
+{
+   uint8_t bytes[5];
+   unsigned num_bytes = 0;
+
+   while (value >= 0x80) {
+      bytes[num_bytes++] = (value & 0x7f) | 0x80;
+      value >>= 7;
+   }
+   bytes[num_bytes++] = value;
+
+   return blob_write_bytes(blob, bytes, num_bytes);
+}
+
 #define ASSERT_ALIGNED(_offset, _align) \
    assert(align_uintptr((_offset), (_align)) == (_offset))
 
@@ -325,6 +340,30 @@ BLOB_READ_TYPE(blob_read_uint32, uint32_t)
 BLOB_READ_TYPE(blob_read_uint64, uint64_t)
 BLOB_READ_TYPE(blob_read_intptr, intptr_t)
 
+uint32_t
+blob_read_varint32(struct blob_reader *blob)
+{
+   uint32_t value = 0;
+
+   for (unsigned shift = 0; shift < 35; shift += 7) {
+      if (!ensure_can_read(blob, 1))
+         return 0;
+
+      uint8_t byte = *blob->current++;
+
+      /* The 5th byte only has room for the top 4 bits. */
+      if (shift == 28 && byte > 0x0f)
+         break;
+
+      value |= (uint32_t)(byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+         return value;
+   }
+
+   blob->overrun = true;
+   return 0;
+}
+
 char *
 blob_read_string(struct blob_reader *blob)
 {
@@ -312,6 +312,17 @@ blob_overwrite_intptr(struct blob *blob,
 bool
 blob_write_string(struct blob *blob, const char *str);
 
+/**
+ * Add a uint32_t to a blob as an unsigned LEB128 varint.
+ *
+ * Values below 128 take a single byte and no value takes more than 5.
+ * Unlike blob_write_uint32, this never adds padding before the value.
+ *
+ * \return True unless allocation failed.
+ */
+bool
+blob_write_varint32(struct blob *blob, uint32_t value);
+
 /**
  * Start reading a blob, (initializing the contents of \blob for reading).
  *
@@ -408,6 +419,16 @@ blob_read_uint32(struct blob_reader *blob);
 uint64_t
 blob_read_uint64(struct blob_reader *blob);
 
+/**
+ * Read a uint32_t written by blob_write_varint32 from the current location,
+ * (and update the current location to just past it).
+ *
+ * \return The uint32_t read, or 0 if the varint is truncated, longer than
+ * 5 bytes or doesn't fit in 32 bits, in which case the overrun flag is set.
+ */
+uint32_t
+blob_read_varint32(struct blob_reader *blob);
+
 /**
  * Read an intptr_t value from the current location, (and update the
  * current location to just past this intptr_t).
@@ -36,8 +36,11 @@
 
 #ifdef HAVE_ZSTD
 #include "zstd.h"
+#include "zdict.h"
 #endif
 
+#include <stdlib.h>
+
 #include "util/compress.h"
 #include "util/perf/cpu_trace.h"
 #include "macros.h"
@@ -166,4 +169,164 @@ util_compress_inflate(const uint8_t *in_data, size_t in_data_size,
 #endif
 }
 
+
+struct util_compress_dict {
+#ifdef HAVE_ZSTD
+   ZSTD_CDict *cdict;
+   ZSTD_DDict *ddict;
+#endif
+   uint32_t id;
+};
+
+/**
+ * Creates a dictionary from the output of util_compress_dict_train(), or
+ * returns NULL if that isn't one.
+ */
+struct util_compress_dict *
+util_compress_dict_create(const void *dict_data, size_t dict_size)
+{
+#ifdef HAVE_ZSTD
+   /* Raw content dictionaries have no ID, and frames compressed with them
+    * can't be told apart from ones compressed without a dictionary.
+    */
+   uint32_t id = ZSTD_getDictID_fromDict(dict_data, dict_size);
+   if (!id)
+      return NULL;
+
+   struct util_compress_dict *dict = calloc(1, sizeof(*dict));
+   if (!dict)
+      return NULL;
+
+   dict->id = id;
+   dict->cdict = ZSTD_createCDict(dict_data, dict_size, ZSTD_COMPRESSION_LEVEL);
+   dict->ddict = ZSTD_createDDict(dict_data, dict_size);
+   if (!dict->cdict || !dict->ddict) {
+      util_compress_dict_destroy(dict);
+      return NULL;
+   }
+
+   return dict;
+#else
+   return NULL;
+#endif
+}
+
+void
+util_compress_dict_destroy(struct util_compress_dict *dict)
+{
+   if (!dict)
+      return;
+
+#ifdef HAVE_ZSTD
+   ZSTD_freeCDict(dict->cdict);
+   ZSTD_freeDDict(dict->ddict);
+#endif
+   free(dict);
+}
+
+uint32_t
+util_compress_dict_id(const struct util_compress_dict *dict)
+{
+   return dict ? dict->id : 0;
+}
+
+/**
+ * Trains a dictionary on num_samples samples stored back to back in samples,
+ * and returns its size, or 0 on failure.  A few hundred samples and a
+ * dictionary of about 1/100th of their total size are a good start.
+ */
+size_t
+util_compress_dict_train(void *dict_data, size_t dict_buff_size,
+                         const void *samples, const size_t *sample_sizes,
+                         unsigned num_samples)
+{
+   MESA_TRACE_FUNC();
+#ifdef HAVE_ZSTD
+   size_t ret = ZDICT_trainFromBuffer(dict_data, dict_buff_size, samples,
+                                      sample_sizes, num_samples);
+   if (ZDICT_isError(ret))
+      return 0;
+
+   return ret;
+#else
+   return 0;
+#endif
+}
+
+/**
+ * Returns the ID of the dictionary compressed data needs, or 0 if it was
+ * compressed without one.
+ */
+uint32_t
+util_compress_get_dict_id(const uint8_t *in_data, size_t in_data_size)
+{
+#ifdef HAVE_ZSTD
+   return ZSTD_getDictID_fromFrame(in_data, in_data_size);
+#else
+   return 0;
+#endif
+}
+
+/**
+ * Like util_compress_inflate(), but also handles data compressed with dict,
+ * which may be NULL.
+ */
+bool
+util_compress_inflate_dict(const struct util_compress_dict *dict,
+                           const uint8_t *in_data, size_t in_data_size,
+                           uint8_t *out_data, size_t out_data_size)
+{
+   uint32_t id = util_compress_get_dict_id(in_data, in_data_size);
+   if (!id)
+      return util_compress_inflate(in_data, in_data_size, out_data,
+                                   out_data_size);
+
+   if (id != util_compress_dict_id(dict))
+      return false;
+
+#ifdef HAVE_ZSTD
+   MESA_TRACE_FUNC();
+   ZSTD_DCtx *dctx = ZSTD_createDCtx();
+   if (!dctx)
+      return false;
+
+   size_t ret = ZSTD_decompress_usingDDict(dctx, out_data, out_data_size,
+                                           in_data, in_data_size, dict->ddict);
+   ZSTD_freeDCtx(dctx);
+   return !ZSTD_isError(ret) && ret == out_data_size;
+#else
+   return false;
+#endif
+}
+
+/**
+ * Like util_compress_deflate(), but compresses with dict unless it is NULL.
+ */
+size_t
+util_compress_deflate_dict(const struct util_compress_dict *dict,
+                           const uint8_t *in_data, size_t in_data_size,
+                           uint8_t *out_data, size_t out_buff_size)
+{
+   if (!dict)
+      return util_compress_deflate(in_data, in_data_size, out_data,
+                                   out_buff_size);
+
+#ifdef HAVE_ZSTD
+   MESA_TRACE_FUNC();
+   ZSTD_CCtx *cctx = ZSTD_createCCtx();
+   if (!cctx)
+      return 0;
+
+   size_t ret = ZSTD_compress_usingCDict(cctx, out_data, out_buff_size,
+                                         in_data, in_data_size, dict->cdict);
+   ZSTD_freeCCtx(cctx);
+   if (ZSTD_isError(ret))
+      return 0;
+
+   return ret;
+#else
+   return 0;
+#endif
+}
+
 #endif
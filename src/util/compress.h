@@ -26,6 +26,10 @@
 #include <stdbool.h>
 #include <inttypes.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 size_t
 util_compress_max_compressed_len(size_t in_data_size);
 
@@ -37,4 +41,45 @@ size_t
 util_compress_deflate(const uint8_t *in_data, size_t in_data_size,
                       uint8_t *out_data, size_t out_buff_size);
 
+/* Dictionaries trained on samples of similar data make small inputs compress
+ * much better. They are only supported with zstd: util_compress_dict_create()
+ * and util_compress_dict_train() fail otherwise.
+ *
+ * Data compressed with a dictionary records its ID, so that
+ * util_compress_inflate_dict() can tell it apart from data compressed
+ * without one, or with another dictionary.
+ */
+struct util_compress_dict;
+
+struct util_compress_dict *
+util_compress_dict_create(const void *dict_data, size_t dict_size);
+
+void
+util_compress_dict_destroy(struct util_compress_dict *dict);
+
+uint32_t
+util_compress_dict_id(const struct util_compress_dict *dict);
+
+size_t
+util_compress_dict_train(void *dict_data, size_t dict_buff_size,
+                         const void *samples, const size_t *sample_sizes,
+                         unsigned num_samples);
+
+uint32_t
+util_compress_get_dict_id(const uint8_t *in_data, size_t in_data_size);
+
+bool
+util_compress_inflate_dict(const struct util_compress_dict *dict,
+                           const uint8_t *in_data, size_t in_data_size,
+                           uint8_t *out_data, size_t out_data_size);
+
+size_t
+util_compress_deflate_dict(const struct util_compress_dict *dict,
+                           const uint8_t *in_data, size_t in_data_size,
+                           uint8_t *out_data, size_t out_buff_size);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
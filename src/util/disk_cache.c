@@ -39,6 +39,7 @@
 
 #include "util/compress.h"
 #include "util/crc32.h"
+#include "util/hash_table.h"
 #include "util/u_debug.h"
 #include "util/rand_xor.h"
 #include "util/u_atomic.h"
@@ -115,6 +116,8 @@ disk_cache_type_create(const char *gpu_name,
    if (cache == NULL)
       goto fail;
 
+   simple_mtx_init(&cache->prefetch_mtx, mtx_plain);
+
    /* Assume failure. */
    cache->path_init_failed = true;
    cache->type = DISK_CACHE_NONE;
@@ -151,6 +154,9 @@ disk_cache_type_create(const char *gpu_name,
 
    cache->type = cache_type;
 
+   if (!cache->compression_disabled)
+      disk_cache_load_compress_dict(local, cache, gpu_name);
+
    cache->stats.enabled = debug_get_bool_option("MESA_SHADER_CACHE_SHOW_STATS",
                                                 false);
 
@@ -255,8 +261,10 @@ disk_cache_type_create(const char *gpu_name,
    return cache;
 
  fail:
-   if (cache)
+   if (cache) {
+      util_compress_dict_destroy(cache->compress_dict);
       ralloc_free(cache);
+   }
    ralloc_free(local);
 
    return NULL;
@@ -308,6 +316,81 @@ disk_cache_create(const char *gpu_name, const char *driver_id,
    return cache;
 }
 
+struct disk_cache_prefetch_job {
+   struct util_queue_fence fence;
+
+   struct disk_cache *cache;
+
+   cache_key key;
+
+   void *data;
+   size_t size;
+};
+
+static uint32_t
+prefetch_key_hash(const void *key)
+{
+   /* Keys are SHA-1 hashes already. */
+   uint32_t hash;
+   memcpy(&hash, key, sizeof(hash));
+   return hash;
+}
+
+static bool
+prefetch_key_equal(const void *a, const void *b)
+{
+   return memcmp(a, b, CACHE_KEY_SIZE) == 0;
+}
+
+/* Removes the prefetch of key from the cache, if there is one. The job may
+ * still be running, so callers must wait for its fence before using it.
+ */
+static struct disk_cache_prefetch_job *
+take_prefetch_job(struct disk_cache *cache, const cache_key key)
+{
+   struct disk_cache_prefetch_job *pf_job = NULL;
+
+   if (!p_atomic_read(&cache->prefetched))
+      return NULL;
+
+   simple_mtx_lock(&cache->prefetch_mtx);
+   struct hash_entry *entry =
+      _mesa_hash_table_search(cache->prefetched, key);
+   if (entry) {
+      pf_job = entry->data;
+      _mesa_hash_table_remove(cache->prefetched, entry);
+   }
+   simple_mtx_unlock(&cache->prefetch_mtx);
+
+   return pf_job;
+}
+
+static void *
+finish_prefetch_job(struct disk_cache_prefetch_job *pf_job, size_t *size)
+{
+   util_queue_fence_wait(&pf_job->fence);
+
+   void *data = pf_job->data;
+   if (size)
+      *size = pf_job->size;
+
+   util_queue_fence_destroy(&pf_job->fence);
+   free(pf_job);
+   return data;
+}
+
+/* A prefetch that was queued before a put or removal of the same key may have
+ * read the old item, or nothing at all.
+ */
+static void
+drop_prefetch_job(struct disk_cache *cache, const cache_key key)
+{
+   struct disk_cache_prefetch_job *pf_job = take_prefetch_job(cache, key);
+
+   if (pf_job)
+      free(finish_prefetch_job(pf_job, NULL));
+}
+
 void
 disk_cache_destroy(struct disk_cache *cache)
 {
@@ -321,6 +404,14 @@ disk_cache_destroy(struct disk_cache *cache)
       util_queue_finish(&cache->cache_queue);
       util_queue_destroy(&cache->cache_queue);
 
+      /* Prefetched items that were never asked for */
+      if (cache->prefetched) {
+         hash_table_foreach(cache->prefetched, entry) {
+            struct disk_cache_prefetch_job *pf_job = entry->data;
+            free(finish_prefetch_job(pf_job, NULL));
+         }
+      }
+
       if (cache->foz_ro_cache)
          disk_cache_destroy(cache->foz_ro_cache);
 
@@ -333,6 +424,11 @@ disk_cache_destroy(struct disk_cache *cache)
       disk_cache_destroy_mmap(cache);
    }
 
+   if (cache) {
+      util_compress_dict_destroy(cache->compress_dict);
+      simple_mtx_destroy(&cache->prefetch_mtx);
+   }
+
    ralloc_free(cache);
 }
 
@@ -347,15 +443,14 @@ disk_cache_remove(struct disk_cache *cache, const cache_key key)
 {
    if (cache->type == DISK_CACHE_DATABASE) {
       mesa_cache_db_multipart_entry_remove(&cache->cache_db, key);
-      return;
+   } else {
+      char *filename = disk_cache_get_cache_filename(cache, key);
+      if (filename)
+         disk_cache_evict_item(cache, filename);
    }
 
-   char *filename = disk_cache_get_cache_filename(cache, key);
-   if (filename == NULL) {
-      return;
-   }
-
-   disk_cache_evict_item(cache, filename);
+   /* Don't let a get return what was prefetched before the removal. */
+   drop_prefetch_job(cache, key);
 }
 
 static struct disk_cache_put_job *
@@ -555,6 +650,8 @@ disk_cache_put(struct disk_cache *cache, const cache_key key,
    if (!util_queue_is_initialized(&cache->cache_queue))
       return;
 
+   drop_prefetch_job(cache, key);
+
    struct disk_cache_put_job *dc_job =
       create_put_job(cache, key, (void*)data, size, cache_item_metadata, false);
 
@@ -575,6 +672,8 @@ disk_cache_put_nocopy(struct disk_cache *cache, const cache_key key,
       return;
    }
 
+   drop_prefetch_job(cache, key);
+
    struct disk_cache_put_job *dc_job =
       create_put_job(cache, key, data, size, cache_item_metadata, true);
 
@@ -585,8 +684,8 @@ disk_cache_put_nocopy(struct disk_cache *cache, const cache_key key,
    }
 }
 
-void *
-disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
+static void *
+disk_cache_load(struct disk_cache *cache, const cache_key key, size_t *size)
 {
    void *buf = NULL;
 
@@ -610,6 +709,67 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
       }
    }
 
+   return buf;
+}
+
+static void
+cache_prefetch(void *job, void *gdata, int thread_index)
+{
+   struct disk_cache_prefetch_job *pf_job = job;
+
+   pf_job->data = disk_cache_load(pf_job->cache, pf_job->key, &pf_job->size);
+}
+
+void
+disk_cache_prefetch(struct disk_cache *cache, const cache_key *keys,
+                    unsigned num_keys)
+{
+   if (!util_queue_is_initialized(&cache->cache_queue))
+      return;
+
+   simple_mtx_lock(&cache->prefetch_mtx);
+
+   if (!cache->prefetched) {
+      struct hash_table *ht =
+         _mesa_hash_table_create(cache, prefetch_key_hash, prefetch_key_equal);
+      if (!ht) {
+         simple_mtx_unlock(&cache->prefetch_mtx);
+         return;
+      }
+      p_atomic_set(&cache->prefetched, ht);
+   }
+
+   for (unsigned i = 0; i < num_keys; i++) {
+      if (_mesa_hash_table_search(cache->prefetched, keys[i]))
+         continue;
+
+      struct disk_cache_prefetch_job *pf_job = calloc(1, sizeof(*pf_job));
+      if (!pf_job)
+         break;
+
+      pf_job->cache = cache;
+      memcpy(pf_job->key, keys[i], CACHE_KEY_SIZE);
+      util_queue_fence_init(&pf_job->fence);
+
+      _mesa_hash_table_insert(cache->prefetched, pf_job->key, pf_job);
+      util_queue_add_job(&cache->cache_queue, pf_job, &pf_job->fence,
+                         cache_prefetch, NULL, 0);
+   }
+
+   simple_mtx_unlock(&cache->prefetch_mtx);
+}
+
+void *
+disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
+{
+   struct disk_cache_prefetch_job *pf_job = take_prefetch_job(cache, key);
+   void *buf;
+
+   if (pf_job)
+      buf = finish_prefetch_job(pf_job, size);
+   else
+      buf = disk_cache_load(cache, key, size);
+
    if (unlikely(cache->stats.enabled)) {
       if (buf)
          p_atomic_inc(&cache->stats.hits);
@@ -620,6 +780,48 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
    return buf;
 }
 
+struct disk_cache_get_many {
+   struct disk_cache *cache;
+   const cache_key *keys;
+   void **data;
+   size_t *sizes;
+};
+
+static void
+cache_get_many_range(void *data, unsigned start, unsigned end,
+                     int thread_index)
+{
+   struct disk_cache_get_many *gm = data;
+
+   for (unsigned i = start; i < end; i++) {
+      gm->data[i] = disk_cache_get(gm->cache, gm->keys[i],
+                                   gm->sizes ? &gm->sizes[i] : NULL);
+   }
+}
+
+void
+disk_cache_get_many(struct disk_cache *cache, unsigned num_keys,
+                    const cache_key *keys, void **data, size_t *sizes)
+{
+   struct disk_cache_get_many gm = {
+      .cache = cache,
+      .keys = keys,
+      .data = data,
+      .sizes = sizes,
+   };
+
+   if (!util_queue_is_initialized(&cache->cache_queue)) {
+      cache_get_many_range(&gm, 0, num_keys, 0);
+      return;
+   }
+
+   /* Every item is a file read plus decompression, which is plenty of work
+    * to be worth a job of its own.
+    */
+   util_queue_parallel_for(&cache->cache_queue, num_keys, 1,
+                           cache_get_many_range, &gm);
+}
+
 void
 disk_cache_put_key(struct disk_cache *cache, const cache_key key)
 {
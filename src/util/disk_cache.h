@@ -229,6 +229,31 @@ disk_cache_put_nocopy(struct disk_cache *cache, const cache_key key,
 void *
 disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size);
 
+/**
+ * Start loading the items named by \keys in the background, so that later
+ * calls to disk_cache_get() for them only wait for the load instead of
+ * doing it.
+ *
+ * This is meant for warming up at startup, when the keys of many items are
+ * known before any of them is needed. Each prefetched item is returned by
+ * the first disk_cache_get() of its key; items that are never asked for are
+ * freed by disk_cache_destroy().
+ */
+void
+disk_cache_prefetch(struct disk_cache *cache, const cache_key *keys,
+                    unsigned num_keys);
+
+/**
+ * Retrieve \num_keys items at once, loading and decompressing them on the
+ * cache's threads.
+ *
+ * \data[i] and, if \sizes is non-NULL, \sizes[i] are set as if by
+ * disk_cache_get(cache, keys[i], &sizes[i]).
+ */
+void
+disk_cache_get_many(struct disk_cache *cache, unsigned num_keys,
+                    const cache_key *keys, void **data, size_t *sizes);
+
 /**
  * Store the name \key within the cache, (without any associated data).
  *
@@ -304,6 +329,23 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
    return NULL;
 }
 
+static inline void
+disk_cache_prefetch(struct disk_cache *cache, const cache_key *keys,
+                    unsigned num_keys)
+{
+}
+
+static inline void
+disk_cache_get_many(struct disk_cache *cache, unsigned num_keys,
+                    const cache_key *keys, void **data, size_t *sizes)
+{
+   for (unsigned i = 0; i < num_keys; i++) {
+      data[i] = NULL;
+      if (sizes)
+         sizes[i] = 0;
+   }
+}
+
 static inline void
 disk_cache_put_key(struct disk_cache *cache, const cache_key key)
 {
@@ -100,6 +100,7 @@ disk_cache_get_function_identifier(void *ptr, struct mesa_sha1 *ctx)
 
 #include "util/blob.h"
 #include "util/crc32.h"
+#include "util/os_file.h"
 #include "util/u_debug.h"
 #include "util/ralloc.h"
 #include "util/rand_xor.h"
@@ -540,12 +541,20 @@ disk_cache_evict_item(struct disk_cache *cache, char *filename)
       p_atomic_add(&cache->size->value, - (uint64_t)sb.st_blocks * 512);
 }
 
+/* Returns the uncompressed data of a cache item, or NULL.  *unusable is set
+ * if the item will never load, so that the caller removes it and the next
+ * put of the key can store it again: every backend skips writing keys that
+ * it already has.
+ */
 static void *
 parse_and_validate_cache_item(struct disk_cache *cache, void *cache_item,
-                              size_t cache_item_size, size_t *size)
+                              size_t cache_item_size, size_t *size,
+                              bool *unusable)
 {
    uint8_t *uncompressed_data = NULL;
 
+   *unusable = false;
+
    struct blob_reader ci_blob_reader;
    blob_reader_init(&ci_blob_reader, cache_item, cache_item_size);
 
@@ -592,8 +601,18 @@ parse_and_validate_cache_item(struct disk_cache *cache, void *cache_item,
    const uint8_t *data = (uint8_t *) blob_read_bytes(&ci_blob_reader, cache_data_size);
 
    /* Check the data for corruption */
-   if (cf_data->crc32 != util_hash_crc32(data, cache_data_size))
+   if (cf_data->crc32 != util_hash_crc32(data, cache_data_size)) {
+      *unusable = true;
+      goto fail;
+   }
+
+   /* Compressed with a dictionary that has since been replaced */
+   uint32_t dict_id = util_compress_get_dict_id(data, cache_data_size);
+   if (!cache->compression_disabled && dict_id &&
+       dict_id != util_compress_dict_id(cache->compress_dict)) {
+      *unusable = true;
       goto fail;
+   }
 
    /* Uncompress the cache data */
    uncompressed_data = malloc(cf_data->uncompressed_size);
@@ -606,8 +625,9 @@ parse_and_validate_cache_item(struct disk_cache *cache, void *cache_item,
 
       memcpy(uncompressed_data, data, cache_data_size);
    } else {
-      if (!util_compress_inflate(data, cache_data_size, uncompressed_data,
-                                 cf_data->uncompressed_size))
+      if (!util_compress_inflate_dict(cache->compress_dict, data,
+                                      cache_data_size, uncompressed_data,
+                                      cf_data->uncompressed_size))
          goto fail;
    }
 
@@ -623,6 +643,40 @@ parse_and_validate_cache_item(struct disk_cache *cache, void *cache_item,
    return NULL;
 }
 
+/* Splits up a cache item of any driver, for tools looking at whole caches.
+ * The layout of the driver keys is the one of disk_cache_type_create().
+ */
+bool
+disk_cache_parse_item_info(const void *cache_item, size_t cache_item_size,
+                           struct disk_cache_item_info *info)
+{
+   struct blob_reader ci_blob_reader;
+   blob_reader_init(&ci_blob_reader, cache_item, cache_item_size);
+
+   blob_read_bytes(&ci_blob_reader, sizeof(uint8_t)); /* cache version */
+   info->driver_id = blob_read_string(&ci_blob_reader);
+   info->gpu_name = blob_read_string(&ci_blob_reader);
+   blob_read_bytes(&ci_blob_reader, sizeof(uint8_t)); /* pointer size */
+   blob_read_bytes(&ci_blob_reader, sizeof(uint64_t)); /* driver flags */
+
+   uint32_t md_type = blob_read_uint32(&ci_blob_reader);
+   if (md_type == CACHE_ITEM_TYPE_GLSL) {
+      uint32_t num_keys = blob_read_uint32(&ci_blob_reader);
+      blob_read_bytes(&ci_blob_reader, num_keys * sizeof(cache_key));
+   }
+
+   const struct cache_entry_file_data *cf_data =
+      blob_read_bytes(&ci_blob_reader, sizeof(struct cache_entry_file_data));
+   if (ci_blob_reader.overrun)
+      return false;
+
+   info->uncompressed_size = cf_data->uncompressed_size;
+   info->data_size = ci_blob_reader.end - ci_blob_reader.current;
+   info->data = blob_read_bytes(&ci_blob_reader, info->data_size);
+
+   return cf_data->crc32 == util_hash_crc32(info->data, info->data_size);
+}
+
 void *
 disk_cache_load_item(struct disk_cache *cache, char *filename, size_t *size)
 {
@@ -645,10 +699,16 @@ disk_cache_load_item(struct disk_cache *cache, char *filename, size_t *size)
    if (ret == -1)
       goto fail;
 
-    uint8_t *uncompressed_data =
-       parse_and_validate_cache_item(cache, data, sb.st_size, size);
-   if (!uncompressed_data)
+   bool unusable;
+   uint8_t *uncompressed_data =
+       parse_and_validate_cache_item(cache, data, sb.st_size, size, &unusable);
+   if (!uncompressed_data) {
+      if (unusable) {
+         disk_cache_evict_item(cache, filename);
+         filename = NULL;
+      }
       goto fail;
+   }
 
    free(data);
    free(filename);
@@ -706,8 +766,9 @@ create_cache_item_header_and_blob(struct disk_cache_put_job *dc_job,
       if (compressed_data == NULL)
          return false;
       compressed_size =
-         util_compress_deflate(dc_job->data, dc_job->size,
-                              compressed_data, max_buf);
+         util_compress_deflate_dict(dc_job->cache->compress_dict,
+                                    dc_job->data, dc_job->size,
+                                    compressed_data, max_buf);
       if (compressed_size == 0)
          goto fail;
    }
@@ -1020,10 +1081,15 @@ disk_cache_load_item_foz(struct disk_cache *cache, const cache_key key,
    if (!cache_item)
       return NULL;
 
+   bool unusable;
    uint8_t *uncompressed_data =
-       parse_and_validate_cache_item(cache, cache_item, cache_tem_size, size);
+       parse_and_validate_cache_item(cache, cache_item, cache_tem_size, size,
+                                     &unusable);
    free(cache_item);
 
+   if (unusable)
+      foz_invalidate_entry(&cache->foz_db, key);
+
    return uncompressed_data;
 }
 
@@ -1051,6 +1117,29 @@ disk_cache_load_cache_index_foz(void *mem_ctx, struct disk_cache *cache)
 }
 
 
+/* Loads the compression dictionary of gpu_name's items, if someone trained
+ * one with src/util/tools/mesa_cache_dict.c.  Items compressed with another
+ * dictionary, e.g. before it was retrained, are removed when they fail to
+ * load, so that they are stored again.
+ */
+void
+disk_cache_load_compress_dict(void *mem_ctx, struct disk_cache *cache,
+                              const char *gpu_name)
+{
+   char *filename = ralloc_asprintf(mem_ctx, "%s/%s" DISK_CACHE_DICT_SUFFIX,
+                                    cache->path, gpu_name);
+   if (!filename)
+      return;
+
+   size_t size;
+   char *dict_data = os_read_file(filename, &size);
+   if (!dict_data)
+      return;
+
+   cache->compress_dict = util_compress_dict_create(dict_data, size);
+   free(dict_data);
+}
+
 void
 disk_cache_touch_cache_user_marker(char *path)
 {
@@ -1159,10 +1248,15 @@ disk_cache_db_load_item(struct disk_cache *cache, const cache_key key,
    if (!cache_item)
       return NULL;
 
+   bool unusable;
    uint8_t *uncompressed_data =
-       parse_and_validate_cache_item(cache, cache_item, cache_tem_size, size);
+       parse_and_validate_cache_item(cache, cache_item, cache_tem_size, size,
+                                     &unusable);
    free(cache_item);
 
+   if (unusable)
+      mesa_cache_db_multipart_entry_remove(&cache->cache_db, key);
+
    return uncompressed_data;
 }
 
@@ -24,6 +24,7 @@
 #ifndef DISK_CACHE_OS_H
 #define DISK_CACHE_OS_H
 
+#include "util/simple_mtx.h"
 #include "util/u_queue.h"
 
 #if DETECT_OS_WINDOWS
@@ -49,6 +50,11 @@ extern "C" {
 /* The number of keys that can be stored in the index. */
 #define CACHE_INDEX_MAX_KEYS (1 << CACHE_INDEX_KEY_BITS)
 
+/* Appended to the GPU name to get the file name of its compression
+ * dictionary within the cache directory.
+ */
+#define DISK_CACHE_DICT_SUFFIX ".zdict"
+
 enum disk_cache_type {
    DISK_CACHE_NONE,
    DISK_CACHE_MULTI_FILE,
@@ -96,6 +102,9 @@ struct disk_cache {
    /* Don't compress cached data. This is for testing purposes only. */
    bool compression_disabled;
 
+   /* Dictionary to compress cached data with, may be NULL. */
+   struct util_compress_dict *compress_dict;
+
    struct {
       bool enabled;
       unsigned hits;
@@ -104,6 +113,12 @@ struct disk_cache {
 
    /* Internal RO FOZ cache for combined use of RO and RW caches. */
    struct disk_cache *foz_ro_cache;
+
+   /* Items being loaded by disk_cache_prefetch(), keyed by cache key and
+    * consumed by disk_cache_get().
+    */
+   simple_mtx_t prefetch_mtx;
+   struct hash_table *prefetched;
 };
 
 struct cache_entry_file_data {
@@ -111,6 +126,18 @@ struct cache_entry_file_data {
    uint32_t uncompressed_size;
 };
 
+struct disk_cache_item_info {
+   const char *driver_id;
+   const char *gpu_name;
+
+   /* The data as written, compressed unless the cache that wrote it had
+    * compression disabled.
+    */
+   const void *data;
+   size_t data_size;
+   uint32_t uncompressed_size;
+};
+
 struct disk_cache_put_job {
    struct util_queue_fence fence;
 
@@ -142,6 +169,10 @@ void *
 disk_cache_load_item_foz(struct disk_cache *cache, const cache_key key,
                          size_t *size);
 
+bool
+disk_cache_parse_item_info(const void *cache_item, size_t cache_item_size,
+                           struct disk_cache_item_info *info);
+
 void *
 disk_cache_load_item(struct disk_cache *cache, char *filename, size_t *size);
 
@@ -161,6 +192,10 @@ disk_cache_enabled(void);
 bool
 disk_cache_load_cache_index_foz(void *mem_ctx, struct disk_cache *cache);
 
+void
+disk_cache_load_compress_dict(void *mem_ctx, struct disk_cache *cache,
+                              const char *gpu_name);
+
 void
 disk_cache_touch_cache_user_marker(char *path);
 
@@ -0,0 +1,701 @@
+/*
+ * Copyright 2024 Mesa contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * @file
+ * SSE4.1, F16C and AVX2 pack/unpack paths for the most common formats.
+ *
+ * Every function here must produce exactly the same bits as the generic
+ * code from u_format_pack.py, leftover pixels are handed to it.  The
+ * functions are compiled for their instruction set with target attributes,
+ * so that the rest of the file doesn't depend on the build flags, and are
+ * only picked after checking the CPU caps.
+ */
+
+#include "util/detect_arch.h"
+#include "util/format/u_format.h"
+
+#if (DETECT_ARCH_X86 || DETECT_ARCH_X86_64) && !defined(NO_FORMAT_ASM) && defined(__GNUC__)
+
+#include <immintrin.h>
+#include "u_format_pack.h"
+#include "util/format_srgb.h"
+#include "util/u_cpu_detect.h"
+
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_F16C  __attribute__((target("sse4.1,f16c")))
+#define TARGET_AVX2  __attribute__((target("avx2")))
+
+/* Per-pixel byte shuffles, repeated for every 32-bit pixel of a register.
+ * A negative index is an X channel, which reads as 0xff when unpacking and
+ * is written as 0 when packing.
+ */
+#define SHUF(s, base) ((s) < 0 ? -128 : (s) + (base))
+#define SHUF4(s0, s1, s2, s3, base) \
+   SHUF(s0, base), SHUF(s1, base), SHUF(s2, base), SHUF(s3, base)
+#define SHUF16(s0, s1, s2, s3) \
+   SHUF4(s0, s1, s2, s3, 0), SHUF4(s0, s1, s2, s3, 4), \
+   SHUF4(s0, s1, s2, s3, 8), SHUF4(s0, s1, s2, s3, 12)
+
+#define FILL(s) ((s) < 0 ? -1 : 0)
+#define FILL4(s0, s1, s2, s3) FILL(s0), FILL(s1), FILL(s2), FILL(s3)
+#define FILL16(s0, s1, s2, s3) \
+   FILL4(s0, s1, s2, s3), FILL4(s0, s1, s2, s3), \
+   FILL4(s0, s1, s2, s3), FILL4(s0, s1, s2, s3)
+
+#define X -1
+
+
+/*
+ * Helpers
+ */
+
+/* Like ubyte_to_float() on the sixteen channels of four R8G8B8A8 pixels. */
+static inline void TARGET_SSE41
+store_rgba_8unorm_as_float(float *restrict dst, __m128i rgba)
+{
+   const __m128 scale = _mm_set1_ps(1.0f / 255.0f);
+
+   for (unsigned i = 0; i < 4; i++) {
+      __m128i c = _mm_cvtepu8_epi32(rgba);
+      _mm_storeu_ps(dst + 4 * i, _mm_mul_ps(_mm_cvtepi32_ps(c), scale));
+      rgba = _mm_srli_si128(rgba, 4);
+   }
+}
+
+/* Like float_to_ubyte() on every lane, including its NaN handling. */
+static inline __m128i TARGET_SSE41
+float_to_8unorm(__m128 f)
+{
+   __m128 t = _mm_add_ps(_mm_mul_ps(f, _mm_set1_ps(255.0f / 256.0f)),
+                         _mm_set1_ps(32768.0f));
+   __m128i r = _mm_and_si128(_mm_castps_si128(t), _mm_set1_epi32(0xff));
+   __m128 ge_one = _mm_cmpge_ps(f, _mm_set1_ps(1.0f));
+   r = _mm_blendv_epi8(r, _mm_set1_epi32(0xff), _mm_castps_si128(ge_one));
+   return _mm_and_si128(r, _mm_castps_si128(_mm_cmpgt_ps(f, _mm_setzero_ps())));
+}
+
+/* Four R32G32B32A32_FLOAT pixels to R8G8B8A8_UNORM. */
+static inline __m128i TARGET_SSE41
+load_rgba_float_as_8unorm(const float *restrict src)
+{
+   __m128i p0 = float_to_8unorm(_mm_loadu_ps(src + 0));
+   __m128i p1 = float_to_8unorm(_mm_loadu_ps(src + 4));
+   __m128i p2 = float_to_8unorm(_mm_loadu_ps(src + 8));
+   __m128i p3 = float_to_8unorm(_mm_loadu_ps(src + 12));
+
+   return _mm_packus_epi16(_mm_packus_epi32(p0, p1), _mm_packus_epi32(p2, p3));
+}
+
+/* _mesa_unorm_to_unorm(x, bits, 8) for bits-wide unorms in 32-bit lanes,
+ * dividing by 2^bits - 1 with the usual add-and-shift identity.
+ */
+static inline __m128i TARGET_SSE41
+unorm_to_8unorm(__m128i x, unsigned bits)
+{
+   __m128i n = _mm_add_epi32(_mm_mullo_epi32(x, _mm_set1_epi32(255)),
+                             _mm_set1_epi32((1 << (bits - 1)) - 1));
+   n = _mm_add_epi32(_mm_add_epi32(n, _mm_srli_epi32(n, bits)),
+                     _mm_set1_epi32(1));
+   return _mm_srli_epi32(n, bits);
+}
+
+
+/*
+ * 8-bit UNORM swizzles
+ */
+
+static inline void TARGET_SSE41
+unpack_swizzle_8unorm_sse41(uint8_t *restrict dst, const uint8_t *restrict src,
+                            unsigned width, __m128i shuffle, __m128i fill)
+{
+   for (unsigned x = 0; x < width; x += 4) {
+      __m128i v = _mm_loadu_si128((const __m128i *)src);
+      v = _mm_or_si128(_mm_shuffle_epi8(v, shuffle), fill);
+      _mm_storeu_si128((__m128i *)dst, v);
+      src += 16;
+      dst += 16;
+   }
+}
+
+static inline void TARGET_SSE41
+unpack_swizzle_float_sse41(float *restrict dst, const uint8_t *restrict src,
+                           unsigned width, __m128i shuffle, __m128i fill)
+{
+   for (unsigned x = 0; x < width; x += 4) {
+      __m128i v = _mm_loadu_si128((const __m128i *)src);
+      v = _mm_or_si128(_mm_shuffle_epi8(v, shuffle), fill);
+      store_rgba_8unorm_as_float(dst, v);
+      src += 16;
+      dst += 16;
+   }
+}
+
+static inline void TARGET_SSE41
+pack_swizzle_8unorm_sse41(uint8_t *restrict dst, const uint8_t *restrict src,
+                          unsigned width, __m128i shuffle)
+{
+   for (unsigned x = 0; x < width; x += 4) {
+      __m128i v = _mm_loadu_si128((const __m128i *)src);
+      _mm_storeu_si128((__m128i *)dst, _mm_shuffle_epi8(v, shuffle));
+      src += 16;
+      dst += 16;
+   }
+}
+
+static inline void TARGET_SSE41
+pack_swizzle_float_sse41(uint8_t *restrict dst, const float *restrict src,
+                         unsigned width, __m128i shuffle)
+{
+   for (unsigned x = 0; x < width; x += 4) {
+      __m128i v = load_rgba_float_as_8unorm(src);
+      _mm_storeu_si128((__m128i *)dst, _mm_shuffle_epi8(v, shuffle));
+      src += 16;
+      dst += 16;
+   }
+}
+
+static inline void TARGET_AVX2
+unpack_swizzle_8unorm_avx2(uint8_t *restrict dst, const uint8_t *restrict src,
+                           unsigned width, __m128i shuffle, __m128i fill)
+{
+   const __m256i shuffle2 = _mm256_broadcastsi128_si256(shuffle);
+   const __m256i fill2 = _mm256_broadcastsi128_si256(fill);
+
+   for (unsigned x = 0; x < width; x += 8) {
+      __m256i v = _mm256_loadu_si256((const __m256i *)src);
+      v = _mm256_or_si256(_mm256_shuffle_epi8(v, shuffle2), fill2);
+      _mm256_storeu_si256((__m256i *)dst, v);
+      src += 32;
+      dst += 32;
+   }
+}
+
+static inline void TARGET_AVX2
+pack_swizzle_8unorm_avx2(uint8_t *restrict dst, const uint8_t *restrict src,
+                         unsigned width, __m128i shuffle)
+{
+   const __m256i shuffle2 = _mm256_broadcastsi128_si256(shuffle);
+
+   for (unsigned x = 0; x < width; x += 8) {
+      __m256i v = _mm256_loadu_si256((const __m256i *)src);
+      _mm256_storeu_si256((__m256i *)dst, _mm256_shuffle_epi8(v, shuffle2));
+      src += 32;
+      dst += 32;
+   }
+}
+
+/* sRGB to linear through the same table as
+ * util_format_srgb_8unorm_to_linear_float(), alpha like ubyte_to_float().
+ */
+static inline void TARGET_AVX2
+unpack_swizzle_srgb_float_avx2(float *restrict dst, const uint8_t *restrict src,
+                               unsigned width, __m128i shuffle, __m128i fill)
+{
+   const __m256 scale = _mm256_set1_ps(1.0f / 255.0f);
+
+   for (unsigned x = 0; x < width; x += 4) {
+      __m128i v = _mm_loadu_si128((const __m128i *)src);
+      v = _mm_or_si128(_mm_shuffle_epi8(v, shuffle), fill);
+
+      for (unsigned i = 0; i < 2; i++) {
+         __m256i idx = _mm256_cvtepu8_epi32(v);
+         __m256 rgb = _mm256_i32gather_ps(util_format_srgb_8unorm_to_linear_float_table,
+                                          idx, 4);
+         __m256 a = _mm256_mul_ps(_mm256_cvtepi32_ps(idx), scale);
+         _mm256_storeu_ps(dst + 8 * i, _mm256_blend_ps(rgb, a, 0x88));
+         v = _mm_srli_si128(v, 8);
+      }
+      src += 16;
+      dst += 16;
+   }
+}
+
+/* u* are the packed bytes of R, G, B and A, p* the channels of the packed
+ * bytes.
+ */
+#define SWIZZLE_8UNORM(sn, u0, u1, u2, u3, p0, p1, p2, p3)                    \
+static void TARGET_SSE41                                                      \
+util_format_##sn##_unpack_rgba_8unorm_sse41(uint8_t *restrict dst,            \
+                                            const uint8_t *restrict src,      \
+                                            unsigned width)                   \
+{                                                                             \
+   unsigned w = width & ~3;                                                   \
+   unpack_swizzle_8unorm_sse41(dst, src, w,                                   \
+                               _mm_setr_epi8(SHUF16(u0, u1, u2, u3)),         \
+                               _mm_setr_epi8(FILL16(u0, u1, u2, u3)));        \
+   if (w < width)                                                             \
+      util_format_##sn##_unpack_rgba_8unorm(dst + w * 4, src + w * 4,         \
+                                            width - w);                       \
+}                                                                             \
+                                                                              \
+static void TARGET_SSE41                                                      \
+util_format_##sn##_unpack_rgba_float_sse41(void *restrict dst,                \
+                                           const uint8_t *restrict src,       \
+                                           unsigned width)                    \
+{                                                                             \
+   unsigned w = width & ~3;                                                   \
+   unpack_swizzle_float_sse41(dst, src, w,                                    \
+                              _mm_setr_epi8(SHUF16(u0, u1, u2, u3)),          \
+                              _mm_setr_epi8(FILL16(u0, u1, u2, u3)));         \
+   if (w < width)                                                             \
+      util_format_##sn##_unpack_rgba_float((float *)dst + w * 4, src + w * 4, \
+                                           width - w);                        \
+}                                                                             \
+                                                                              \
+static void TARGET_SSE41                                                      \
+util_format_##sn##_pack_rgba_float_sse41(uint8_t *restrict dst_row,           \
+                                         unsigned dst_stride,                 \
+                                         const float *restrict src_row,       \
+                                         unsigned src_stride,                 \
+                                         unsigned width, unsigned height)     \
+{                                                                             \
+   unsigned w = width & ~3;                                                   \
+   for (unsigned y = 0; y < height; y++) {                                    \
+      pack_swizzle_float_sse41(dst_row, src_row, w,                           \
+                               _mm_setr_epi8(SHUF16(p0, p1, p2, p3)));        \
+      if (w < width)                                                          \
+         util_format_##sn##_pack_rgba_float(dst_row + w * 4, 0,               \
+                                            src_row + w * 4, 0,               \
+                                            width - w, 1);                    \
+      dst_row += dst_stride;                                                  \
+      src_row += src_stride / sizeof(*src_row);                               \
+   }                                                                          \
+}                                                                             \
+                                                                              \
+static void TARGET_AVX2                                                       \
+util_format_##sn##_unpack_rgba_8unorm_avx2(uint8_t *restrict dst,             \
+                                           const uint8_t *restrict src,       \
+                                           unsigned width)                    \
+{                                                                             \
+   unsigned w = width & ~7;                                                   \
+   unpack_swizzle_8unorm_avx2(dst, src, w,                                    \
+                              _mm_setr_epi8(SHUF16(u0, u1, u2, u3)),          \
+                              _mm_setr_epi8(FILL16(u0, u1, u2, u3)));         \
+   if (w < width)                                                             \
+      util_format_##sn##_unpack_rgba_8unorm_sse41(dst + w * 4, src + w * 4,   \
+                                                  width - w);                 \
+}
+
+/* R8G8B8A8_UNORM is left out, the generic code is a plain copy. */
+#define SWIZZLE_8UNORM_PACK(sn, p0, p1, p2, p3)                               \
+static void TARGET_SSE41                                                      \
+util_format_##sn##_pack_rgba_8unorm_sse41(uint8_t *restrict dst_row,          \
+                                          unsigned dst_stride,                \
+                                          const uint8_t *restrict src_row,    \
+                                          unsigned src_stride,                \
+                                          unsigned width, unsigned height)    \
+{                                                                             \
+   unsigned w = width & ~3;                                                   \
+   for (unsigned y = 0; y < height; y++) {                                    \
+      pack_swizzle_8unorm_sse41(dst_row, src_row, w,                          \
+                                _mm_setr_epi8(SHUF16(p0, p1, p2, p3)));       \
+      if (w < width)                                                          \
+         util_format_##sn##_pack_rgba_8unorm(dst_row + w * 4, 0,              \
+                                             src_row + w * 4, 0,              \
+                                             width - w, 1);                   \
+      dst_row += dst_stride;                                                  \
+      src_row += src_stride;                                                  \
+   }                                                                          \
+}                                                                             \
+                                                                              \
+static void TARGET_AVX2                                                       \
+util_format_##sn##_pack_rgba_8unorm_avx2(uint8_t *restrict dst_row,           \
+                                         unsigned dst_stride,                 \
+                                         const uint8_t *restrict src_row,     \
+                                         unsigned src_stride,                 \
+                                         unsigned width, unsigned height)     \
+{                                                                             \
+   unsigned w = width & ~7;                                                   \
+   for (unsigned y = 0; y < height; y++) {                                    \
+      pack_swizzle_8unorm_avx2(dst_row, src_row, w,                           \
+                               _mm_setr_epi8(SHUF16(p0, p1, p2, p3)));        \
+      if (w < width)                                                          \
+         util_format_##sn##_pack_rgba_8unorm_sse41(dst_row + w * 4, 0,        \
+                                                   src_row + w * 4, 0,        \
+                                                   width - w, 1);             \
+      dst_row += dst_stride;                                                  \
+      src_row += src_stride;                                                  \
+   }                                                                          \
+}
+
+#define SWIZZLE_SRGB(sn, u0, u1, u2, u3)                                      \
+static void TARGET_AVX2                                                       \
+util_format_##sn##_unpack_rgba_float_avx2(void *restrict dst,                 \
+                                          const uint8_t *restrict src,        \
+                                          unsigned width)                     \
+{                                                                             \
+   unsigned w = width & ~3;                                                   \
+   unpack_swizzle_srgb_float_avx2(dst, src, w,                                \
+                                  _mm_setr_epi8(SHUF16(u0, u1, u2, u3)),      \
+                                  _mm_setr_epi8(FILL16(u0, u1, u2, u3)));     \
+   if (w < width)                                                             \
+      util_format_##sn##_unpack_rgba_float((float *)dst + w * 4, src + w * 4, \
+                                           width - w);                        \
+}
+
+SWIZZLE_8UNORM(r8g8b8a8_unorm, 0, 1, 2, 3, 0, 1, 2, 3)
+SWIZZLE_8UNORM(r8g8b8x8_unorm, 0, 1, 2, X, 0, 1, 2, X)
+SWIZZLE_8UNORM(b8g8r8a8_unorm, 2, 1, 0, 3, 2, 1, 0, 3)
+SWIZZLE_8UNORM(b8g8r8x8_unorm, 2, 1, 0, X, 2, 1, 0, X)
+SWIZZLE_8UNORM(a8r8g8b8_unorm, 1, 2, 3, 0, 3, 0, 1, 2)
+SWIZZLE_8UNORM(x8r8g8b8_unorm, 1, 2, 3, X, X, 0, 1, 2)
+SWIZZLE_8UNORM(a8b8g8r8_unorm, 3, 2, 1, 0, 3, 2, 1, 0)
+SWIZZLE_8UNORM(x8b8g8r8_unorm, 3, 2, 1, X, X, 2, 1, 0)
+
+SWIZZLE_8UNORM_PACK(r8g8b8x8_unorm, 0, 1, 2, X)
+SWIZZLE_8UNORM_PACK(b8g8r8a8_unorm, 2, 1, 0, 3)
+SWIZZLE_8UNORM_PACK(b8g8r8x8_unorm, 2, 1, 0, X)
+SWIZZLE_8UNORM_PACK(a8r8g8b8_unorm, 3, 0, 1, 2)
+SWIZZLE_8UNORM_PACK(x8r8g8b8_unorm, X, 0, 1, 2)
+SWIZZLE_8UNORM_PACK(a8b8g8r8_unorm, 3, 2, 1, 0)
+SWIZZLE_8UNORM_PACK(x8b8g8r8_unorm, X, 2, 1, 0)
+
+SWIZZLE_SRGB(r8g8b8a8_srgb, 0, 1, 2, 3)
+SWIZZLE_SRGB(r8g8b8x8_srgb, 0, 1, 2, X)
+SWIZZLE_SRGB(b8g8r8a8_srgb, 2, 1, 0, 3)
+SWIZZLE_SRGB(b8g8r8x8_srgb, 2, 1, 0, X)
+SWIZZLE_SRGB(a8r8g8b8_srgb, 1, 2, 3, 0)
+SWIZZLE_SRGB(x8r8g8b8_srgb, 1, 2, 3, X)
+SWIZZLE_SRGB(a8b8g8r8_srgb, 3, 2, 1, 0)
+SWIZZLE_SRGB(x8b8g8r8_srgb, 3, 2, 1, X)
+
+
+/*
+ * 10_10_10_2 UNORM
+ */
+
+#define UNORM_10_10_10_2(sn, r_shift, b_shift)                                \
+static void TARGET_SSE41                                                      \
+util_format_##sn##_unpack_rgba_8unorm_sse41(uint8_t *restrict dst,            \
+                                            const uint8_t *restrict src,      \
+                                            unsigned width)                   \
+{                                                                             \
+   const __m128i mask = _mm_set1_epi32(0x3ff);                                \
+   unsigned w = width & ~3;                                                   \
+   for (unsigned x = 0; x < w; x += 4) {                                      \
+      __m128i v = _mm_loadu_si128((const __m128i *)src);                      \
+      __m128i r = _mm_and_si128(_mm_srli_epi32(v, r_shift), mask);            \
+      __m128i g = _mm_and_si128(_mm_srli_epi32(v, 10), mask);                 \
+      __m128i b = _mm_and_si128(_mm_srli_epi32(v, b_shift), mask);            \
+      __m128i a = _mm_mullo_epi32(_mm_srli_epi32(v, 30), _mm_set1_epi32(0x55)); \
+      __m128i rgba = unorm_to_8unorm(r, 10);                                  \
+      rgba = _mm_or_si128(rgba, _mm_slli_epi32(unorm_to_8unorm(g, 10), 8));   \
+      rgba = _mm_or_si128(rgba, _mm_slli_epi32(unorm_to_8unorm(b, 10), 16));  \
+      rgba = _mm_or_si128(rgba, _mm_slli_epi32(a, 24));                       \
+      _mm_storeu_si128((__m128i *)dst, rgba);                                 \
+      src += 16;                                                              \
+      dst += 16;                                                              \
+   }                                                                          \
+   if (w < width)                                                             \
+      util_format_##sn##_unpack_rgba_8unorm(dst, src, width - w);             \
+}                                                                             \
+                                                                              \
+static void TARGET_SSE41                                                      \
+util_format_##sn##_unpack_rgba_float_sse41(void *restrict dst_row,            \
+                                           const uint8_t *restrict src,       \
+                                           unsigned width)                    \
+{                                                                             \
+   const __m128i mask = _mm_set1_epi32(0x3ff);                                \
+   const __m128 scale = _mm_set1_ps(1.0f / 0x3ff);                            \
+   float *dst = dst_row;                                                      \
+   unsigned w = width & ~3;                                                   \
+   for (unsigned x = 0; x < w; x += 4) {                                      \
+      __m128i v = _mm_loadu_si128((const __m128i *)src);                      \
+      __m128 r = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(v, r_shift), mask)); \
+      __m128 g = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(v, 10), mask)); \
+      __m128 b = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(v, b_shift), mask)); \
+      __m128 a = _mm_cvtepi32_ps(_mm_srli_epi32(v, 30));                      \
+      r = _mm_mul_ps(r, scale);                                               \
+      g = _mm_mul_ps(g, scale);                                               \
+      b = _mm_mul_ps(b, scale);                                               \
+      a = _mm_mul_ps(a, _mm_set1_ps(1.0f / 0x3));                             \
+      _MM_TRANSPOSE4_PS(r, g, b, a);                                          \
+      _mm_storeu_ps(dst + 0, r);                                              \
+      _mm_storeu_ps(dst + 4, g);                                              \
+      _mm_storeu_ps(dst + 8, b);                                              \
+      _mm_storeu_ps(dst + 12, a);                                             \
+      src += 16;                                                              \
+      dst += 16;                                                              \
+   }                                                                          \
+   if (w < width)                                                             \
+      util_format_##sn##_unpack_rgba_float(dst, src, width - w);              \
+}
+
+UNORM_10_10_10_2(r10g10b10a2_unorm, 0, 20)
+UNORM_10_10_10_2(b10g10r10a2_unorm, 20, 0)
+
+
+/*
+ * R16G16B16A16_UNORM
+ */
+
+static void TARGET_SSE41
+util_format_r16g16b16a16_unorm_unpack_rgba_8unorm_sse41(uint8_t *restrict dst,
+                                                        const uint8_t *restrict src,
+                                                        unsigned width)
+{
+   unsigned w = width & ~3;
+   for (unsigned x = 0; x < w; x += 4) {
+      __m128i v0 = _mm_loadu_si128((const __m128i *)src);
+      __m128i v1 = _mm_loadu_si128((const __m128i *)(src + 16));
+      __m128i c0 = _mm_packus_epi32(unorm_to_8unorm(_mm_cvtepu16_epi32(v0), 16),
+                                    unorm_to_8unorm(_mm_unpackhi_epi16(v0, _mm_setzero_si128()), 16));
+      __m128i c1 = _mm_packus_epi32(unorm_to_8unorm(_mm_cvtepu16_epi32(v1), 16),
+                                    unorm_to_8unorm(_mm_unpackhi_epi16(v1, _mm_setzero_si128()), 16));
+      _mm_storeu_si128((__m128i *)dst, _mm_packus_epi16(c0, c1));
+      src += 32;
+      dst += 16;
+   }
+   if (w < width)
+      util_format_r16g16b16a16_unorm_unpack_rgba_8unorm(dst, src, width - w);
+}
+
+static void TARGET_SSE41
+util_format_r16g16b16a16_unorm_unpack_rgba_float_sse41(void *restrict dst_row,
+                                                       const uint8_t *restrict src,
+                                                       unsigned width)
+{
+   const __m128 scale = _mm_set1_ps(1.0f / 0xffff);
+   float *dst = dst_row;
+   for (unsigned x = 0; x < width; x++) {
+      __m128i v = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *)src));
+      _mm_storeu_ps(dst, _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+      src += 8;
+      dst += 4;
+   }
+}
+
+static void TARGET_SSE41
+util_format_r16g16b16a16_unorm_pack_rgba_8unorm_sse41(uint8_t *restrict dst_row,
+                                                      unsigned dst_stride,
+                                                      const uint8_t *restrict src_row,
+                                                      unsigned src_stride,
+                                                      unsigned width, unsigned height)
+{
+   unsigned w = width & ~3;
+   for (unsigned y = 0; y < height; y++) {
+      const uint8_t *src = src_row;
+      uint8_t *dst = dst_row;
+      for (unsigned x = 0; x < w; x += 4) {
+         /* x * 257, as in _mesa_unorm_to_unorm(x, 8, 16) */
+         __m128i v = _mm_loadu_si128((const __m128i *)src);
+         _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi8(v, v));
+         _mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi8(v, v));
+         src += 16;
+         dst += 32;
+      }
+      if (w < width)
+         util_format_r16g16b16a16_unorm_pack_rgba_8unorm(dst, 0, src, 0,
+                                                         width - w, 1);
+      dst_row += dst_stride;
+      src_row += src_stride;
+   }
+}
+
+
+/*
+ * R16G16B16A16_FLOAT
+ *
+ * The generic code only uses F16C when USE_X86_64_ASM is set, and the
+ * software conversion differs in NaN payloads.
+ */
+
+#if defined(USE_X86_64_ASM)
+
+static void TARGET_F16C
+util_format_r16g16b16a16_float_unpack_rgba_float_f16c(void *restrict dst_row,
+                                                      const uint8_t *restrict src,
+                                                      unsigned width)
+{
+   float *dst = dst_row;
+   for (unsigned x = 0; x < width; x++) {
+      __m128i v = _mm_loadl_epi64((const __m128i *)src);
+      _mm_storeu_ps(dst, _mm_cvtph_ps(v));
+      src += 8;
+      dst += 4;
+   }
+}
+
+static void TARGET_F16C
+util_format_r16g16b16a16_float_pack_rgba_float_f16c(uint8_t *restrict dst_row,
+                                                    unsigned dst_stride,
+                                                    const float *restrict src_row,
+                                                    unsigned src_stride,
+                                                    unsigned width, unsigned height)
+{
+   for (unsigned y = 0; y < height; y++) {
+      const float *src = src_row;
+      uint8_t *dst = dst_row;
+      for (unsigned x = 0; x < width; x++) {
+         /* Round towards zero, like _mesa_float_to_float16_rtz() */
+         __m128i v = _mm_cvtps_ph(_mm_loadu_ps(src), _MM_FROUND_TO_ZERO);
+         _mm_storel_epi64((__m128i *)dst, v);
+         src += 4;
+         dst += 8;
+      }
+      dst_row += dst_stride;
+      src_row += src_stride / sizeof(*src_row);
+   }
+}
+
+#endif /* USE_X86_64_ASM */
+
+
+/*
+ * Tables
+ */
+
+#define SWIZZLE_8UNORM_UNPACK_TABLE(fmt, sn, isa)                                   \
+   [PIPE_FORMAT_##fmt] = {                                                    \
+      .unpack_rgba_8unorm = &util_format_##sn##_unpack_rgba_8unorm_##isa,     \
+      .unpack_rgba = &util_format_##sn##_unpack_rgba_float_sse41,             \
+   }
+
+#define SWIZZLE_8UNORM_PACK_TABLE(fmt, sn, isa)                                     \
+   [PIPE_FORMAT_##fmt] = {                                                    \
+      .pack_rgba_8unorm = &util_format_##sn##_pack_rgba_8unorm_##isa,         \
+      .pack_rgba_float = &util_format_##sn##_pack_rgba_float_sse41,           \
+   }
+
+#define SWIZZLE_SRGB_UNPACK_TABLE(fmt, sn)                                          \
+   [PIPE_FORMAT_##fmt] = {                                                    \
+      .unpack_rgba_8unorm = &util_format_##sn##_unpack_rgba_8unorm,           \
+      .unpack_rgba = &util_format_##sn##_unpack_rgba_float_avx2,              \
+   }
+
+static const struct util_format_unpack_description util_format_unpack_descriptions_sse41[] = {
+   SWIZZLE_8UNORM_UNPACK_TABLE(R8G8B8A8_UNORM, r8g8b8a8_unorm, sse41),
+   SWIZZLE_8UNORM_UNPACK_TABLE(R8G8B8X8_UNORM, r8g8b8x8_unorm, sse41),
+   SWIZZLE_8UNORM_UNPACK_TABLE(B8G8R8A8_UNORM, b8g8r8a8_unorm, sse41),
+   SWIZZLE_8UNORM_UNPACK_TABLE(B8G8R8X8_UNORM, b8g8r8x8_unorm, sse41),
+   SWIZZLE_8UNORM_UNPACK_TABLE(A8R8G8B8_UNORM, a8r8g8b8_unorm, sse41),
+   SWIZZLE_8UNORM_UNPACK_TABLE(X8R8G8B8_UNORM, x8r8g8b8_unorm, sse41),
+   SWIZZLE_8UNORM_UNPACK_TABLE(A8B8G8R8_UNORM, a8b8g8r8_unorm, sse41),
+   SWIZZLE_8UNORM_UNPACK_TABLE(X8B8G8R8_UNORM, x8b8g8r8_unorm, sse41),
+   [PIPE_FORMAT_R10G10B10A2_UNORM] = {
+      .unpack_rgba_8unorm = &util_format_r10g10b10a2_unorm_unpack_rgba_8unorm_sse41,
+      .unpack_rgba = &util_format_r10g10b10a2_unorm_unpack_rgba_float_sse41,
+   },
+   [PIPE_FORMAT_B10G10R10A2_UNORM] = {
+      .unpack_rgba_8unorm = &util_format_b10g10r10a2_unorm_unpack_rgba_8unorm_sse41,
+      .unpack_rgba = &util_format_b10g10r10a2_unorm_unpack_rgba_float_sse41,
+   },
+   [PIPE_FORMAT_R16G16B16A16_UNORM] = {
+      .unpack_rgba_8unorm = &util_format_r16g16b16a16_unorm_unpack_rgba_8unorm_sse41,
+      .unpack_rgba = &util_format_r16g16b16a16_unorm_unpack_rgba_float_sse41,
+   },
+};
+
+static const struct util_format_pack_description util_format_pack_descriptions_sse41[] = {
+   [PIPE_FORMAT_R8G8B8A8_UNORM] = {
+      .pack_rgba_8unorm = &util_format_r8g8b8a8_unorm_pack_rgba_8unorm,
+      .pack_rgba_float = &util_format_r8g8b8a8_unorm_pack_rgba_float_sse41,
+   },
+   SWIZZLE_8UNORM_PACK_TABLE(R8G8B8X8_UNORM, r8g8b8x8_unorm, sse41),
+   SWIZZLE_8UNORM_PACK_TABLE(B8G8R8A8_UNORM, b8g8r8a8_unorm, sse41),
+   SWIZZLE_8UNORM_PACK_TABLE(B8G8R8X8_UNORM, b8g8r8x8_unorm, sse41),
+   SWIZZLE_8UNORM_PACK_TABLE(A8R8G8B8_UNORM, a8r8g8b8_unorm, sse41),
+   SWIZZLE_8UNORM_PACK_TABLE(X8R8G8B8_UNORM, x8r8g8b8_unorm, sse41),
+   SWIZZLE_8UNORM_PACK_TABLE(A8B8G8R8_UNORM, a8b8g8r8_unorm, sse41),
+   SWIZZLE_8UNORM_PACK_TABLE(X8B8G8R8_UNORM, x8b8g8r8_unorm, sse41),
+   [PIPE_FORMAT_R16G16B16A16_UNORM] = {
+      .pack_rgba_8unorm = &util_format_r16g16b16a16_unorm_pack_rgba_8unorm_sse41,
+      .pack_rgba_float = &util_format_r16g16b16a16_unorm_pack_rgba_float,
+   },
+};
+
+#if defined(USE_X86_64_ASM)
+static const struct util_format_unpack_description util_format_unpack_descriptions_f16c[] = {
+   [PIPE_FORMAT_R16G16B16A16_FLOAT] = {
+      .unpack_rgba_8unorm = &util_format_r16g16b16a16_float_unpack_rgba_8unorm,
+      .unpack_rgba = &util_format_r16g16b16a16_float_unpack_rgba_float_f16c,
+   },
+};
+
+static const struct util_format_pack_description util_format_pack_descriptions_f16c[] = {
+   [PIPE_FORMAT_R16G16B16A16_FLOAT] = {
+      .pack_rgba_8unorm = &util_format_r16g16b16a16_float_pack_rgba_8unorm,
+      .pack_rgba_float = &util_format_r16g16b16a16_float_pack_rgba_float_f16c,
+   },
+};
+#endif
+
+static const struct util_format_unpack_description util_format_unpack_descriptions_avx2[] = {
+   SWIZZLE_8UNORM_UNPACK_TABLE(R8G8B8A8_UNORM, r8g8b8a8_unorm, avx2),
+   SWIZZLE_8UNORM_UNPACK_TABLE(R8G8B8X8_UNORM, r8g8b8x8_unorm, avx2),
+   SWIZZLE_8UNORM_UNPACK_TABLE(B8G8R8A8_UNORM, b8g8r8a8_unorm, avx2),
+   SWIZZLE_8UNORM_UNPACK_TABLE(B8G8R8X8_UNORM, b8g8r8x8_unorm, avx2),
+   SWIZZLE_8UNORM_UNPACK_TABLE(A8R8G8B8_UNORM, a8r8g8b8_unorm, avx2),
+   SWIZZLE_8UNORM_UNPACK_TABLE(X8R8G8B8_UNORM, x8r8g8b8_unorm, avx2),
+   SWIZZLE_8UNORM_UNPACK_TABLE(A8B8G8R8_UNORM, a8b8g8r8_unorm, avx2),
+   SWIZZLE_8UNORM_UNPACK_TABLE(X8B8G8R8_UNORM, x8b8g8r8_unorm, avx2),
+   SWIZZLE_SRGB_UNPACK_TABLE(R8G8B8A8_SRGB, r8g8b8a8_srgb),
+   SWIZZLE_SRGB_UNPACK_TABLE(R8G8B8X8_SRGB, r8g8b8x8_srgb),
+   SWIZZLE_SRGB_UNPACK_TABLE(B8G8R8A8_SRGB, b8g8r8a8_srgb),
+   SWIZZLE_SRGB_UNPACK_TABLE(B8G8R8X8_SRGB, b8g8r8x8_srgb),
+   SWIZZLE_SRGB_UNPACK_TABLE(A8R8G8B8_SRGB, a8r8g8b8_srgb),
+   SWIZZLE_SRGB_UNPACK_TABLE(X8R8G8B8_SRGB, x8r8g8b8_srgb),
+   SWIZZLE_SRGB_UNPACK_TABLE(A8B8G8R8_SRGB, a8b8g8r8_srgb),
+   SWIZZLE_SRGB_UNPACK_TABLE(X8B8G8R8_SRGB, x8b8g8r8_srgb),
+};
+
+static const struct util_format_pack_description util_format_pack_descriptions_avx2[] = {
+   [PIPE_FORMAT_R8G8B8A8_UNORM] = {
+      .pack_rgba_8unorm = &util_format_r8g8b8a8_unorm_pack_rgba_8unorm,
+      .pack_rgba_float = &util_format_r8g8b8a8_unorm_pack_rgba_float_sse41,
+   },
+   SWIZZLE_8UNORM_PACK_TABLE(R8G8B8X8_UNORM, r8g8b8x8_unorm, avx2),
+   SWIZZLE_8UNORM_PACK_TABLE(B8G8R8A8_UNORM, b8g8r8a8_unorm, avx2),
+   SWIZZLE_8UNORM_PACK_TABLE(B8G8R8X8_UNORM, b8g8r8x8_unorm, avx2),
+   SWIZZLE_8UNORM_PACK_TABLE(A8R8G8B8_UNORM, a8r8g8b8_unorm, avx2),
+   SWIZZLE_8UNORM_PACK_TABLE(X8R8G8B8_UNORM, x8r8g8b8_unorm, avx2),
+   SWIZZLE_8UNORM_PACK_TABLE(A8B8G8R8_UNORM, a8b8g8r8_unorm, avx2),
+   SWIZZLE_8UNORM_PACK_TABLE(X8B8G8R8_UNORM, x8b8g8r8_unorm, avx2),
+};
+
+#define LOOKUP(table, format) \
+   ((format) < ARRAY_SIZE(table) && (table)[format].unpack_rgba ? &(table)[format] : NULL)
+
+#define LOOKUP_PACK(table, format) \
+   ((format) < ARRAY_SIZE(table) && (table)[format].pack_rgba_float ? &(table)[format] : NULL)
+
+const struct util_format_unpack_description *
+util_format_unpack_description_x86(enum pipe_format format)
+{
+   const struct util_cpu_caps_t *caps = util_get_cpu_caps();
+   const struct util_format_unpack_description *unpack = NULL;
+
+   if (caps->has_avx2)
+      unpack = LOOKUP(util_format_unpack_descriptions_avx2, format);
+#if defined(USE_X86_64_ASM)
+   if (!unpack && caps->has_f16c && caps->has_sse4_1)
+      unpack = LOOKUP(util_format_unpack_descriptions_f16c, format);
+#endif
+   if (!unpack && caps->has_sse4_1)
+      unpack = LOOKUP(util_format_unpack_descriptions_sse41, format);
+
+   return unpack;
+}
+
+const struct util_format_pack_description *
+util_format_pack_description_x86(enum pipe_format format)
+{
+   const struct util_cpu_caps_t *caps = util_get_cpu_caps();
+   const struct util_format_pack_description *pack = NULL;
+
+   if (caps->has_avx2)
+      pack = LOOKUP_PACK(util_format_pack_descriptions_avx2, format);
+#if defined(USE_X86_64_ASM)
+   if (!pack && caps->has_f16c && caps->has_sse4_1)
+      pack = LOOKUP_PACK(util_format_pack_descriptions_f16c, format);
+#endif
+   if (!pack && caps->has_sse4_1)
+      pack = LOOKUP_PACK(util_format_pack_descriptions_sse41, format);
+
+   return pack;
+}
+
+#endif /* DETECT_ARCH_X86 || DETECT_ARCH_X86_64 */
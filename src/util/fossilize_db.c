@@ -753,6 +753,28 @@ fail_file:
    simple_mtx_unlock(&foz_db->flock_mtx);
    return false;
 }
+
+/* Forgets an entry that can't be used, so that foz_write_entry() appends a
+ * replacement.  Entries later in the index override earlier ones with the
+ * same key when the index is loaded again.
+ */
+void
+foz_invalidate_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit)
+{
+   uint64_t hash = truncate_hash_to_64bits(cache_key_160bit);
+
+   if (!foz_db->alive)
+      return;
+
+   simple_mtx_lock(&foz_db->mtx);
+
+   struct foz_db_entry *entry =
+      _mesa_hash_table_u64_search(foz_db->index_db, hash);
+   if (entry && memcmp(entry->key, cache_key_160bit, sizeof(entry->key)) == 0)
+      _mesa_hash_table_u64_remove(foz_db->index_db, hash);
+
+   simple_mtx_unlock(&foz_db->mtx);
+}
 #else
 
 bool
@@ -783,4 +805,9 @@ foz_write_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
    return false;
 }
 
+void
+foz_invalidate_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit)
+{
+}
+
 #endif
@@ -109,4 +109,7 @@ bool
 foz_write_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit,
                 const void *blob, size_t size);
 
+void
+foz_invalidate_entry(struct foz_db *foz_db, const uint8_t *cache_key_160bit);
+
 #endif /* FOSSILIZE_DB_H */
@@ -16,6 +16,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "crc32.h"
@@ -85,20 +87,36 @@ static inline bool mesa_db_write_data(FILE *file, const void *data, size_t size)
 }
 #define mesa_db_write(file, var) mesa_db_write_data(file, var, sizeof(*(var)))
 
+static inline bool mesa_db_pread_data(FILE *file, void *data, size_t size,
+                                      off_t pos)
+{
+   return pread(fileno(file), data, size, pos) == (ssize_t)size;
+}
+#define mesa_db_pread(file, var, pos) \
+   mesa_db_pread_data(file, var, sizeof(*(var)), pos)
+
+static inline bool mesa_db_pwrite_data(FILE *file, const void *data,
+                                       size_t size, off_t pos)
+{
+   return pwrite(fileno(file), data, size, pos) == (ssize_t)size;
+}
+#define mesa_db_pwrite(file, var, pos) \
+   mesa_db_pwrite_data(file, var, sizeof(*(var)), pos)
+
 static inline bool mesa_db_truncate(FILE *file, long pos)
 {
    return !ftruncate(fileno(file), pos);
 }
 
 static bool
-mesa_db_lock(struct mesa_cache_db *db)
+mesa_db_flock(struct mesa_cache_db *db, int operation)
 {
    simple_mtx_lock(&db->flock_mtx);
 
-   if (flock(fileno(db->cache.file), LOCK_EX) == -1)
+   if (flock(fileno(db->cache.file), operation) == -1)
       goto unlock_mtx;
 
-   if (flock(fileno(db->index.file), LOCK_EX) == -1)
+   if (flock(fileno(db->index.file), operation) == -1)
       goto unlock_cache;
 
    return true;
@@ -111,6 +129,26 @@ unlock_mtx:
    return false;
 }
 
+/* Taken by anything that writes to the database files. */
+static bool
+mesa_db_lock(struct mesa_cache_db *db)
+{
+   return mesa_db_flock(db, LOCK_EX);
+}
+
+/* Taken by lookups, so that processes sharing the cache don't serialize
+ * on them.  The files are only appended to, compacted or truncated under
+ * the exclusive lock, so the index and cache file contents are stable
+ * while it's held.  The one exception is the last access time of index
+ * entries, which readers update in place: racing updates all store about
+ * the same time.
+ */
+static bool
+mesa_db_lock_shared(struct mesa_cache_db *db)
+{
+   return mesa_db_flock(db, LOCK_SH);
+}
+
 static void
 mesa_db_unlock(struct mesa_cache_db *db)
 {
@@ -233,6 +271,60 @@ mesa_db_zap(struct mesa_cache_db *db)
    return true;
 }
 
+/* Zap the database while holding the shared lock.  Truncating the files
+ * would make other readers fault on their mappings, so the lock has to be
+ * taken exclusively first.  flock() drops the shared lock before waiting
+ * for the exclusive one, hence readers zapping at the same time can't
+ * deadlock.
+ */
+static void
+mesa_db_zap_shared(struct mesa_cache_db *db)
+{
+   db->alive = false;
+
+   flock(fileno(db->index.file), LOCK_UN);
+
+   if (flock(fileno(db->cache.file), LOCK_EX) == -1 ||
+       flock(fileno(db->index.file), LOCK_EX) == -1)
+      return;
+
+   mesa_db_zap(db);
+}
+
+/* Returns the [offset, offset + size) range of the cache file, mapping the
+ * whole file again if it grew past the current mapping.  Must be called
+ * under the lock, which keeps other processes from truncating the file.
+ * Checking the range against the file size avoids faulting on a mapping
+ * that outlived a compaction.
+ */
+static const void *
+mesa_db_map_cache_range(struct mesa_cache_db *db, uint64_t offset,
+                        uint64_t size)
+{
+   struct stat st;
+
+   if (fstat(fileno(db->cache.file), &st) == -1 ||
+       offset + size > (uint64_t)st.st_size)
+      return NULL;
+
+   if (offset + size > db->cache_map_size) {
+      if (db->cache_map)
+         munmap(db->cache_map, db->cache_map_size);
+
+      db->cache_map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED,
+                           fileno(db->cache.file), 0);
+      if (db->cache_map == MAP_FAILED) {
+         db->cache_map = NULL;
+         db->cache_map_size = 0;
+         return NULL;
+      }
+
+      db->cache_map_size = st.st_size;
+   }
+
+   return (const uint8_t *)db->cache_map + offset;
+}
+
 static bool
 mesa_db_index_entry_valid(struct mesa_index_db_file_entry *entry)
 {
@@ -610,6 +702,9 @@ mesa_cache_db_open(struct mesa_cache_db *db, const char *cache_path)
    if (!mesa_db_open_file(&db->index, cache_path, "mesa_cache.idx"))
       goto close_cache;
 
+   db->cache_map = NULL;
+   db->cache_map_size = 0;
+
    db->mem_ctx = ralloc_context(NULL);
    if (!db->mem_ctx)
       goto close_index;
@@ -662,6 +757,9 @@ mesa_cache_db_close(struct mesa_cache_db *db)
    simple_mtx_destroy(&db->flock_mtx);
    ralloc_free(db->mem_ctx);
 
+   if (db->cache_map)
+      munmap(db->cache_map, db->cache_map_size);
+
    mesa_db_close_file(&db->index);
    mesa_db_close_file(&db->cache);
 }
@@ -688,9 +786,10 @@ mesa_cache_db_read_entry(struct mesa_cache_db *db,
    struct mesa_cache_db_file_entry cache_entry;
    struct mesa_index_db_file_entry index_entry;
    struct mesa_index_db_hash_entry *hash_entry;
+   const void *mapped;
    void *data = NULL;
 
-   if (!mesa_db_lock(db))
+   if (!mesa_db_lock_shared(db))
       return NULL;
 
    if (!db->alive)
@@ -706,38 +805,47 @@ mesa_cache_db_read_entry(struct mesa_cache_db *db,
    if (!hash_entry)
       goto fail;
 
-   if (!mesa_db_seek(db->cache.file, hash_entry->cache_db_file_offset) ||
-       !mesa_db_read(db->cache.file, &cache_entry) ||
-       !mesa_db_cache_entry_valid(&cache_entry))
+   mapped = mesa_db_map_cache_range(db, hash_entry->cache_db_file_offset,
+                                    sizeof(cache_entry));
+   if (!mapped)
+      goto fail_fatal;
+
+   memcpy(&cache_entry, mapped, sizeof(cache_entry));
+
+   if (!mesa_db_cache_entry_valid(&cache_entry))
       goto fail_fatal;
 
    if (memcmp(cache_entry.key, cache_key_160bit, sizeof(cache_entry.key)))
       goto fail;
 
+   mapped = mesa_db_map_cache_range(db, hash_entry->cache_db_file_offset +
+                                    sizeof(cache_entry), cache_entry.size);
+   if (!mapped || util_hash_crc32(mapped, cache_entry.size) != cache_entry.crc)
+      goto fail_fatal;
+
    data = malloc(cache_entry.size);
    if (!data)
       goto fail;
 
-   if (!mesa_db_read_data(db->cache.file, data, cache_entry.size) ||
-       util_hash_crc32(data, cache_entry.size) != cache_entry.crc)
-      goto fail_fatal;
+   memcpy(data, mapped, cache_entry.size);
 
-   if (!mesa_db_seek(db->index.file, hash_entry->index_db_file_offset) ||
-       !mesa_db_read(db->index.file, &index_entry) ||
+   if (!mesa_db_pread(db->index.file, &index_entry,
+                      hash_entry->index_db_file_offset) ||
        !mesa_db_index_entry_valid(&index_entry) ||
        index_entry.cache_db_file_offset != hash_entry->cache_db_file_offset ||
        index_entry.size != hash_entry->size)
       goto fail_fatal;
 
+   /* Only the access time is written, see mesa_db_lock_shared() */
    index_entry.last_access_time = os_time_get_nano();
    hash_entry->last_access_time = index_entry.last_access_time;
 
-   if (!mesa_db_seek(db->index.file, hash_entry->index_db_file_offset) ||
-       !mesa_db_write(db->index.file, &index_entry))
+   if (!mesa_db_pwrite(db->index.file, &index_entry.last_access_time,
+                       hash_entry->index_db_file_offset +
+                       offsetof(struct mesa_index_db_file_entry,
+                                last_access_time)))
       goto fail_fatal;
 
-   fflush(db->index.file);
-
    mesa_db_unlock(db);
 
    *size = cache_entry.size;
@@ -745,7 +853,7 @@ mesa_cache_db_read_entry(struct mesa_cache_db *db,
    return data;
 
 fail_fatal:
-   mesa_db_zap(db);
+   mesa_db_zap_shared(db);
 fail:
    free(data);
 
@@ -754,6 +862,60 @@ fail:
    return NULL;
 }
 
+/**
+ * Calls cb with every entry of the database, without updating their access
+ * times.  The blob is only valid during the call, which must not use the
+ * database.
+ */
+bool
+mesa_cache_db_foreach_entry(struct mesa_cache_db *db,
+                            mesa_cache_db_entry_cb cb, void *data)
+{
+   struct mesa_cache_db_file_entry cache_entry;
+   const void *mapped;
+   bool ret = false;
+
+   if (!mesa_db_lock_shared(db))
+      return false;
+
+   if (!db->alive)
+      goto out;
+
+   if (mesa_db_uuid_changed(db) && !mesa_db_reload(db))
+      goto out;
+
+   if (!mesa_db_update_index(db))
+      goto out;
+
+   hash_table_u64_foreach(db->index_db, entry) {
+      struct mesa_index_db_hash_entry *hash_entry = entry.data;
+
+      mapped = mesa_db_map_cache_range(db, hash_entry->cache_db_file_offset,
+                                       sizeof(cache_entry));
+      if (!mapped)
+         goto out;
+
+      memcpy(&cache_entry, mapped, sizeof(cache_entry));
+
+      if (!mesa_db_cache_entry_valid(&cache_entry))
+         goto out;
+
+      mapped = mesa_db_map_cache_range(db, hash_entry->cache_db_file_offset +
+                                       sizeof(cache_entry), cache_entry.size);
+      if (!mapped || util_hash_crc32(mapped, cache_entry.size) != cache_entry.crc)
+         goto out;
+
+      cb(cache_entry.key, mapped, cache_entry.size, data);
+   }
+
+   ret = true;
+
+out:
+   mesa_db_unlock(db);
+
+   return ret;
+}
+
 static bool
 mesa_cache_db_has_space_locked(struct mesa_cache_db *db, size_t blob_size)
 {
@@ -905,7 +1067,7 @@ mesa_cache_db_has_space(struct mesa_cache_db *db, size_t blob_size)
 {
    bool has_space;
 
-   if (!mesa_db_lock(db))
+   if (!mesa_db_lock_shared(db))
       return false;
 
    if (!mesa_db_seek_end(db->cache.file))
@@ -918,7 +1080,7 @@ mesa_cache_db_has_space(struct mesa_cache_db *db, size_t blob_size)
    return has_space;
 
 fail_fatal:
-   mesa_db_zap(db);
+   mesa_db_zap_shared(db);
    mesa_db_unlock(db);
 
    return false;
@@ -947,7 +1109,7 @@ mesa_cache_db_eviction_score(struct mesa_cache_db *db)
    unsigned num_entries, i = 0;
    double eviction_score = 0;
 
-   if (!mesa_db_lock(db))
+   if (!mesa_db_lock_shared(db))
       return 0;
 
    if (!db->alive)
@@ -989,7 +1151,7 @@ mesa_cache_db_eviction_score(struct mesa_cache_db *db)
    return eviction_score;
 
 fail_fatal:
-   mesa_db_zap(db);
+   mesa_db_zap_shared(db);
 fail:
    mesa_db_unlock(db);
 
@@ -32,6 +32,9 @@ struct mesa_cache_db {
    struct hash_table_u64 *index_db;
    struct mesa_cache_db_file cache;
    struct mesa_cache_db_file index;
+   /* Read-only mapping of the cache file, only accessed under flock */
+   void *cache_map;
+   size_t cache_map_size;
    uint64_t max_cache_size;
    simple_mtx_t flock_mtx;
    void *mem_ctx;
@@ -39,6 +42,10 @@ struct mesa_cache_db {
    bool alive;
 };
 
+typedef void (*mesa_cache_db_entry_cb)(const uint8_t *cache_key_160bit,
+                                       const void *blob, size_t blob_size,
+                                       void *data);
+
 #if DETECT_OS_WINDOWS == 0
 bool
 mesa_cache_db_open(struct mesa_cache_db *db, const char *cache_path);
@@ -67,6 +74,10 @@ bool
 mesa_cache_db_entry_remove(struct mesa_cache_db *db,
                            const uint8_t *cache_key_160bit);
 
+bool
+mesa_cache_db_foreach_entry(struct mesa_cache_db *db,
+                            mesa_cache_db_entry_cb cb, void *data);
+
 bool
 mesa_db_wipe_path(const char *cache_path);
 
@@ -122,6 +133,13 @@ mesa_cache_db_entry_remove(struct mesa_cache_db *db,
    return false;
 }
 
+static inline bool
+mesa_cache_db_foreach_entry(struct mesa_cache_db *db,
+                            mesa_cache_db_entry_cb cb, void *data)
+{
+   return false;
+}
+
 static inline bool
 mesa_db_wipe_path(const char *cache_path)
 {
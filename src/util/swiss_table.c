@@ -0,0 +1,96 @@
+/*
+ * Copyright 2024 Mesa contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <string.h>
+
+#include "ralloc.h"
+#include "swiss_table.h"
+
+#define E SWISS_CTRL_EMPTY
+
+/* Control bytes of a table with no storage, so that searching an empty
+ * table needs no special case.  It is never written: with growth_left == 0
+ * the first insertion rehashes.
+ */
+static const int8_t swiss_table_empty_group[SWISS_GROUP_WIDTH] = {
+   E, E, E, E, E, E, E, E, E, E, E, E, E, E, E, E,
+};
+
+#undef E
+
+static uint32_t
+swiss_table_max_entries(uint32_t capacity)
+{
+   return capacity - capacity / 8;
+}
+
+void
+swiss_table_init(struct swiss_table *ht, void *mem_ctx)
+{
+   ht->slots = NULL;
+   ht->ctrl = (int8_t *)swiss_table_empty_group;
+   ht->mem_ctx = mem_ctx;
+   ht->group_mask = 0;
+   ht->entries = 0;
+   ht->growth_left = 0;
+}
+
+void
+swiss_table_fini(struct swiss_table *ht)
+{
+   ralloc_free(ht->slots);
+   swiss_table_init(ht, ht->mem_ctx);
+}
+
+void
+swiss_table_clear(struct swiss_table *ht)
+{
+   uint32_t capacity = swiss_table_capacity(ht);
+
+   memset(ht->ctrl, SWISS_CTRL_EMPTY, capacity);
+   ht->entries = 0;
+   ht->growth_left = swiss_table_max_entries(capacity);
+}
+
+/**
+ * Switches \p ht to empty storage with room for at least \p min_entries,
+ * returning the previous state in \p old for swiss_table_rehash() to move
+ * the entries over.  The table keeps its size when enough of it was
+ * tombstones, so that insert/remove cycles don't grow it forever.
+ */
+bool
+swiss_table_resize(struct swiss_table *ht, size_t entry_size,
+                   uint32_t min_entries, struct swiss_table *old)
+{
+   /* Leave some headroom so that a same-size rehash is worth it. */
+   uint64_t wanted = (uint64_t)min_entries + min_entries / 8;
+   uint32_t num_groups = 1;
+   while (swiss_table_max_entries(num_groups * SWISS_GROUP_WIDTH) < wanted) {
+      if (num_groups >= (UINT32_MAX / SWISS_GROUP_WIDTH) / 2)
+         return false;
+      num_groups *= 2;
+   }
+
+   uint32_t capacity = num_groups * SWISS_GROUP_WIDTH;
+   char *mem = ralloc_size(ht->mem_ctx, (size_t)capacity * (entry_size + 1));
+   if (!mem)
+      return false;
+
+   *old = *ht;
+
+   ht->slots = mem;
+   ht->ctrl = (int8_t *)(mem + (size_t)capacity * entry_size);
+   ht->group_mask = num_groups - 1;
+   ht->growth_left = swiss_table_max_entries(capacity) - ht->entries;
+   memset(ht->ctrl, SWISS_CTRL_EMPTY, capacity);
+
+   return true;
+}
+
+void
+swiss_table_release(struct swiss_table *old)
+{
+   ralloc_free(old->slots);
+}
@@ -0,0 +1,419 @@
+/*
+ * Copyright 2024 Mesa contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * @file
+ * Open-addressing hash table with compile-time hash and equality functions.
+ *
+ * This is an alternative to struct hash_table for hot paths where the cost
+ * of calling the hash and compare functions through pointers and of walking
+ * 24-byte entries shows up in profiles.  The layout follows the "Swiss
+ * table" design: every slot has a one-byte control value which is either
+ * empty, deleted, or the top 7 bits of the key's hash, and the control bytes
+ * are probed 16 at a time so that most lookups only compare a single key.
+ *
+ * Tables are declared per key type with DECLARE_SWISS_TABLE:
+ *
+ *    static inline uint32_t foo_hash(const struct foo *key) { ... }
+ *    static inline bool foo_equal(const struct foo *a, const struct foo *b) { ... }
+ *
+ *    DECLARE_SWISS_TABLE(foo_table, const struct foo *, foo_hash, foo_equal)
+ *
+ *    struct foo_table ht;
+ *    foo_table_init(&ht, mem_ctx);
+ *    foo_table_insert(&ht, key, data);
+ *    struct foo_table_entry *entry = foo_table_search(&ht, key);
+ *
+ * Unlike struct hash_table, any key value (including NULL) may be stored.
+ * Entry pointers are invalidated by insertion but not by removal.
+ */
+
+#ifndef _SWISS_TABLE_H
+#define _SWISS_TABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bitscan.h"
+#include "detect_arch.h"
+#include "macros.h"
+
+#if DETECT_ARCH_SSE
+#include <emmintrin.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SWISS_GROUP_WIDTH 16
+
+#define SWISS_CTRL_EMPTY   ((int8_t)-128)
+#define SWISS_CTRL_DELETED ((int8_t)-2)
+
+/**
+ * Type-erased table.  Slots are \p entry_size bytes each, with the key at
+ * offset 0.  Use the functions generated by DECLARE_SWISS_TABLE instead of
+ * accessing this directly.
+ */
+struct swiss_table {
+   void *slots;
+   int8_t *ctrl;
+   void *mem_ctx;
+   uint32_t group_mask;
+   uint32_t entries;
+   /* Number of empty slots that can be filled before rehashing. */
+   uint32_t growth_left;
+};
+
+void swiss_table_init(struct swiss_table *ht, void *mem_ctx);
+void swiss_table_fini(struct swiss_table *ht);
+void swiss_table_clear(struct swiss_table *ht);
+bool swiss_table_resize(struct swiss_table *ht, size_t entry_size,
+                        uint32_t min_entries, struct swiss_table *old);
+void swiss_table_release(struct swiss_table *old);
+
+static inline uint32_t
+swiss_table_capacity(const struct swiss_table *ht)
+{
+   return ht->slots ? (ht->group_mask + 1) * SWISS_GROUP_WIDTH : 0;
+}
+
+/* The low bits of the hash pick the group, so mix the whole hash into the
+ * control byte: plenty of Mesa hash functions leave the top bits constant.
+ */
+static inline int8_t
+swiss_h2(uint32_t hash)
+{
+   return (int8_t)((hash * 0x9e3779b1u) >> 25);
+}
+
+/* Bitmask of the slots in the group whose control byte is \p h2. */
+static inline unsigned
+swiss_group_match(const int8_t *group, int8_t h2)
+{
+#if DETECT_ARCH_SSE
+   __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+   return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(h2)));
+#else
+   unsigned mask = 0;
+   for (unsigned i = 0; i < SWISS_GROUP_WIDTH; i++)
+      mask |= (unsigned)(group[i] == h2) << i;
+   return mask;
+#endif
+}
+
+static inline unsigned
+swiss_group_match_empty(const int8_t *group)
+{
+   return swiss_group_match(group, SWISS_CTRL_EMPTY);
+}
+
+/* Bitmask of the empty or deleted slots in the group. */
+static inline unsigned
+swiss_group_match_free(const int8_t *group)
+{
+#if DETECT_ARCH_SSE
+   __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+   return _mm_movemask_epi8(_mm_cmplt_epi8(ctrl, _mm_set1_epi8(-1)));
+#else
+   unsigned mask = 0;
+   for (unsigned i = 0; i < SWISS_GROUP_WIDTH; i++)
+      mask |= (unsigned)(group[i] < -1) << i;
+   return mask;
+#endif
+}
+
+/* Bitmask of the occupied slots in the group. */
+static inline unsigned
+swiss_group_match_full(const int8_t *group)
+{
+#if DETECT_ARCH_SSE
+   __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+   return ~_mm_movemask_epi8(ctrl) & 0xffff;
+#else
+   unsigned mask = 0;
+   for (unsigned i = 0; i < SWISS_GROUP_WIDTH; i++)
+      mask |= (unsigned)(group[i] >= 0) << i;
+   return mask;
+#endif
+}
+
+static inline void *
+swiss_table_slot(const struct swiss_table *ht, size_t entry_size,
+                 uint32_t index)
+{
+   return (char *)ht->slots + (size_t)index * entry_size;
+}
+
+/* Groups are visited with triangular steps, which covers all of them since
+ * the group count is a power of two.  The load factor guarantees an empty
+ * slot somewhere, so probing always terminates.
+ */
+static ALWAYS_INLINE void *
+swiss_table_search(const struct swiss_table *ht, size_t entry_size,
+                   uint32_t hash, const void *key,
+                   bool (*entry_equal)(const void *entry, const void *key))
+{
+   const int8_t h2 = swiss_h2(hash);
+   uint32_t group = hash & ht->group_mask;
+
+   for (uint32_t step = 1;; step++) {
+      const int8_t *ctrl = ht->ctrl + group * SWISS_GROUP_WIDTH;
+
+      unsigned match = swiss_group_match(ctrl, h2);
+      while (match) {
+         unsigned i = u_bit_scan(&match);
+         void *entry = swiss_table_slot(ht, entry_size,
+                                        group * SWISS_GROUP_WIDTH + i);
+         if (likely(entry_equal(entry, key)))
+            return entry;
+      }
+
+      if (likely(swiss_group_match_empty(ctrl)))
+         return NULL;
+
+      group = (group + step) & ht->group_mask;
+   }
+}
+
+static inline uint32_t
+swiss_table_find_free(const struct swiss_table *ht, uint32_t hash)
+{
+   uint32_t group = hash & ht->group_mask;
+
+   for (uint32_t step = 1;; step++) {
+      unsigned free = swiss_group_match_free(ht->ctrl + group * SWISS_GROUP_WIDTH);
+      if (likely(free))
+         return group * SWISS_GROUP_WIDTH + ffs(free) - 1;
+
+      group = (group + step) & ht->group_mask;
+   }
+}
+
+/**
+ * Moves all entries to new storage with room for at least \p min_entries,
+ * dropping tombstones.  This is inlined into a per-table function by
+ * DECLARE_SWISS_TABLE so that the hash function and entry copies are too.
+ */
+static ALWAYS_INLINE bool
+swiss_table_rehash(struct swiss_table *ht, size_t entry_size,
+                   uint32_t min_entries,
+                   uint32_t (*entry_hash)(const void *entry))
+{
+   struct swiss_table old;
+   if (!swiss_table_resize(ht, entry_size, min_entries, &old))
+      return false;
+
+   uint32_t old_capacity = swiss_table_capacity(&old);
+   for (uint32_t base = 0; base < old_capacity; base += SWISS_GROUP_WIDTH) {
+      unsigned full = swiss_group_match_full(old.ctrl + base);
+      while (full) {
+         const void *entry = swiss_table_slot(&old, entry_size,
+                                              base + u_bit_scan(&full));
+         uint32_t hash = entry_hash(entry);
+         uint32_t index = swiss_table_find_free(ht, hash);
+
+         ht->ctrl[index] = swiss_h2(hash);
+         memcpy(swiss_table_slot(ht, entry_size, index), entry, entry_size);
+      }
+   }
+
+   swiss_table_release(&old);
+   return true;
+}
+
+/**
+ * Returns the entry for \p key, adding an uninitialized one if there was
+ * none (and setting *found to false), or NULL on allocation failure.
+ */
+static ALWAYS_INLINE void *
+swiss_table_insert(struct swiss_table *ht, size_t entry_size,
+                   uint32_t hash, const void *key,
+                   bool (*entry_equal)(const void *entry, const void *key),
+                   bool (*rehash)(struct swiss_table *ht, uint32_t min_entries),
+                   bool *found)
+{
+   void *entry = swiss_table_search(ht, entry_size, hash, key, entry_equal);
+   *found = entry != NULL;
+   if (entry)
+      return entry;
+
+   uint32_t index = swiss_table_find_free(ht, hash);
+   if (unlikely(ht->growth_left == 0 && ht->ctrl[index] == SWISS_CTRL_EMPTY)) {
+      if (!rehash(ht, ht->entries + 1))
+         return NULL;
+      index = swiss_table_find_free(ht, hash);
+   }
+
+   if (ht->ctrl[index] == SWISS_CTRL_EMPTY)
+      ht->growth_left--;
+   ht->ctrl[index] = swiss_h2(hash);
+   ht->entries++;
+
+   return swiss_table_slot(ht, entry_size, index);
+}
+
+static inline void
+swiss_table_remove(struct swiss_table *ht, size_t entry_size, void *entry)
+{
+   uint32_t index = ((char *)entry - (char *)ht->slots) / entry_size;
+
+   /* If the group still has an empty slot, no probe sequence ever went past
+    * it, so the slot can go back to empty instead of leaving a tombstone.
+    */
+   if (swiss_group_match_empty(ht->ctrl + (index & ~(SWISS_GROUP_WIDTH - 1)))) {
+      ht->ctrl[index] = SWISS_CTRL_EMPTY;
+      ht->growth_left++;
+   } else {
+      ht->ctrl[index] = SWISS_CTRL_DELETED;
+   }
+   ht->entries--;
+}
+
+static inline void *
+swiss_table_next_entry(const struct swiss_table *ht, size_t entry_size,
+                       void *entry)
+{
+   uint32_t capacity = swiss_table_capacity(ht);
+   uint32_t index = entry ?
+      ((char *)entry - (char *)ht->slots) / entry_size + 1 : 0;
+
+   for (; index < capacity; index++) {
+      if (ht->ctrl[index] >= 0)
+         return swiss_table_slot(ht, entry_size, index);
+   }
+
+   return NULL;
+}
+
+/**
+ * Declares struct name, struct name_entry and the name_* functions for a
+ * table of \p key_type keys with void * data.  \p hash_fn and \p equal_fn
+ * take keys by value, and are called directly so they can be inlined.
+ */
+#define DECLARE_SWISS_TABLE(name, key_type, hash_fn, equal_fn)                 \
+   struct name##_entry {                                                       \
+      key_type key;                                                            \
+      void *data;                                                              \
+   };                                                                          \
+                                                                               \
+   struct name {                                                               \
+      struct swiss_table table;                                                \
+   };                                                                          \
+                                                                               \
+   static inline uint32_t                                                      \
+   name##_entry_hash(const void *entry)                                        \
+   {                                                                           \
+      return hash_fn(((const struct name##_entry *)entry)->key);               \
+   }                                                                           \
+                                                                               \
+   static inline bool                                                          \
+   name##_entry_equal(const void *entry, const void *key)                      \
+   {                                                                           \
+      return equal_fn(((const struct name##_entry *)entry)->key,               \
+                      *(const key_type *)key);                                 \
+   }                                                                           \
+                                                                               \
+   static ATTRIBUTE_NOINLINE UNUSED bool                                       \
+   name##_rehash(struct swiss_table *table, uint32_t min_entries)              \
+   {                                                                           \
+      return swiss_table_rehash(table, sizeof(struct name##_entry),            \
+                                min_entries, name##_entry_hash);               \
+   }                                                                           \
+                                                                               \
+   static inline void                                                          \
+   name##_init(struct name *ht, void *mem_ctx)                                 \
+   {                                                                           \
+      swiss_table_init(&ht->table, mem_ctx);                                   \
+   }                                                                           \
+                                                                               \
+   static inline void                                                          \
+   name##_fini(struct name *ht)                                                \
+   {                                                                           \
+      swiss_table_fini(&ht->table);                                            \
+   }                                                                           \
+                                                                               \
+   static inline void                                                          \
+   name##_clear(struct name *ht)                                               \
+   {                                                                           \
+      swiss_table_clear(&ht->table);                                           \
+   }                                                                           \
+                                                                               \
+   static inline uint32_t                                                      \
+   name##_num_entries(const struct name *ht)                                   \
+   {                                                                           \
+      return ht->table.entries;                                                \
+   }                                                                           \
+                                                                               \
+   static inline bool                                                          \
+   name##_reserve(struct name *ht, uint32_t size)                              \
+   {                                                                           \
+      if (size <= ht->table.entries + ht->table.growth_left)                   \
+         return true;                                                          \
+      return name##_rehash(&ht->table, size);                                  \
+   }                                                                           \
+                                                                               \
+   static inline struct name##_entry *                                         \
+   name##_search(const struct name *ht, key_type key)                          \
+   {                                                                           \
+      return (struct name##_entry *)                                           \
+         swiss_table_search(&ht->table, sizeof(struct name##_entry),           \
+                            hash_fn(key), &key, name##_entry_equal);           \
+   }                                                                           \
+                                                                               \
+   /* Adds or replaces the entry for key, like _mesa_hash_table_insert(). */   \
+   static inline struct name##_entry *                                         \
+   name##_insert(struct name *ht, key_type key, void *data)                    \
+   {                                                                           \
+      bool found;                                                              \
+      struct name##_entry *entry = (struct name##_entry *)                     \
+         swiss_table_insert(&ht->table, sizeof(struct name##_entry),           \
+                            hash_fn(key), &key, name##_entry_equal,            \
+                            name##_rehash, &found);                            \
+      if (entry) {                                                             \
+         entry->key = key;                                                     \
+         entry->data = data;                                                   \
+      }                                                                        \
+      return entry;                                                            \
+   }                                                                           \
+                                                                               \
+   static inline void                                                          \
+   name##_remove(struct name *ht, struct name##_entry *entry)                  \
+   {                                                                           \
+      if (entry)                                                               \
+         swiss_table_remove(&ht->table, sizeof(struct name##_entry), entry);   \
+   }                                                                           \
+                                                                               \
+   static inline void                                                          \
+   name##_remove_key(struct name *ht, key_type key)                            \
+   {                                                                           \
+      name##_remove(ht, name##_search(ht, key));                               \
+   }                                                                           \
+                                                                               \
+   static inline struct name##_entry *                                         \
+   name##_next_entry(const struct name *ht, struct name##_entry *entry)        \
+   {                                                                           \
+      return (struct name##_entry *)                                           \
+         swiss_table_next_entry(&ht->table, sizeof(struct name##_entry),       \
+                                entry);                                        \
+   }
+
+/**
+ * Iterates over a table declared with DECLARE_SWISS_TABLE(name, ...).  Safe
+ * against removal, but not against insertion.
+ */
+#define swiss_table_foreach(name, ht, entry)                                   \
+   for (struct name##_entry *entry = name##_next_entry(ht, NULL);              \
+        entry != NULL;                                                         \
+        entry = name##_next_entry(ht, entry))
+
+#ifdef __cplusplus
+} /* extern C */
+#endif
+
+#endif /* _SWISS_TABLE_H */
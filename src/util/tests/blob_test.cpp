@@ -196,6 +196,56 @@ TEST(BlobTest, DetectOverrun)
    blob_finish(&blob);
 }
 
+// Test varints of all lengths, and that they are not aligned.
+TEST(BlobTest, Varint)
+{
+   static const uint32_t values[] = {
+      0, 1, 0x7f, 0x80, 0x3fff, 0x4000, 0x1fffff, 0x200000, 0xfffffff,
+      0x10000000, 0xdeadbeef, UINT32_MAX,
+   };
+   static const unsigned sizes[] = { 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 5 };
+   struct blob blob;
+   struct blob_reader reader;
+
+   blob_init(&blob);
+
+   blob_write_uint8(&blob, 0xff);
+   for (unsigned i = 0; i < ARRAY_SIZE(values); i++) {
+      size_t offset = blob.size;
+      blob_write_varint32(&blob, values[i]);
+      EXPECT_EQ(sizes[i], blob.size - offset) << "size of varint " << values[i];
+   }
+
+   blob_reader_init(&reader, blob.data, blob.size);
+
+   EXPECT_EQ(0xff, blob_read_uint8(&reader));
+   for (unsigned i = 0; i < ARRAY_SIZE(values); i++)
+      EXPECT_EQ(values[i], blob_read_varint32(&reader)) << "varint " << i;
+
+   EXPECT_EQ(reader.end, reader.current);
+   EXPECT_FALSE(reader.overrun);
+
+   // A truncated varint
+   blob_reader_init(&reader, blob.data, blob.size - 1);
+   reader.current = reader.end - 4;
+   EXPECT_EQ(0, blob_read_varint32(&reader));
+   EXPECT_TRUE(reader.overrun);
+
+   // A varint longer than 5 bytes
+   static const uint8_t too_long[] = { 0x80, 0x80, 0x80, 0x80, 0x80, 0x01 };
+   blob_reader_init(&reader, too_long, sizeof(too_long));
+   EXPECT_EQ(0, blob_read_varint32(&reader));
+   EXPECT_TRUE(reader.overrun);
+
+   // A varint with bits above the 32nd
+   static const uint8_t too_big[] = { 0xff, 0xff, 0xff, 0xff, 0x1f };
+   blob_reader_init(&reader, too_big, sizeof(too_big));
+   EXPECT_EQ(0, blob_read_varint32(&reader));
+   EXPECT_TRUE(reader.overrun);
+
+   blob_finish(&blob);
+}
+
 // Test that we can read and write some large objects, (exercising the code in
 // the blob_write functions to realloc blob->data.
 TEST(BlobTest, BigObjects)
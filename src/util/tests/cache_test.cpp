@@ -38,6 +38,7 @@
 #include <unistd.h>
 #include <utime.h>
 
+#include "util/compress.h"
 #include "util/detect_os.h"
 #include "util/mesa-sha1.h"
 #include "util/disk_cache.h"
@@ -537,6 +538,170 @@ test_put_and_get_between_instances(const char *driver_id)
    disk_cache_destroy(cache2);
 }
 
+static void
+test_prefetch_and_get_many(const char *driver_id)
+{
+   const unsigned num_items = 16;
+   uint8_t keys[num_items][20];
+   char blobs[num_items][32];
+   void *data[num_items];
+   size_t sizes[num_items];
+   char *result;
+   size_t size;
+
+#ifdef SHADER_CACHE_DISABLE_BY_DEFAULT
+   setenv("MESA_SHADER_CACHE_DISABLE", "false", 1);
+#endif /* SHADER_CACHE_DISABLE_BY_DEFAULT */
+
+   /* Make sure none of the items gets evicted. */
+   setenv("MESA_SHADER_CACHE_MAX_SIZE", "1M", 1);
+
+   struct disk_cache *cache = disk_cache_create("test_prefetch",
+                                                driver_id, 0);
+
+   /* Leave the last item out of the cache. */
+   for (unsigned i = 0; i < num_items; i++) {
+      snprintf(blobs[i], sizeof(blobs[i]), "prefetched blob number %u", i);
+      disk_cache_compute_key(cache, blobs[i], sizeof(blobs[i]), keys[i]);
+      if (i < num_items - 1)
+         disk_cache_put(cache, keys[i], blobs[i], sizeof(blobs[i]), NULL);
+   }
+   disk_cache_wait_for_idle(cache);
+
+   disk_cache_get_many(cache, num_items, keys, data, sizes);
+   for (unsigned i = 0; i < num_items - 1; i++) {
+      EXPECT_STREQ((char *) data[i], blobs[i]) << "disk_cache_get_many item " << i;
+      EXPECT_EQ(sizes[i], sizeof(blobs[i])) << "disk_cache_get_many size " << i;
+      free(data[i]);
+   }
+   EXPECT_EQ(data[num_items - 1], nullptr) << "disk_cache_get_many of missing item";
+   EXPECT_EQ(sizes[num_items - 1], 0) << "disk_cache_get_many size of missing item";
+
+   /* Prefetched items come back from disk_cache_get(), including misses. */
+   disk_cache_prefetch(cache, keys, num_items);
+   for (unsigned i = 0; i < num_items; i++) {
+      result = (char *) disk_cache_get(cache, keys[i], &size);
+      if (i < num_items - 1) {
+         EXPECT_STREQ(result, blobs[i]) << "disk_cache_get of prefetched item " << i;
+         EXPECT_EQ(size, sizeof(blobs[i])) << "disk_cache_get size of prefetched item " << i;
+      } else {
+         EXPECT_EQ(result, nullptr) << "disk_cache_get of prefetched missing item";
+      }
+      free(result);
+   }
+
+   /* A put replaces whatever a pending prefetch of the same key found. */
+   disk_cache_prefetch(cache, &keys[num_items - 1], 1);
+   disk_cache_put(cache, keys[num_items - 1], blobs[num_items - 1],
+                  sizeof(blobs[num_items - 1]), NULL);
+   disk_cache_wait_for_idle(cache);
+
+   result = (char *) disk_cache_get(cache, keys[num_items - 1], &size);
+   EXPECT_STREQ(result, blobs[num_items - 1]) << "disk_cache_get after prefetch and put";
+   free(result);
+
+   /* A removal drops whatever a prefetch of the same key found. */
+   disk_cache_prefetch(cache, keys, 1);
+   disk_cache_wait_for_idle(cache);
+   disk_cache_remove(cache, keys[0]);
+
+   result = (char *) disk_cache_get(cache, keys[0], &size);
+   EXPECT_EQ(result, nullptr) << "disk_cache_get after prefetch and remove";
+   free(result);
+
+   /* Prefetches that are never consumed are freed with the cache. */
+   disk_cache_prefetch(cache, keys, num_items);
+
+   disk_cache_destroy(cache);
+
+   unsetenv("MESA_SHADER_CACHE_MAX_SIZE");
+}
+
+#ifdef HAVE_ZSTD
+static void
+test_put_and_get_with_dict(const char *driver_id)
+{
+   const unsigned num_samples = 512;
+   const unsigned sample_size = 128;
+   char *samples = (char *) calloc(num_samples, sample_size);
+   size_t sample_sizes[num_samples];
+   uint8_t dict_data[4096];
+   char blob[] = "A blob much like the samples the dictionary was trained on";
+   uint8_t blob_key[20];
+   char *result;
+   size_t size;
+
+#ifdef SHADER_CACHE_DISABLE_BY_DEFAULT
+   setenv("MESA_SHADER_CACHE_DISABLE", "false", 1);
+#endif /* SHADER_CACHE_DISABLE_BY_DEFAULT */
+
+   /* Similar samples, so that there is something to learn. */
+   for (unsigned i = 0; i < num_samples; i++) {
+      sample_sizes[i] =
+         snprintf(samples + i * sample_size, sample_size,
+                  "sample %u: uniform vec4 color_%u; in vec2 uv_%u; "
+                  "out vec4 frag_%u; // %u", i, i * 7, i % 13, i % 5,
+                  i * i) + 1;
+   }
+
+   size_t dict_size = util_compress_dict_train(dict_data, sizeof(dict_data),
+                                               samples, sample_sizes,
+                                               num_samples);
+   ASSERT_NE(dict_size, 0) << "util_compress_dict_train";
+
+   struct disk_cache *cache = disk_cache_create("test_dict", driver_id, 0);
+   EXPECT_EQ(cache->compress_dict, nullptr) << "no dictionary before training one";
+
+   char *dict_filename;
+   ASSERT_NE(asprintf(&dict_filename, "%s/test_dict" DISK_CACHE_DICT_SUFFIX,
+                      cache->path), -1);
+   FILE *f = fopen(dict_filename, "wb");
+   ASSERT_NE(f, nullptr) << "creating " << dict_filename;
+   fwrite(dict_data, dict_size, 1, f);
+   fclose(f);
+   disk_cache_destroy(cache);
+
+   cache = disk_cache_create("test_dict", driver_id, 0);
+   EXPECT_NE(cache->compress_dict, nullptr) << "dictionary loaded from the cache dir";
+
+   disk_cache_compute_key(cache, blob, sizeof(blob), blob_key);
+   disk_cache_put(cache, blob_key, blob, sizeof(blob), NULL);
+   disk_cache_wait_for_idle(cache);
+
+   result = (char *) disk_cache_get(cache, blob_key, &size);
+   EXPECT_STREQ(result, blob) << "disk_cache_get with dictionary";
+   EXPECT_EQ(size, sizeof(blob)) << "disk_cache_get with dictionary (size)";
+   free(result);
+   disk_cache_destroy(cache);
+
+   /* Items compressed with a dictionary can't be loaded without it. */
+   unlink(dict_filename);
+   cache = disk_cache_create("test_dict", driver_id, 0);
+
+   result = (char *) disk_cache_get(cache, blob_key, &size);
+   EXPECT_EQ(result, nullptr) << "disk_cache_get of item needing a dictionary";
+
+   /* The failed get dropped the item, so that it can be stored again. */
+   disk_cache_put(cache, blob_key, blob, sizeof(blob), NULL);
+   disk_cache_wait_for_idle(cache);
+
+   result = (char *) disk_cache_get(cache, blob_key, &size);
+   EXPECT_STREQ(result, blob) << "disk_cache_get after storing an item again";
+   free(result);
+   disk_cache_destroy(cache);
+
+   /* The replacement is the one found by later instances. */
+   cache = disk_cache_create("test_dict", driver_id, 0);
+   result = (char *) disk_cache_get(cache, blob_key, &size);
+   EXPECT_STREQ(result, blob) << "disk_cache_get of an item stored again";
+   free(result);
+   disk_cache_destroy(cache);
+
+   free(dict_filename);
+   free(samples);
+}
+#endif
+
 static void
 test_put_and_get_between_instances_with_eviction(const char *driver_id)
 {
@@ -666,6 +831,63 @@ test_put_and_get_between_instances_with_eviction(const char *driver_id)
    disk_cache_destroy(cache[0]);
    disk_cache_destroy(cache[1]);
 }
+
+/* The reader maps the cache file, make sure that the mapping follows the
+ * file as the writer grows it and compacts it.
+ */
+static void
+test_db_reader_follows_writer(void)
+{
+   const char *path = CACHE_TEST_TMP "/db-reader";
+   struct mesa_cache_db writer, reader;
+   uint8_t keys[64][20];
+   uint8_t blob[1000];
+   unsigned i;
+   size_t size;
+
+   EXPECT_EQ(mkdir(path, 0755), 0) << "mkdir " << path;
+
+   ASSERT_TRUE(mesa_cache_db_open(&writer, path));
+   ASSERT_TRUE(mesa_cache_db_open(&reader, path));
+   mesa_cache_db_set_size_limit(&writer, 1024 * 1024);
+   mesa_cache_db_set_size_limit(&reader, 1024 * 1024);
+
+   for (i = 0; i < ARRAY_SIZE(keys); i++) {
+      memset(keys[i], i + 1, sizeof(keys[i]));
+      memset(blob, i, sizeof(blob));
+
+      EXPECT_TRUE(mesa_cache_db_entry_write(&writer, keys[i], blob,
+                                            sizeof(blob)));
+
+      /* Every entry is past the end of what the reader mapped so far. */
+      uint8_t *result = (uint8_t *)
+         mesa_cache_db_read_entry(&reader, keys[i], &size);
+      ASSERT_NE(result, nullptr) << "entry " << i;
+      EXPECT_EQ(size, sizeof(blob));
+      EXPECT_EQ(memcmp(result, blob, sizeof(blob)), 0);
+      free(result);
+   }
+
+   /* Compacting shrinks the file under the reader's mapping. */
+   for (i = 0; i < ARRAY_SIZE(keys); i += 2)
+      EXPECT_TRUE(mesa_cache_db_entry_remove(&writer, keys[i]));
+
+   for (i = 0; i < ARRAY_SIZE(keys); i++) {
+      uint8_t *result = (uint8_t *)
+         mesa_cache_db_read_entry(&reader, keys[i], &size);
+      if (i % 2) {
+         memset(blob, i, sizeof(blob));
+         ASSERT_NE(result, nullptr) << "entry " << i;
+         EXPECT_EQ(memcmp(result, blob, sizeof(blob)), 0);
+      } else {
+         EXPECT_EQ(result, nullptr) << "entry " << i;
+      }
+      free(result);
+   }
+
+   mesa_cache_db_close(&reader);
+   mesa_cache_db_close(&writer);
+}
 #endif /* ENABLE_SHADER_CACHE */
 
 class Cache : public ::testing::Test {
@@ -703,6 +925,13 @@ run_tests:
 
    test_put_key_and_get_key(driver_id);
 
+   test_prefetch_and_get_many(driver_id);
+
+#ifdef HAVE_ZSTD
+   if (compress)
+      test_put_and_get_with_dict(driver_id);
+#endif
+
    setenv("MESA_DISK_CACHE_MULTI_FILE", "false", 1);
 
    int err = rmrf_local(CACHE_TEST_TMP);
@@ -743,6 +972,11 @@ run_tests:
 
    test_put_and_get_between_instances(driver_id);
 
+#ifdef HAVE_ZSTD
+   if (compress)
+      test_put_and_get_with_dict(driver_id);
+#endif
+
    setenv("MESA_DISK_CACHE_SINGLE_FILE", "false", 1);
 
    int err = rmrf_local(CACHE_TEST_TMP);
@@ -786,6 +1020,14 @@ TEST_F(Cache, Database)
 
    test_put_and_get_between_instances_with_eviction(driver_id);
 
+   test_prefetch_and_get_many(driver_id);
+
+   test_db_reader_follows_writer();
+
+#ifdef HAVE_ZSTD
+   test_put_and_get_with_dict("make_check");
+#endif
+
    unsetenv("MESA_DISK_CACHE_DATABASE_NUM_PARTS");
 
    err = rmrf_local(CACHE_TEST_TMP);
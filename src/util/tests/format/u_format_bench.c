@@ -0,0 +1,117 @@
+/*
+ * Copyright 2024 Mesa contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * @file
+ * Throughput of the pack/unpack functions picked by
+ * util_format_(un)pack_description(), against the generic code.
+ *
+ *    u_format_bench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "util/format/u_format.h"
+#include "util/os_time.h"
+#include "util/u_math.h"
+
+#define WIDTH 1024
+
+static const enum pipe_format formats[] = {
+   PIPE_FORMAT_R8G8B8A8_UNORM,
+   PIPE_FORMAT_B8G8R8A8_UNORM,
+   PIPE_FORMAT_B8G8R8X8_UNORM,
+   PIPE_FORMAT_B8G8R8A8_SRGB,
+   PIPE_FORMAT_R10G10B10A2_UNORM,
+   PIPE_FORMAT_R16G16B16A16_UNORM,
+   PIPE_FORMAT_R16G16B16A16_FLOAT,
+};
+
+enum bench_func {
+   BENCH_UNPACK_RGBA_8UNORM,
+   BENCH_UNPACK_RGBA,
+   BENCH_PACK_RGBA_8UNORM,
+   BENCH_PACK_RGBA_FLOAT,
+};
+
+static const char *func_names[] = {
+   [BENCH_UNPACK_RGBA_8UNORM] = "unpack_rgba_8unorm",
+   [BENCH_UNPACK_RGBA] = "unpack_rgba",
+   [BENCH_PACK_RGBA_8UNORM] = "pack_rgba_8unorm",
+   [BENCH_PACK_RGBA_FLOAT] = "pack_rgba_float",
+};
+
+static uint8_t packed[WIDTH * 16];
+static uint8_t rgba8[WIDTH * 4];
+static float rgba[WIDTH * 4];
+
+/* Returns megapixels per second. */
+static double
+run(const struct util_format_unpack_description *unpack,
+    const struct util_format_pack_description *pack,
+    enum bench_func func, unsigned iterations)
+{
+   int64_t start = os_time_get_nano();
+
+   for (unsigned i = 0; i < iterations; i++) {
+      switch (func) {
+      case BENCH_UNPACK_RGBA_8UNORM:
+         unpack->unpack_rgba_8unorm(rgba8, packed, WIDTH);
+         break;
+      case BENCH_UNPACK_RGBA:
+         unpack->unpack_rgba(rgba, packed, WIDTH);
+         break;
+      case BENCH_PACK_RGBA_8UNORM:
+         pack->pack_rgba_8unorm(packed, 0, rgba8, 0, WIDTH, 1);
+         break;
+      case BENCH_PACK_RGBA_FLOAT:
+         pack->pack_rgba_float(packed, 0, rgba, 0, WIDTH, 1);
+         break;
+      }
+   }
+
+   int64_t elapsed = MAX2(os_time_get_nano() - start, 1);
+   return (double)iterations * WIDTH * 1000.0 / elapsed;
+}
+
+int
+main(int argc, char **argv)
+{
+   unsigned iterations = argc > 1 ? atoi(argv[1]) : 20000;
+
+   for (unsigned i = 0; i < ARRAY_SIZE(packed); i++)
+      packed[i] = i * 7;
+   for (unsigned i = 0; i < ARRAY_SIZE(rgba8); i++)
+      rgba8[i] = i * 13;
+   for (unsigned i = 0; i < ARRAY_SIZE(rgba); i++)
+      rgba[i] = (float)(i % 300) / 255.0f;
+
+   printf("%-24s %-20s %12s %12s %9s\n",
+          "format", "function", "generic", "selected", "speedup");
+
+   for (unsigned f = 0; f < ARRAY_SIZE(formats); f++) {
+      enum pipe_format format = formats[f];
+      const struct util_format_unpack_description *unpack =
+         util_format_unpack_description(format);
+      const struct util_format_unpack_description *unpack_generic =
+         util_format_unpack_description_generic(format);
+      const struct util_format_pack_description *pack =
+         util_format_pack_description(format);
+      const struct util_format_pack_description *pack_generic =
+         util_format_pack_description_generic(format);
+
+      for (enum bench_func func = 0; func < ARRAY_SIZE(func_names); func++) {
+         double generic = run(unpack_generic, pack_generic, func, iterations);
+         double selected = run(unpack, pack, func, iterations);
+
+         printf("%-24s %-20s %8.0f MP/s %8.0f MP/s %8.2fx\n",
+                util_format_short_name(format), func_names[func],
+                generic, selected, selected / generic);
+      }
+   }
+
+   return EXIT_SUCCESS;
+}
@@ -29,7 +29,9 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <float.h>
+#include <string.h>
 
+#include "util/detect_arch.h"
 #include "util/half_float.h"
 #include "util/u_math.h"
 #include "util/format/u_format.h"
@@ -778,6 +780,129 @@ test_format_metadata(const struct util_format_description *format_desc,
    return success;
 }
 
+#if (DETECT_ARCH_X86 || DETECT_ARCH_X86_64) && !defined(NO_FORMAT_ASM) && defined(__GNUC__)
+
+#define SIMD_TEST_MAX_WIDTH 67
+
+static uint32_t
+simd_test_rand(void)
+{
+   static uint32_t state = 0x12345678;
+   state ^= state << 13;
+   state ^= state >> 17;
+   state ^= state << 5;
+   return state;
+}
+
+static float
+simd_test_rand_float(void)
+{
+   static const float special[] = {
+      0.0f, -0.0f, 1.0f, -1.0f, 0.5f, 2.0f, 1.0f / 255.0f, 254.5f / 255.0f,
+      1e-30f, INFINITY, -INFINITY, NAN,
+   };
+   uint32_t r = simd_test_rand();
+
+   switch (r % 4) {
+   case 0:
+      return special[(r >> 2) % ARRAY_SIZE(special)];
+   case 1:
+      return (float)((r >> 2) % 256) / 255.0f;
+   case 2:
+      return uif(simd_test_rand());
+   default:
+      return (float)(r >> 8) / (float)(1 << 24) * 1.25f - 0.125f;
+   }
+}
+
+/*
+ * The x86 paths must produce the same bits as the generic code, for every
+ * width so that both the vector loops and the leftovers get covered.
+ */
+static bool
+test_format_x86_matches_generic(enum pipe_format format)
+{
+   const struct util_format_unpack_description *unpack =
+      util_format_unpack_description_x86(format);
+   const struct util_format_pack_description *pack =
+      util_format_pack_description_x86(format);
+   const struct util_format_unpack_description *unpack_generic =
+      util_format_unpack_description_generic(format);
+   const struct util_format_pack_description *pack_generic =
+      util_format_pack_description_generic(format);
+   const unsigned bpp = util_format_get_blocksize(format);
+   bool success = true;
+
+   if (!unpack && !pack)
+      return true;
+
+   printf("Testing util_format_%s x86 paths ...\n", util_format_short_name(format));
+   fflush(stdout);
+
+   for (unsigned width = 1; width <= SIMD_TEST_MAX_WIDTH; width++) {
+      uint8_t packed[SIMD_TEST_MAX_WIDTH * 16];
+      uint8_t packed_ref[SIMD_TEST_MAX_WIDTH * 16];
+      uint8_t rgba8[SIMD_TEST_MAX_WIDTH * 4];
+      uint8_t rgba8_ref[SIMD_TEST_MAX_WIDTH * 4];
+      float rgba[SIMD_TEST_MAX_WIDTH * 4];
+      float rgba_ref[SIMD_TEST_MAX_WIDTH * 4];
+
+      if (unpack) {
+         for (unsigned i = 0; i < width * bpp; i++)
+            packed[i] = simd_test_rand();
+
+         memset(rgba8, 0, sizeof(rgba8));
+         memset(rgba8_ref, 0, sizeof(rgba8_ref));
+         unpack->unpack_rgba_8unorm(rgba8, packed, width);
+         unpack_generic->unpack_rgba_8unorm(rgba8_ref, packed, width);
+         if (memcmp(rgba8, rgba8_ref, sizeof(rgba8))) {
+            printf("FAILED: unpack_rgba_8unorm differs for width %u\n", width);
+            success = false;
+         }
+
+         memset(rgba, 0, sizeof(rgba));
+         memset(rgba_ref, 0, sizeof(rgba_ref));
+         unpack->unpack_rgba(rgba, packed, width);
+         unpack_generic->unpack_rgba(rgba_ref, packed, width);
+         if (memcmp(rgba, rgba_ref, sizeof(rgba))) {
+            printf("FAILED: unpack_rgba differs for width %u\n", width);
+            success = false;
+         }
+      }
+
+      if (pack) {
+         /* Two rows, to check the strides as well */
+         for (unsigned i = 0; i < ARRAY_SIZE(rgba8); i++)
+            rgba8[i] = simd_test_rand();
+
+         memset(packed, 0, sizeof(packed));
+         memset(packed_ref, 0, sizeof(packed_ref));
+         pack->pack_rgba_8unorm(packed, width * bpp, rgba8, width * 2, width, 2);
+         pack_generic->pack_rgba_8unorm(packed_ref, width * bpp, rgba8, width * 2, width, 2);
+         if (memcmp(packed, packed_ref, sizeof(packed))) {
+            printf("FAILED: pack_rgba_8unorm differs for width %u\n", width);
+            success = false;
+         }
+
+         for (unsigned i = 0; i < ARRAY_SIZE(rgba); i++)
+            rgba[i] = simd_test_rand_float();
+
+         memset(packed, 0, sizeof(packed));
+         memset(packed_ref, 0, sizeof(packed_ref));
+         pack->pack_rgba_float(packed, width * bpp, rgba, width * 8, width, 2);
+         pack_generic->pack_rgba_float(packed_ref, width * bpp, rgba, width * 8, width, 2);
+         if (memcmp(packed, packed_ref, sizeof(packed))) {
+            printf("FAILED: pack_rgba_float differs for width %u\n", width);
+            success = false;
+         }
+      }
+   }
+
+   return success;
+}
+
+#endif
+
 static bool
 test_all(void)
 {
@@ -857,6 +982,11 @@ test_all(void)
 
       TEST_FORMAT_METADATA(norm_flags);
 
+#if (DETECT_ARCH_X86 || DETECT_ARCH_X86_64) && !defined(NO_FORMAT_ASM) && defined(__GNUC__)
+      if (!test_format_x86_matches_generic(format))
+         success = false;
+#endif
+
 #     undef TEST_ONE_FUNC
 #     undef TEST_ONE_FORMAT
    }
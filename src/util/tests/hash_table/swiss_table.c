@@ -0,0 +1,152 @@
+/*
+ * Copyright 2024 Mesa contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+#undef NDEBUG
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include "util/hash_table.h"
+#include "util/ralloc.h"
+#include "util/swiss_table.h"
+
+#define SIZE 10000
+
+static inline uint32_t
+u32_hash(uint32_t key)
+{
+   return _mesa_hash_u32(&key);
+}
+
+static inline bool
+u32_equal(uint32_t a, uint32_t b)
+{
+   return a == b;
+}
+
+/* Everything collides, to exercise probing across groups. */
+static inline uint32_t
+bad_hash(uint32_t key)
+{
+   return key & 1;
+}
+
+DECLARE_SWISS_TABLE(u32_table, uint32_t, u32_hash, u32_equal)
+DECLARE_SWISS_TABLE(bad_table, uint32_t, bad_hash, u32_equal)
+
+static void
+test_insert_remove(void)
+{
+   void *mem_ctx = ralloc_context(NULL);
+   static bool present[SIZE];
+   struct u32_table ht;
+   uint32_t i;
+
+   u32_table_init(&ht, mem_ctx);
+   assert(u32_table_search(&ht, 0) == NULL);
+   u32_table_remove_key(&ht, 0);
+
+   for (i = 0; i < SIZE; i++) {
+      struct u32_table_entry *entry =
+         u32_table_insert(&ht, i, (void *)(uintptr_t)(i + 1));
+      assert(entry && entry->key == i);
+      present[i] = true;
+   }
+   assert(u32_table_num_entries(&ht) == SIZE);
+
+   /* Replacing keeps the entry count */
+   u32_table_insert(&ht, 7, (void *)(uintptr_t)1234);
+   assert(u32_table_search(&ht, 7)->data == (void *)(uintptr_t)1234);
+   u32_table_insert(&ht, 7, (void *)(uintptr_t)8);
+   assert(u32_table_num_entries(&ht) == SIZE);
+
+   /* Churn, which leaves tombstones around without growing the table */
+   uint32_t capacity = swiss_table_capacity(&ht.table);
+   for (unsigned round = 0; round < 20; round++) {
+      for (i = round % 3; i < SIZE; i += 3) {
+         if (present[i]) {
+            u32_table_remove_key(&ht, i);
+         } else {
+            u32_table_insert(&ht, i, (void *)(uintptr_t)(i + 1));
+         }
+         present[i] = !present[i];
+      }
+   }
+   assert(swiss_table_capacity(&ht.table) == capacity);
+
+   uint32_t count = 0;
+   for (i = 0; i < SIZE; i++) {
+      struct u32_table_entry *entry = u32_table_search(&ht, i);
+      if (present[i]) {
+         assert(entry && entry->key == i);
+         assert(entry->data == (void *)(uintptr_t)(i + 1));
+         count++;
+      } else {
+         assert(entry == NULL);
+      }
+   }
+   assert(u32_table_search(&ht, SIZE) == NULL);
+   assert(u32_table_num_entries(&ht) == count);
+
+   /* Iteration sees every entry once, and allows removal */
+   swiss_table_foreach(u32_table, &ht, entry) {
+      assert(present[entry->key]);
+      present[entry->key] = false;
+      u32_table_remove(&ht, entry);
+      count--;
+   }
+   assert(count == 0);
+   assert(u32_table_num_entries(&ht) == 0);
+
+   u32_table_insert(&ht, 1, NULL);
+   u32_table_clear(&ht);
+   assert(u32_table_num_entries(&ht) == 0);
+   assert(u32_table_search(&ht, 1) == NULL);
+
+   u32_table_fini(&ht);
+   ralloc_free(mem_ctx);
+}
+
+static void
+test_collisions(void)
+{
+   struct bad_table ht;
+   uint32_t i;
+
+   bad_table_init(&ht, NULL);
+   assert(bad_table_reserve(&ht, 1000));
+   uint32_t capacity = swiss_table_capacity(&ht.table);
+
+   for (i = 0; i < 1000; i++)
+      bad_table_insert(&ht, i, (void *)(uintptr_t)i);
+   assert(swiss_table_capacity(&ht.table) == capacity);
+
+   for (i = 0; i < 1000; i += 2)
+      bad_table_remove_key(&ht, i);
+
+   for (i = 0; i < 1000; i++) {
+      struct bad_table_entry *entry = bad_table_search(&ht, i);
+      if (i % 2) {
+         assert(entry && entry->data == (void *)(uintptr_t)i);
+      } else {
+         assert(entry == NULL);
+      }
+   }
+   assert(bad_table_num_entries(&ht) == 500);
+
+   bad_table_fini(&ht);
+}
+
+int
+main(int argc, char **argv)
+{
+   (void) argc;
+   (void) argv;
+
+   test_insert_remove();
+   test_collisions();
+
+   return 0;
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright 2024 Mesa contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * @file
+ * Compares struct hash_table against a DECLARE_SWISS_TABLE table, with
+ * pointer keys as used by most compiler passes.
+ *
+ *    swiss_table_bench [operations per size]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "util/hash_table.h"
+#include "util/os_time.h"
+#include "util/ralloc.h"
+#include "util/swiss_table.h"
+
+/* Same as _mesa_hash_pointer(), but inlinable. */
+static inline uint32_t
+pointer_hash(const void *key)
+{
+   uintptr_t num = (uintptr_t)key;
+   return (uint32_t)((num >> 2) ^ (num >> 6) ^ (num >> 10) ^ (num >> 14));
+}
+
+static inline bool
+pointer_equal(const void *a, const void *b)
+{
+   return a == b;
+}
+
+DECLARE_SWISS_TABLE(ptr_table, const void *, pointer_hash, pointer_equal)
+
+/* Stand-in for the NIR instructions or SSA defs used as keys. */
+struct bench_key {
+   uint64_t pad[6];
+};
+
+struct bench_result {
+   double insert, hit, miss;
+};
+
+static volatile uintptr_t sink;
+
+/* Like a pass, every round builds a table, queries it and throws it away. */
+static struct bench_result
+bench_hash_table(struct bench_key *keys, unsigned num_keys,
+                 const uint32_t *order, unsigned rounds)
+{
+   struct bench_result res = { 0 };
+   uintptr_t sum = 0;
+
+   for (unsigned r = 0; r < rounds; r++) {
+      int64_t start = os_time_get_nano();
+      struct hash_table *ht = _mesa_pointer_hash_table_create(NULL);
+      for (unsigned i = 0; i < num_keys; i++)
+         _mesa_hash_table_insert(ht, &keys[i], &keys[i]);
+      int64_t inserted = os_time_get_nano();
+      for (unsigned i = 0; i < num_keys; i++)
+         sum += (uintptr_t)_mesa_hash_table_search(ht, &keys[order[i]])->data;
+      int64_t hit = os_time_get_nano();
+      for (unsigned i = 0; i < num_keys; i++)
+         sum += !!_mesa_hash_table_search(ht, &keys[num_keys + order[i]]);
+      int64_t missed = os_time_get_nano();
+      _mesa_hash_table_destroy(ht, NULL);
+
+      res.insert += inserted - start;
+      res.hit += hit - inserted;
+      res.miss += missed - hit;
+   }
+
+   sink = sum;
+   return res;
+}
+
+static struct bench_result
+bench_swiss_table(struct bench_key *keys, unsigned num_keys,
+                  const uint32_t *order, unsigned rounds)
+{
+   struct bench_result res = { 0 };
+   uintptr_t sum = 0;
+
+   for (unsigned r = 0; r < rounds; r++) {
+      int64_t start = os_time_get_nano();
+      struct ptr_table ht;
+      ptr_table_init(&ht, NULL);
+      for (unsigned i = 0; i < num_keys; i++)
+         ptr_table_insert(&ht, &keys[i], &keys[i]);
+      int64_t inserted = os_time_get_nano();
+      for (unsigned i = 0; i < num_keys; i++)
+         sum += (uintptr_t)ptr_table_search(&ht, &keys[order[i]])->data;
+      int64_t hit = os_time_get_nano();
+      for (unsigned i = 0; i < num_keys; i++)
+         sum += !!ptr_table_search(&ht, &keys[num_keys + order[i]]);
+      int64_t missed = os_time_get_nano();
+      ptr_table_fini(&ht);
+
+      res.insert += inserted - start;
+      res.hit += hit - inserted;
+      res.miss += missed - hit;
+   }
+
+   sink = sum;
+   return res;
+}
+
+int
+main(int argc, char **argv)
+{
+   static const unsigned sizes[] = { 16, 256, 4096, 65536 };
+   unsigned ops = argc > 1 ? atoi(argv[1]) : 4000000;
+
+   printf("%8s %-12s %10s %10s %10s\n",
+          "entries", "table", "insert", "hit", "miss");
+
+   for (unsigned s = 0; s < ARRAY_SIZE(sizes); s++) {
+      unsigned num_keys = sizes[s];
+      unsigned rounds = MAX2(ops / num_keys, 1);
+
+      /* The second half of the keys is never inserted. */
+      struct bench_key *keys = calloc(num_keys * 2, sizeof(*keys));
+      uint32_t *order = malloc(num_keys * sizeof(*order));
+      if (!keys || !order)
+         return EXIT_FAILURE;
+
+      /* Look keys up in a random order, like a pass would. */
+      uint32_t rand = 0x12345678;
+      for (unsigned i = 0; i < num_keys; i++)
+         order[i] = i;
+      for (unsigned i = num_keys - 1; i > 0; i--) {
+         rand ^= rand << 13;
+         rand ^= rand >> 17;
+         rand ^= rand << 5;
+         unsigned j = rand % (i + 1);
+         uint32_t tmp = order[i];
+         order[i] = order[j];
+         order[j] = tmp;
+      }
+
+      struct bench_result ht = bench_hash_table(keys, num_keys, order, rounds);
+      struct bench_result st = bench_swiss_table(keys, num_keys, order, rounds);
+
+      /* Nanoseconds per operation */
+      const double num_ops = (double)rounds * num_keys;
+      ht.insert /= num_ops; ht.hit /= num_ops; ht.miss /= num_ops;
+      st.insert /= num_ops; st.hit /= num_ops; st.miss /= num_ops;
+
+      printf("%8u %-12s %8.1f ns %7.1f ns %7.1f ns\n", num_keys, "hash_table",
+             ht.insert, ht.hit, ht.miss);
+      printf("%8u %-12s %8.1f ns %7.1f ns %7.1f ns\n", num_keys, "swiss_table",
+             st.insert, st.hit, st.miss);
+      printf("%8u %-12s %9.2fx %9.2fx %9.2fx\n", num_keys, "speedup",
+             ht.insert / st.insert, ht.hit / st.hit, ht.miss / st.miss);
+
+      free(order);
+      free(keys);
+   }
+
+   return EXIT_SUCCESS;
+}
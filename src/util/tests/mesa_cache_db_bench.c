@@ -0,0 +1,149 @@
+/*
+ * Copyright 2024 Mesa contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * @file
+ * Lookup throughput of one mesa_cache_db shared by several processes, like
+ * many applications starting at once with the same shader cache.
+ *
+ *    mesa_cache_db_bench [lookups per process]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "util/macros.h"
+#include "util/mesa_cache_db.h"
+#include "util/os_time.h"
+
+#define NUM_ENTRIES 1024
+#define ENTRY_SIZE  4096
+
+static uint32_t
+xorshift(uint32_t *state)
+{
+   *state ^= *state << 13;
+   *state ^= *state >> 17;
+   *state ^= *state << 5;
+   return *state;
+}
+
+static void
+make_key(unsigned i, uint8_t key[20])
+{
+   uint32_t state = 0x9e3779b9 * (i + 1);
+
+   for (unsigned j = 0; j < 20; j++)
+      key[j] = xorshift(&state);
+}
+
+static int
+run_reader(const char *path, int start_fd, unsigned lookups, unsigned seed)
+{
+   struct mesa_cache_db db;
+   uint8_t key[20];
+   char c;
+
+   if (!mesa_cache_db_open(&db, path))
+      return EXIT_FAILURE;
+
+   /* Wait for all readers to be ready */
+   if (read(start_fd, &c, 1) != 0)
+      return EXIT_FAILURE;
+
+   for (unsigned i = 0; i < lookups; i++) {
+      size_t size;
+
+      make_key(xorshift(&seed) % NUM_ENTRIES, key);
+      void *data = mesa_cache_db_read_entry(&db, key, &size);
+      if (!data || size != ENTRY_SIZE)
+         return EXIT_FAILURE;
+      free(data);
+   }
+
+   mesa_cache_db_close(&db);
+   return EXIT_SUCCESS;
+}
+
+/* Returns the total number of lookups per second. */
+static double
+run(const char *path, unsigned num_procs, unsigned lookups)
+{
+   int start[2];
+   bool ok = true;
+
+   if (pipe(start))
+      return 0;
+
+   for (unsigned i = 0; i < num_procs; i++) {
+      pid_t pid = fork();
+      if (pid == 0) {
+         close(start[1]);
+         _exit(run_reader(path, start[0], lookups, 0x1234567 + i));
+      }
+      if (pid < 0)
+         ok = false;
+   }
+
+   /* Closing the pipe starts all the readers at once */
+   usleep(100000);
+   int64_t begin = os_time_get_nano();
+   close(start[1]);
+   close(start[0]);
+
+   int status;
+   while (wait(&status) > 0)
+      ok &= WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+
+   int64_t end = os_time_get_nano();
+
+   if (!ok) {
+      fprintf(stderr, "a reader failed\n");
+      return 0;
+   }
+
+   return (double)num_procs * lookups / ((end - begin) / 1e9);
+}
+
+int
+main(int argc, char **argv)
+{
+   static const unsigned proc_counts[] = { 1, 2, 4, 8, 16, 32 };
+   unsigned lookups = argc > 1 ? atoi(argv[1]) : 20000;
+   char path[] = "/tmp/mesa_cache_db_bench.XXXXXX";
+   struct mesa_cache_db db;
+   uint8_t blob[ENTRY_SIZE];
+   uint8_t key[20];
+
+   if (!mkdtemp(path) || !mesa_cache_db_open(&db, path))
+      return EXIT_FAILURE;
+
+   mesa_cache_db_set_size_limit(&db, 2ull * NUM_ENTRIES * ENTRY_SIZE);
+
+   for (unsigned i = 0; i < NUM_ENTRIES; i++) {
+      memset(blob, i, sizeof(blob));
+      make_key(i, key);
+      if (!mesa_cache_db_entry_write(&db, key, blob, sizeof(blob)))
+         return EXIT_FAILURE;
+   }
+   mesa_cache_db_close(&db);
+
+   printf("%10s %16s %14s\n", "processes", "lookups/s", "us/lookup");
+
+   for (unsigned p = 0; p < ARRAY_SIZE(proc_counts); p++) {
+      double rate = run(path, proc_counts[p], lookups);
+
+      printf("%10u %16.0f %14.2f\n", proc_counts[p], rate,
+             rate ? proc_counts[p] * 1e6 / rate : 0);
+   }
+
+   mesa_db_wipe_path(path);
+   rmdir(path);
+
+   return EXIT_SUCCESS;
+}
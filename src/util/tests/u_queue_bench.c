@@ -0,0 +1,165 @@
+/*
+ * Copyright 2024 Mesa contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * @file
+ * Compares the default FIFO util_queue against UTIL_QUEUE_INIT_WORK_STEALING
+ * for many tiny jobs, jobs spawning jobs and util_queue_parallel_for.
+ *
+ *    u_queue_bench [jobs]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "util/os_time.h"
+#include "util/u_atomic.h"
+#include "util/u_math.h"
+#include "util/u_queue.h"
+
+static volatile unsigned sink;
+
+/* Roughly the cost of a small compile job's bookkeeping */
+static void
+spin(unsigned iterations)
+{
+   unsigned x = 1;
+
+   for (unsigned i = 0; i < iterations; i++)
+      x = x * 1664525 + 1013904223;
+   sink = x;
+}
+
+static void
+tiny_execute(void *job, void *gdata, int thread_index)
+{
+   spin(64);
+}
+
+static void
+bench_tiny(struct util_queue *queue, unsigned num_jobs)
+{
+   for (unsigned i = 0; i < num_jobs; i++)
+      util_queue_add_job(queue, NULL, NULL, tiny_execute, NULL, 0);
+   util_queue_finish(queue);
+}
+
+struct spawn_job {
+   struct util_queue_group *group;
+   unsigned depth;
+};
+
+static void
+spawn_cleanup(void *data, void *gdata, int thread_index);
+
+static void
+spawn_execute(void *data, void *gdata, int thread_index)
+{
+   struct spawn_job *job = data;
+
+   spin(64);
+   if (!job->depth)
+      return;
+
+   for (unsigned i = 0; i < 2; i++) {
+      struct spawn_job *child = malloc(sizeof(*child));
+      child->group = job->group;
+      child->depth = job->depth - 1;
+      util_queue_group_add_job(job->group, child, spawn_execute,
+                               spawn_cleanup, 0);
+   }
+}
+
+static void
+spawn_cleanup(void *data, void *gdata, int thread_index)
+{
+   free(data);
+}
+
+static void
+bench_spawn(struct util_queue *queue, unsigned num_jobs)
+{
+   struct util_queue_group group;
+   util_queue_group_init(&group, queue);
+
+   struct spawn_job *root = malloc(sizeof(*root));
+   root->group = &group;
+   /* A full binary tree of num_jobs - 1 jobs */
+   root->depth = util_logbase2(num_jobs) - 1;
+   util_queue_group_add_job(&group, root, spawn_execute, spawn_cleanup, 0);
+
+   util_queue_group_wait(&group);
+   util_queue_group_destroy(&group);
+}
+
+static void
+range_execute(void *data, unsigned start, unsigned end, int thread_index)
+{
+   for (unsigned i = start; i < end; i++)
+      spin(64);
+}
+
+static void
+bench_parallel_for(struct util_queue *queue, unsigned num_jobs)
+{
+   util_queue_parallel_for(queue, num_jobs, 16, range_execute, NULL);
+}
+
+static const struct {
+   const char *name;
+   void (*func)(struct util_queue *queue, unsigned num_jobs);
+} benches[] = {
+   { "tiny jobs", bench_tiny },
+   { "spawn", bench_spawn },
+   { "parallel_for", bench_parallel_for },
+};
+
+/* Returns nanoseconds per job. */
+static double
+run(unsigned bench, unsigned num_threads, unsigned flags, unsigned num_jobs)
+{
+   struct util_queue queue;
+
+   /* Spawned jobs can't wait for space without deadlocking. */
+   if (!util_queue_init(&queue, "bench", num_jobs * 2, num_threads,
+                        flags | UTIL_QUEUE_INIT_RESIZE_IF_FULL, NULL))
+      return 0;
+
+   /* Warm up, which also starts all the threads. */
+   benches[bench].func(&queue, num_jobs / 16);
+
+   int64_t start = os_time_get_nano();
+   benches[bench].func(&queue, num_jobs);
+   int64_t end = os_time_get_nano();
+
+   util_queue_destroy(&queue);
+   return (double)(end - start) / num_jobs;
+}
+
+int
+main(int argc, char **argv)
+{
+   static const unsigned thread_counts[] = { 1, 2, 4, 8 };
+   unsigned num_jobs = argc > 1 ? atoi(argv[1]) : 1 << 16;
+
+   num_jobs = util_next_power_of_two(MAX2(num_jobs, 16));
+
+   printf("%-14s %8s %12s %14s %8s\n",
+          "workload", "threads", "fifo", "work stealing", "speedup");
+
+   for (unsigned b = 0; b < ARRAY_SIZE(benches); b++) {
+      for (unsigned t = 0; t < ARRAY_SIZE(thread_counts); t++) {
+         unsigned num_threads = thread_counts[t];
+         double fifo = run(b, num_threads, 0, num_jobs);
+         double ws = run(b, num_threads, UTIL_QUEUE_INIT_WORK_STEALING,
+                         num_jobs);
+
+         printf("%-14s %8u %9.1f ns %11.1f ns %7.2fx\n", benches[b].name,
+                num_threads, fifo, ws, fifo / ws);
+      }
+   }
+
+   return EXIT_SUCCESS;
+}
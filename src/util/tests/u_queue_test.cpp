@@ -0,0 +1,383 @@
+/*
+ * Copyright 2024 Mesa contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <gtest/gtest.h>
+
+#include "util/u_atomic.h"
+#include "util/u_queue.h"
+
+#define NUM_THREADS 4
+
+class UtilQueue : public ::testing::TestWithParam<unsigned> {
+protected:
+   struct util_queue queue;
+
+   void SetUp() override
+   {
+      /* Big enough for jobs adding jobs not to wait for space. */
+      ASSERT_TRUE(util_queue_init(&queue, "test", 4096, NUM_THREADS,
+                                  GetParam(), NULL));
+   }
+
+   void TearDown() override
+   {
+      util_queue_destroy(&queue);
+   }
+};
+
+INSTANTIATE_TEST_SUITE_P(
+   Flags, UtilQueue,
+   ::testing::Values(0u, (unsigned)UTIL_QUEUE_INIT_RESIZE_IF_FULL,
+                     (unsigned)UTIL_QUEUE_INIT_WORK_STEALING),
+   [](const ::testing::TestParamInfo<unsigned> &info) {
+      switch (info.param) {
+      case UTIL_QUEUE_INIT_RESIZE_IF_FULL: return "Resize";
+      case UTIL_QUEUE_INIT_WORK_STEALING: return "WorkStealing";
+      default: return "Default";
+      }
+   });
+
+static void
+inc_execute(void *job, void *gdata, int thread_index)
+{
+   EXPECT_GE(thread_index, 0);
+   EXPECT_LT(thread_index, NUM_THREADS);
+   p_atomic_inc((int *)job);
+}
+
+TEST_P(UtilQueue, Fences)
+{
+   struct util_queue_fence fences[256];
+   int count = 0;
+
+   for (unsigned i = 0; i < ARRAY_SIZE(fences); i++) {
+      util_queue_fence_init(&fences[i]);
+      util_queue_add_job(&queue, &count, &fences[i], inc_execute, NULL, 0);
+   }
+
+   for (unsigned i = 0; i < ARRAY_SIZE(fences); i++) {
+      util_queue_fence_wait(&fences[i]);
+      util_queue_fence_destroy(&fences[i]);
+   }
+   EXPECT_EQ(count, 256);
+}
+
+TEST_P(UtilQueue, Finish)
+{
+   int count = 0;
+
+   for (unsigned i = 0; i < 1000; i++)
+      util_queue_add_job(&queue, &count, NULL, inc_execute, NULL, 0);
+
+   util_queue_finish(&queue);
+   EXPECT_EQ(p_atomic_read(&count), 1000);
+}
+
+struct spawn_job {
+   struct util_queue *queue;
+   struct util_queue_group *group;
+   unsigned depth;
+   int *count;
+};
+
+static void
+spawn_execute(void *data, void *gdata, int thread_index)
+{
+   struct spawn_job *job = (struct spawn_job *)data;
+
+   p_atomic_inc(job->count);
+   if (!job->depth)
+      return;
+
+   /* Jobs adding jobs to their own group */
+   for (unsigned i = 0; i < 2; i++) {
+      struct spawn_job *child = (struct spawn_job *)malloc(sizeof(*child));
+      *child = *job;
+      child->depth--;
+      util_queue_group_add_job(job->group, child, spawn_execute,
+                               [](void *job, void *, int) { free(job); }, 0);
+   }
+}
+
+TEST_P(UtilQueue, GroupSpawn)
+{
+   struct util_queue_group group;
+   int count = 0;
+
+   util_queue_group_init(&group, &queue);
+
+   struct spawn_job root = { &queue, &group, 10, &count };
+   util_queue_group_add_job(&group, &root, spawn_execute, NULL, 0);
+
+   util_queue_group_wait(&group);
+   EXPECT_TRUE(util_queue_group_is_finished(&group));
+   EXPECT_EQ(count, (1 << 11) - 1);
+
+   util_queue_group_destroy(&group);
+}
+
+struct stage_job {
+   int *done;
+   int *done_before;
+   int expected_before;
+};
+
+static void
+stage_execute(void *data, void *gdata, int thread_index)
+{
+   struct stage_job *job = (struct stage_job *)data;
+
+   if (job->done_before) {
+      EXPECT_EQ(p_atomic_read(job->done_before), job->expected_before);
+   }
+   p_atomic_inc(job->done);
+}
+
+TEST_P(UtilQueue, GroupDependencies)
+{
+   /* a -> b, c -> d */
+   struct util_queue_group a, b, c, d;
+   int a_done = 0, bc_done = 0, d_done = 0;
+   struct stage_job a_job = { &a_done, NULL, 0 };
+   struct stage_job bc_job = { &bc_done, &a_done, 32 };
+   struct stage_job d_job = { &d_done, &bc_done, 64 };
+
+   util_queue_group_init(&a, &queue);
+   util_queue_group_init(&b, &queue);
+   util_queue_group_init(&c, &queue);
+   util_queue_group_init(&d, &queue);
+
+   /* Added back to front, so that nothing is ordered by accident. */
+   util_queue_group_add_dependency(&d, &b);
+   util_queue_group_add_dependency(&d, &c);
+   util_queue_group_add_job(&d, &d_job, stage_execute, NULL, 0);
+   util_queue_group_close(&d);
+
+   util_queue_group_add_dependency(&b, &a);
+   util_queue_group_add_dependency(&c, &a);
+   for (unsigned i = 0; i < 32; i++) {
+      util_queue_group_add_job(&b, &bc_job, stage_execute, NULL, 0);
+      util_queue_group_add_job(&c, &bc_job, stage_execute, NULL, 0);
+   }
+   util_queue_group_close(&b);
+   util_queue_group_close(&c);
+
+   EXPECT_FALSE(util_queue_group_is_finished(&d));
+   for (unsigned i = 0; i < 32; i++)
+      util_queue_group_add_job(&a, &a_job, stage_execute, NULL, 0);
+   util_queue_group_close(&a);
+
+   util_queue_group_wait(&d);
+   EXPECT_EQ(a_done, 32);
+   EXPECT_EQ(bc_done, 64);
+   EXPECT_EQ(d_done, 1);
+
+   /* Depending on a finished group doesn't block. */
+   struct util_queue_group e;
+   util_queue_group_init(&e, &queue);
+   util_queue_group_add_dependency(&e, &d);
+   util_queue_group_add_job(&e, &d_job, stage_execute, NULL, 0);
+   util_queue_group_wait(&e);
+   EXPECT_EQ(d_done, 2);
+
+   util_queue_group_destroy(&e);
+   util_queue_group_destroy(&d);
+   util_queue_group_destroy(&c);
+   util_queue_group_destroy(&b);
+   util_queue_group_destroy(&a);
+}
+
+TEST_P(UtilQueue, GroupJoinWithoutJobs)
+{
+   /* a, b -> join -> c */
+   struct util_queue_group a, b, join, c;
+   int a_done = 0, c_done = 0;
+   struct stage_job a_job = { &a_done, NULL, 0 };
+   struct stage_job c_job = { &c_done, &a_done, 16 };
+
+   util_queue_group_init(&a, &queue);
+   util_queue_group_init(&b, &queue);
+   util_queue_group_init(&join, &queue);
+   util_queue_group_init(&c, &queue);
+
+   util_queue_group_add_dependency(&join, &a);
+   util_queue_group_add_dependency(&join, &b);
+   util_queue_group_close(&join);
+   EXPECT_FALSE(util_queue_group_is_finished(&join));
+
+   util_queue_group_add_dependency(&c, &join);
+   util_queue_group_add_job(&c, &c_job, stage_execute, NULL, 0);
+   util_queue_group_close(&c);
+
+   for (unsigned i = 0; i < 16; i++)
+      util_queue_group_add_job(&a, &a_job, stage_execute, NULL, 0);
+   util_queue_group_close(&a);
+   util_queue_group_wait(&a);
+
+   /* Still blocked by b. */
+   EXPECT_FALSE(util_queue_group_is_finished(&join));
+   EXPECT_EQ(p_atomic_read(&c_done), 0);
+
+   util_queue_group_close(&b);
+   util_queue_group_wait(&c);
+   EXPECT_TRUE(util_queue_group_is_finished(&join));
+   EXPECT_EQ(c_done, 1);
+
+   util_queue_group_destroy(&c);
+   util_queue_group_destroy(&join);
+   util_queue_group_destroy(&b);
+   util_queue_group_destroy(&a);
+}
+
+static void
+mark_range(void *data, unsigned start, unsigned end, int thread_index)
+{
+   uint8_t *visited = (uint8_t *)data;
+
+   EXPECT_LT(start, end);
+   EXPECT_GE(thread_index, 0);
+   for (unsigned i = start; i < end; i++)
+      p_atomic_inc(&visited[i]);
+}
+
+TEST_P(UtilQueue, ParallelFor)
+{
+   uint8_t visited[1001] = { 0 };
+
+   util_queue_parallel_for(&queue, ARRAY_SIZE(visited), 7, mark_range,
+                           visited);
+
+   for (unsigned i = 0; i < ARRAY_SIZE(visited); i++)
+      EXPECT_EQ(visited[i], 1) << "index " << i;
+}
+
+struct nested_job {
+   struct util_queue *queue;
+   uint8_t visited[NUM_THREADS * 2][300];
+};
+
+static void
+nested_range(void *data, unsigned start, unsigned end, int thread_index)
+{
+   struct nested_job *job = (struct nested_job *)data;
+
+   for (unsigned i = start; i < end; i++) {
+      util_queue_parallel_for(job->queue, ARRAY_SIZE(job->visited[i]), 10,
+                              mark_range, job->visited[i]);
+   }
+}
+
+TEST_P(UtilQueue, ParallelForNested)
+{
+   struct nested_job *job = (struct nested_job *)calloc(1, sizeof(*job));
+   job->queue = &queue;
+
+   /* Every thread waits in an outer loop iteration. */
+   util_queue_parallel_for(&queue, ARRAY_SIZE(job->visited), 1, nested_range,
+                           job);
+
+   for (unsigned i = 0; i < ARRAY_SIZE(job->visited); i++) {
+      for (unsigned j = 0; j < ARRAY_SIZE(job->visited[i]); j++)
+         EXPECT_EQ(job->visited[i][j], 1);
+   }
+   free(job);
+}
+
+static void
+count_range(void *data, unsigned start, unsigned end, int thread_index)
+{
+   p_atomic_add((int *)data, end - start);
+}
+
+static void
+block_execute(void *job, void *gdata, int thread_index)
+{
+   while (p_atomic_read((int *)job))
+      thrd_yield();
+}
+
+TEST_P(UtilQueue, ParallelForDiscarded)
+{
+   struct util_queue other;
+   int blocked = 1, count = 0;
+
+   ASSERT_TRUE(util_queue_init(&other, "test2", 64, 1, GetParam(), NULL));
+   util_queue_add_job(&other, &blocked, NULL, block_execute, NULL, 0);
+
+   /* The jobs are stuck behind the blocking one, so the calling thread has
+    * to run every chunk.
+    */
+   util_queue_parallel_for(&other, 1000, 1, count_range, &count);
+   EXPECT_EQ(count, 1000);
+
+   /* The leftover jobs are discarded, which must release them. */
+   p_atomic_set(&blocked, 0);
+   util_queue_destroy(&other);
+}
+
+static void
+wait_kill_execute(void *job, void *gdata, int thread_index)
+{
+   struct util_queue *queue = (struct util_queue *)job;
+
+   while (p_atomic_read(&queue->num_threads))
+      thrd_yield();
+}
+
+TEST_P(UtilQueue, DiscardedJob)
+{
+   struct util_queue other;
+   struct util_queue_fence fence;
+   int count[2] = { 0, 0 };
+
+   ASSERT_TRUE(util_queue_init(&other, "test2", 64, 1, GetParam(), NULL));
+   util_queue_fence_init(&fence);
+
+   /* The second job is still queued when the thread is told to exit. */
+   util_queue_add_job(&other, &other, NULL, wait_kill_execute, NULL, 0);
+   util_queue_add_job(&other, count, &fence,
+                      [](void *job, void *, int) { p_atomic_inc((int *)job); },
+                      [](void *job, void *, int) { p_atomic_inc((int *)job + 1); },
+                      0);
+   util_queue_destroy(&other);
+
+   EXPECT_TRUE(util_queue_fence_is_signalled(&fence));
+   if (GetParam() == UTIL_QUEUE_INIT_WORK_STEALING) {
+      /* Threads empty their deques before exiting. */
+      EXPECT_EQ(count[0], 1);
+      EXPECT_EQ(count[1], 1);
+   } else {
+      /* The job never ran, so its cleanup isn't called either. */
+      EXPECT_EQ(count[0], 0);
+      EXPECT_EQ(count[1], 0);
+   }
+   util_queue_fence_destroy(&fence);
+}
+
+TEST_P(UtilQueue, DropJob)
+{
+   struct util_queue_fence fences[256];
+   int count = 0;
+
+   for (unsigned i = 0; i < ARRAY_SIZE(fences); i++) {
+      util_queue_fence_init(&fences[i]);
+      util_queue_add_job(&queue, &count, &fences[i], inc_execute, NULL, 0);
+   }
+
+   for (unsigned i = 0; i < ARRAY_SIZE(fences); i += 2) {
+      util_queue_drop_job(&queue, &fences[i]);
+      EXPECT_TRUE(util_queue_fence_is_signalled(&fences[i]));
+   }
+
+   for (unsigned i = 0; i < ARRAY_SIZE(fences); i++) {
+      util_queue_fence_wait(&fences[i]);
+      util_queue_fence_destroy(&fences[i]);
+   }
+   util_queue_finish(&queue);
+
+   /* Dropped jobs run only if they had already started. */
+   EXPECT_GE(count, (int)ARRAY_SIZE(fences) / 2);
+   EXPECT_LE(count, (int)ARRAY_SIZE(fences));
+}
@@ -0,0 +1,359 @@
+/*
+ * Copyright 2024 Mesa contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * @file
+ * Trains and inspects the zstd dictionaries the shader cache compresses its
+ * items with.
+ *
+ * A dictionary is trained on the items of existing caches, either of the
+ * multi-file or of the database layout, and only helps the driver whose
+ * items it was trained on.  The cache picks it up from
+ * <cache dir>/<gpu name>.zdict, for example:
+ *
+ *    mesa_cache_dict train -g llvmpipe -o llvmpipe.zdict \
+ *       ~/.cache/mesa_shader_cache_db
+ *    mesa_cache_dict info llvmpipe.zdict ~/.cache/mesa_shader_cache_db
+ *    cp llvmpipe.zdict ~/.cache/mesa_shader_cache_db/
+ *
+ * Items compressed with a previous dictionary can't be loaded anymore after
+ * replacing it, and are compiled and stored again.
+ */
+
+#include <ftw.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util/compress.h"
+#include "util/disk_cache.h"
+#include "util/disk_cache_os.h"
+#include "util/mesa_cache_db.h"
+#include "util/os_file.h"
+#include "util/os_time.h"
+#include "util/u_dynarray.h"
+
+/* The default of the zstd command line tool */
+#define DEFAULT_DICT_SIZE (110 * 1024)
+
+struct samples {
+   const char *gpu_name;
+   const struct util_compress_dict *dict;
+
+   /* Uncompressed items, back to back */
+   struct util_dynarray data;
+   struct util_dynarray sizes;
+
+   unsigned skipped;
+};
+
+/* Set for the nftw() callback, which takes no user data. */
+static struct samples *walk_samples;
+
+static void
+add_item(struct samples *samples, const void *cache_item, size_t size)
+{
+   struct disk_cache_item_info info;
+
+   if (!disk_cache_parse_item_info(cache_item, size, &info)) {
+      samples->skipped++;
+      return;
+   }
+
+   if (samples->gpu_name && strcmp(info.gpu_name, samples->gpu_name))
+      return;
+
+   void *dst = util_dynarray_grow_bytes(&samples->data, 1,
+                                        info.uncompressed_size);
+   if (!dst)
+      return;
+
+   /* Items of caches with compression disabled are stored as is. */
+   if (!util_compress_inflate_dict(samples->dict, info.data, info.data_size,
+                                   dst, info.uncompressed_size)) {
+      if (info.data_size != info.uncompressed_size) {
+         samples->data.size -= info.uncompressed_size;
+         samples->skipped++;
+         return;
+      }
+      memcpy(dst, info.data, info.data_size);
+   }
+
+   util_dynarray_append(&samples->sizes, size_t, info.uncompressed_size);
+}
+
+static void
+add_db_entry(const uint8_t *cache_key_160bit, const void *blob,
+             size_t blob_size, void *data)
+{
+   add_item(data, blob, blob_size);
+}
+
+static bool
+is_cache_subdir(const char *path, size_t len)
+{
+   /* Items of the multi-file layout are in directories named after the
+    * first byte of their key in hex.
+    */
+   return len >= 3 && path[len - 3] == '/' &&
+          strspn(path + len - 2, "0123456789abcdef") == 2;
+}
+
+static int
+walk_file(const char *fpath, const struct stat *sb, int typeflag,
+          struct FTW *ftwbuf)
+{
+   const char *name = fpath + ftwbuf->base;
+
+   if (typeflag != FTW_F)
+      return 0;
+
+   if (!strcmp(name, "mesa_cache.db")) {
+      char *dir = strndup(fpath, ftwbuf->base);
+      struct mesa_cache_db db;
+
+      if (dir && mesa_cache_db_open(&db, dir)) {
+         if (!mesa_cache_db_foreach_entry(&db, add_db_entry, walk_samples))
+            fprintf(stderr, "failed to read %s\n", fpath);
+         mesa_cache_db_close(&db);
+      }
+      free(dir);
+      return 0;
+   }
+
+   if (!is_cache_subdir(fpath, ftwbuf->base - 1) ||
+       strlen(name) < 4 || !strcmp(name + strlen(name) - 4, ".tmp"))
+      return 0;
+
+   size_t size;
+   char *cache_item = os_read_file(fpath, &size);
+   if (cache_item) {
+      add_item(walk_samples, cache_item, size);
+      free(cache_item);
+   }
+
+   return 0;
+}
+
+static bool
+load_samples(struct samples *samples, char **cache_dirs, int num_cache_dirs)
+{
+   walk_samples = samples;
+
+   for (int i = 0; i < num_cache_dirs; i++) {
+      if (nftw(cache_dirs[i], walk_file, 16, FTW_PHYS) == -1) {
+         fprintf(stderr, "failed to read %s\n", cache_dirs[i]);
+         return false;
+      }
+   }
+
+   unsigned count = util_dynarray_num_elements(&samples->sizes, size_t);
+   printf("%u items, %zu bytes", count, (size_t)samples->data.size);
+   if (samples->skipped)
+      printf(", %u unreadable items skipped", samples->skipped);
+   printf("\n");
+
+   return count != 0;
+}
+
+static struct util_compress_dict *
+load_dict(const char *filename)
+{
+   size_t size;
+   char *dict_data = os_read_file(filename, &size);
+   if (!dict_data) {
+      fprintf(stderr, "failed to read %s\n", filename);
+      return NULL;
+   }
+
+   struct util_compress_dict *dict = util_compress_dict_create(dict_data, size);
+   if (dict)
+      printf("dictionary %s: id 0x%08x, %zu bytes\n", filename,
+             util_compress_dict_id(dict), size);
+   else
+      fprintf(stderr, "%s is not a zstd dictionary\n", filename);
+
+   free(dict_data);
+   return dict;
+}
+
+static int
+train(const char *output, size_t dict_size, struct samples *samples,
+      char **cache_dirs, int num_cache_dirs)
+{
+   if (!load_samples(samples, cache_dirs, num_cache_dirs))
+      return EXIT_FAILURE;
+
+   void *dict_data = malloc(dict_size);
+   if (!dict_data)
+      return EXIT_FAILURE;
+
+   dict_size = util_compress_dict_train(dict_data, dict_size,
+                                        samples->data.data,
+                                        samples->sizes.data,
+                                        util_dynarray_num_elements(&samples->sizes, size_t));
+   if (!dict_size) {
+      fprintf(stderr, "training failed, more items are needed\n");
+      free(dict_data);
+      return EXIT_FAILURE;
+   }
+
+   FILE *f = fopen(output, "wb");
+   bool ok = f && fwrite(dict_data, dict_size, 1, f) == 1;
+   if (f)
+      ok &= fclose(f) == 0;
+   free(dict_data);
+
+   if (!ok) {
+      fprintf(stderr, "failed to write %s\n", output);
+      return EXIT_FAILURE;
+   }
+
+   struct util_compress_dict *dict = load_dict(output);
+   util_compress_dict_destroy(dict);
+
+   return dict ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Compresses all samples with dict, which may be NULL, and prints how well
+ * that went.
+ */
+static void
+evaluate(const char *name, const struct util_compress_dict *dict,
+         const struct samples *samples)
+{
+   const uint8_t *data = samples->data.data;
+   size_t compressed_size = 0;
+   int64_t deflate_time = 0, inflate_time = 0;
+
+   util_dynarray_foreach(&samples->sizes, size_t, size) {
+      size_t max_size = util_compress_max_compressed_len(*size);
+      uint8_t *compressed = malloc(max_size);
+      uint8_t *uncompressed = malloc(*size);
+
+      int64_t start = os_time_get_nano();
+      size_t item_size = util_compress_deflate_dict(dict, data, *size,
+                                                    compressed, max_size);
+      int64_t mid = os_time_get_nano();
+      if (item_size &&
+          !util_compress_inflate_dict(dict, compressed, item_size,
+                                      uncompressed, *size))
+         item_size = 0;
+      int64_t end = os_time_get_nano();
+
+      deflate_time += mid - start;
+      inflate_time += end - mid;
+      compressed_size += item_size ? item_size : *size;
+
+      free(compressed);
+      free(uncompressed);
+      data += *size;
+   }
+
+   printf("%-14s %14zu %9.2f%% %12.2f ms %12.2f ms\n", name, compressed_size,
+          100.0 * compressed_size / samples->data.size,
+          deflate_time / 1e6, inflate_time / 1e6);
+}
+
+static int
+info(const char *filename, struct samples *samples, char **cache_dirs,
+     int num_cache_dirs)
+{
+   struct util_compress_dict *dict = load_dict(filename);
+   if (!dict)
+      return EXIT_FAILURE;
+
+   if (num_cache_dirs) {
+      if (!load_samples(samples, cache_dirs, num_cache_dirs)) {
+         util_compress_dict_destroy(dict);
+         return EXIT_FAILURE;
+      }
+
+      printf("%-14s %14s %10s %15s %15s\n", "", "compressed", "ratio",
+             "compress", "decompress");
+      evaluate("no dictionary", NULL, samples);
+      evaluate("dictionary", dict, samples);
+   }
+
+   util_compress_dict_destroy(dict);
+   return EXIT_SUCCESS;
+}
+
+static void
+print_usage(const char *name)
+{
+   fprintf(stderr,
+           "usage: %s train [-g gpu name] [-s dictionary size] "
+           "[-d current dictionary] -o output cache_dir...\n"
+           "       %s info [-g gpu name] [-d current dictionary] "
+           "dictionary [cache_dir...]\n",
+           name, name);
+}
+
+int
+main(int argc, char **argv)
+{
+   const char *output = NULL, *current_dict = NULL;
+   size_t dict_size = DEFAULT_DICT_SIZE;
+   struct samples samples = { 0 };
+   int opt, ret;
+
+   if (argc < 2) {
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+   }
+
+   const char *command = argv[1];
+   optind = 2;
+
+   while ((opt = getopt(argc, argv, "g:s:d:o:")) != -1) {
+      switch (opt) {
+      case 'g':
+         samples.gpu_name = optarg;
+         break;
+      case 's':
+         dict_size = strtoul(optarg, NULL, 0);
+         break;
+      case 'd':
+         current_dict = optarg;
+         break;
+      case 'o':
+         output = optarg;
+         break;
+      default:
+         print_usage(argv[0]);
+         return EXIT_FAILURE;
+      }
+   }
+
+   util_dynarray_init(&samples.data, NULL);
+   util_dynarray_init(&samples.sizes, NULL);
+
+   /* Needed to read items compressed with it */
+   struct util_compress_dict *dict = NULL;
+   if (current_dict) {
+      dict = load_dict(current_dict);
+      if (!dict)
+         return EXIT_FAILURE;
+      samples.dict = dict;
+   }
+
+   if (!strcmp(command, "train") && output && optind < argc) {
+      ret = train(output, dict_size, &samples, argv + optind, argc - optind);
+   } else if (!strcmp(command, "info") && optind < argc) {
+      ret = info(argv[optind], &samples, argv + optind + 1,
+                 argc - optind - 1);
+   } else {
+      print_usage(argv[0]);
+      ret = EXIT_FAILURE;
+   }
+
+   util_compress_dict_destroy(dict);
+   util_dynarray_fini(&samples.data);
+   util_dynarray_fini(&samples.sizes);
+
+   return ret;
+}
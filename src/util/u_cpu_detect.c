@@ -496,6 +496,83 @@ check_os_loongarch64_support(void)
 #endif /* DETECT_ARCH_LOONGARCH64 */
 
 
+#if DETECT_OS_LINUX
+/* Highest NUMA node number looked for in sysfs */
+#define MAX_NUMA_NODES 64
+
+/**
+ * Fill in the CPU <-> NUMA node mapping from sysfs.  Nodes without CPUs
+ * (memory only) are skipped and the remaining ones are numbered densely.
+ */
+static void
+get_numa_topology(void)
+{
+   util_affinity_mask *masks = NULL;
+   unsigned num_nodes = 0;
+
+   for (unsigned node = 0; node < MAX_NUMA_NODES; node++) {
+      char name[PATH_MAX];
+      snprintf(name, sizeof(name), "/sys/devices/system/node/node%u/cpulist",
+               node);
+      size_t size = 0;
+      char *list = os_read_file(name, &size);
+      if (!list)
+         continue;
+
+      util_affinity_mask *new_masks =
+         realloc(masks, sizeof(util_affinity_mask) * (num_nodes + 1));
+      if (!new_masks) {
+         free(list);
+         break;
+      }
+      masks = new_masks;
+      memset(&masks[num_nodes], 0, sizeof(util_affinity_mask));
+
+      /* The format is a list of ranges, e.g. "0-15,64-79" */
+      bool has_cpus = false;
+      char *p = list;
+      while (*p >= '0' && *p <= '9') {
+         unsigned first = strtoul(p, &p, 10);
+         unsigned last = first;
+         if (*p == '-')
+            last = strtoul(p + 1, &p, 10);
+
+         for (unsigned cpu = first; cpu <= last && cpu < UTIL_MAX_CPUS; cpu++) {
+            masks[num_nodes][cpu / 32] |= 1u << (cpu % 32);
+            util_cpu_caps.cpu_to_numa_node[cpu] = num_nodes;
+            has_cpus = true;
+         }
+
+         if (*p != ',')
+            break;
+         p++;
+      }
+      free(list);
+
+      if (has_cpus)
+         num_nodes++;
+   }
+
+   if (num_nodes > 1) {
+      util_cpu_caps.num_numa_nodes = num_nodes;
+      util_cpu_caps.numa_affinity_mask = masks;
+   } else {
+      free(masks);
+   }
+
+   if (num_nodes > 1 && debug_get_option_dump_cpu()) {
+      fprintf(stderr, "CPU <-> NUMA node mapping:\n");
+      for (unsigned i = 0; i < num_nodes; i++) {
+         fprintf(stderr, "  - node %u mask = ", i);
+         for (int j = util_cpu_caps.max_cpus - 1; j >= 0; j -= 32)
+            fprintf(stderr, "%08x ", util_cpu_caps.numa_affinity_mask[i][j / 32]);
+         fprintf(stderr, "\n");
+      }
+   }
+}
+#endif
+
+
 static void
 get_cpu_topology(void)
 {
@@ -504,7 +581,13 @@ get_cpu_topology(void)
 
    memset(util_cpu_caps.cpu_to_L3, 0xff, sizeof(util_cpu_caps.cpu_to_L3));
 
+   util_cpu_caps.num_numa_nodes = 1;
+   memset(util_cpu_caps.cpu_to_numa_node, 0xff,
+          sizeof(util_cpu_caps.cpu_to_numa_node));
+
 #if DETECT_OS_LINUX
+   get_numa_topology();
+
    uint64_t big_cap = 0;
    unsigned num_big_cpus = 0;
    uint64_t *caps = malloc(sizeof(uint64_t) * util_cpu_caps.max_cpus);
@@ -1022,6 +1105,7 @@ _util_cpu_detect_once(void)
       printf("util_cpu_caps.has_avx512vbmi = %u\n", util_cpu_caps.has_avx512vbmi);
       printf("util_cpu_caps.has_clflushopt = %u\n", util_cpu_caps.has_clflushopt);
       printf("util_cpu_caps.num_L3_caches = %u\n", util_cpu_caps.num_L3_caches);
+      printf("util_cpu_caps.num_numa_nodes = %u\n", util_cpu_caps.num_numa_nodes);
       printf("util_cpu_caps.num_cpu_mask_bits = %u\n", util_cpu_caps.num_cpu_mask_bits);
    }
    _util_cpu_caps_state.caps = util_cpu_caps;
@@ -132,6 +132,12 @@ struct util_cpu_caps_t {
 
    /* Affinity masks for each L3 cache. */
    util_affinity_mask *L3_affinity_mask;
+
+   unsigned num_numa_nodes;
+   uint16_t cpu_to_numa_node[UTIL_MAX_CPUS];
+
+   /* Affinity masks for each NUMA node with CPUs, NULL with a single node. */
+   util_affinity_mask *numa_affinity_mask;
    /**
     * number of "big" CPUs in big.LITTLE configuration
     * 
@@ -155,6 +161,7 @@ struct _util_cpu_caps_state_t {
 };
 
 #define U_CPU_INVALID_L3 0xffff
+#define U_CPU_INVALID_NUMA_NODE 0xffff
 
 static inline ATTRIBUTE_CONST const struct util_cpu_caps_t *
 util_get_cpu_caps(void)
@@ -28,6 +28,8 @@
 
 #include "c11/threads.h"
 #include "util/u_cpu_detect.h"
+#include "util/u_math.h"
+#include "util/u_memory.h"
 #include "util/os_time.h"
 #include "util/u_string.h"
 #include "util/u_thread.h"
@@ -47,6 +49,14 @@
 static void
 util_queue_kill_threads(struct util_queue *queue, unsigned keep_num_threads,
                         bool locked);
+static void
+util_queue_push_job(struct util_queue *queue, const struct util_queue_job *job);
+static void
+util_queue_group_job_done(struct util_queue_group *group);
+
+/* The queue and thread index of the current thread, if it's a queue thread. */
+static __THREAD_INITIAL_EXEC struct util_queue *current_queue;
+static __THREAD_INITIAL_EXEC int current_thread_index;
 
 /****************************************************************************
  * Wait for all queues to assert idle when exit() is called.
@@ -226,6 +236,198 @@ util_queue_fence_destroy(struct util_queue_fence *fence)
  * util_queue implementation
  */
 
+static void
+util_queue_execute_job(struct util_queue_job *job, int thread_index)
+{
+   if (!job->job)
+      return;
+
+   job->execute(job->job, job->global_data, thread_index);
+   if (job->fence)
+      util_queue_fence_signal(job->fence);
+   if (job->cleanup)
+      job->cleanup(job->job, job->global_data, thread_index);
+   if (job->group)
+      util_queue_group_job_done(job->group);
+}
+
+static void
+util_queue_parallel_for_execute(void *job, void *gdata, int thread_index);
+
+/* For jobs that will never execute because all threads are gone.  Jobs of
+ * work-stealing queues, group jobs and parallel_for jobs are released like
+ * util_queue_drop_job does, calling cleanup with thread_index -1.  Other
+ * jobs only get their fence signalled: the cleanup callbacks of existing
+ * FIFO users expect the job to have run.
+ */
+static void
+util_queue_discard_job(struct util_queue *queue, struct util_queue_job *job)
+{
+   if (!job->job)
+      return;
+
+   if (job->fence)
+      util_queue_fence_signal(job->fence);
+
+   if (!queue->deques && !job->group &&
+       job->execute != util_queue_parallel_for_execute)
+      return;
+
+   if (job->cleanup)
+      job->cleanup(job->job, job->global_data, -1);
+   if (job->group)
+      util_queue_group_job_done(job->group);
+}
+
+/* Work-stealing deque.  The owner thread pushes and pops at the bottom,
+ * other threads steal from the top.  top and bottom only ever increase and
+ * are read without the lock to skip empty deques.
+ */
+struct util_queue_deque {
+   alignas(CACHE_LINE_SIZE) simple_mtx_t lock;
+   unsigned top, bottom;
+   unsigned size; /* power of two */
+   struct util_queue_job *jobs;
+};
+
+static bool
+util_queue_deque_init(struct util_queue_deque *deque, unsigned size)
+{
+   simple_mtx_init(&deque->lock, mtx_plain);
+   deque->size = util_next_power_of_two(MAX2(size, 8));
+   deque->jobs = (struct util_queue_job *)
+                 calloc(deque->size, sizeof(struct util_queue_job));
+   return deque->jobs != NULL;
+}
+
+static void
+util_queue_deque_destroy(struct util_queue_deque *deque)
+{
+   simple_mtx_destroy(&deque->lock);
+   free(deque->jobs);
+}
+
+static bool
+util_queue_deque_is_empty(struct util_queue_deque *deque)
+{
+   return p_atomic_read(&deque->top) == p_atomic_read(&deque->bottom);
+}
+
+static void
+util_queue_deque_push(struct util_queue_deque *deque,
+                      const struct util_queue_job *job)
+{
+   simple_mtx_lock(&deque->lock);
+
+   if (deque->bottom - deque->top == deque->size) {
+      unsigned new_size = deque->size * 2;
+      struct util_queue_job *jobs =
+         (struct util_queue_job *)malloc(new_size * sizeof(*jobs));
+      assert(jobs);
+
+      for (unsigned i = deque->top; i != deque->bottom; i++)
+         jobs[i & (new_size - 1)] = deque->jobs[i & (deque->size - 1)];
+
+      free(deque->jobs);
+      deque->jobs = jobs;
+      deque->size = new_size;
+   }
+
+   deque->jobs[deque->bottom & (deque->size - 1)] = *job;
+   p_atomic_set(&deque->bottom, deque->bottom + 1);
+
+   simple_mtx_unlock(&deque->lock);
+}
+
+/* Pops the newest job, or steals the oldest one. */
+static bool
+util_queue_deque_pop(struct util_queue_deque *deque,
+                     struct util_queue_job *job, bool steal)
+{
+   if (util_queue_deque_is_empty(deque))
+      return false;
+
+   simple_mtx_lock(&deque->lock);
+
+   if (deque->top == deque->bottom) {
+      simple_mtx_unlock(&deque->lock);
+      return false;
+   }
+
+   if (steal) {
+      *job = deque->jobs[deque->top & (deque->size - 1)];
+      p_atomic_set(&deque->top, deque->top + 1);
+   } else {
+      p_atomic_set(&deque->bottom, deque->bottom - 1);
+      *job = deque->jobs[deque->bottom & (deque->size - 1)];
+   }
+
+   simple_mtx_unlock(&deque->lock);
+   return true;
+}
+
+/* Takes a job from the thread's own deque, or steals one. */
+static bool
+util_queue_get_job_ws(struct util_queue *queue, int thread_index,
+                      struct util_queue_job *job)
+{
+   bool found = util_queue_deque_pop(&queue->deques[thread_index], job, false);
+
+   for (unsigned i = 1; !found && i < queue->max_threads; i++) {
+      unsigned victim = (thread_index + i) % queue->max_threads;
+      found = util_queue_deque_pop(&queue->deques[victim], job, true);
+   }
+
+   if (found)
+      p_atomic_dec(&queue->num_queued);
+   return found;
+}
+
+static void
+util_queue_job_finished_ws(struct util_queue *queue)
+{
+   /* util_queue_finish waits on has_space_cond, which is otherwise unused
+    * with work stealing.
+    */
+   if (p_atomic_dec_zero(&queue->num_unfinished)) {
+      mtx_lock(&queue->lock);
+      cnd_broadcast(&queue->has_space_cond);
+      mtx_unlock(&queue->lock);
+   }
+}
+
+static void
+util_queue_thread_loop_ws(struct util_queue *queue, int thread_index)
+{
+   while (1) {
+      struct util_queue_job job;
+
+      if (util_queue_get_job_ws(queue, thread_index, &job)) {
+         util_queue_execute_job(&job, thread_index);
+         util_queue_job_finished_ws(queue);
+         continue;
+      }
+
+      /* Nothing to do: sleep until a job is added.  Adding a job increments
+       * num_queued before checking num_sleeping, so either the producer
+       * sees us sleeping or we see its job.
+       */
+      mtx_lock(&queue->lock);
+      p_atomic_inc(&queue->num_sleeping);
+      while (thread_index < queue->num_threads &&
+             p_atomic_read(&queue->num_queued) == 0)
+         cnd_wait(&queue->has_queued_cond, &queue->lock);
+      p_atomic_dec(&queue->num_sleeping);
+
+      /* only kill threads that are above "num_threads" */
+      if (thread_index >= queue->num_threads) {
+         mtx_unlock(&queue->lock);
+         break;
+      }
+      mtx_unlock(&queue->lock);
+   }
+}
+
 struct thread_input {
    struct util_queue *queue;
    int thread_index;
@@ -264,6 +466,14 @@ util_queue_thread_func(void *input)
       u_thread_setname(name);
    }
 
+   current_queue = queue;
+   current_thread_index = thread_index;
+
+   if (queue->flags & UTIL_QUEUE_INIT_WORK_STEALING) {
+      util_queue_thread_loop_ws(queue, thread_index);
+      return 0;
+   }
+
    while (1) {
       struct util_queue_job job;
 
@@ -290,23 +500,20 @@ util_queue_thread_func(void *input)
          queue->total_jobs_size -= job.job_size;
       mtx_unlock(&queue->lock);
 
-      if (job.job) {
-         job.execute(job.job, job.global_data, thread_index);
-         if (job.fence)
-            util_queue_fence_signal(job.fence);
-         if (job.cleanup)
-            job.cleanup(job.job, job.global_data, thread_index);
-      }
+      util_queue_execute_job(&job, thread_index);
    }
 
    /* signal remaining jobs if all threads are being terminated */
+   struct util_dynarray remaining;
+   util_dynarray_init(&remaining, NULL);
+
    mtx_lock(&queue->lock);
    if (queue->num_threads == 0) {
       for (unsigned i = queue->read_idx; i != queue->write_idx;
            i = (i + 1) % queue->max_jobs) {
          if (queue->jobs[i].job) {
-            if (queue->jobs[i].fence)
-               util_queue_fence_signal(queue->jobs[i].fence);
+            util_dynarray_append(&remaining, struct util_queue_job,
+                                 queue->jobs[i]);
             queue->jobs[i].job = NULL;
          }
       }
@@ -314,6 +521,11 @@ util_queue_thread_func(void *input)
       queue->num_queued = 0;
    }
    mtx_unlock(&queue->lock);
+
+   /* Group jobs can add more jobs, so do it without the lock. */
+   util_dynarray_foreach(&remaining, struct util_queue_job, job)
+      util_queue_discard_job(queue, job);
+   util_dynarray_fini(&remaining);
    return 0;
 }
 
@@ -449,6 +661,19 @@ util_queue_init(struct util_queue *queue,
    if (!queue->threads)
       goto fail;
 
+   if (flags & UTIL_QUEUE_INIT_WORK_STEALING) {
+      queue->deques = (struct util_queue_deque *)
+         align_calloc(queue->max_threads * sizeof(struct util_queue_deque),
+                      CACHE_LINE_SIZE);
+      if (!queue->deques)
+         goto fail;
+
+      for (i = 0; i < queue->max_threads; i++) {
+         if (!util_queue_deque_init(&queue->deques[i], max_jobs))
+            goto fail;
+      }
+   }
+
    /* start threads */
    for (i = 0; i < queue->num_threads; i++) {
       if (!util_queue_create_thread(queue, i)) {
@@ -469,6 +694,12 @@ util_queue_init(struct util_queue *queue,
 fail:
    free(queue->threads);
 
+   if (queue->deques) {
+      for (i = 0; i < queue->max_threads; i++)
+         util_queue_deque_destroy(&queue->deques[i]);
+      align_free(queue->deques);
+   }
+
    if (queue->jobs) {
       cnd_destroy(&queue->has_space_cond);
       cnd_destroy(&queue->has_queued_cond);
@@ -507,6 +738,18 @@ util_queue_kill_threads(struct util_queue *queue, unsigned keep_num_threads,
       mtx_unlock(&queue->lock);
       for (unsigned i = keep_num_threads; i < old_num_threads; i++)
          thrd_join(queue->threads[i], NULL);
+
+      /* Jobs of terminated threads are stolen by the remaining ones, signal
+       * them if there are none left.
+       */
+      if (queue->deques && keep_num_threads == 0) {
+         struct util_queue_job job;
+         while (util_queue_get_job_ws(queue, 0, &job)) {
+            util_queue_discard_job(queue, &job);
+            util_queue_job_finished_ws(queue);
+         }
+      }
+
       if (locked)
          mtx_lock(&queue->lock);
    } else {
@@ -537,12 +780,68 @@ util_queue_destroy(struct util_queue *queue)
    mtx_destroy(&queue->lock);
    free(queue->jobs);
    free(queue->threads);
+
+   if (queue->deques) {
+      for (unsigned i = 0; i < queue->max_threads; i++)
+         util_queue_deque_destroy(&queue->deques[i]);
+      align_free(queue->deques);
+   }
+}
+
+static void
+util_queue_add_job_ws(struct util_queue *queue, const struct util_queue_job *job)
+{
+   if (p_atomic_read(&queue->num_threads) == 0) {
+      /* Shutting down, see util_queue_add_job_locked. */
+      util_queue_discard_job(queue, &(struct util_queue_job){
+         .job = job->job,
+         .global_data = queue->global_data,
+         .group = job->group,
+         .execute = job->execute,
+         .cleanup = job->cleanup,
+      });
+      return;
+   }
+
+   if (job->fence)
+      util_queue_fence_reset(job->fence);
+
+   /* Scale the number of threads up if there's already one job waiting. */
+   if (p_atomic_read(&queue->num_queued) > 0 &&
+       p_atomic_read(&queue->num_threads) < queue->max_threads) {
+      /* Re-check under the lock, a stale num_threads would kill threads. */
+      mtx_lock(&queue->lock);
+      if (queue->create_threads_on_demand &&
+          queue->num_threads < queue->max_threads)
+         util_queue_adjust_num_threads(queue, queue->num_threads + 1, true);
+      mtx_unlock(&queue->lock);
+   }
+
+   /* Jobs added by a job stay on the same thread unless stolen. */
+   unsigned index;
+   if (current_queue == queue) {
+      index = current_thread_index;
+   } else {
+      index = p_atomic_inc_return(&queue->next_deque) %
+              MAX2(p_atomic_read(&queue->num_threads), 1);
+   }
+
+   p_atomic_inc(&queue->num_unfinished);
+   util_queue_deque_push(&queue->deques[index], job);
+
+   p_atomic_inc(&queue->num_queued);
+   if (p_atomic_read(&queue->num_sleeping) > 0) {
+      mtx_lock(&queue->lock);
+      cnd_signal(&queue->has_queued_cond);
+      mtx_unlock(&queue->lock);
+   }
 }
 
 static void
 util_queue_add_job_locked(struct util_queue *queue,
                           void *job,
                           struct util_queue_fence *fence,
+                          struct util_queue_group *group,
                           util_queue_execute_func execute,
                           util_queue_execute_func cleanup,
                           const size_t job_size,
@@ -550,6 +849,21 @@ util_queue_add_job_locked(struct util_queue *queue,
 {
    struct util_queue_job *ptr;
 
+   if (queue->deques) {
+      assert(!locked);
+      struct util_queue_job ws_job = {
+         .job = job,
+         .global_data = queue->global_data,
+         .job_size = job_size,
+         .fence = fence,
+         .group = group,
+         .execute = execute,
+         .cleanup = cleanup,
+      };
+      util_queue_add_job_ws(queue, &ws_job);
+      return;
+   }
+
    if (!locked)
       mtx_lock(&queue->lock);
    if (queue->num_threads == 0) {
@@ -558,6 +872,13 @@ util_queue_add_job_locked(struct util_queue *queue,
       /* well no good option here, but any leaks will be
        * short-lived as things are shutting down..
        */
+      util_queue_discard_job(queue, &(struct util_queue_job){
+         .job = job,
+         .global_data = queue->global_data,
+         .group = group,
+         .execute = execute,
+         .cleanup = cleanup,
+      });
       return;
    }
 
@@ -614,6 +935,7 @@ util_queue_add_job_locked(struct util_queue *queue,
    ptr->job = job;
    ptr->global_data = queue->global_data;
    ptr->fence = fence;
+   ptr->group = group;
    ptr->execute = execute;
    ptr->cleanup = cleanup;
    ptr->job_size = job_size;
@@ -635,8 +957,8 @@ util_queue_add_job(struct util_queue *queue,
                    util_queue_execute_func cleanup,
                    const size_t job_size)
 {
-   util_queue_add_job_locked(queue, job, fence, execute, cleanup, job_size,
-                             false);
+   util_queue_add_job_locked(queue, job, fence, NULL, execute, cleanup,
+                             job_size, false);
 }
 
 /**
@@ -657,6 +979,33 @@ util_queue_drop_job(struct util_queue *queue, struct util_queue_fence *fence)
    if (util_queue_fence_is_signalled(fence))
       return;
 
+   if (queue->deques) {
+      for (unsigned d = 0; d < queue->max_threads && !removed; d++) {
+         struct util_queue_deque *deque = &queue->deques[d];
+
+         simple_mtx_lock(&deque->lock);
+         for (unsigned i = deque->top; i != deque->bottom; i++) {
+            struct util_queue_job *job = &deque->jobs[i & (deque->size - 1)];
+            if (job->job && job->fence == fence) {
+               if (job->cleanup)
+                  job->cleanup(job->job, queue->global_data, -1);
+
+               /* Just clear it. The threads will treat as a no-op job. */
+               job->job = NULL;
+               removed = true;
+               break;
+            }
+         }
+         simple_mtx_unlock(&deque->lock);
+      }
+
+      if (removed)
+         util_queue_fence_signal(fence);
+      else
+         util_queue_fence_wait(fence);
+      return;
+   }
+
    mtx_lock(&queue->lock);
    for (unsigned i = queue->read_idx; i != queue->write_idx;
         i = (i + 1) % queue->max_jobs) {
@@ -699,6 +1048,16 @@ util_queue_finish(struct util_queue *queue)
       return;
    }
 
+   /* With work stealing, the barrier jobs below could run before older
+    * jobs, so wait for the queue to be idle instead.
+    */
+   if (queue->deques) {
+      while (queue->num_threads && p_atomic_read(&queue->num_unfinished))
+         cnd_wait(&queue->has_space_cond, &queue->lock);
+      mtx_unlock(&queue->lock);
+      return;
+   }
+
    /* We need to disable adding new threads in util_queue_add_job because
     * the finish operation requires a fixed number of threads.
     *
@@ -712,7 +1071,7 @@ util_queue_finish(struct util_queue *queue)
 
    for (unsigned i = 0; i < queue->num_threads; ++i) {
       util_queue_fence_init(&fences[i]);
-      util_queue_add_job_locked(queue, &barrier, &fences[i],
+      util_queue_add_job_locked(queue, &barrier, &fences[i], NULL,
                                 util_queue_finish_execute, NULL, 0, true);
    }
    queue->create_threads_on_demand = true;
@@ -726,6 +1085,301 @@ util_queue_finish(struct util_queue *queue)
    free(fences);
 }
 
+/****************************************************************************
+ * util_queue_group
+ */
+
+void
+util_queue_group_init(struct util_queue_group *group, struct util_queue *queue)
+{
+   memset(group, 0, sizeof(*group));
+   group->queue = queue;
+   group->pending = 1;
+   simple_mtx_init(&group->lock, mtx_plain);
+   util_dynarray_init(&group->deferred, NULL);
+   util_dynarray_init(&group->successors, NULL);
+   util_queue_fence_init(&group->fence);
+   util_queue_fence_reset(&group->fence);
+}
+
+void
+util_queue_group_destroy(struct util_queue_group *group)
+{
+   util_queue_group_wait(group);
+
+   assert(!group->deferred.size && !group->successors.size);
+   util_dynarray_fini(&group->deferred);
+   util_dynarray_fini(&group->successors);
+   util_queue_fence_destroy(&group->fence);
+   simple_mtx_destroy(&group->lock);
+}
+
+void
+util_queue_group_add_dependency(struct util_queue_group *group,
+                                struct util_queue_group *dependency)
+{
+   /* No jobs yet: pending only holds the closing and blocked references. */
+   assert(!group->closed && group->pending == 1 + !!group->num_blockers);
+
+   simple_mtx_lock(&dependency->lock);
+   if (!dependency->finished) {
+      util_dynarray_append(&dependency->successors,
+                           struct util_queue_group *, group);
+
+      /* A blocked group can't finish even if it has no jobs, so that
+       * successors aren't released early.  Dropped by
+       * util_queue_group_unblock.
+       */
+      simple_mtx_lock(&group->lock);
+      if (!group->num_blockers++)
+         p_atomic_inc(&group->pending);
+      simple_mtx_unlock(&group->lock);
+   }
+   simple_mtx_unlock(&dependency->lock);
+}
+
+static void
+util_queue_group_unblock(struct util_queue_group *group)
+{
+   simple_mtx_lock(&group->lock);
+   assert(group->num_blockers > 0);
+   if (--group->num_blockers > 0) {
+      simple_mtx_unlock(&group->lock);
+      return;
+   }
+
+   struct util_dynarray deferred = group->deferred;
+   util_dynarray_init(&group->deferred, NULL);
+   simple_mtx_unlock(&group->lock);
+
+   util_dynarray_foreach(&deferred, struct util_queue_job, job) {
+      util_queue_add_job_locked(group->queue, job->job, NULL, group,
+                                job->execute, job->cleanup, job->job_size,
+                                false);
+   }
+   util_dynarray_fini(&deferred);
+
+   util_queue_group_job_done(group);
+}
+
+static void
+util_queue_group_job_done(struct util_queue_group *group)
+{
+   if (!p_atomic_dec_zero(&group->pending))
+      return;
+
+   simple_mtx_lock(&group->lock);
+   group->finished = true;
+   struct util_dynarray successors = group->successors;
+   util_dynarray_init(&group->successors, NULL);
+   simple_mtx_unlock(&group->lock);
+
+   util_dynarray_foreach(&successors, struct util_queue_group *, successor)
+      util_queue_group_unblock(*successor);
+   util_dynarray_fini(&successors);
+
+   /* Wake up threads sleeping in util_queue_group_wait. */
+   struct util_queue *queue = group->queue;
+   if (queue->deques) {
+      mtx_lock(&queue->lock);
+      cnd_broadcast(&queue->has_queued_cond);
+      mtx_unlock(&queue->lock);
+   }
+
+   /* The group may be destroyed as soon as this is signalled. */
+   util_queue_fence_signal(&group->fence);
+}
+
+void
+util_queue_group_add_job(struct util_queue_group *group,
+                         void *job,
+                         util_queue_execute_func execute,
+                         util_queue_execute_func cleanup,
+                         const size_t job_size)
+{
+   /* Only jobs of the group can add to it once it's closed. */
+   assert(p_atomic_read(&group->pending) > 0);
+   p_atomic_inc(&group->pending);
+
+   simple_mtx_lock(&group->lock);
+   if (group->num_blockers) {
+      struct util_queue_job deferred = {
+         .job = job,
+         .job_size = job_size,
+         .group = group,
+         .execute = execute,
+         .cleanup = cleanup,
+      };
+      util_dynarray_append(&group->deferred, struct util_queue_job, deferred);
+      simple_mtx_unlock(&group->lock);
+      return;
+   }
+   simple_mtx_unlock(&group->lock);
+
+   util_queue_add_job_locked(group->queue, job, NULL, group, execute, cleanup,
+                             job_size, false);
+}
+
+/**
+ * Declare that no more jobs will be added, so that the group can finish.
+ * Must not race with util_queue_group_add_job.
+ */
+void
+util_queue_group_close(struct util_queue_group *group)
+{
+   if (group->closed)
+      return;
+
+   group->closed = true;
+   util_queue_group_job_done(group);
+}
+
+/**
+ * Close the group and wait until it has finished.
+ */
+void
+util_queue_group_wait(struct util_queue_group *group)
+{
+   struct util_queue *queue = group->queue;
+
+   util_queue_group_close(group);
+
+   /* If every thread of the queue blocked here, nothing would run the jobs
+    * of the group.  Run jobs while waiting instead, which FIFO queues can't
+    * do because it would run them out of order.
+    */
+   if (current_queue == queue) {
+      assert(queue->deques && "nested waits need UTIL_QUEUE_INIT_WORK_STEALING");
+
+      while (!p_atomic_read(&group->finished)) {
+         struct util_queue_job job;
+
+         if (util_queue_get_job_ws(queue, current_thread_index, &job)) {
+            util_queue_execute_job(&job, current_thread_index);
+            util_queue_job_finished_ws(queue);
+            continue;
+         }
+
+         /* The remaining jobs run on other threads.  Sleep until a job is
+          * added or util_queue_group_job_done sets finished, which it does
+          * before broadcasting under the lock.
+          */
+         mtx_lock(&queue->lock);
+         p_atomic_inc(&queue->num_sleeping);
+         while (!p_atomic_read(&group->finished) &&
+                p_atomic_read(&queue->num_queued) == 0 &&
+                current_thread_index < (int)queue->num_threads)
+            cnd_wait(&queue->has_queued_cond, &queue->lock);
+         p_atomic_dec(&queue->num_sleeping);
+         mtx_unlock(&queue->lock);
+      }
+   }
+
+   util_queue_fence_wait(&group->fence);
+}
+
+/****************************************************************************
+ * util_queue_parallel_for
+ */
+
+struct util_queue_parallel_for {
+   util_queue_parallel_func func;
+   void *data;
+   unsigned count;
+   unsigned grain;
+   unsigned num_chunks;
+   unsigned next_chunk;
+   unsigned num_chunks_done;
+   int refcount;
+   struct util_queue_fence done;
+};
+
+static void
+util_queue_parallel_for_unref(struct util_queue_parallel_for *pf)
+{
+   if (p_atomic_dec_zero(&pf->refcount)) {
+      util_queue_fence_destroy(&pf->done);
+      free(pf);
+   }
+}
+
+static void
+util_queue_parallel_for_execute(void *job, void *gdata, int thread_index)
+{
+   struct util_queue_parallel_for *pf = job;
+   unsigned chunk;
+
+   while ((chunk = p_atomic_inc_return(&pf->next_chunk) - 1) < pf->num_chunks) {
+      unsigned start = chunk * pf->grain;
+
+      pf->func(pf->data, start, MIN2(start + pf->grain, pf->count),
+               thread_index);
+
+      if (p_atomic_inc_return(&pf->num_chunks_done) == pf->num_chunks)
+         util_queue_fence_signal(&pf->done);
+   }
+}
+
+static void
+util_queue_parallel_for_cleanup(void *job, void *gdata, int thread_index)
+{
+   util_queue_parallel_for_unref(job);
+}
+
+void
+util_queue_parallel_for(struct util_queue *queue,
+                        unsigned count, unsigned grain,
+                        util_queue_parallel_func func, void *data)
+{
+   if (!count)
+      return;
+
+   grain = MAX2(grain, 1);
+   unsigned num_chunks = DIV_ROUND_UP(count, grain);
+   bool in_queue = current_queue == queue;
+
+   if (num_chunks == 1 && in_queue) {
+      func(data, 0, count, current_thread_index);
+      return;
+   }
+
+   /* Jobs would be dropped, e.g. after the atexit handler. */
+   if (!p_atomic_read(&queue->num_threads)) {
+      func(data, 0, count, 0);
+      return;
+   }
+
+   struct util_queue_parallel_for *pf =
+      (struct util_queue_parallel_for *)calloc(1, sizeof(*pf));
+   assert(pf);
+
+   pf->func = func;
+   pf->data = data;
+   pf->count = count;
+   pf->grain = grain;
+   pf->num_chunks = num_chunks;
+   util_queue_fence_init(&pf->done);
+   util_queue_fence_reset(&pf->done);
+
+   /* The calling thread takes chunks too, so that the loop completes even
+    * if the jobs are discarded because the queue is shutting down.
+    */
+   unsigned num_jobs = MIN2(num_chunks - 1, queue->max_threads);
+   pf->refcount = num_jobs + 1;
+
+   for (unsigned i = 0; i < num_jobs; i++) {
+      util_queue_add_job(queue, pf, NULL, util_queue_parallel_for_execute,
+                         util_queue_parallel_for_cleanup, 0);
+   }
+
+   util_queue_parallel_for_execute(pf, NULL,
+                                   in_queue ? current_thread_index : 0);
+
+   /* Jobs that start after this only find that there are no chunks left. */
+   util_queue_fence_wait(&pf->done);
+   util_queue_parallel_for_unref(pf);
+}
+
 int64_t
 util_queue_get_thread_time_nano(struct util_queue *queue, unsigned thread_index)
 {
@@ -28,6 +28,17 @@
  *
  * Jobs can be added from any thread. After that, the wait call can be used
  * to wait for completion of the job.
+ *
+ * With UTIL_QUEUE_INIT_WORK_STEALING, every thread has its own deque instead
+ * of all threads sharing one ring buffer and lock: jobs added from outside
+ * are spread over the deques, jobs added by a job go to the deque of the
+ * thread running it, and idle threads steal from the others.  Jobs are no
+ * longer started in submission order, and max_jobs is only the initial deque
+ * size.
+ *
+ * Jobs can be grouped with util_queue_group, which can in turn depend on
+ * other groups, and util_queue_parallel_for() splits a loop over the
+ * threads.  Both work with either kind of queue.
  */
 
 #ifndef U_QUEUE_H
@@ -40,6 +51,7 @@
 #include "util/futex.h"
 #include "util/list.h"
 #include "util/macros.h"
+#include "util/u_dynarray.h"
 #include "util/os_time.h"
 #include "util/u_atomic.h"
 #include "util/u_thread.h"
@@ -51,6 +63,7 @@ extern "C" {
 #define UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY      (1 << 0)
 #define UTIL_QUEUE_INIT_RESIZE_IF_FULL            (1 << 1)
 #define UTIL_QUEUE_INIT_SET_FULL_THREAD_AFFINITY  (1 << 2)
+#define UTIL_QUEUE_INIT_WORK_STEALING             (1 << 3)
 
 #if UTIL_FUTEX_SUPPORTED
 #define UTIL_QUEUE_FENCE_FUTEX
@@ -211,15 +224,20 @@ util_queue_fence_wait_timeout(struct util_queue_fence *fence,
 
 typedef void (*util_queue_execute_func)(void *job, void *gdata, int thread_index);
 
+struct util_queue_group;
+
 struct util_queue_job {
    void *job;
    void *global_data;
    size_t job_size;
    struct util_queue_fence *fence;
+   struct util_queue_group *group;
    util_queue_execute_func execute;
    util_queue_execute_func cleanup;
 };
 
+struct util_queue_deque;
+
 /* Put this into your context. */
 struct util_queue {
    char name[14]; /* 13 characters = the thread name without the index */
@@ -238,6 +256,14 @@ struct util_queue {
    struct util_queue_job *jobs;
    void *global_data;
 
+   /* UTIL_QUEUE_INIT_WORK_STEALING: num_queued is updated atomically and
+    * counts the jobs in all deques, and lock only protects sleeping.
+    */
+   struct util_queue_deque *deques; /* one per thread */
+   unsigned next_deque;             /* for jobs added from outside */
+   int num_sleeping;
+   int num_unfinished;              /* for util_queue_finish */
+
    /* for cleanup at exit(), protected by exit_mutex */
    struct list_head head;
 };
@@ -260,8 +286,80 @@ void util_queue_add_job(struct util_queue *queue,
 void util_queue_drop_job(struct util_queue *queue,
                          struct util_queue_fence *fence);
 
+/* Wait until all previously added jobs have completed.  With
+ * UTIL_QUEUE_INIT_WORK_STEALING, this waits for the queue to be idle
+ * instead, so jobs added by other threads in the meantime are waited for
+ * too.
+ */
 void util_queue_finish(struct util_queue *queue);
 
+/* A set of jobs that can be waited for together, and that can be made to
+ * start only once other groups have finished.
+ *
+ *    util_queue_group_init(&link, queue);
+ *    util_queue_group_add_dependency(&link, &compile);
+ *    util_queue_group_add_job(&link, ...);
+ *    util_queue_group_close(&link);
+ *
+ *    util_queue_group_add_job(&compile, ...);
+ *    util_queue_group_add_job(&compile, ...);
+ *    util_queue_group_wait(&compile);
+ *
+ * A group finishes once it has been closed (util_queue_group_wait() closes
+ * it too) and all of its jobs are done, so its jobs can add more jobs to it
+ * even after it's closed.  Dependencies must be added before the group's
+ * first job, and must not form cycles.  A group with dependencies doesn't
+ * finish before they do, even if it has no jobs.
+ *
+ * util_queue_group_wait() can be called from a job of the same queue only
+ * with UTIL_QUEUE_INIT_WORK_STEALING, in which case the thread runs other
+ * jobs while waiting.
+ */
+struct util_queue_group {
+   struct util_queue *queue;
+   struct util_queue_fence fence; /* signalled when the group finishes */
+   simple_mtx_t lock;
+   int pending;                   /* unfinished jobs, +1 until closed,
+                                   * +1 while blocked */
+   bool closed;
+   bool finished;                 /* protected by lock */
+   unsigned num_blockers;         /* unfinished dependencies, protected by lock */
+   struct util_dynarray deferred; /* jobs waiting for num_blockers == 0 */
+   struct util_dynarray successors; /* groups depending on this one */
+};
+
+void util_queue_group_init(struct util_queue_group *group,
+                           struct util_queue *queue);
+void util_queue_group_destroy(struct util_queue_group *group);
+void util_queue_group_add_dependency(struct util_queue_group *group,
+                                     struct util_queue_group *dependency);
+void util_queue_group_add_job(struct util_queue_group *group,
+                              void *job,
+                              util_queue_execute_func execute,
+                              util_queue_execute_func cleanup,
+                              const size_t job_size);
+void util_queue_group_close(struct util_queue_group *group);
+void util_queue_group_wait(struct util_queue_group *group);
+
+static inline bool
+util_queue_group_is_finished(struct util_queue_group *group)
+{
+   return util_queue_fence_is_signalled(&group->fence);
+}
+
+typedef void (*util_queue_parallel_func)(void *data, unsigned start,
+                                         unsigned end, int thread_index);
+
+/* Calls func on chunks of at most grain items covering [0, count) from the
+ * queue's threads, and returns when all of them are done.  The calling
+ * thread processes chunks as well instead of just waiting, so this can be
+ * nested in a job of the same queue.  Chunks run by a thread that isn't one
+ * of the queue's get thread_index 0.
+ */
+void util_queue_parallel_for(struct util_queue *queue,
+                             unsigned count, unsigned grain,
+                             util_queue_parallel_func func, void *data);
+
 /* Adjust the number of active threads. The new number of threads can't be
  * greater than the initial number of threads at the creation of the queue,
  * and it can't be less than 1.
@@ -0,0 +1,188 @@
+/*
+ * Copyright 2024 Mesa contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * @file
+ * Multi-threaded lookup/insert throughput of vk_pipeline_cache.
+ *
+ * Every thread looks up random keys among a pre-populated set, and adds a
+ * new object every so often, like pipeline compile threads hitting a warm
+ * cache.
+ *
+ *    vk_pipeline_cache_bench [max threads] [ops per thread]
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "c11/threads.h"
+#include "util/os_time.h"
+#include "util/u_atomic.h"
+
+#include "vk_alloc.h"
+#include "vk_device.h"
+#include "vk_physical_device.h"
+#include "vk_pipeline_cache.h"
+
+#define NUM_KEYS        4096
+#define INSERT_INTERVAL 16
+
+struct bench_key {
+   uint32_t id;
+   uint32_t pad[4];
+};
+
+struct bench_thread {
+   thrd_t thread;
+   struct vk_device *device;
+   struct vk_pipeline_cache *cache;
+   uint32_t index;
+   uint32_t num_ops;
+   uint32_t hits;
+};
+
+static uint32_t next_key_id = NUM_KEYS;
+
+static VKAPI_ATTR void VKAPI_CALL
+bench_GetPhysicalDeviceProperties(VkPhysicalDevice physicalDevice,
+                                  VkPhysicalDeviceProperties *pProperties)
+{
+   memset(pProperties, 0, sizeof(*pProperties));
+}
+
+static void
+add_key(struct vk_device *device, struct vk_pipeline_cache *cache, uint32_t id)
+{
+   struct bench_key key = { .id = id };
+   uint64_t data = id;
+
+   struct vk_raw_data_cache_object *object =
+      vk_raw_data_cache_object_create(device, &key, sizeof(key),
+                                      &data, sizeof(data));
+   if (!object)
+      return;
+
+   struct vk_pipeline_cache_object *cached =
+      vk_pipeline_cache_add_object(cache, &object->base);
+   vk_pipeline_cache_object_unref(device, cached);
+}
+
+static int
+bench_thread_func(void *data)
+{
+   struct bench_thread *t = data;
+   uint32_t rand = 0x9e3779b9 * (t->index + 1);
+
+   for (uint32_t i = 0; i < t->num_ops; i++) {
+      rand ^= rand << 13;
+      rand ^= rand >> 17;
+      rand ^= rand << 5;
+
+      if (i % INSERT_INTERVAL == INSERT_INTERVAL - 1) {
+         add_key(t->device, t->cache, p_atomic_inc_return(&next_key_id));
+         continue;
+      }
+
+      struct bench_key key = { .id = rand % NUM_KEYS };
+      bool cache_hit;
+      struct vk_pipeline_cache_object *object =
+         vk_pipeline_cache_lookup_object(t->cache, &key, sizeof(key),
+                                         &vk_raw_data_cache_object_ops,
+                                         &cache_hit);
+      if (object) {
+         t->hits += cache_hit;
+         vk_pipeline_cache_object_unref(t->device, object);
+      }
+   }
+
+   return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+   unsigned max_threads = argc > 1 ? atoi(argv[1]) : 16;
+   uint32_t num_ops = argc > 2 ? atoi(argv[2]) : 200000;
+
+   /* Just enough of a device for the pipeline cache */
+   struct vk_physical_device pdevice = {
+      .base.type = VK_OBJECT_TYPE_PHYSICAL_DEVICE,
+   };
+   pdevice.dispatch_table.GetPhysicalDeviceProperties =
+      bench_GetPhysicalDeviceProperties;
+
+   struct vk_device device = {
+      .base.type = VK_OBJECT_TYPE_DEVICE,
+      .alloc = *vk_default_allocator(),
+      .physical = &pdevice,
+   };
+
+   struct bench_thread *threads = calloc(max_threads, sizeof(*threads));
+   if (!threads)
+      return EXIT_FAILURE;
+
+   printf("%8s %14s %10s\n", "threads", "ops/s", "speedup");
+
+   double base_rate = 0;
+   for (unsigned num_threads = 1; num_threads <= max_threads;
+        num_threads *= 2) {
+      struct vk_pipeline_cache_create_info info = {
+         .force_enable = true,
+         .skip_disk_cache = true,
+      };
+      struct vk_pipeline_cache *cache =
+         vk_pipeline_cache_create(&device, &info, NULL);
+      if (!cache) {
+         free(threads);
+         return EXIT_FAILURE;
+      }
+
+      for (uint32_t id = 0; id < NUM_KEYS; id++)
+         add_key(&device, cache, id);
+
+      int64_t start = os_time_get_nano();
+
+      for (unsigned i = 0; i < num_threads; i++) {
+         threads[i] = (struct bench_thread) {
+            .device = &device,
+            .cache = cache,
+            .index = i,
+            .num_ops = num_ops,
+         };
+         thrd_create(&threads[i].thread, bench_thread_func, &threads[i]);
+      }
+
+      uint64_t hits = 0;
+      for (unsigned i = 0; i < num_threads; i++) {
+         thrd_join(threads[i].thread, NULL);
+         hits += threads[i].hits;
+      }
+
+      int64_t elapsed = os_time_get_nano() - start;
+      double rate = (double)num_threads * num_ops * 1e9 / elapsed;
+      if (num_threads == 1)
+         base_rate = rate;
+
+      printf("%8u %14.0f %9.2fx\n", num_threads, rate, rate / base_rate);
+
+      /* All lookups are for keys added up front */
+      const uint64_t num_lookups =
+         (uint64_t)num_threads * (num_ops - num_ops / INSERT_INTERVAL);
+      if (hits != num_lookups) {
+         fprintf(stderr, "%" PRIu64 " lookups out of %" PRIu64 " missed\n",
+                 num_lookups - hits, num_lookups);
+         vk_pipeline_cache_destroy(cache, NULL);
+         free(threads);
+         return EXIT_FAILURE;
+      }
+
+      vk_pipeline_cache_destroy(cache, NULL);
+   }
+
+   free(threads);
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,350 @@
+/*
+ * Copyright 2024 Mesa contributors
+ * SPDX-License-Identifier: MIT
+ */
+
+/**
+ * @file
+ * Lazy loading of vk_pipeline_cache initial data.
+ *
+ * Serializes a cache of raw data objects, loads it back lazily, looks up
+ * some or all of the objects and checks what is handed out, what is
+ * serialized again and that the copy of the initial data is freed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "vk_alloc.h"
+#include "vk_common_entrypoints.h"
+#include "vk_device.h"
+#include "vk_physical_device.h"
+#include "vk_pipeline_cache.h"
+
+#define NUM_OBJECTS 64
+#define DATA_SIZE   1024
+
+#define ALLOC_HEADER_SIZE 64
+
+struct test_key {
+   uint32_t id;
+   uint32_t pad[3];
+};
+
+/* Live allocations, and how many of them can hold a copy of the blob. */
+static size_t num_allocs;
+static size_t num_large_allocs;
+static size_t large_alloc_size = SIZE_MAX;
+
+static int failures;
+
+#define CHECK(cond)                                                    \
+   do {                                                                \
+      if (!(cond)) {                                                   \
+         fprintf(stderr, "%s:%d: check failed: %s\n",                  \
+                 __FILE__, __LINE__, #cond);                           \
+         failures++;                                                   \
+      }                                                                \
+   } while (0)
+
+static void
+track_alloc(size_t size, int delta)
+{
+   num_allocs += delta;
+   if (size >= large_alloc_size)
+      num_large_allocs += delta;
+}
+
+static VKAPI_ATTR void * VKAPI_CALL
+test_alloc(void *pUserData, size_t size, size_t align,
+           VkSystemAllocationScope allocationScope)
+{
+   if (align > ALLOC_HEADER_SIZE)
+      return NULL;
+
+   char *mem = malloc(ALLOC_HEADER_SIZE + size);
+   if (mem == NULL)
+      return NULL;
+
+   memcpy(mem, &size, sizeof(size));
+   track_alloc(size, 1);
+   return mem + ALLOC_HEADER_SIZE;
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+test_free(void *pUserData, void *pMemory)
+{
+   if (pMemory == NULL)
+      return;
+
+   char *mem = (char *)pMemory - ALLOC_HEADER_SIZE;
+   size_t size;
+   memcpy(&size, mem, sizeof(size));
+   track_alloc(size, -1);
+   free(mem);
+}
+
+static VKAPI_ATTR void * VKAPI_CALL
+test_realloc(void *pUserData, void *pOriginal, size_t size, size_t align,
+             VkSystemAllocationScope allocationScope)
+{
+   void *mem = test_alloc(pUserData, size, align, allocationScope);
+   if (mem == NULL || pOriginal == NULL)
+      return mem;
+
+   size_t old_size;
+   memcpy(&old_size, (char *)pOriginal - ALLOC_HEADER_SIZE, sizeof(old_size));
+   memcpy(mem, pOriginal, MIN2(old_size, size));
+   test_free(pUserData, pOriginal);
+   return mem;
+}
+
+static VKAPI_ATTR void VKAPI_CALL
+test_GetPhysicalDeviceProperties(VkPhysicalDevice physicalDevice,
+                                 VkPhysicalDeviceProperties *pProperties)
+{
+   memset(pProperties, 0, sizeof(*pProperties));
+}
+
+static void
+fill_data(uint8_t *data, uint32_t id)
+{
+   for (uint32_t i = 0; i < DATA_SIZE; i++)
+      data[i] = (uint8_t)(id * 31 + i);
+}
+
+static struct vk_pipeline_cache *
+create_cache(struct vk_device *device, const void *data, size_t size,
+             bool lazy)
+{
+   const VkPipelineCacheCreateInfo create_info = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+      .initialDataSize = size,
+      .pInitialData = data,
+   };
+   struct vk_pipeline_cache_create_info info = {
+      .pCreateInfo = &create_info,
+      .force_enable = true,
+      .skip_disk_cache = true,
+      .lazy_load = lazy,
+   };
+   return vk_pipeline_cache_create(device, &info, NULL);
+}
+
+static void *
+get_cache_data(struct vk_device *device, struct vk_pipeline_cache *cache,
+               size_t *size)
+{
+   VkDevice _device = vk_device_to_handle(device);
+   VkPipelineCache _cache = vk_pipeline_cache_to_handle(cache);
+
+   *size = 0;
+   if (vk_common_GetPipelineCacheData(_device, _cache, size, NULL) !=
+       VK_SUCCESS)
+      return NULL;
+
+   void *data = malloc(*size);
+   if (data == NULL)
+      return NULL;
+
+   if (vk_common_GetPipelineCacheData(_device, _cache, size, data) !=
+       VK_SUCCESS) {
+      free(data);
+      return NULL;
+   }
+
+   return data;
+}
+
+static struct vk_pipeline_cache_object *
+lookup(struct vk_pipeline_cache *cache, uint32_t id)
+{
+   struct test_key key = { .id = id };
+   bool cache_hit;
+   struct vk_pipeline_cache_object *object =
+      vk_pipeline_cache_lookup_object(cache, &key, sizeof(key),
+                                      &vk_raw_data_cache_object_ops,
+                                      &cache_hit);
+   CHECK(object == NULL || cache_hit);
+   return object;
+}
+
+static bool
+object_has_data(struct vk_pipeline_cache_object *object, uint32_t id)
+{
+   struct vk_raw_data_cache_object *data_obj =
+      container_of(object, struct vk_raw_data_cache_object, base);
+   uint8_t expected[DATA_SIZE];
+
+   fill_data(expected, id);
+   return data_obj->data_size == DATA_SIZE &&
+          memcmp(data_obj->data, expected, DATA_SIZE) == 0;
+}
+
+static void *
+create_blob(struct vk_device *device, size_t *size)
+{
+   struct vk_pipeline_cache *cache = create_cache(device, NULL, 0, false);
+   if (cache == NULL)
+      return NULL;
+
+   for (uint32_t id = 0; id < NUM_OBJECTS; id++) {
+      struct test_key key = { .id = id };
+      uint8_t data[DATA_SIZE];
+
+      fill_data(data, id);
+      struct vk_raw_data_cache_object *object =
+         vk_raw_data_cache_object_create(device, &key, sizeof(key),
+                                         data, sizeof(data));
+      CHECK(object != NULL);
+      if (object == NULL)
+         continue;
+
+      vk_pipeline_cache_object_unref(device,
+         vk_pipeline_cache_add_object(cache, &object->base));
+   }
+
+   void *blob = get_cache_data(device, cache, size);
+   vk_pipeline_cache_destroy(cache, NULL);
+   return blob;
+}
+
+/* Look up half of the objects, serialize, and destroy the cache while the
+ * objects looked up are still referenced.
+ */
+static void
+test_lookup_subset(struct vk_device *device, const void *blob, size_t size)
+{
+   const size_t allocs_before = num_allocs;
+
+   struct vk_pipeline_cache *cache = create_cache(device, blob, size, true);
+   CHECK(cache != NULL);
+   if (cache == NULL)
+      return;
+
+   CHECK(vk_pipeline_cache_num_objects(cache) == NUM_OBJECTS);
+   CHECK(num_large_allocs == 1);
+
+   struct vk_pipeline_cache_object *objects[NUM_OBJECTS / 2];
+   for (uint32_t id = 0; id < NUM_OBJECTS / 2; id++) {
+      objects[id] = lookup(cache, id);
+      CHECK(objects[id] != NULL);
+      CHECK(objects[id] == NULL || object_has_data(objects[id], id));
+   }
+
+   /* Objects that weren't looked up still point into the copy */
+   CHECK(num_large_allocs == 1);
+
+   /* Serializing writes looked up and untouched objects alike */
+   size_t new_size;
+   void *new_blob = get_cache_data(device, cache, &new_size);
+   CHECK(new_blob != NULL);
+   CHECK(new_size == size);
+
+   vk_pipeline_cache_destroy(cache, NULL);
+   CHECK(num_large_allocs == 0);
+
+   for (uint32_t id = 0; id < NUM_OBJECTS / 2; id++) {
+      if (objects[id] == NULL)
+         continue;
+
+      CHECK(object_has_data(objects[id], id));
+      vk_pipeline_cache_object_unref(device, objects[id]);
+   }
+
+   /* The serialized data loads back with every object in it */
+   if (new_blob != NULL) {
+      cache = create_cache(device, new_blob, new_size, false);
+      CHECK(cache != NULL);
+      for (uint32_t id = 0; cache != NULL && id < NUM_OBJECTS; id++) {
+         struct vk_pipeline_cache_object *object = lookup(cache, id);
+         CHECK(object != NULL);
+         if (object == NULL)
+            continue;
+
+         CHECK(object_has_data(object, id));
+         vk_pipeline_cache_object_unref(device, object);
+      }
+      if (cache != NULL)
+         vk_pipeline_cache_destroy(cache, NULL);
+      free(new_blob);
+   }
+
+   CHECK(num_allocs == allocs_before);
+}
+
+/* The copy of the initial data goes away once all objects were looked up. */
+static void
+test_lookup_all(struct vk_device *device, const void *blob, size_t size)
+{
+   const size_t allocs_before = num_allocs;
+
+   struct vk_pipeline_cache *cache = create_cache(device, blob, size, true);
+   CHECK(cache != NULL);
+   if (cache == NULL)
+      return;
+
+   for (uint32_t id = 0; id < NUM_OBJECTS; id++) {
+      CHECK(num_large_allocs == 1);
+
+      struct vk_pipeline_cache_object *object = lookup(cache, id);
+      CHECK(object != NULL);
+      if (object == NULL)
+         continue;
+
+      CHECK(object_has_data(object, id));
+      vk_pipeline_cache_object_unref(device, object);
+   }
+
+   CHECK(num_large_allocs == 0);
+   CHECK(vk_pipeline_cache_num_objects(cache) == NUM_OBJECTS);
+
+   /* Looking up again hits the copies */
+   for (uint32_t id = 0; id < NUM_OBJECTS; id++) {
+      struct vk_pipeline_cache_object *object = lookup(cache, id);
+      CHECK(object != NULL && object_has_data(object, id));
+      if (object != NULL)
+         vk_pipeline_cache_object_unref(device, object);
+   }
+
+   vk_pipeline_cache_destroy(cache, NULL);
+   CHECK(num_allocs == allocs_before);
+}
+
+int
+main(void)
+{
+   /* Just enough of a device for the pipeline cache */
+   struct vk_physical_device pdevice = {
+      .base.type = VK_OBJECT_TYPE_PHYSICAL_DEVICE,
+   };
+   pdevice.dispatch_table.GetPhysicalDeviceProperties =
+      test_GetPhysicalDeviceProperties;
+
+   struct vk_device device = {
+      .base.type = VK_OBJECT_TYPE_DEVICE,
+      .alloc = {
+         .pfnAllocation = test_alloc,
+         .pfnReallocation = test_realloc,
+         .pfnFree = test_free,
+      },
+      .physical = &pdevice,
+   };
+
+   size_t size;
+   void *blob = create_blob(&device, &size);
+   if (blob == NULL) {
+      fprintf(stderr, "failed to create the initial data\n");
+      return EXIT_FAILURE;
+   }
+
+   CHECK(size > NUM_OBJECTS * DATA_SIZE);
+   large_alloc_size = size;
+
+   test_lookup_subset(&device, blob, size);
+   test_lookup_all(&device, blob, size);
+
+   free(blob);
+   return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
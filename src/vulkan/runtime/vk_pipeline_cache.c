@@ -117,6 +117,81 @@ vk_raw_data_cache_object_create(struct vk_device *device,
    return data_obj;
 }
 
+/* Copy of the initial data of a lazily loaded cache, shared by the objects
+ * pointing into it.
+ */
+struct vk_pipeline_cache_data {
+   uint32_t ref_cnt;
+
+   /* uint64_t so the copy is aligned to VK_PIPELINE_CACHE_BLOB_ALIGN */
+   uint64_t data[];
+};
+
+struct vk_lazy_cache_object {
+   struct vk_raw_data_cache_object base;
+
+   /* Object type in the initial data, so it's written back out the same */
+   int32_t type;
+
+   struct vk_pipeline_cache_data *backing;
+};
+
+static void
+vk_lazy_cache_object_destroy(struct vk_device *device,
+                             struct vk_pipeline_cache_object *object)
+{
+   struct vk_lazy_cache_object *lazy_obj =
+      container_of(object, struct vk_lazy_cache_object, base.base);
+
+   if (p_atomic_dec_zero(&lazy_obj->backing->ref_cnt))
+      vk_free(&device->alloc, lazy_obj->backing);
+
+   vk_free(&device->alloc, lazy_obj);
+}
+
+/* Raw data objects still pointing into the initial data.  Nothing is ever
+ * deserialized into one, they're only created by vk_pipeline_cache_load().
+ */
+static const struct vk_pipeline_cache_object_ops vk_lazy_cache_object_ops = {
+   .serialize = vk_raw_data_cache_object_serialize,
+   .destroy = vk_lazy_cache_object_destroy,
+};
+
+static struct vk_lazy_cache_object *
+vk_lazy_cache_object_create(struct vk_device *device,
+                            struct vk_pipeline_cache_data *backing,
+                            int32_t type,
+                            const void *key_data, uint32_t key_size,
+                            const void *data, size_t data_size)
+{
+   struct vk_lazy_cache_object *lazy_obj =
+      vk_alloc(&device->alloc, sizeof(*lazy_obj), 8,
+               VK_SYSTEM_ALLOCATION_SCOPE_DEVICE);
+   if (lazy_obj == NULL)
+      return NULL;
+
+   vk_pipeline_cache_object_init(device, &lazy_obj->base.base,
+                                 &vk_lazy_cache_object_ops,
+                                 key_data, key_size);
+   lazy_obj->base.data = data;
+   lazy_obj->base.data_size = data_size;
+   lazy_obj->type = type;
+   lazy_obj->backing = backing;
+   p_atomic_inc(&backing->ref_cnt);
+
+   return lazy_obj;
+}
+
+/* Whether the object is serialized data which still has to be deserialized
+ * into the real object on lookup.
+ */
+static bool
+vk_pipeline_cache_object_is_raw(const struct vk_pipeline_cache_object *object)
+{
+   return object->ops == &vk_raw_data_cache_object_ops ||
+          object->ops == &vk_lazy_cache_object_ops;
+}
+
 static bool
 object_keys_equal(const void *void_a, const void *void_b)
 {
@@ -134,35 +209,46 @@ object_key_hash(const void *void_object)
    return _mesa_hash_data(object->key_data, object->key_size);
 }
 
-static void
-vk_pipeline_cache_lock(struct vk_pipeline_cache *cache)
+/* The sets index their buckets with the low bits of the hash, so pick the
+ * shard with the high ones.
+ */
+static struct vk_pipeline_cache_shard *
+vk_pipeline_cache_shard(struct vk_pipeline_cache *cache, uint32_t hash)
 {
+   return &cache->shards[hash >> (32 - VK_PIPELINE_CACHE_SHARD_BITS)];
+}
 
+static void
+vk_pipeline_cache_lock(struct vk_pipeline_cache *cache,
+                       struct vk_pipeline_cache_shard *shard)
+{
    if (!(cache->flags & VK_PIPELINE_CACHE_CREATE_EXTERNALLY_SYNCHRONIZED_BIT))
-      simple_mtx_lock(&cache->lock);
+      simple_mtx_lock(&shard->lock);
 }
 
 static void
-vk_pipeline_cache_unlock(struct vk_pipeline_cache *cache)
+vk_pipeline_cache_unlock(struct vk_pipeline_cache *cache,
+                         struct vk_pipeline_cache_shard *shard)
 {
    if (!(cache->flags & VK_PIPELINE_CACHE_CREATE_EXTERNALLY_SYNCHRONIZED_BIT))
-      simple_mtx_unlock(&cache->lock);
+      simple_mtx_unlock(&shard->lock);
 }
 
-/* cache->lock must be held when calling */
+/* shard->lock must be held when calling */
 static void
 vk_pipeline_cache_remove_object(struct vk_pipeline_cache *cache,
+                                struct vk_pipeline_cache_shard *shard,
                                 uint32_t hash,
                                 struct vk_pipeline_cache_object *object)
 {
    struct set_entry *entry =
-      _mesa_set_search_pre_hashed(cache->object_cache, hash, object);
+      _mesa_set_search_pre_hashed(shard->objects, hash, object);
    if (entry && entry->key == (const void *)object) {
       /* Drop the reference owned by the cache */
       if (!cache->weak_ref)
          vk_pipeline_cache_object_unref(cache->base.device, object);
 
-      _mesa_set_remove(cache->object_cache, entry);
+      _mesa_set_remove(shard->objects, entry);
    }
 }
 
@@ -185,13 +271,15 @@ vk_pipeline_cache_object_unref(struct vk_device *device, struct vk_pipeline_cach
       if (p_atomic_dec_zero(&object->ref_cnt))
          object->ops->destroy(device, object);
    } else {
-      vk_pipeline_cache_lock(weak_owner);
+      uint32_t hash = object_key_hash(object);
+      struct vk_pipeline_cache_shard *shard =
+         vk_pipeline_cache_shard(weak_owner, hash);
+
+      vk_pipeline_cache_lock(weak_owner, shard);
       bool destroy = p_atomic_dec_zero(&object->ref_cnt);
-      if (destroy) {
-         uint32_t hash = object_key_hash(object);
-         vk_pipeline_cache_remove_object(weak_owner, hash, object);
-      }
-      vk_pipeline_cache_unlock(weak_owner);
+      if (destroy)
+         vk_pipeline_cache_remove_object(weak_owner, shard, hash, object);
+      vk_pipeline_cache_unlock(weak_owner, shard);
       if (destroy)
          object->ops->destroy(device, object);
    }
@@ -284,15 +372,16 @@ vk_pipeline_cache_insert_object(struct vk_pipeline_cache *cache,
 {
    assert(object->ops != NULL);
 
-   if (cache->object_cache == NULL)
+   if (cache->shards == NULL)
       return object;
 
    uint32_t hash = object_key_hash(object);
+   struct vk_pipeline_cache_shard *shard = vk_pipeline_cache_shard(cache, hash);
 
-   vk_pipeline_cache_lock(cache);
+   vk_pipeline_cache_lock(cache, shard);
    bool found = false;
    struct set_entry *entry = _mesa_set_search_or_add_pre_hashed(
-       cache->object_cache, hash, object, &found);
+       shard->objects, hash, object, &found);
 
    struct vk_pipeline_cache_object *result = NULL;
    /* add reference to either the found or inserted object */
@@ -301,7 +390,7 @@ vk_pipeline_cache_insert_object(struct vk_pipeline_cache *cache,
        if (found_object->ops != object->ops) {
           /* The found object in the cache isn't fully formed. Replace it. */
           assert(!cache->weak_ref);
-          assert(found_object->ops == &vk_raw_data_cache_object_ops);
+          assert(vk_pipeline_cache_object_is_raw(found_object));
           assert(object->ref_cnt == 1);
           entry->key = object;
           object = found_object;
@@ -315,7 +404,7 @@ vk_pipeline_cache_insert_object(struct vk_pipeline_cache *cache,
       else
          vk_pipeline_cache_object_weak_ref(cache, result);
    }
-   vk_pipeline_cache_unlock(cache);
+   vk_pipeline_cache_unlock(cache, shard);
 
    if (found) {
       vk_pipeline_cache_object_unref(cache->base.device, object);
@@ -343,21 +432,24 @@ vk_pipeline_cache_lookup_object(struct vk_pipeline_cache *cache,
 
    struct vk_pipeline_cache_object *object = NULL;
 
-   if (cache != NULL && cache->object_cache != NULL) {
-      vk_pipeline_cache_lock(cache);
+   if (cache != NULL && cache->shards != NULL) {
+      struct vk_pipeline_cache_shard *shard =
+         vk_pipeline_cache_shard(cache, hash);
+
+      vk_pipeline_cache_lock(cache, shard);
       struct set_entry *entry =
-         _mesa_set_search_pre_hashed(cache->object_cache, hash, &key);
+         _mesa_set_search_pre_hashed(shard->objects, hash, &key);
       if (entry) {
          object = vk_pipeline_cache_object_ref((void *)entry->key);
          if (cache_hit != NULL)
             *cache_hit = true;
       }
-      vk_pipeline_cache_unlock(cache);
+      vk_pipeline_cache_unlock(cache, shard);
    }
 
    if (object == NULL) {
       struct disk_cache *disk_cache = cache->base.device->physical->disk_cache;
-      if (!cache->skip_disk_cache && disk_cache && cache->object_cache) {
+      if (!cache->skip_disk_cache && disk_cache && cache->shards) {
          cache_key cache_key;
          disk_cache_compute_key(disk_cache, key_data, key_size, cache_key);
 
@@ -379,7 +471,10 @@ vk_pipeline_cache_lookup_object(struct vk_pipeline_cache *cache,
       return NULL;
    }
 
-   if (object->ops == &vk_raw_data_cache_object_ops &&
+   /* Lazily loaded objects are raw data objects as far as users of
+    * vk_raw_data_cache_object_ops are concerned.
+    */
+   if (vk_pipeline_cache_object_is_raw(object) &&
        ops != &vk_raw_data_cache_object_ops) {
       /* The object isn't fully formed yet and we need to deserialize it into
        * a real object before it can be used.
@@ -397,18 +492,38 @@ vk_pipeline_cache_lookup_object(struct vk_pipeline_cache *cache,
          vk_pipeline_cache_log(cache,
                                "Deserializing pipeline cache object failed");
 
-         vk_pipeline_cache_lock(cache);
-         vk_pipeline_cache_remove_object(cache, hash, object);
-         vk_pipeline_cache_unlock(cache);
+         struct vk_pipeline_cache_shard *shard =
+            vk_pipeline_cache_shard(cache, hash);
+         vk_pipeline_cache_lock(cache, shard);
+         vk_pipeline_cache_remove_object(cache, shard, hash, object);
+         vk_pipeline_cache_unlock(cache, shard);
          vk_pipeline_cache_object_unref(cache->base.device, object);
          return NULL;
       }
 
       vk_pipeline_cache_object_unref(cache->base.device, object);
       object = vk_pipeline_cache_insert_object(cache, real_object);
+   } else if (object->ops == &vk_lazy_cache_object_ops) {
+      /* Hand out and cache a copy, so the initial data can be freed once
+       * every object pointing into it has been looked up.
+       */
+      struct vk_raw_data_cache_object *lazy_data =
+         container_of(object, struct vk_raw_data_cache_object, base);
+
+      struct vk_raw_data_cache_object *data_obj =
+         vk_raw_data_cache_object_create(cache->base.device,
+                                         object->key_data, object->key_size,
+                                         lazy_data->data,
+                                         lazy_data->data_size);
+      if (data_obj != NULL) {
+         vk_pipeline_cache_object_unref(cache->base.device, object);
+         object = vk_pipeline_cache_insert_object(cache, &data_obj->base);
+      }
    }
 
-   assert(object->ops == ops);
+   assert(object->ops == ops ||
+          (ops == &vk_raw_data_cache_object_ops &&
+           object->ops == &vk_lazy_cache_object_ops));
 
    return object;
 }
@@ -557,8 +672,10 @@ find_ops_for_type(const struct vk_physical_device *pdevice,
 
 static void
 vk_pipeline_cache_load(struct vk_pipeline_cache *cache,
-                       const void *data, size_t size)
+                       const void *data, size_t size, bool lazy)
 {
+   struct vk_device *device = cache->base.device;
+
    struct blob_reader blob;
    blob_reader_init(&blob, data, size);
 
@@ -571,6 +688,24 @@ vk_pipeline_cache_load(struct vk_pipeline_cache *cache,
    if (memcmp(&header, &cache->header, sizeof(header)) != 0)
       return;
 
+   struct vk_pipeline_cache_data *backing = NULL;
+   if (lazy) {
+      /* pInitialData only has to stay around during vkCreatePipelineCache(),
+       * so make one copy for all the objects to point into.
+       */
+      backing = vk_alloc(&device->alloc, sizeof(*backing) + size, 8,
+                         VK_SYSTEM_ALLOCATION_SCOPE_DEVICE);
+      if (backing == NULL)
+         return;
+
+      /* The reference of this function, dropped once all objects have theirs */
+      backing->ref_cnt = 1;
+      memcpy(backing->data, data, size);
+
+      blob_reader_init(&blob, backing->data, size);
+      blob_skip_bytes(&blob, sizeof(header) + sizeof(count));
+   }
+
    for (uint32_t i = 0; i < count; i++) {
       int32_t type = blob_read_uint32(&blob);
       uint32_t key_size = blob_read_uint32(&blob);
@@ -581,20 +716,36 @@ vk_pipeline_cache_load(struct vk_pipeline_cache *cache,
       if (blob.overrun)
          break;
 
-      const struct vk_pipeline_cache_object_ops *ops =
-         find_ops_for_type(cache->base.device->physical, type);
+      struct vk_pipeline_cache_object *object;
+      if (lazy) {
+         /* Neither deserialized nor added to the disk cache until it's
+          * looked up.
+          */
+         struct vk_lazy_cache_object *lazy_obj =
+            vk_lazy_cache_object_create(device, backing, type,
+                                        key_data, key_size, data, data_size);
+         object = lazy_obj ?
+            vk_pipeline_cache_insert_object(cache, &lazy_obj->base.base) : NULL;
+      } else {
+         const struct vk_pipeline_cache_object_ops *ops =
+            find_ops_for_type(device->physical, type);
 
-      struct vk_pipeline_cache_object *object =
-         vk_pipeline_cache_create_and_insert_object(cache, key_data, key_size,
-                                                    data, data_size, ops);
+         object = vk_pipeline_cache_create_and_insert_object(cache,
+                                                             key_data, key_size,
+                                                             data, data_size,
+                                                             ops);
+      }
 
       if (object == NULL) {
          vk_pipeline_cache_log(cache, "Failed to load pipeline cache object");
          continue;
       }
 
-      vk_pipeline_cache_object_unref(cache->base.device, object);
+      vk_pipeline_cache_object_unref(device, object);
    }
+
+   if (backing != NULL && p_atomic_dec_zero(&backing->ref_cnt))
+      vk_free(&device->alloc, backing);
 }
 
 struct vk_pipeline_cache *
@@ -637,17 +788,33 @@ vk_pipeline_cache_create(struct vk_device *device,
    };
    memcpy(cache->header.uuid, pdevice_props.pipelineCacheUUID, VK_UUID_SIZE);
 
-   simple_mtx_init(&cache->lock, mtx_plain);
-
    if (info->force_enable ||
        debug_get_bool_option("VK_ENABLE_PIPELINE_CACHE", true)) {
-      cache->object_cache = _mesa_set_create(NULL, object_key_hash,
-                                             object_keys_equal);
+      cache->shards = vk_zalloc2(&device->alloc, pAllocator,
+                                 VK_PIPELINE_CACHE_SHARD_COUNT *
+                                 sizeof(*cache->shards),
+                                 8,
+                                 VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+      if (cache->shards == NULL) {
+         vk_object_free(device, pAllocator, cache);
+         return NULL;
+      }
+
+      for (unsigned i = 0; i < VK_PIPELINE_CACHE_SHARD_COUNT; i++) {
+         simple_mtx_init(&cache->shards[i].lock, mtx_plain);
+         cache->shards[i].objects = _mesa_set_create(NULL, object_key_hash,
+                                                     object_keys_equal);
+      }
    }
 
-   if (cache->object_cache && pCreateInfo->initialDataSize > 0) {
+   if (cache->shards && pCreateInfo->initialDataSize > 0) {
+      /* Lazy deserialization isn't supported in weak reference mode */
+      const bool lazy = !cache->weak_ref &&
+         (info->lazy_load ||
+          debug_get_bool_option("MESA_VK_PIPELINE_CACHE_LAZY_LOAD", false));
+
       vk_pipeline_cache_load(cache, pCreateInfo->pInitialData,
-                             pCreateInfo->initialDataSize);
+                             pCreateInfo->initialDataSize, lazy);
    }
 
    return cache;
@@ -657,20 +824,43 @@ void
 vk_pipeline_cache_destroy(struct vk_pipeline_cache *cache,
                           const VkAllocationCallbacks *pAllocator)
 {
-   if (cache->object_cache) {
-      if (!cache->weak_ref) {
-         set_foreach(cache->object_cache, entry) {
-            vk_pipeline_cache_object_unref(cache->base.device, (void *)entry->key);
+   if (cache->shards) {
+      for (unsigned i = 0; i < VK_PIPELINE_CACHE_SHARD_COUNT; i++) {
+         struct vk_pipeline_cache_shard *shard = &cache->shards[i];
+
+         if (!cache->weak_ref) {
+            set_foreach(shard->objects, entry) {
+               vk_pipeline_cache_object_unref(cache->base.device, (void *)entry->key);
+            }
+         } else {
+            assert(shard->objects->entries == 0);
          }
-      } else {
-         assert(cache->object_cache->entries == 0);
+         _mesa_set_destroy(shard->objects, NULL);
+         simple_mtx_destroy(&shard->lock);
       }
-      _mesa_set_destroy(cache->object_cache, NULL);
+      vk_free2(&cache->base.device->alloc, pAllocator, cache->shards);
    }
-   simple_mtx_destroy(&cache->lock);
    vk_object_free(cache->base.device, pAllocator, cache);
 }
 
+uint32_t
+vk_pipeline_cache_num_objects(struct vk_pipeline_cache *cache)
+{
+   if (cache->shards == NULL)
+      return 0;
+
+   uint32_t count = 0;
+   for (unsigned i = 0; i < VK_PIPELINE_CACHE_SHARD_COUNT; i++) {
+      struct vk_pipeline_cache_shard *shard = &cache->shards[i];
+
+      vk_pipeline_cache_lock(cache, shard);
+      count += shard->objects->entries;
+      vk_pipeline_cache_unlock(cache, shard);
+   }
+
+   return count;
+}
+
 VKAPI_ATTR VkResult VKAPI_CALL
 vk_common_CreatePipelineCache(VkDevice _device,
                               const VkPipelineCacheCreateInfo *pCreateInfo,
@@ -733,11 +923,15 @@ vk_common_GetPipelineCacheData(VkDevice _device,
       return VK_INCOMPLETE;
    }
 
-   vk_pipeline_cache_lock(cache);
+   const unsigned shard_count =
+      cache->shards != NULL ? VK_PIPELINE_CACHE_SHARD_COUNT : 0;
 
    VkResult result = VK_SUCCESS;
-   if (cache->object_cache != NULL) {
-      set_foreach(cache->object_cache, entry) {
+   for (unsigned i = 0; i < shard_count; i++) {
+      struct vk_pipeline_cache_shard *shard = &cache->shards[i];
+
+      vk_pipeline_cache_lock(cache, shard);
+      set_foreach(shard->objects, entry) {
          struct vk_pipeline_cache_object *object = (void *)entry->key;
 
          if (object->ops->serialize == NULL)
@@ -745,7 +939,13 @@ vk_common_GetPipelineCacheData(VkDevice _device,
 
          size_t blob_size_save = blob.size;
 
-         int32_t type = find_type_for_ops(device->physical, object->ops);
+         int32_t type;
+         if (object->ops == &vk_lazy_cache_object_ops) {
+            type = container_of(object, struct vk_lazy_cache_object,
+                                base.base)->type;
+         } else {
+            type = find_type_for_ops(device->physical, object->ops);
+         }
          blob_write_uint32(&blob, type);
          blob_write_uint32(&blob, object->key_size);
          intptr_t data_size_resv = blob_reserve_uint32(&blob);
@@ -777,9 +977,11 @@ vk_common_GetPipelineCacheData(VkDevice _device,
 
          count++;
       }
-   }
+      vk_pipeline_cache_unlock(cache, shard);
 
-   vk_pipeline_cache_unlock(cache);
+      if (result != VK_SUCCESS)
+         break;
+   }
 
    blob_overwrite_uint32(&blob, count_offset, count);
 
@@ -801,53 +1003,60 @@ vk_common_MergePipelineCaches(VkDevice _device,
    assert(dst->base.device == device);
    assert(!dst->weak_ref);
 
-   if (!dst->object_cache)
+   if (!dst->shards)
       return VK_SUCCESS;
 
-   vk_pipeline_cache_lock(dst);
-
    for (uint32_t i = 0; i < srcCacheCount; i++) {
       VK_FROM_HANDLE(vk_pipeline_cache, src, pSrcCaches[i]);
       assert(src->base.device == device);
 
-      if (!src->object_cache)
+      if (!src->shards)
          continue;
 
       assert(src != dst);
       if (src == dst)
          continue;
 
-      vk_pipeline_cache_lock(src);
-
-      set_foreach(src->object_cache, src_entry) {
-         struct vk_pipeline_cache_object *src_object = (void *)src_entry->key;
-
-         bool found_in_dst = false;
-         struct set_entry *dst_entry =
-            _mesa_set_search_or_add_pre_hashed(dst->object_cache,
-                                               src_entry->hash,
-                                               src_object, &found_in_dst);
-         if (found_in_dst) {
-            struct vk_pipeline_cache_object *dst_object = (void *)dst_entry->key;
-            if (dst_object->ops == &vk_raw_data_cache_object_ops &&
-                src_object->ops != &vk_raw_data_cache_object_ops) {
-               /* Even though dst has the object, it only has the blob version
-                * which isn't as useful.  Replace it with the real object.
-                */
-               vk_pipeline_cache_object_unref(device, dst_object);
-               dst_entry->key = vk_pipeline_cache_object_ref(src_object);
+      /* Both caches use the same hash, so each object goes to the shard
+       * with the same index.
+       */
+      for (unsigned s = 0; s < VK_PIPELINE_CACHE_SHARD_COUNT; s++) {
+         struct vk_pipeline_cache_shard *dst_shard = &dst->shards[s];
+         struct vk_pipeline_cache_shard *src_shard = &src->shards[s];
+
+         vk_pipeline_cache_lock(dst, dst_shard);
+         vk_pipeline_cache_lock(src, src_shard);
+
+         set_foreach(src_shard->objects, src_entry) {
+            struct vk_pipeline_cache_object *src_object = (void *)src_entry->key;
+
+            bool found_in_dst = false;
+            struct set_entry *dst_entry =
+               _mesa_set_search_or_add_pre_hashed(dst_shard->objects,
+                                                  src_entry->hash,
+                                                  src_object, &found_in_dst);
+            if (found_in_dst) {
+               struct vk_pipeline_cache_object *dst_object = (void *)dst_entry->key;
+               if (vk_pipeline_cache_object_is_raw(dst_object) &&
+                   !vk_pipeline_cache_object_is_raw(src_object)) {
+                  /* Even though dst has the object, it only has the blob
+                   * version which isn't as useful.  Replace it with the real
+                   * object.
+                   */
+                  vk_pipeline_cache_object_unref(device, dst_object);
+                  dst_entry->key = vk_pipeline_cache_object_ref(src_object);
+               }
+            } else {
+               /* We inserted src_object in dst so it needs a reference */
+               assert(dst_entry->key == (const void *)src_object);
+               vk_pipeline_cache_object_ref(src_object);
             }
-         } else {
-            /* We inserted src_object in dst so it needs a reference */
-            assert(dst_entry->key == (const void *)src_object);
-            vk_pipeline_cache_object_ref(src_object);
          }
-      }
 
-      vk_pipeline_cache_unlock(src);
+         vk_pipeline_cache_unlock(src, src_shard);
+         vk_pipeline_cache_unlock(dst, dst_shard);
+      }
    }
 
-   vk_pipeline_cache_unlock(dst);
-
    return VK_SUCCESS;
 }
@@ -147,6 +147,30 @@ void
 vk_pipeline_cache_object_unref(struct vk_device *device,
                                struct vk_pipeline_cache_object *object);
 
+/** Number of independently locked parts of a vk_pipeline_cache
+ *
+ * Objects are spread over the shards by key hash, so that threads looking
+ * up or adding different objects don't serialize on a single lock.
+ */
+#define VK_PIPELINE_CACHE_SHARD_BITS 4
+#define VK_PIPELINE_CACHE_SHARD_COUNT (1 << VK_PIPELINE_CACHE_SHARD_BITS)
+
+struct vk_pipeline_cache_shard {
+   /* Padded to a cache line so that threads using neighbouring shards don't
+    * bounce the same line between them.  It isn't aligned, because the
+    * allocation callbacks don't have to support that.
+    */
+   union {
+      struct {
+         /** Protects objects */
+         simple_mtx_t lock;
+
+         struct set *objects;
+      };
+      char pad[64];
+   };
+};
+
 /** A generic implementation of VkPipelineCache */
 struct vk_pipeline_cache {
    struct vk_object_base base;
@@ -158,10 +182,10 @@ struct vk_pipeline_cache {
 
    struct vk_pipeline_cache_header header;
 
-   /** Protects object_cache */
-   simple_mtx_t lock;
-
-   struct set *object_cache;
+   /** VK_PIPELINE_CACHE_SHARD_COUNT shards, or NULL if the in-memory cache
+    * is disabled
+    */
+   struct vk_pipeline_cache_shard *shards;
 };
 
 VK_DEFINE_NONDISP_HANDLE_CASTS(vk_pipeline_cache, base, VkPipelineCache,
@@ -198,6 +222,19 @@ struct vk_pipeline_cache_create_info {
 
    /** If true, do not attempt to use the disk cache */
    bool skip_disk_cache;
+
+   /** If true, only index the objects in pCreateInfo::pInitialData
+    *
+    * The initial data is copied once and every object is left as raw data
+    * pointing into that copy until it is first looked up, instead of being
+    * deserialized and copied into the disk cache one by one.  This makes
+    * creating a cache from a large blob a lot cheaper, but the copy stays
+    * around until every object in it has been looked up.  It can also be
+    * enabled with MESA_VK_PIPELINE_CACHE_LAZY_LOAD=1.
+    *
+    * Ignored for weak reference mode caches.
+    */
+   bool lazy_load;
 };
 
 struct vk_pipeline_cache *
@@ -208,6 +245,10 @@ void
 vk_pipeline_cache_destroy(struct vk_pipeline_cache *cache,
                           const VkAllocationCallbacks *pAllocator);
 
+/** Returns the number of objects in the in-memory cache */
+uint32_t
+vk_pipeline_cache_num_objects(struct vk_pipeline_cache *cache);
+
 /** Attempts to look up an object in the cache by key
  *
  * If an object is found in the cache matching the given key, *cache_hit is
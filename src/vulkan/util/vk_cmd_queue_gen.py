@@ -76,7 +76,11 @@ TEMPLATE_H = Template(COPYRIGHT + """\
 
 #pragma once
 
+#include <stdint.h>
+#include <string.h>
+
 #include "util/list.h"
+#include "util/macros.h"
 
 #define VK_PROTOTYPES
 #include <vulkan/vulkan_core.h>
@@ -93,6 +97,14 @@ struct vk_device_dispatch_table;
 struct vk_cmd_queue {
    const VkAllocationCallbacks *alloc;
    struct list_head cmds;
+
+   /* Linear allocator for the commands and all the data they point to,
+    * which is freed at once when the queue is reset or finished.
+    * See vk_cmd_queue_zalloc().
+    */
+   struct list_head blocks;
+   uint8_t *block_ptr;
+   uint8_t *block_end;
 };
 
 enum vk_cmd_type {
@@ -181,25 +193,42 @@ struct vk_cmd_queue_entry {
 
 void vk_free_queue(struct vk_cmd_queue *queue);
 
-static inline void
-vk_cmd_queue_init(struct vk_cmd_queue *queue, VkAllocationCallbacks *alloc)
+void *vk_cmd_queue_zalloc_block(struct vk_cmd_queue *queue, size_t size);
+
+/**
+ * Allocate zeroed memory for a command or its data, which lives until
+ * the queue is reset.  It must not be freed individually.
+ */
+static inline void *
+vk_cmd_queue_zalloc(struct vk_cmd_queue *queue, size_t size)
 {
-   queue->alloc = alloc;
-   list_inithead(&queue->cmds);
+   size = ALIGN_POT(size, 8);
+   if (likely(size <= (size_t)(queue->block_end - queue->block_ptr))) {
+      void *ptr = queue->block_ptr;
+      queue->block_ptr += size;
+      return memset(ptr, 0, size);
+   }
+
+   return vk_cmd_queue_zalloc_block(queue, size);
 }
 
 static inline void
-vk_cmd_queue_reset(struct vk_cmd_queue *queue)
+vk_cmd_queue_init(struct vk_cmd_queue *queue, VkAllocationCallbacks *alloc)
 {
-   vk_free_queue(queue);
+   queue->alloc = alloc;
    list_inithead(&queue->cmds);
+   list_inithead(&queue->blocks);
+   queue->block_ptr = NULL;
+   queue->block_end = NULL;
 }
 
+/* Frees the commands, but keeps the last block for recording new ones */
+void vk_cmd_queue_reset(struct vk_cmd_queue *queue);
+
 static inline void
 vk_cmd_queue_finish(struct vk_cmd_queue *queue)
 {
    vk_free_queue(queue);
-   list_inithead(&queue->cmds);
 }
 
 void vk_cmd_queue_execute(struct vk_cmd_queue *queue,
@@ -255,29 +284,110 @@ size_t vk_cmd_queue_type_sizes[] = {
 % endfor
 };
 
-% for c in commands:
-% if c.guard is not None:
-#ifdef ${c.guard}
-% endif
+/* Commands are allocated from blocks of at least this size, doubling up
+ * to the maximum as the queue grows.
+ */
+#define VK_CMD_QUEUE_MIN_BLOCK_SIZE (4 * 1024)
+#define VK_CMD_QUEUE_MAX_BLOCK_SIZE (256 * 1024)
+
+struct vk_cmd_queue_block {
+   struct list_head link;
+   size_t size;
+   alignas(8) uint8_t data[];
+};
+
+void *
+vk_cmd_queue_zalloc_block(struct vk_cmd_queue *queue, size_t size)
+{
+   size_t block_size = VK_CMD_QUEUE_MIN_BLOCK_SIZE;
+   if (queue->block_end) {
+      struct vk_cmd_queue_block *last =
+         list_last_entry(&queue->blocks, struct vk_cmd_queue_block, link);
+      block_size = MIN2(last->size * 2, VK_CMD_QUEUE_MAX_BLOCK_SIZE);
+   }
+
+   /* Large arrays get a block of their own, and the current block is
+    * kept for the following commands.
+    */
+   const bool dedicated = size > block_size / 2;
+   if (dedicated)
+      block_size = size;
+
+   struct vk_cmd_queue_block *block =
+      vk_alloc(queue->alloc, sizeof(*block) + block_size, 8,
+               VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+   if (!block)
+      return NULL;
+
+   block->size = block_size;
+   memset(block->data, 0, size);
+
+   if (dedicated) {
+      list_add(&block->link, &queue->blocks);
+   } else {
+      list_addtail(&block->link, &queue->blocks);
+      queue->block_ptr = block->data + size;
+      queue->block_end = block->data + block_size;
+   }
+
+   return block->data;
+}
+
 static void
-vk_free_${to_underscore(c.name)}(struct vk_cmd_queue *queue,
-${' ' * len('vk_free_' + to_underscore(c.name) + '(')}\\
-struct vk_cmd_queue_entry *cmd)
+vk_cmd_queue_free_cmds(struct vk_cmd_queue *queue)
 {
-   if (cmd->driver_free_cb)
-      cmd->driver_free_cb(queue, cmd);
-   else
-      vk_free(queue->alloc, cmd->driver_data);
-% for p in c.params[1:]:
-% if p.len:
-   vk_free(queue->alloc, (${remove_suffix(p.decl.replace("const", ""), p.name)})cmd->u.${to_struct_field_name(c.name)}.${to_field_name(p.name)});
-% elif '*' in p.decl:
-   ${get_struct_free(c, p, types)}
-% endif
-% endfor
-   vk_free(queue->alloc, cmd);
+   list_for_each_entry(struct vk_cmd_queue_entry, cmd, &queue->cmds, cmd_link) {
+      if (cmd->driver_free_cb)
+         cmd->driver_free_cb(queue, cmd);
+      else
+         vk_free(queue->alloc, cmd->driver_data);
+   }
+   list_inithead(&queue->cmds);
+}
+
+void
+vk_free_queue(struct vk_cmd_queue *queue)
+{
+   vk_cmd_queue_free_cmds(queue);
+
+   list_for_each_entry_safe(struct vk_cmd_queue_block, block,
+                            &queue->blocks, link)
+      vk_free(queue->alloc, block);
+   list_inithead(&queue->blocks);
+   queue->block_ptr = NULL;
+   queue->block_end = NULL;
+}
+
+void
+vk_cmd_queue_reset(struct vk_cmd_queue *queue)
+{
+   vk_cmd_queue_free_cmds(queue);
+
+   /* Keep the current block, which is the largest regular one, so that
+    * recording the same commands again doesn't allocate anything.
+    */
+   struct vk_cmd_queue_block *keep = NULL;
+   if (queue->block_end) {
+      keep = list_last_entry(&queue->blocks, struct vk_cmd_queue_block, link);
+      list_del(&keep->link);
+   }
+
+   list_for_each_entry_safe(struct vk_cmd_queue_block, block,
+                            &queue->blocks, link)
+      vk_free(queue->alloc, block);
+   list_inithead(&queue->blocks);
+
+   if (keep) {
+      list_addtail(&keep->link, &queue->blocks);
+      queue->block_ptr = keep->data;
+      queue->block_end = keep->data + keep->size;
+   }
 }
 
+% for c in commands:
+% if c.guard is not None:
+#ifdef ${c.guard}
+% endif
 % if c.name not in manual_commands and c.name not in no_enqueue_commands:
 VkResult vk_enqueue_${to_underscore(c.name)}(struct vk_cmd_queue *queue
 % for p in c.params[1:]:
@@ -285,8 +395,7 @@ VkResult vk_enqueue_${to_underscore(c.name)}(struct vk_cmd_queue *queue
 % endfor
 )
 {
-   struct vk_cmd_queue_entry *cmd = vk_zalloc(queue->alloc, vk_cmd_queue_type_sizes[${to_enum_name(c.name)}], 8,
-                                              VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+   struct vk_cmd_queue_entry *cmd = vk_cmd_queue_zalloc(queue, vk_cmd_queue_type_sizes[${to_enum_name(c.name)}]);
    if (!cmd) return VK_ERROR_OUT_OF_HOST_MEMORY;
 
    cmd->type = ${to_enum_name(c.name)};
@@ -316,8 +425,7 @@ VkResult vk_enqueue_${to_underscore(c.name)}(struct vk_cmd_queue *queue
 
 % if need_error_handling:
 err:
-   if (cmd)
-      vk_free_${to_underscore(c.name)}(queue, cmd);
+   /* What was copied is freed with the queue */
    return VK_ERROR_OUT_OF_HOST_MEMORY;
 % endif
 }
@@ -328,27 +436,6 @@ err:
 
 % endfor
 
-void
-vk_free_queue(struct vk_cmd_queue *queue)
-{
-   struct vk_cmd_queue_entry *tmp, *cmd;
-   LIST_FOR_EACH_ENTRY_SAFE(cmd, tmp, &queue->cmds, cmd_link) {
-      switch(cmd->type) {
-% for c in commands:
-% if c.guard is not None:
-#ifdef ${c.guard}
-% endif
-      case ${to_enum_name(c.name)}:
-         vk_free_${to_underscore(c.name)}(queue, cmd);
-         break;
-% if c.guard is not None:
-#endif // ${c.guard}
-% endif
-% endfor
-      }
-   }
-}
-
 void
 vk_cmd_queue_execute(struct vk_cmd_queue *queue,
                      VkCommandBuffer commandBuffer,
@@ -470,7 +557,7 @@ def get_array_copy(command, param):
         field_size = "1"
     else:
         field_size = "sizeof(*%s)" % field_name
-    allocation = "%s = vk_zalloc(queue->alloc, %s * (%s), 8, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);\n   if (%s == NULL) goto err;\n" % (field_name, field_size, param.len, field_name)
+    allocation = "%s = vk_cmd_queue_zalloc(queue, %s * (%s));\n   if (%s == NULL) goto err;\n" % (field_name, field_size, param.len, field_name)
     copy = "memcpy((void*)%s, %s, %s * (%s));" % (field_name, param.name, field_size, param.len)
     return "%s\n   %s" % (allocation, copy)
 
@@ -480,7 +567,7 @@ def get_array_member_copy(struct, src_name, member):
         field_size = "sizeof(*%s)" % (field_name)
     else:
         field_size = "sizeof(*%s) * %s->%s" % (field_name, struct, member.len)
-    allocation = "%s = vk_zalloc(queue->alloc, %s, 8, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);\n   if (%s == NULL) goto err;\n" % (field_name, field_size, field_name)
+    allocation = "%s = vk_cmd_queue_zalloc(queue, %s);\n   if (%s == NULL) goto err;\n" % (field_name, field_size, field_name)
     copy = "memcpy((void*)%s, %s->%s, %s);" % (field_name, src_name, member.name, field_size)
     return "if (%s->%s) {\n   %s\n   %s\n}\n" % (src_name, member.name, allocation, copy)
 
@@ -516,7 +603,7 @@ def get_struct_copy(dst, src_name, src_type, size, types, level=0):
     global tmp_dst_idx
     global tmp_src_idx
 
-    allocation = "%s = vk_zalloc(queue->alloc, %s, 8, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);\n      if (%s == NULL) goto err;\n" % (dst, size, dst)
+    allocation = "%s = vk_cmd_queue_zalloc(queue, %s);\n      if (%s == NULL) goto err;\n" % (dst, size, dst)
     copy = "memcpy((void*)%s, %s, %s);" % (dst, src_name, size)
 
     level += 1
@@ -536,19 +623,6 @@ def get_struct_copy(dst, src_name, src_type, size, types, level=0):
     indent = "   " * level
     return "%s\n      %s\n      %s\n      %s\n      %s\n      %s\n%s} else {\n      %s\n%s}" % (if_stmt, allocation, copy, tmp_dst, tmp_src, member_copies, indent, null_assignment, indent)
 
-def get_struct_free(command, param, types):
-    field_name = "cmd->u.%s.%s" % (to_struct_field_name(command.name), to_field_name(param.name))
-    const_cast = remove_suffix(param.decl.replace("const", ""), param.name)
-    struct_free = "vk_free(queue->alloc, (%s)%s);" % (const_cast, field_name)
-    member_frees = ""
-    if (param.type in types):
-        for member in types[param.type].members:
-            if member.len and member.len != 'null-terminated':
-                member_name = "cmd->u.%s.%s->%s" % (to_struct_field_name(command.name), to_field_name(param.name), member.name)
-                const_cast = remove_suffix(member.decl.replace("const", ""), member.name)
-                member_frees += "vk_free(queue->alloc, (%s)%s);\n" % (const_cast, member_name)
-    return "%s      %s\n" % (member_frees, struct_free)
-
 EntrypointType = namedtuple('EntrypointType', 'name enum members extended_by guard')
 
 def get_types_defines(doc):
@@ -666,7 +740,6 @@ def main():
         'to_struct_name': to_struct_name,
         'get_array_copy': get_array_copy,
         'get_struct_copy': get_struct_copy,
-        'get_struct_free': get_struct_free,
         'types': types,
         'manual_commands': MANUAL_COMMANDS,
         'no_enqueue_commands': NO_ENQUEUE_COMMANDS,